@@ -0,0 +1,202 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "StdAfx.h"
+#include "Agent.h"
+
+#include <sstream>
+
+#include "Coordinator.h"
+#include "Utility.h"
+#include "Log.h"
+
+
+Agent::Agent(void)
+{
+    m_Connected = false;
+    m_Shutdown = NULL;
+    m_StartAt = 0;
+    m_LastProgress = 0;
+}
+
+
+Agent::~Agent(void)
+{
+}
+
+bool Agent::Connect(string address, int port, bool * shutdown) {
+
+    if (!m_Link.Connect(address, port)) return false;
+
+    m_Connected = true;
+    m_Shutdown = shutdown;
+
+    Log::info("Connected to the coordinator at %s\n", m_Link.getPeer().c_str());
+    return true;
+}
+
+bool Agent::ReceiveScenario(int tokens, int workers, int * iterations, int * interval, bool * paced) {
+
+    char host[MAX_COMPUTERNAME_LENGTH + 1];
+    DWORD size = sizeof(host);
+    if (!GetComputerNameA(host, &size)) strcpy_s(host, sizeof(host), "unknown");
+
+    stringstream hello;
+    hello << "HELLO " << COORDINATOR_PROTOCOL << " " << host << " " << tokens << " " << workers;
+
+    if (!m_Link.SendLine(hello.str())) {
+        Log::error("Unable to announce this agent to the coordinator\n");
+        return false;
+    }
+
+    Log::info("Waiting for the coordinator's scenario\n");
+
+    // The coordinator only sends the scenario once every agent has connected
+    string line, command;
+    int scenarioIterations = 0, scenarioInterval = 0, scenarioPaced = 0;
+
+    if (!this->ReadCommand(&line)) return false;
+
+    stringstream scenario(line);
+    scenario >> command >> scenarioIterations >> scenarioInterval >> scenarioPaced;
+
+    if (command != "SCENARIO" || scenarioIterations < 1 || scenarioInterval < 0) {
+        Log::error("Expected the scenario from the coordinator, got '%s'\n", line.c_str());
+        return false;
+    }
+
+    // Note the start time as soon as it arrives, so the local setup that follows doesn't delay it
+    int delay = 0;
+
+    if (!this->ReadCommand(&line)) return false;
+
+    stringstream start(line);
+    start >> command >> delay;
+
+    if (command != "START") {
+        Log::error("Expected the start time from the coordinator, got '%s'\n", line.c_str());
+        return false;
+    }
+
+    m_StartAt = Utility::QueryMicroseconds() + delay * 1000.0;
+
+    *iterations = scenarioIterations;
+    *interval = scenarioInterval;
+    *paced = (scenarioPaced != 0);
+
+    Log::info("Coordinator scenario: %d iterations per token, %s %d ms, starting in %d ms\n",
+              scenarioIterations, *paced ? "starting one on each worker every" : "waiting between each for",
+              scenarioInterval, delay);
+    return true;
+}
+
+bool Agent::WaitForStart() {
+
+    double remaining = m_StartAt - Utility::QueryMicroseconds();
+
+    if (remaining < 0) {
+        Log::warn("Started %.0f ms after the coordinated start time\n", -remaining / 1000.0);
+        return true;
+    }
+
+    Sleep((DWORD)(remaining / 1000.0));
+    return true;
+}
+
+bool Agent::Poll(int iterations, Results * results) {
+
+    string line;
+
+    while (m_Link.ReadLine(&line, 0)) {
+        if (line == "STOP") {
+            Log::info("The coordinator has stopped the load test\n");
+            return false;
+        }
+    }
+
+    if (!m_Link.isOpen()) {
+        Log::warn("Lost the connection to the coordinator\n");
+        return false;
+    }
+
+    double now = Utility::QueryMicroseconds();
+    if (now - m_LastProgress < COORDINATOR_PROGRESS_INTERVAL * 1000.0) return true;
+
+    m_LastProgress = now;
+
+    stringstream command;
+    command << "PROGRESS " << iterations;
+
+    return this->SendBlock(command.str(), results);
+}
+
+bool Agent::SendResults(Results * results) {
+
+    bool sent = this->SendBlock("RESULTS", results);
+    m_Link.Close();
+
+    if (sent) {
+        Log::info("Latency results sent to the coordinator\n");
+    } else {
+        Log::error("Unable to send the latency results to the coordinator\n");
+    }
+
+    return sent;
+}
+
+bool Agent::isConnected() {
+    return m_Connected;
+}
+
+bool Agent::ReadCommand(string * line) {
+
+    // Poll so that Ctrl-C is seen while waiting on the other agents
+    while (!m_Link.ReadLine(line, 1000)) {
+
+        if (!m_Link.isOpen()) {
+            Log::error("The coordinator closed the connection\n");
+            return false;
+        }
+
+        if (NULL != m_Shutdown && *m_Shutdown) return false;
+    }
+
+    return true;
+}
+
+bool Agent::SendBlock(string command, Results * results) {
+
+    // A copy, so results still being recorded carry the period up to now
+    Results snapshot;
+    results->Capture(&snapshot);
+
+    stringstream stream;
+    snapshot.Write(stream);
+
+    string data = stream.str();
+    stringstream line;
+    line << command << " " << data.size();
+
+    return m_Link.SendLine(line.str()) && m_Link.SendBlock(&data);
+}
@@ -0,0 +1,82 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+#include "stdafx.h"
+
+#include <windows.h>
+#include <string>
+
+#include "NetLink.h"
+#include "Results.h"
+
+using namespace std;
+
+
+// The agent side of a distributed load test (see Coordinator). Takes the scenario and start time from
+// the coordinator, then streams the progress and histograms of the local run back to it.
+class Agent
+{
+public:
+    Agent(void);
+    ~Agent(void);
+
+    // Connects to the coordinator at [address] ("host" or "host:port"). Waiting for the coordinator
+    // gives up once [shutdown] is set.
+    bool Connect(string address, int port, bool * shutdown);
+
+    // Announces the local [tokens] and [workers] per token and waits for the scenario, which replaces
+    // [iterations] and [interval]. [paced] is set when the interval is the period between the starts of
+    // each worker's transactions (to hold the coordinator's rate) rather than the gap after each one.
+    bool ReceiveScenario(int tokens, int workers, int * iterations, int * interval, bool * paced);
+
+    // Waits for the start time the coordinator sent with the scenario
+    bool WaitForStart();
+
+    // Streams the progress so far, at most every COORDINATOR_PROGRESS_INTERVAL. Returns false once
+    // the coordinator has asked the agent to stop, or has gone away.
+    bool Poll(int iterations, Results * results);
+
+    // Sends the final results and disconnects
+    bool SendResults(Results * results);
+
+    // Returns true once Connect has succeeded
+    bool isConnected();
+
+private:
+    // Waits for the next line from the coordinator
+    bool ReadCommand(string * line);
+
+    // Sends [results] announced by [command] (which is followed by the length)
+    bool SendBlock(string command, Results * results);
+
+private:
+    NetLink m_Link;
+    bool m_Connected;
+    bool * m_Shutdown;
+
+    // When to start (Utility::QueryMicroseconds), and when progress was last sent
+    double m_StartAt;
+    double m_LastProgress;
+};
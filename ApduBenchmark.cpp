@@ -0,0 +1,313 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "StdAfx.h"
+#include "ApduBenchmark.h"
+
+#include <fstream>
+#include <sstream>
+
+#include "PCSC.h"
+#include "Utility.h"
+#include "Log.h"
+
+// The script used when none is supplied - SELECT the PIV application and read the CHUID
+static const char * DEFAULT_SCRIPT[][2] = {
+    { "SELECT-PIV", "00A4040009A0000003080000100000" },
+    { "GET-CHUID",  "00CB3FFF055C035FC10200" }
+};
+
+
+ApduBenchmark::ApduBenchmark(void)
+{
+}
+
+
+ApduBenchmark::~ApduBenchmark(void)
+{
+}
+
+int ApduBenchmark::Run(vector<wstring> * inputs, int iterations, string resultsPath, bool * shutdown) {
+
+    Log::debug("ApduBenchmark::Run: Called\n");
+
+    vector<ApduCommand> script;
+
+    if (inputs->size() > 1) {
+        Log::error("Only one APDU script may be supplied.\n");
+        return EXIT_FAILURE;
+    }
+
+    if (inputs->size() == 1) {
+        string path((*inputs)[0].begin(), (*inputs)[0].end());
+        if (!LoadScript(path, &script)) return EXIT_FAILURE;
+    }
+    else {
+        for (size_t i = 0; i < sizeof(DEFAULT_SCRIPT) / sizeof(DEFAULT_SCRIPT[0]); i++) {
+            ApduCommand command;
+            command.name = DEFAULT_SCRIPT[i][0];
+            command.command.resize(strlen(DEFAULT_SCRIPT[i][1]) / 2);
+            Utility::HexStringToArray((char *)&command.command[0], DEFAULT_SCRIPT[i][1], command.command.size());
+            script.push_back(command);
+        }
+    }
+
+    if (script.empty()) {
+        Log::error("The APDU script is empty.\n");
+        return EXIT_FAILURE;
+    }
+
+    PCSC::Initialise();
+
+    vector<string> readers;
+
+    try {
+        PCSC::ListReaders(&readers);
+    }
+    catch (...) {
+        Log::error("Unable to list the smart card readers\n");
+        return EXIT_FAILURE;
+    }
+
+    // Identify each card by its CPLC, so the round trips line up with its PKCS#11 results
+    map<string, string> serials;
+    PCSC::QueryCPLC(&readers, &serials);
+
+    Results results;
+    vector<ApduWorker> workers;
+
+    for (size_t i = 0; i < readers.size(); i++) {
+
+        if (serials.find(readers[i]) == serials.end()) {
+            Log::warn("Skipping '%s' - no card, or the CPLC could not be read\n", readers[i].c_str());
+            continue;
+        }
+
+        ApduWorker worker;
+        worker.reader = readers[i];
+        worker.serial = serials[readers[i]];
+        worker.script = &script;
+        worker.iterations = iterations;
+        worker.shutdown = shutdown;
+        worker.results = &results;
+        worker.completed = 0;
+        worker.failures = 0;
+        workers.push_back(worker);
+    }
+
+    if (workers.empty()) {
+        Log::error("No cards were found to replay the script against.\n");
+        return EXIT_FAILURE;
+    }
+
+    Log::info("Replaying %u APDUs %d times against %u cards\n", (unsigned)script.size(), iterations, (unsigned)workers.size());
+
+    // Each reader gets its own thread, so the cards run side by side as they do under PKCS#11
+    vector<HANDLE> threads(workers.size(), (HANDLE)NULL);
+
+    results.Start();
+
+    for (size_t i = 0; i < workers.size(); i++) {
+        threads[i] = CreateThread(NULL, 0, ThreadProc, &workers[i], 0, NULL);
+        if (NULL == threads[i]) Replay(&workers[i]);
+    }
+
+    for (size_t i = 0; i < workers.size(); i++) {
+        if (NULL != threads[i]) {
+            WaitForSingleObject(threads[i], INFINITE);
+            CloseHandle(threads[i]);
+        }
+    }
+
+    results.Stop();
+    PCSC::Release();
+
+    // Replace any earlier APDU results in the file, keeping the PKCS#11 results (and their period) beside them
+    Results combined;
+
+    if (GetFileAttributesA(resultsPath.c_str()) != INVALID_FILE_ATTRIBUTES) {
+        if (!combined.Load(resultsPath)) return EXIT_FAILURE;
+    }
+
+    combined.Replace(APDU_MECHANISM, &results);
+
+    Report(&workers, &combined);
+
+    if (!combined.Save(resultsPath)) return EXIT_FAILURE;
+    Log::info("\nAPDU round trips written to %s\n", resultsPath.c_str());
+
+    return EXIT_SUCCESS;
+}
+
+bool ApduBenchmark::LoadScript(string path, vector<ApduCommand> * script) {
+
+    ifstream in(path.c_str());
+    if (!in.is_open()) {
+        Log::error("Unable to open the APDU script %s\n", path.c_str());
+        return false;
+    }
+
+    string line;
+    int number = 0;
+
+    while (getline(in, line)) {
+
+        number++;
+
+        stringstream buffer(line);
+        ApduCommand command;
+        string hex, part;
+
+        buffer >> command.name;
+        if (command.name.empty() || command.name[0] == '#') continue;
+
+        // The APDU may be split into groups of bytes for readability
+        while (buffer >> part) hex += part;
+
+        if (hex.empty() || hex.length() % 2 != 0 || hex.length() < 8) {
+            Log::error("%s line %d: expected a name and a command APDU of at least 4 bytes\n", path.c_str(), number);
+            return false;
+        }
+
+        try {
+            command.command.resize(hex.length() / 2);
+            Utility::HexStringToArray((char *)&command.command[0], hex.c_str(), command.command.size());
+        }
+        catch (...) {
+            Log::error("%s line %d: invalid hex in the command APDU\n", path.c_str(), number);
+            return false;
+        }
+
+        script->push_back(command);
+    }
+
+    Log::debug("ApduBenchmark::LoadScript: Read %u APDUs from %s\n", (unsigned)script->size(), path.c_str());
+    return true;
+}
+
+DWORD WINAPI ApduBenchmark::ThreadProc(LPVOID param) {
+
+    Replay((ApduWorker *)param);
+    return 0;
+}
+
+void ApduBenchmark::Replay(ApduWorker * worker) {
+
+    DWORD protocol = 0;
+    ULONG_PTR card;
+
+    try {
+        card = PCSC::Connect(worker->reader, &protocol);
+    }
+    catch (...) {
+        Log::error("Unable to connect to '%s'\n", worker->reader.c_str());
+        return;
+    }
+
+    vector<BYTE> response;
+
+    for (int i = 0; i < worker->iterations && !*worker->shutdown; i++) {
+
+        for (size_t j = 0; j < worker->script->size(); j++) {
+
+            ApduCommand * command = &(*worker->script)[j];
+            double started = Utility::QueryMicroseconds();
+
+            try {
+                PCSC::Transmit(card, protocol, &command->command, &response);
+            }
+            catch (...) {
+                // The card has most likely gone, so there is no point carrying on
+                Log::error(" - %s %s Failure\n", worker->serial.c_str(), command->name.c_str());
+                worker->failures++;
+                PCSC::Disconnect(card);
+                return;
+            }
+
+            double elapsed = Utility::QueryMicroseconds() - started;
+
+            // Anything other than 9000 means the card did less work than the script intended
+            if (response.size() < 2 || response[response.size() - 2] != 0x90 || response[response.size() - 1] != 0x00) {
+                Log::debug(" - %s %s returned %s\n", worker->serial.c_str(), command->name.c_str(),
+                           (response.size() < 2) ? "no status" : Utility::ArraytoHexString((char *)&response[response.size() - 2], 2).c_str());
+                worker->failures++;
+                continue;
+            }
+
+            worker->results->Record(worker->serial, command->name, APDU_MECHANISM, elapsed);
+        }
+
+        worker->completed++;
+    }
+
+    PCSC::Disconnect(card);
+}
+
+void ApduBenchmark::Report(vector<ApduWorker> * workers, Results * results) {
+
+    Results * replayed = workers->front().results;
+    map<string, Histogram> * histograms = replayed->getHistograms();
+    map<string, Histogram> * existing = results->getHistograms();
+
+    for (size_t i = 0; i < workers->size(); i++) {
+
+        ApduWorker * worker = &(*workers)[i];
+
+        // The replay's own rate - the PKCS#11 results in the file were measured over a different period
+        unsigned long long apdus = 0;
+        for (map<string, Histogram>::iterator entry = histograms->begin(); entry != histograms->end(); ++entry) {
+            string operation, mechanism, serial;
+            Results::SplitKey(entry->first, &operation, &mechanism, &serial);
+            if (serial == worker->serial) apdus += entry->second.getCount();
+        }
+
+        Log::info("\n%s (%s) - %d passes, %d failed APDUs, %.1f APDUs/s\n",
+                  worker->serial.c_str(), worker->reader.c_str(), worker->completed, worker->failures,
+                  (replayed->getDuration() > 0) ? apdus / replayed->getDuration() : 0);
+        Log::info("%-20s %-14s %10s %10s %10s %10s %10s\n", "OPERATION", "MECHANISM", "COUNT", "MEAN", "P50", "P99", "MAX");
+
+        // The raw APDU round trips first, then the PKCS#11 operations on the same card for comparison
+        map<string, Histogram> * sources[2] = { histograms, existing };
+
+        for (int s = 0; s < 2; s++) {
+            for (map<string, Histogram>::iterator entry = sources[s]->begin();
+                    entry != sources[s]->end();
+                    ++entry)
+            {
+                string operation, mechanism, serial;
+                Results::SplitKey(entry->first, &operation, &mechanism, &serial);
+
+                if (serial != worker->serial) continue;
+
+                // The combined results now hold the APDU round trips as well
+                if (s == 1 && mechanism == APDU_MECHANISM) continue;
+
+                Log::info("%-20s %-14s %10llu %7.1f ms %7.1f ms %7.1f ms %7.1f ms\n",
+                          operation.c_str(), mechanism.c_str(), entry->second.getCount(),
+                          entry->second.getMean() / 1000.0, entry->second.getPercentile(50) / 1000.0,
+                          entry->second.getPercentile(99) / 1000.0, entry->second.getMaximum() / 1000.0);
+            }
+        }
+    }
+}
@@ -0,0 +1,86 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+#include "stdafx.h"
+
+#include <windows.h>
+#include <string>
+#include <vector>
+
+#include "Results.h"
+
+using namespace std;
+
+// The mechanism column used for APDU round trips in the results file
+#define APDU_MECHANISM          "APDU"
+
+typedef struct {
+    // The operation name the round trips are recorded under (no spaces)
+    string name;
+
+    // The command APDU
+    vector<BYTE> command;
+} ApduCommand;
+
+// The replay of the script against one reader, run on its own thread
+typedef struct {
+    string reader;
+    string serial;
+    vector<ApduCommand> * script;
+    int iterations;
+    bool * shutdown;
+
+    // Shared by all of the workers
+    Results * results;
+
+    // Completed passes of the script, and APDUs that failed or returned an error status
+    int completed;
+    int failures;
+} ApduWorker;
+
+
+class ApduBenchmark
+{
+public:
+    ApduBenchmark(void);
+    ~ApduBenchmark(void);
+
+    // Replays the APDU script in [inputs] (or the built-in PIV script) [iterations] times against
+    // every card present, and adds the round trip histograms to the results file.
+    static int Run(vector<wstring> * inputs, int iterations, string resultsPath, bool * shutdown);
+
+    // Reads a script of "NAME HEX" lines. Blank lines and lines starting with '#' are ignored.
+    static bool LoadScript(string path, vector<ApduCommand> * script);
+
+private:
+    // Worker thread entry point
+    static DWORD WINAPI ThreadProc(LPVOID param);
+
+    // Replays the script against a single reader
+    static void Replay(ApduWorker * worker);
+
+    // Prints the APDU round trips for each card, next to its PKCS#11 operations from [results]
+    static void Report(vector<ApduWorker> * workers, Results * results);
+};
@@ -0,0 +1,422 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "StdAfx.h"
+#include "BatchJob.h"
+
+#include "PKCS11Manager.h"
+#include "Utility.h"
+#include "Log.h"
+
+
+BatchJob::BatchJob(void)
+{
+    m_Affinity = NULL;
+    m_Prepare = NULL;
+    m_Operation = NULL;
+    m_Shutdown = NULL;
+    m_StartEvent = NULL;
+    m_Items = 0;
+    m_Started = 0;
+    m_Makespan = 0;
+
+    InitializeCriticalSection(&m_Serialise);
+}
+
+
+BatchJob::~BatchJob(void)
+{
+    this->Clear();
+    DeleteCriticalSection(&m_Serialise);
+}
+
+bool BatchJob::Run(vector<PKCS11Slot> * slots, map<CK_ULONG, string> * serials, int items, int workers, string pin,
+                   BatchPrepare prepare, BatchOperation operation, bool * shutdown) {
+
+    Log::debug("BatchJob::Run: Called\n");
+
+    this->Clear();
+
+    m_Items = items;
+    m_Prepare = prepare;
+    m_Operation = operation;
+    m_Shutdown = shutdown;
+    m_Makespan = 0;
+
+    if (workers < 1) workers = 1;
+
+    // Each worker holds one session for the whole job
+    for (vector<PKCS11Slot>::iterator slot = slots->begin();
+            slot != slots->end();
+            ++slot)
+    {
+        SessionPool * pool = new SessionPool(PKCS11Manager::getFunctionList(), slot->id, workers, pin);
+        m_Pools[slot->id] = pool;
+
+        for (int index = 0; index < workers; index++) {
+
+            BatchWorker * worker = new BatchWorker;
+            worker->job = this;
+            worker->slot = new PKCS11Slot(*slot);
+            worker->serial = (*serials)[slot->id];
+            worker->pool = pool;
+            worker->thread = NULL;
+            worker->completed = 0;
+            worker->failed = 0;
+            worker->stolen = 0;
+            worker->busy = 0;
+            worker->finished = 0;
+            worker->abandoned = false;
+            InitializeCriticalSection(&worker->lock);
+
+            m_Workers.push_back(worker);
+        }
+    }
+
+    if (m_Workers.empty()) {
+        Log::error("There are no tokens to run the batch on\n");
+        return false;
+    }
+
+    if (!PKCS11Manager::isThreadSafe()) {
+        Log::warn("Batch operations will be serialised across tokens\n");
+    }
+
+    // An even split to start with - stealing evens out the differences in speed
+    size_t count = m_Workers.size();
+    for (size_t i = 0; i < count; i++) {
+
+        int first = (int)((long long)items * i / count);
+        int last = (int)((long long)items * (i + 1) / count);
+
+        for (int item = first; item < last; item++) m_Workers[i]->items.push_back(item + 1);
+    }
+
+    Log::info("Running a batch of %d items across %u tokens (%d workers each)\n", items, (unsigned)slots->size(), workers);
+
+    m_StartEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    map<string, int> indexes;
+
+    for (size_t i = 0; i < count; i++) {
+
+        BatchWorker * worker = m_Workers[i];
+        worker->thread = CreateThread(NULL, 0, WorkerProc, worker, CREATE_SUSPENDED, NULL);
+
+        // Its share stays in its deque for the other workers to steal
+        if (NULL == worker->thread) {
+            Log::error("Unable to create a batch worker for token %s\n", worker->serial.c_str());
+            continue;
+        }
+
+        if (NULL != m_Affinity) {
+            int index = indexes[worker->serial]++;
+            if (index == 0) {
+                m_Affinity->PinWorker(worker->thread, worker->serial);
+            } else {
+                char suffix[16];
+                sprintf_s(suffix, sizeof(suffix), "/%d", index);
+                m_Affinity->PinWorker(worker->thread, worker->serial + suffix);
+            }
+        }
+
+        ResumeThread(worker->thread);
+    }
+
+    m_Started = Utility::QueryMicroseconds();
+    SetEvent(m_StartEvent);
+
+    int completed = 0;
+    double finished = m_Started;
+
+    for (size_t i = 0; i < count; i++) {
+
+        BatchWorker * worker = m_Workers[i];
+        if (NULL == worker->thread) continue;
+
+        WaitForSingleObject(worker->thread, INFINITE);
+
+        completed += worker->completed;
+        if (worker->finished > finished) finished = worker->finished;
+    }
+
+    m_Makespan = finished - m_Started;
+
+    for (map<CK_SLOT_ID, SessionPool *>::iterator pool = m_Pools.begin();
+            pool != m_Pools.end();
+            ++pool)
+    {
+        pool->second->Close();
+    }
+
+    CloseHandle(m_StartEvent);
+    m_StartEvent = NULL;
+
+    Log::info("BATCH COMPLETE\n");
+
+    return completed == items;
+}
+
+void BatchJob::SetAffinity(ThreadAffinity * affinity) {
+    m_Affinity = affinity;
+}
+
+void BatchJob::Report() {
+
+    if (m_Workers.empty()) return;
+
+    typedef struct {
+        int workers;
+        int completed;
+        int failed;
+        int stolen;
+        double busy;
+    } TokenShare;
+
+    map<string, TokenShare> tokens;
+    int completed = 0, failed = 0, remaining = 0;
+    double earliest = 0, latest = 0;
+
+    for (size_t i = 0; i < m_Workers.size(); i++) {
+
+        BatchWorker * worker = m_Workers[i];
+
+        if (tokens.find(worker->serial) == tokens.end()) {
+            TokenShare share = { 0, 0, 0, 0, 0 };
+            tokens[worker->serial] = share;
+        }
+
+        TokenShare * share = &tokens[worker->serial];
+        share->workers++;
+        share->completed += worker->completed;
+        share->failed += worker->failed;
+        share->stolen += worker->stolen;
+        share->busy += worker->busy;
+
+        completed += worker->completed;
+        failed += worker->failed;
+        remaining += (int)worker->items.size();
+
+        // The spread of the finishing times shows how well the stealing balanced the load
+        if (worker->finished > 0 && !worker->abandoned) {
+            if (earliest == 0 || worker->finished < earliest) earliest = worker->finished;
+            if (worker->finished > latest) latest = worker->finished;
+        }
+    }
+
+    double makespan = m_Makespan / 1000000.0;
+
+    Log::info("\nBATCH JOB (%d items, %u workers):\n", m_Items, (unsigned)m_Workers.size());
+    Log::info(" - Makespan %.2f s, %.1f items/s overall\n", makespan, (makespan > 0) ? completed / makespan : 0);
+    Log::info(" - %d completed, %d failed, %d not attempted\n", completed, failed, remaining);
+    Log::info(" - The workers ran out of work within %.2f s of each other\n", (latest - earliest) / 1000000.0);
+
+    Log::info("%-20s %8s %10s %7s %10s %9s %8s %10s %7s\n",
+              "SERIAL", "WORKERS", "COMPLETED", "SHARE", "ITEMS/S", "STOLEN", "FAILED", "IDLE", "IDLE %");
+
+    for (map<string, TokenShare>::iterator token = tokens.begin();
+            token != tokens.end();
+            ++token)
+    {
+        TokenShare * share = &token->second;
+
+        // Idle is the worker time not spent in an operation - logging in, stealing, or waiting for the others
+        double available = share->workers * makespan;
+        double idle = available - share->busy / 1000000.0;
+        if (idle < 0) idle = 0;
+
+        Log::info("%-20s %8d %10d %6.1f%% %10.1f %9d %8d %8.2f s %6.1f%%\n",
+                  token->first.c_str(), share->workers, share->completed,
+                  (completed > 0) ? share->completed * 100.0 / completed : 0,
+                  (makespan > 0) ? share->completed / makespan : 0,
+                  share->stolen, share->failed, idle, (available > 0) ? idle * 100.0 / available : 0);
+    }
+}
+
+DWORD WINAPI BatchJob::WorkerProc(LPVOID param) {
+
+    BatchWorker * worker = (BatchWorker *)param;
+    worker->job->Work(worker);
+
+    return 0;
+}
+
+void BatchJob::Work(BatchWorker * worker) {
+
+    WaitForSingleObject(m_StartEvent, INFINITE);
+
+    Log::debug("BatchJob::Work: Worker for %s started\n", worker->serial.c_str());
+
+    CK_SESSION_HANDLE session;
+    CK_OBJECT_HANDLE key = 0;
+    bool ready = false;
+    bool attached = false;
+
+    if (worker->pool->Acquire(&session, NULL)) {
+
+        worker->slot->AttachSession(session);
+        attached = true;
+
+        try {
+            key = m_Prepare(worker->slot);
+            ready = true;
+        }
+        catch (...) {
+            Log::error("Unable to prepare token %s for the batch, leaving its items to the other tokens\n", worker->serial.c_str());
+        }
+    }
+
+    worker->abandoned = !ready;
+
+    bool serialise = !PKCS11Manager::isThreadSafe();
+    int failures = 0;
+    int item;
+
+    while (ready && !*m_Shutdown && this->Next(worker, &item)) {
+
+        bool success = false;
+
+        if (serialise) EnterCriticalSection(&m_Serialise);
+
+        double started = Utility::QueryMicroseconds();
+
+        try {
+            success = m_Operation(worker->slot, worker->serial, key, item);
+        }
+        catch (...) {
+            Log::error("Unhandled exception during item %d on %s ...\n", item, worker->serial.c_str());
+        }
+
+        worker->busy += Utility::QueryMicroseconds() - started;
+
+        if (serialise) LeaveCriticalSection(&m_Serialise);
+
+        if (success) {
+            worker->completed++;
+            failures = 0;
+            continue;
+        }
+
+        worker->failed++;
+
+        // Most likely the token has gone - stop, so the rest of its share is stolen by the working tokens
+        if (++failures >= BATCH_FAILURE_LIMIT) {
+            Log::warn("Token %s failed %d items in a row, leaving the rest of its share to the other tokens\n",
+                      worker->serial.c_str(), failures);
+            worker->abandoned = true;
+            break;
+        }
+    }
+
+    worker->finished = Utility::QueryMicroseconds();
+
+    if (attached) worker->pool->Release(worker->slot->DetachSession());
+
+    Log::debug("BatchJob::Work: Worker for %s finished\n", worker->serial.c_str());
+}
+
+bool BatchJob::Next(BatchWorker * worker, int * item) {
+
+    for (;;) {
+
+        EnterCriticalSection(&worker->lock);
+
+        if (!worker->items.empty()) {
+            *item = worker->items.back();
+            worker->items.pop_back();
+            LeaveCriticalSection(&worker->lock);
+            return true;
+        }
+
+        LeaveCriticalSection(&worker->lock);
+
+        if (!this->Steal(worker)) return false;
+    }
+}
+
+bool BatchJob::Steal(BatchWorker * worker) {
+
+    // The victim with the most left, so the remaining work is halved rather than nibbled at.
+    // Only one deque is ever locked at a time.
+    BatchWorker * victim = NULL;
+    size_t most = 0;
+
+    for (size_t i = 0; i < m_Workers.size(); i++) {
+
+        if (m_Workers[i] == worker) continue;
+
+        EnterCriticalSection(&m_Workers[i]->lock);
+        size_t size = m_Workers[i]->items.size();
+        LeaveCriticalSection(&m_Workers[i]->lock);
+
+        if (size > most) {
+            most = size;
+            victim = m_Workers[i];
+        }
+    }
+
+    if (NULL == victim) return false;
+
+    vector<int> taken;
+
+    EnterCriticalSection(&victim->lock);
+
+    size_t take = (victim->items.size() + 1) / 2;
+    taken.assign(victim->items.begin(), victim->items.begin() + take);
+    victim->items.erase(victim->items.begin(), victim->items.begin() + take);
+
+    LeaveCriticalSection(&victim->lock);
+
+    // Another thief may have emptied it first, in which case the caller simply looks again
+    EnterCriticalSection(&worker->lock);
+    worker->items.insert(worker->items.end(), taken.begin(), taken.end());
+    worker->stolen += (int)taken.size();
+    LeaveCriticalSection(&worker->lock);
+
+    Log::debug("BatchJob::Steal: %s took %u items from %s\n", worker->serial.c_str(), (unsigned)taken.size(), victim->serial.c_str());
+
+    return true;
+}
+
+void BatchJob::Clear() {
+
+    for (size_t i = 0; i < m_Workers.size(); i++) {
+
+        if (NULL != m_Workers[i]->thread) CloseHandle(m_Workers[i]->thread);
+        DeleteCriticalSection(&m_Workers[i]->lock);
+
+        delete m_Workers[i]->slot;
+        delete m_Workers[i];
+    }
+
+    m_Workers.clear();
+
+    for (map<CK_SLOT_ID, SessionPool *>::iterator pool = m_Pools.begin();
+            pool != m_Pools.end();
+            ++pool)
+    {
+        delete pool->second;
+    }
+
+    m_Pools.clear();
+}
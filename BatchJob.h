@@ -0,0 +1,133 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+#include "stdafx.h"
+
+#include <windows.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+
+#include "PKCS11Slot.h"
+#include "SessionPool.h"
+#include "ThreadAffinity.h"
+
+using namespace std;
+
+// The number of consecutive failures after which a worker leaves its remaining items to the others
+#define BATCH_FAILURE_LIMIT     3
+
+// Finds the object the batch operations use, on a worker's (logged in) session. Throws if it can't be found.
+typedef CK_OBJECT_HANDLE (*BatchPrepare)(PKCS11Slot * slot);
+
+// Performs one item of the batch. Returns true if it succeeded.
+typedef bool (*BatchOperation)(PKCS11Slot * slot, string serial, CK_OBJECT_HANDLE key, int item);
+
+class BatchJob;
+
+// A thread working through its share of the batch, and stealing from the others once that runs out
+typedef struct {
+    BatchJob * job;
+    PKCS11Slot * slot;
+    string serial;
+    SessionPool * pool;
+
+    HANDLE thread;
+
+    // The items still to be done. The owner takes from the back, thieves from the front.
+    deque<int> items;
+    CRITICAL_SECTION lock;
+
+    // Items completed and failed by this worker, and the number it took from the others
+    int completed;
+    int failed;
+    int stolen;
+
+    // Time spent in the operations, and when the worker ran out of work (microseconds)
+    double busy;
+    double finished;
+
+    // Set when the worker gave up on its token, leaving its items to the others
+    bool abandoned;
+} BatchWorker;
+
+
+// Completes a fixed number of operations as quickly as possible across every token. The items are
+// split evenly between the workers up front, and a worker that runs out steals half of the remaining
+// items of another, so fast tokens pick up the slack from slow (or failed) ones.
+class BatchJob
+{
+public:
+    BatchJob(void);
+    ~BatchJob(void);
+
+    // Runs [items] operations across [workers] threads per token in [slots] (identified as [serials]),
+    // each thread on its own pooled session logged in with [pin]. Returns true if every item succeeded.
+    bool Run(vector<PKCS11Slot> * slots, map<CK_ULONG, string> * serials, int items, int workers, string pin,
+             BatchPrepare prepare, BatchOperation operation, bool * shutdown);
+
+    // Pins the workers with [affinity] (call before Run)
+    void SetAffinity(ThreadAffinity * affinity);
+
+    // Logs the makespan, and each token's share of the items and idle time
+    void Report();
+
+private:
+    // Thread entry point
+    static DWORD WINAPI WorkerProc(LPVOID param);
+
+    // The work loop for a single worker
+    void Work(BatchWorker * worker);
+
+    // Takes the next item for [worker], stealing if its own items have run out. Returns false once
+    // there is nothing left anywhere.
+    bool Next(BatchWorker * worker, int * item);
+
+    // Moves half of another worker's remaining items to [worker]. Returns false if they are all empty.
+    bool Steal(BatchWorker * worker);
+
+    // Releases the workers and the pools
+    void Clear();
+
+private:
+    ThreadAffinity * m_Affinity;
+    BatchPrepare m_Prepare;
+    BatchOperation m_Operation;
+    bool * m_Shutdown;
+
+    // Released once every worker has been created, so they all start together
+    HANDLE m_StartEvent;
+
+    // Serialises operations when the library couldn't be initialised for OS locking
+    CRITICAL_SECTION m_Serialise;
+
+    int m_Items;
+    double m_Started;
+    double m_Makespan;
+
+    vector<BatchWorker *> m_Workers;
+    map<CK_SLOT_ID, SessionPool *> m_Pools;
+};
@@ -0,0 +1,126 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "StdAfx.h"
+#include "CalibrationLibrary.h"
+
+#include <string.h>
+
+// Whether the current search has returned its key yet. Calibration runs on a single thread.
+static bool m_Found = false;
+
+
+CalibrationLibrary::CalibrationLibrary(void)
+{
+}
+
+
+CalibrationLibrary::~CalibrationLibrary(void)
+{
+}
+
+static CK_RV CK_CALL_SPEC NullOpenSession(CK_SLOT_ID slotID, CK_FLAGS flags, CK_VOID_PTR pApplication, CK_NOTIFY Notify, CK_SESSION_HANDLE_PTR phSession) {
+    *phSession = 1;
+    return CKR_OK;
+}
+
+static CK_RV CK_CALL_SPEC NullSession(CK_SESSION_HANDLE hSession) {
+    return CKR_OK;
+}
+
+static CK_RV CK_CALL_SPEC NullLogin(CK_SESSION_HANDLE hSession, CK_USER_TYPE userType, CK_UTF8CHAR_PTR pPin, CK_ULONG ulPinLen) {
+    return CKR_OK;
+}
+
+static CK_RV CK_CALL_SPEC NullFindObjectsInit(CK_SESSION_HANDLE hSession, CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount) {
+    m_Found = false;
+    return CKR_OK;
+}
+
+static CK_RV CK_CALL_SPEC NullFindObjects(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE_PTR phObject, CK_ULONG ulMaxObjectCount, CK_ULONG_PTR pulObjectCount) {
+
+    // A single match, so the key searches succeed
+    *pulObjectCount = m_Found ? 0 : 1;
+    if (!m_Found) *phObject = CALIBRATION_KEY_HANDLE;
+
+    m_Found = true;
+    return CKR_OK;
+}
+
+static CK_RV CK_CALL_SPEC NullGenerateRandom(CK_SESSION_HANDLE hSession, CK_BYTE_PTR RandomData, CK_ULONG ulRandomLen) {
+    return CKR_OK;
+}
+
+static CK_RV CK_CALL_SPEC NullOperationInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_OBJECT_HANDLE hKey) {
+    return CKR_OK;
+}
+
+static CK_RV CK_CALL_SPEC NullDigestInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism) {
+    return CKR_OK;
+}
+
+// Encrypt, decrypt, sign and digest - the output is left as it is, at the length the caller allowed
+static CK_RV CK_CALL_SPEC NullOperation(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pData, CK_ULONG ulDataLen, CK_BYTE_PTR pOutput, CK_ULONG_PTR pulOutputLen) {
+    return CKR_OK;
+}
+
+static CK_RV CK_CALL_SPEC NullVerify(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pData, CK_ULONG ulDataLen, CK_BYTE_PTR pSignature, CK_ULONG ulSignatureLen) {
+    return CKR_OK;
+}
+
+CK_FUNCTION_LIST * CalibrationLibrary::getFunctionList() {
+
+    static CK_FUNCTION_LIST functions;
+    static bool initialised = false;
+
+    if (!initialised) {
+        memset(&functions, 0, sizeof(functions));
+
+        functions.version.major = 2;
+        functions.version.minor = 20;
+
+        functions.C_OpenSession = NullOpenSession;
+        functions.C_CloseSession = NullSession;
+        functions.C_Login = NullLogin;
+        functions.C_Logout = NullSession;
+        functions.C_FindObjectsInit = NullFindObjectsInit;
+        functions.C_FindObjects = NullFindObjects;
+        functions.C_FindObjectsFinal = NullSession;
+        functions.C_GenerateRandom = NullGenerateRandom;
+        functions.C_EncryptInit = NullOperationInit;
+        functions.C_Encrypt = NullOperation;
+        functions.C_DecryptInit = NullOperationInit;
+        functions.C_Decrypt = NullOperation;
+        functions.C_DigestInit = NullDigestInit;
+        functions.C_Digest = NullOperation;
+        functions.C_SignInit = NullOperationInit;
+        functions.C_Sign = NullOperation;
+        functions.C_VerifyInit = NullOperationInit;
+        functions.C_Verify = NullVerify;
+
+        initialised = true;
+    }
+
+    return &functions;
+}
@@ -0,0 +1,48 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+#include "stdafx.h"
+
+#include "include/cryptoki.h"
+
+// The serial the calibration transactions are journalled under
+#define CALIBRATION_SERIAL      "CALIBRATION"
+
+// The object handle returned for every key search
+#define CALIBRATION_KEY_HANDLE  1
+
+
+// A PKCS#11 function table whose functions return CKR_OK without doing any work, so that the
+// transaction pipeline can be run to measure the time the harness itself adds.
+// Only the functions used by a transaction are provided; the rest of the table is NULL.
+class CalibrationLibrary
+{
+public:
+    CalibrationLibrary(void);
+    ~CalibrationLibrary(void);
+
+    // Returns the no-op function table
+    static CK_FUNCTION_LIST * getFunctionList();
+};
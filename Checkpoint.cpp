@@ -0,0 +1,349 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "StdAfx.h"
+#include "Checkpoint.h"
+
+#include <fstream>
+#include <sstream>
+
+#include "Utility.h"
+#include "Log.h"
+
+
+Checkpoint::Checkpoint(void)
+{
+    m_Thread = NULL;
+    m_StopEvent = NULL;
+    m_Interval = 0;
+    m_Affinity = NULL;
+    m_Results = NULL;
+    m_Slots = NULL;
+    m_Iterations = NULL;
+    m_Trend = NULL;
+    m_Integrity = NULL;
+    m_Breaker = NULL;
+    m_Resumed = 0;
+    m_Started = Utility::QueryMicroseconds();
+    m_Written = 0;
+}
+
+
+Checkpoint::~Checkpoint(void)
+{
+    this->Stop();
+}
+
+void Checkpoint::Start(string path, int interval, CheckpointState * state, Results * results, SlotManager * slots, volatile LONG * iterations) {
+
+    Log::debug("Checkpoint::Start: Called\n");
+
+    if (NULL != m_Thread) {
+        Log::warn("Checkpoint::Start: Checkpoints are already being written, ignoring\n");
+        return;
+    }
+
+    m_Path = path;
+    m_Interval = interval;
+    m_Results = results;
+    m_Slots = slots;
+    m_Iterations = iterations;
+    m_Resumed = state->elapsed;
+    m_Started = Utility::QueryMicroseconds();
+    m_Written = 0;
+
+    m_StopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    m_Thread = CreateThread(NULL, 0, ThreadProc, this, CREATE_SUSPENDED, NULL);
+
+    if (NULL == m_Thread) {
+        Log::error("Checkpoint::Start: Unable to create the checkpoint thread\n");
+        CloseHandle(m_StopEvent);
+        m_StopEvent = NULL;
+        return;
+    }
+
+    if (NULL != m_Affinity) m_Affinity->PinService(m_Thread, "checkpoint writer");
+    ResumeThread(m_Thread);
+
+    Log::info("Checkpointing the run every %d seconds to %s\n", interval, path.c_str());
+}
+
+void Checkpoint::Stop() {
+
+    if (NULL == m_Thread) return;
+
+    Log::debug("Checkpoint::Stop: Called\n");
+
+    SetEvent(m_StopEvent);
+    WaitForSingleObject(m_Thread, INFINITE);
+
+    CloseHandle(m_Thread);
+    CloseHandle(m_StopEvent);
+    m_Thread = NULL;
+    m_StopEvent = NULL;
+
+    // Final checkpoint, so a later --resume carries on from the end of this leg
+    this->Write();
+
+    Log::info("Run checkpointed to %s after %.0f seconds (%d checkpoints this leg)\n", m_Path.c_str(), this->getElapsed(), m_Written);
+}
+
+void Checkpoint::SetAffinity(ThreadAffinity * affinity) {
+    m_Affinity = affinity;
+}
+
+void Checkpoint::SetSources(LatencyTrend * trend, Integrity * integrity, CircuitBreaker * breaker) {
+    m_Trend = trend;
+    m_Integrity = integrity;
+    m_Breaker = breaker;
+}
+
+double Checkpoint::getElapsed() {
+    return m_Resumed + (Utility::QueryMicroseconds() - m_Started) / 1000000.0;
+}
+
+DWORD WINAPI Checkpoint::ThreadProc(LPVOID param) {
+
+    Checkpoint * checkpoint = (Checkpoint *)param;
+
+    while (WAIT_TIMEOUT == WaitForSingleObject(checkpoint->m_StopEvent, checkpoint->m_Interval * 1000)) {
+        checkpoint->Write();
+    }
+
+    return 0;
+}
+
+void Checkpoint::Write() {
+
+    CheckpointState state;
+    Results current;
+
+    state.elapsed = this->getElapsed();
+    state.iterations = *m_Iterations;
+    m_Slots->QueryIterations(&state.tokens);
+    m_Results->Capture(&current);
+
+    if (NULL != m_Trend) m_Trend->QueryWindows(&state.windows);
+    if (NULL != m_Integrity) m_Integrity->QueryCounts(&state.integrity);
+    if (NULL != m_Breaker) m_Breaker->QueryBreakers(&state.breakers);
+
+    if (Save(m_Path, &state, &current)) m_Written++;
+}
+
+bool Checkpoint::Save(string path, CheckpointState * state, Results * results) {
+
+    string temporary = path + ".tmp";
+
+    ofstream o(temporary.c_str(), ios_base::trunc | ios_base::out);
+    if (!o.is_open()) {
+        Log::error("Unable to write the checkpoint file %s\n", temporary.c_str());
+        return false;
+    }
+
+    o.precision(17);
+    o << CHECKPOINT_HEADER << " " << CHECKPOINT_VERSION << endl;
+    o << "ELAPSED " << state->elapsed << endl;
+    o << "ITERATIONS " << state->iterations << endl;
+
+    for (map<string, int>::iterator token = state->tokens.begin();
+            token != state->tokens.end();
+            ++token)
+    {
+        o << "TOKEN " << token->first << " " << token->second << endl;
+    }
+
+    for (map<string, map<string, vector<LatencyWindow> > >::iterator card = state->windows.begin();
+            card != state->windows.end();
+            ++card)
+    {
+        for (map<string, vector<LatencyWindow> >::iterator op = card->second.begin();
+                op != card->second.end();
+                ++op)
+        {
+            for (size_t i = 0; i < op->second.size(); i++) {
+
+                LatencyWindow * window = &op->second[i];
+
+                o << "WINDOW " << card->first << " " << op->first << " " << window->firstIteration << " "
+                  << window->lastIteration << " " << window->count << " " << window->total << " "
+                  << window->sumSquares << " " << window->minimum << " " << window->maximum << endl;
+            }
+        }
+    }
+
+    for (map<string, map<string, IntegrityCount> >::iterator token = state->integrity.begin();
+            token != state->integrity.end();
+            ++token)
+    {
+        for (map<string, IntegrityCount>::iterator check = token->second.begin();
+                check != token->second.end();
+                ++check)
+        {
+            o << "INTEGRITY " << token->first << " " << check->first << " " << check->second.checked << " "
+              << check->second.mismatched << endl;
+        }
+    }
+
+    for (map<string, BreakerState>::iterator breaker = state->breakers.begin();
+            breaker != state->breakers.end();
+            ++breaker)
+    {
+        o << "BREAKER " << breaker->first << " " << breaker->second.trips << " " << breaker->second.failed << " "
+          << breaker->second.code << " " << (breaker->second.permanent ? 1 : 0) << " " << breaker->second.open << endl;
+    }
+
+    results->Write(o);
+
+    o.close();
+    if (o.fail()) {
+        Log::error("Unable to write the checkpoint file %s\n", temporary.c_str());
+        return false;
+    }
+
+    if (!MoveFileExA(temporary.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        Log::error("Unable to replace the checkpoint file %s (%u)\n", path.c_str(), GetLastError());
+        return false;
+    }
+
+    Log::debug("Checkpoint::Save: %s written at %.0f seconds\n", path.c_str(), state->elapsed);
+    return true;
+}
+
+bool Checkpoint::Load(string path, CheckpointState * state, Results * results) {
+
+    Log::debug("Checkpoint::Load: Reading %s\n", path.c_str());
+
+    ifstream in(path.c_str());
+    if (!in.is_open()) {
+        Log::error("Unable to open the checkpoint file %s\n", path.c_str());
+        return false;
+    }
+
+    string header;
+    int version = 0;
+    in >> header >> version;
+
+    // Version 1 files have no trend windows, integrity counts or breakers, which start fresh
+    if (header != CHECKPOINT_HEADER || version < 1 || version > CHECKPOINT_VERSION) {
+        Log::error("%s is not a version 1 to %d checkpoint file\n", path.c_str(), CHECKPOINT_VERSION);
+        return false;
+    }
+
+    state->elapsed = 0;
+    state->iterations = 0;
+    state->tokens.clear();
+    state->windows.clear();
+    state->integrity.clear();
+    state->breakers.clear();
+
+    // The run state, up to the results block
+    string line, block;
+    bool found = false;
+
+    while (getline(in, line)) {
+
+        if (!found && line.compare(0, strlen(RESULTS_HEADER), RESULTS_HEADER) == 0) found = true;
+
+        if (found) {
+            block += line;
+            block += "\n";
+            continue;
+        }
+
+        stringstream buffer(line);
+        string type;
+        buffer >> type;
+
+        if (type == "ELAPSED") {
+            buffer >> state->elapsed;
+        }
+        else if (type == "ITERATIONS") {
+            buffer >> state->iterations;
+        }
+        else if (type == "TOKEN") {
+
+            string serial;
+            int iterations = 0;
+            buffer >> serial >> iterations;
+
+            if (buffer.fail()) {
+                Log::error("%s contains an invalid token count\n", path.c_str());
+                return false;
+            }
+
+            state->tokens[serial] = iterations;
+        }
+        else if (type == "WINDOW") {
+
+            string serial, operation;
+            LatencyWindow window;
+            buffer >> serial >> operation >> window.firstIteration >> window.lastIteration >> window.count
+                   >> window.total >> window.sumSquares >> window.minimum >> window.maximum;
+
+            if (buffer.fail()) {
+                Log::error("%s contains an invalid trend window\n", path.c_str());
+                return false;
+            }
+
+            state->windows[serial][operation].push_back(window);
+        }
+        else if (type == "INTEGRITY") {
+
+            string serial, check;
+            IntegrityCount count;
+            buffer >> serial >> check >> count.checked >> count.mismatched;
+
+            if (buffer.fail()) {
+                Log::error("%s contains an invalid integrity count\n", path.c_str());
+                return false;
+            }
+
+            state->integrity[serial][check] = count;
+        }
+        else if (type == "BREAKER") {
+
+            string serial;
+            BreakerState breaker;
+            int permanent = 0;
+            memset(&breaker, 0, sizeof(breaker));
+            buffer >> serial >> breaker.trips >> breaker.failed >> breaker.code >> permanent >> breaker.open;
+
+            if (buffer.fail()) {
+                Log::error("%s contains an invalid breaker\n", path.c_str());
+                return false;
+            }
+
+            breaker.permanent = (permanent != 0);
+            state->breakers[serial] = breaker;
+        }
+    }
+
+    if (!found) {
+        Log::error("%s has no results, it may have been truncated\n", path.c_str());
+        return false;
+    }
+
+    stringstream stream(block);
+    return results->Read(stream, path);
+}
@@ -0,0 +1,126 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+#include "stdafx.h"
+
+#include <windows.h>
+#include <string>
+#include <map>
+
+#include "CircuitBreaker.h"
+#include "Integrity.h"
+#include "LatencyTrend.h"
+#include "Results.h"
+#include "SlotManager.h"
+#include "ThreadAffinity.h"
+
+using namespace std;
+
+// The first line of a checkpoint file, followed by the format version
+#define CHECKPOINT_HEADER       "PKCS11LOADTEST-CHECKPOINT"
+#define CHECKPOINT_VERSION      2
+
+// The file the state of a run is checkpointed to, and resumed from
+#define CHECKPOINT_FILE         "checkpoint.txt"
+
+// The state of a run, as written to a checkpoint
+typedef struct {
+    // The run time (seconds) and transactions started so far, over every leg of the run
+    double elapsed;
+    LONG iterations;
+
+    // The transactions started on each token, by journal serial
+    map<string, int> tokens;
+
+    // The latency trend windows, integrity counts and breakers of each token, by journal serial
+    map<string, map<string, vector<LatencyWindow> > > windows;
+    map<string, map<string, IntegrityCount> > integrity;
+    map<string, BreakerState> breakers;
+} CheckpointState;
+
+
+// Periodically saves the state of a long run - the transaction counts, latency trend windows, integrity
+// counts and breakers of each token, and the latency histograms and CK_RV counters - so that a run
+// interrupted by a crash or a reboot can be resumed from where it was rather than restarted from zero.
+//
+// A checkpoint file is the run state followed by a results block. It is written to a temporary file
+// and moved over the last checkpoint, so an interruption mid-write leaves the previous one intact.
+class Checkpoint
+{
+public:
+    Checkpoint(void);
+    ~Checkpoint(void);
+
+    // Starts saving the run to [path] every [interval] seconds. [state] holds what earlier legs of the run
+    // had reached (zeroed for a new run), and [iterations] the transaction count, carried on from [state].
+    void Start(string path, int interval, CheckpointState * state, Results * results, SlotManager * slots, volatile LONG * iterations);
+
+    // Stops the writer, saving a final checkpoint
+    void Stop();
+
+    // Pins the writer thread with [affinity] (call before Start)
+    void SetAffinity(ThreadAffinity * affinity);
+
+    // Also saves the windows of [trend], the counts of [integrity] and the state of [breaker] (call before Start)
+    void SetSources(LatencyTrend * trend, Integrity * integrity, CircuitBreaker * breaker);
+
+    // Returns the run time (seconds) over every leg of the run
+    double getElapsed();
+
+    // Reads the checkpoint at [path] into [state] and [results]. Returns false if it can't be read.
+    static bool Load(string path, CheckpointState * state, Results * results);
+
+    // Writes [state] and [results] to [path], replacing any earlier checkpoint. Returns false on error.
+    static bool Save(string path, CheckpointState * state, Results * results);
+
+private:
+    // Background thread entry point
+    static DWORD WINAPI ThreadProc(LPVOID param);
+
+    // Saves the current state of the run
+    void Write();
+
+private:
+    HANDLE m_Thread;
+    HANDLE m_StopEvent;
+
+    string m_Path;
+    int m_Interval;
+    ThreadAffinity * m_Affinity;
+
+    Results * m_Results;
+    SlotManager * m_Slots;
+    volatile LONG * m_Iterations;
+
+    LatencyTrend * m_Trend;
+    Integrity * m_Integrity;
+    CircuitBreaker * m_Breaker;
+
+    // The run time of earlier legs (seconds), and when this leg started (microseconds)
+    double m_Resumed;
+    double m_Started;
+
+    int m_Written;
+};
@@ -0,0 +1,330 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "StdAfx.h"
+#include "CircuitBreaker.h"
+
+#include "Utility.h"
+#include "Log.h"
+
+
+CircuitBreaker::CircuitBreaker(void)
+{
+    m_Results = NULL;
+    m_Failures = BREAKER_DEFAULT_FAILURES;
+    m_Backoff = BREAKER_DEFAULT_BACKOFF;
+
+    // A login retried with a wrong PIN counts towards locking the token, so it is never retried
+    BreakerPolicy login = { 1, true };
+    m_Policies[CKR_PIN_INCORRECT] = login;
+    m_Policies[CKR_PIN_INVALID] = login;
+    m_Policies[CKR_PIN_LEN_RANGE] = login;
+    m_Policies[CKR_PIN_EXPIRED] = login;
+    m_Policies[CKR_PIN_LOCKED] = login;
+
+    // A pulled card is followed by the slot manager, which stops its workers until it is reinserted
+    BreakerPolicy removed = { 0, false };
+    m_Policies[CKR_DEVICE_REMOVED] = removed;
+    m_Policies[CKR_TOKEN_NOT_PRESENT] = removed;
+
+    InitializeCriticalSection(&m_Lock);
+}
+
+
+CircuitBreaker::~CircuitBreaker(void)
+{
+    DeleteCriticalSection(&m_Lock);
+}
+
+void CircuitBreaker::Configure(int failures, int backoff) {
+    m_Failures = failures;
+    m_Backoff = (backoff > 0) ? backoff : BREAKER_DEFAULT_BACKOFF;
+}
+
+void CircuitBreaker::SetResults(Results * results) {
+    m_Results = results;
+}
+
+bool CircuitBreaker::isEnabled() {
+    return m_Failures > 0;
+}
+
+DWORD CircuitBreaker::Admit(string serial) {
+
+    if (!this->isEnabled()) return 0;
+
+    double now = Utility::QueryMicroseconds();
+    DWORD wait = 0;
+
+    EnterCriticalSection(&m_Lock);
+
+    if (m_Breakers.find(serial) == m_Breakers.end()) {
+        BreakerState breaker;
+        memset(&breaker, 0, sizeof(breaker));
+        breaker.state = BREAKER_CLOSED;
+        breaker.changed = now;
+        m_Breakers[serial] = breaker;
+    }
+
+    BreakerState * breaker = &m_Breakers[serial];
+
+    if (BREAKER_OPEN == breaker->state) {
+
+        if (breaker->permanent) {
+            wait = BREAKER_LOCKED;
+        }
+        else if (now < breaker->retry) {
+            wait = (DWORD)((breaker->retry - now) / 1000) + 1;
+        }
+        else {
+            // Let a single transaction through to see whether the token has recovered
+            this->Transition(serial, breaker, BREAKER_HALF_OPEN, now);
+            breaker->probing = true;
+        }
+    }
+    else if (BREAKER_HALF_OPEN == breaker->state) {
+
+        // Any other workers on the token wait for the probe's outcome
+        if (breaker->probing) {
+            wait = BREAKER_PROBE_WAIT;
+        } else {
+            breaker->probing = true;
+        }
+    }
+
+    LeaveCriticalSection(&m_Lock);
+
+    return wait;
+}
+
+void CircuitBreaker::Record(string serial, bool success, CK_RV code) {
+
+    if (!this->isEnabled()) return;
+
+    double now = Utility::QueryMicroseconds();
+
+    EnterCriticalSection(&m_Lock);
+
+    BreakerState * breaker = &m_Breakers[serial];
+
+    if (success) {
+
+        breaker->consecutive = 0;
+
+        if (BREAKER_HALF_OPEN == breaker->state) {
+
+            double outage = now - breaker->opened;
+
+            this->Transition(serial, breaker, BREAKER_CLOSED, now);
+            breaker->streak = 0;
+            breaker->probing = false;
+
+            if (NULL != m_Results) m_Results->Record(serial, "BREAKER_OPEN", "-", outage);
+        }
+
+        LeaveCriticalSection(&m_Lock);
+        return;
+    }
+
+    breaker->failed++;
+    breaker->code = code;
+
+    BreakerPolicy policy = this->getPolicy(code);
+
+    // Ignored failures leave the breaker as it is, but free the probe for the next worker
+    if (policy.failures <= 0) {
+        breaker->probing = false;
+        LeaveCriticalSection(&m_Lock);
+        return;
+    }
+
+    breaker->consecutive++;
+
+    bool trip = (BREAKER_HALF_OPEN == breaker->state) ||
+                (BREAKER_CLOSED == breaker->state && breaker->consecutive >= policy.failures);
+
+    if (trip) {
+
+        if (BREAKER_CLOSED == breaker->state) breaker->opened = now;
+
+        // The backoff doubles with each failed probe, up to the maximum
+        double backoff = m_Backoff;
+        for (int i = 0; i < breaker->streak && backoff < BREAKER_MAX_BACKOFF; i++) backoff *= 2;
+        if (backoff > BREAKER_MAX_BACKOFF) backoff = BREAKER_MAX_BACKOFF;
+
+        breaker->streak++;
+        breaker->trips++;
+        breaker->permanent = policy.permanent;
+        breaker->probing = false;
+        breaker->retry = now + backoff * 1000;
+
+        this->Transition(serial, breaker, BREAKER_OPEN, now);
+
+        if (policy.permanent) {
+            Log::warn("Token %s will not be used again after %s\n", serial.c_str(), Utility::ErrorToString(code));
+        } else {
+            Log::warn("Token %s backing off for %.1f s after %d consecutive failures (%s)\n",
+                      serial.c_str(), backoff / 1000.0, breaker->consecutive, Utility::ErrorToString(code));
+        }
+    }
+
+    LeaveCriticalSection(&m_Lock);
+}
+
+void CircuitBreaker::Cancel(string serial) {
+
+    if (!this->isEnabled()) return;
+
+    EnterCriticalSection(&m_Lock);
+    if (m_Breakers.find(serial) != m_Breakers.end()) m_Breakers[serial].probing = false;
+    LeaveCriticalSection(&m_Lock);
+}
+
+void CircuitBreaker::QueryBreakers(map<string, BreakerState> * breakers) {
+
+    double now = Utility::QueryMicroseconds();
+
+    EnterCriticalSection(&m_Lock);
+
+    *breakers = m_Breakers;
+
+    for (map<string, BreakerState>::iterator breaker = breakers->begin();
+            breaker != breakers->end();
+            ++breaker)
+    {
+        if (BREAKER_CLOSED != breaker->second.state) breaker->second.open += now - breaker->second.changed;
+    }
+
+    LeaveCriticalSection(&m_Lock);
+}
+
+void CircuitBreaker::RestoreBreakers(map<string, BreakerState> * breakers) {
+
+    double now = Utility::QueryMicroseconds();
+
+    EnterCriticalSection(&m_Lock);
+
+    for (map<string, BreakerState>::iterator entry = breakers->begin();
+            entry != breakers->end();
+            ++entry)
+    {
+        BreakerState breaker;
+        memset(&breaker, 0, sizeof(breaker));
+        breaker.state = entry->second.permanent ? BREAKER_OPEN : BREAKER_CLOSED;
+        breaker.code = entry->second.code;
+        breaker.trips = entry->second.trips;
+        breaker.permanent = entry->second.permanent;
+        breaker.changed = now;
+        breaker.opened = now;
+        breaker.open = entry->second.open;
+        breaker.failed = entry->second.failed;
+        m_Breakers[entry->first] = breaker;
+
+        if (breaker.permanent) {
+            Log::warn("Token %s will not be used again after %s in an earlier leg of the run\n",
+                      entry->first.c_str(), Utility::ErrorToString(breaker.code));
+        }
+    }
+
+    LeaveCriticalSection(&m_Lock);
+}
+
+BreakerPolicy CircuitBreaker::getPolicy(CK_RV code) {
+
+    map<CK_RV, BreakerPolicy>::iterator policy = m_Policies.find(code);
+    if (policy != m_Policies.end()) return policy->second;
+
+    BreakerPolicy fallback = { m_Failures, false };
+    return fallback;
+}
+
+void CircuitBreaker::Transition(string serial, BreakerState * breaker, int state, double now) {
+
+    Log::debug("CircuitBreaker::Transition: %s %s -> %s after %.1f s\n", serial.c_str(),
+               StateToString(breaker->state), StateToString(state), (now - breaker->changed) / 1000000.0);
+
+    if (BREAKER_CLOSED != breaker->state) breaker->open += now - breaker->changed;
+
+    if (BREAKER_CLOSED == state) {
+        Log::info("Token %s recovered, breaker closed after %.1f s\n", serial.c_str(), (now - breaker->opened) / 1000000.0);
+    }
+
+    breaker->state = state;
+    breaker->changed = now;
+}
+
+const char * CircuitBreaker::StateToString(int state) {
+
+    switch (state) {
+    case BREAKER_CLOSED:
+        return "closed";
+    case BREAKER_OPEN:
+        return "open";
+    case BREAKER_HALF_OPEN:
+        return "half-open";
+    }
+
+    return "unknown";
+}
+
+void CircuitBreaker::Report() {
+
+    double now = Utility::QueryMicroseconds();
+
+    EnterCriticalSection(&m_Lock);
+
+    // Nothing to say unless a breaker has opened
+    bool tripped = false;
+    for (map<string, BreakerState>::iterator breaker = m_Breakers.begin();
+            breaker != m_Breakers.end();
+            ++breaker)
+    {
+        if (breaker->second.trips > 0) tripped = true;
+    }
+
+    if (!tripped) {
+        LeaveCriticalSection(&m_Lock);
+        return;
+    }
+
+    Log::info("\nCIRCUIT BREAKERS (open after %d consecutive failures):\n", m_Failures);
+    Log::info("%-20s %-10s %7s %8s %12s %s\n", "SERIAL", "STATE", "TRIPS", "FAILED", "TIME OPEN", "LAST ERROR");
+
+    for (map<string, BreakerState>::iterator entry = m_Breakers.begin();
+            entry != m_Breakers.end();
+            ++entry)
+    {
+        BreakerState * breaker = &entry->second;
+
+        double open = breaker->open;
+        if (BREAKER_CLOSED != breaker->state) open += now - breaker->changed;
+
+        Log::info("%-20s %-10s %7d %8d %10.1f s %s\n",
+                  entry->first.c_str(), breaker->permanent ? "LOCKED" : StateToString(breaker->state),
+                  breaker->trips, breaker->failed, open / 1000000.0,
+                  (breaker->failed > 0) ? Utility::ErrorToString(breaker->code) : "-");
+    }
+
+    LeaveCriticalSection(&m_Lock);
+}
@@ -0,0 +1,152 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+#include "stdafx.h"
+
+#include <windows.h>
+#include <string>
+#include <map>
+
+#include "PKCS11Manager.h"
+#include "Results.h"
+
+using namespace std;
+
+// The consecutive failures that open a token's breaker, and the first backoff (milliseconds) once it has
+#define BREAKER_DEFAULT_FAILURES    5
+#define BREAKER_DEFAULT_BACKOFF     1000
+
+// The longest a breaker stays open before probing again, however often the probes fail (milliseconds)
+#define BREAKER_MAX_BACKOFF         60000
+
+// How long a worker waits while another worker on the same token is probing it (milliseconds)
+#define BREAKER_PROBE_WAIT          250
+
+// Returned by Admit when the token must not be used again in this run
+#define BREAKER_LOCKED              INFINITE
+
+// The states of a token's breaker
+#define BREAKER_CLOSED              0
+#define BREAKER_OPEN                1
+#define BREAKER_HALF_OPEN           2
+
+// How failures with a particular CK_RV are treated
+typedef struct {
+    // The consecutive failures that open the breaker (0 ignores the failure altogether)
+    int failures;
+
+    // Never probe again once open - for failures where retrying does harm, such as an incorrect PIN
+    bool permanent;
+} BreakerPolicy;
+
+// The breaker of a single token
+typedef struct {
+    int state;
+
+    // Failures since the last success, and the CK_RV of the most recent
+    int consecutive;
+    CK_RV code;
+
+    // The times the breaker has opened in a row without a successful probe, and in total
+    int streak;
+    int trips;
+    bool permanent;
+
+    // When the breaker last changed state, last opened from closed, and lets the next probe through (microseconds)
+    double changed;
+    double opened;
+    double retry;
+
+    // Whether a probe is in progress, and the total time spent open or half-open (microseconds)
+    bool probing;
+    double open;
+
+    // The failed transactions
+    int failed;
+} BreakerState;
+
+
+// Stops a failing token from being retried at the full rate. After a run of consecutive failures the
+// token's breaker opens and its workers back off, doubling each time, before a single probe transaction
+// is let through (half-open). A successful probe closes the breaker again. Failures that could lock the
+// token (an incorrect PIN) open it for the rest of the run, and removals are left to the slot manager.
+class CircuitBreaker
+{
+public:
+    CircuitBreaker(void);
+    ~CircuitBreaker(void);
+
+    // Sets the consecutive failures that open a breaker (0 disables every breaker) and the first backoff (milliseconds)
+    void Configure(int failures, int backoff);
+
+    // Records the time each breaker spends open into [results] as BREAKER_OPEN (call before the run)
+    void SetResults(Results * results);
+
+    // Returns true unless the breakers have been disabled
+    bool isEnabled();
+
+    // Asks to run a transaction on token [serial]. Returns 0 if it may run now, BREAKER_LOCKED if the
+    // token must not be used again, or otherwise the milliseconds to wait before asking again.
+    DWORD Admit(string serial);
+
+    // Records the outcome of an admitted transaction. [code] is the CK_RV of the failure (CKR_OK if unknown).
+    void Record(string serial, bool success, CK_RV code);
+
+    // Gives up an admitted transaction that was never run, so another worker can probe the token
+    void Cancel(string serial);
+
+    // Logs the state, trips and time open of each breaker
+    void Report();
+
+    // Copies the breaker of every token into [breakers], with the time spent open up to now
+    void QueryBreakers(map<string, BreakerState> * breakers);
+
+    // Restores the breakers an earlier leg of a resumed run reached. Only the totals and the permanently
+    // open breakers carry on - the rest start closed, as the interruption may have cleared their failures.
+    void RestoreBreakers(map<string, BreakerState> * breakers);
+
+private:
+    // Returns the policy for failures with [code]
+    BreakerPolicy getPolicy(CK_RV code);
+
+    // Moves a breaker to [state], logging the transition. Must be called with m_Lock held.
+    void Transition(string serial, BreakerState * breaker, int state, double now);
+
+    // Returns the name of a breaker state
+    static const char * StateToString(int state);
+
+private:
+    CRITICAL_SECTION m_Lock;
+    Results * m_Results;
+
+    int m_Failures;
+    int m_Backoff;
+
+    // The policies that differ from the default, by CK_RV
+    map<CK_RV, BreakerPolicy> m_Policies;
+
+    // By token serial
+    map<string, BreakerState> m_Breakers;
+};
@@ -0,0 +1,251 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "StdAfx.h"
+#include "Comparison.h"
+
+#include <math.h>
+#include <algorithm>
+
+#include "Log.h"
+
+// Display names for each of the compared statistics
+static const char * STATISTIC_NAMES[COMPARISON_STATISTICS] = { "mean", "p50", "p90", "p99", "ops/s" };
+
+// The statistic index of the throughput, which regresses downwards rather than upwards
+#define STATISTIC_THROUGHPUT    4
+
+// The normal quantile for a two-sided 95% interval
+#define Z_95                    1.959964
+
+
+int Comparison::Run(vector<wstring> * inputs, double threshold, int resamples) {
+
+    Log::debug("Comparison::Run: Called\n");
+
+    if (inputs->size() != 2) {
+        Log::error("A baseline and a candidate results file must be supplied to compare.\n");
+        return EXIT_FAILURE;
+    }
+
+    if (resamples < 100) {
+        Log::error("At least 100 resamples are required for the confidence intervals.\n");
+        return EXIT_FAILURE;
+    }
+
+    Results baseline, candidate;
+    string baselinePath((*inputs)[0].begin(), (*inputs)[0].end());
+    string candidatePath((*inputs)[1].begin(), (*inputs)[1].end());
+
+    if (!baseline.Load(baselinePath)) return EXIT_FAILURE;
+    if (!candidate.Load(candidatePath)) return EXIT_FAILURE;
+
+    map<string, Histogram> * base = baseline.getHistograms();
+    map<string, Histogram> * cand = candidate.getHistograms();
+
+    Aggregate(base);
+    Aggregate(cand);
+
+    Log::info("\nBASELINE  : %s (%.0f seconds)\n", baselinePath.c_str(), baseline.getDuration());
+    Log::info("CANDIDATE : %s (%.0f seconds)\n", candidatePath.c_str(), candidate.getDuration());
+    Log::info("Regression threshold %.1f%%, 95%% confidence intervals from %d bootstrap resamples\n",
+              threshold, resamples);
+
+    Log::info("\n%-20s %-14s %-16s %-5s %12s %12s %9s %21s\n",
+              "OPERATION", "MECHANISM", "SERIAL", "STAT", "BASELINE", "CANDIDATE", "DELTA", "95% CI");
+
+    int regressions = 0;
+    int compared = 0;
+
+    for (map<string, Histogram>::iterator entry = base->begin();
+            entry != base->end();
+            ++entry)
+    {
+        map<string, Histogram>::iterator other = cand->find(entry->first);
+
+        string operation, mechanism, serial;
+        Results::SplitKey(entry->first, &operation, &mechanism, &serial);
+
+        if (other == cand->end()) {
+            Log::warn("%-20s %-14s %-16s missing from the candidate\n", operation.c_str(), mechanism.c_str(), serial.c_str());
+            continue;
+        }
+
+        ComparisonRow rows[COMPARISON_STATISTICS];
+        bool regression = Compare(&entry->second, baseline.getDuration(), &other->second, candidate.getDuration(),
+                                  threshold, resamples, rows);
+
+        for (int i = 0; i < COMPARISON_STATISTICS; i++) {
+            Log::info("%-20s %-14s %-16s %-5s %12.1f %12.1f %+8.1f%% [%+8.1f%%, %+8.1f%%]%s\n",
+                      (i == 0) ? operation.c_str() : "", (i == 0) ? mechanism.c_str() : "", (i == 0) ? serial.c_str() : "",
+                      STATISTIC_NAMES[i], rows[i].baseline, rows[i].candidate, rows[i].delta,
+                      rows[i].lower, rows[i].upper, rows[i].regression ? " REGRESSION" : "");
+        }
+
+        if (entry->second.getCount() < COMPARISON_MIN_COUNT || other->second.getCount() < COMPARISON_MIN_COUNT) {
+            Log::info("%-20s %-14s %-16s (fewer than %d samples - not gated)\n", "", "", "", COMPARISON_MIN_COUNT);
+        }
+
+        compared++;
+        if (regression) regressions++;
+    }
+
+    for (map<string, Histogram>::iterator entry = cand->begin();
+            entry != cand->end();
+            ++entry)
+    {
+        if (base->find(entry->first) == base->end()) {
+            string operation, mechanism, serial;
+            Results::SplitKey(entry->first, &operation, &mechanism, &serial);
+            Log::warn("%-20s %-14s %-16s missing from the baseline\n", operation.c_str(), mechanism.c_str(), serial.c_str());
+        }
+    }
+
+    if (compared == 0) {
+        Log::error("The results files have nothing in common to compare.\n");
+        return EXIT_FAILURE;
+    }
+
+    Log::info("\n");
+
+    if (regressions > 0) {
+        Log::error("%d of %d comparisons show a significant regression of more than %.1f%%\n", regressions, compared, threshold);
+        return COMPARISON_EXIT_REGRESSION;
+    }
+
+    Log::info("No significant regressions in %d comparisons\n", compared);
+    return EXIT_SUCCESS;
+}
+
+bool Comparison::Compare(Histogram * baseline, double baselineDuration,
+                         Histogram * candidate, double candidateDuration,
+                         double threshold, int resamples, ComparisonRow * rows) {
+
+    // Latency statistics - a percentile bootstrap of the relative change, resampling each run independently
+    vector<double> deltas[STATISTIC_THROUGHPUT];
+    for (int i = 0; i < STATISTIC_THROUGHPUT; i++) deltas[i].reserve(resamples);
+
+    // A fixed seed, so the same pair of files always produces the same report
+    unsigned long long seed = 0x9E3779B97F4A7C15ULL;
+    Histogram baseSample, candSample;
+
+    for (int r = 0; r < resamples; r++) {
+
+        baseline->Resample(&baseSample, &seed);
+        candidate->Resample(&candSample, &seed);
+
+        for (int i = 0; i < STATISTIC_THROUGHPUT; i++) {
+            deltas[i].push_back(Delta(Statistic(&baseSample, i), Statistic(&candSample, i)));
+        }
+    }
+
+    int lowerIndex = (int)(resamples * 0.025);
+    int upperIndex = (int)(resamples * 0.975);
+    if (upperIndex >= resamples) upperIndex = resamples - 1;
+
+    bool gated = (baseline->getCount() >= COMPARISON_MIN_COUNT) && (candidate->getCount() >= COMPARISON_MIN_COUNT);
+    bool regression = false;
+
+    for (int i = 0; i < STATISTIC_THROUGHPUT; i++) {
+
+        sort(deltas[i].begin(), deltas[i].end());
+
+        rows[i].baseline = Statistic(baseline, i);
+        rows[i].candidate = Statistic(candidate, i);
+        rows[i].delta = Delta(rows[i].baseline, rows[i].candidate);
+        rows[i].lower = deltas[i][lowerIndex];
+        rows[i].upper = deltas[i][upperIndex];
+
+        // Slower by more than the threshold, with the whole interval above zero
+        rows[i].regression = gated && (rows[i].delta > threshold) && (rows[i].lower > 0);
+        if (rows[i].regression) regression = true;
+    }
+
+    // Throughput - the counts are treated as Poisson, giving a normal interval on the log of the rate ratio
+    ComparisonRow * throughput = &rows[STATISTIC_THROUGHPUT];
+    double baseCount = (double)baseline->getCount();
+    double candCount = (double)candidate->getCount();
+
+    throughput->baseline = (baselineDuration > 0) ? baseCount / baselineDuration : 0;
+    throughput->candidate = (candidateDuration > 0) ? candCount / candidateDuration : 0;
+    throughput->delta = Delta(throughput->baseline, throughput->candidate);
+    throughput->lower = throughput->upper = throughput->delta;
+    throughput->regression = false;
+
+    if (throughput->baseline > 0 && throughput->candidate > 0) {
+
+        double ratio = log(throughput->candidate / throughput->baseline);
+        double error = sqrt(1.0 / baseCount + 1.0 / candCount);
+
+        throughput->lower = (exp(ratio - Z_95 * error) - 1.0) * 100.0;
+        throughput->upper = (exp(ratio + Z_95 * error) - 1.0) * 100.0;
+
+        // Slower by more than the threshold, with the whole interval below zero
+        throughput->regression = gated && (throughput->delta < -threshold) && (throughput->upper < 0);
+        if (throughput->regression) regression = true;
+    }
+
+    return regression;
+}
+
+void Comparison::Aggregate(map<string, Histogram> * histograms) {
+
+    map<string, Histogram> aggregates;
+
+    for (map<string, Histogram>::iterator entry = histograms->begin();
+            entry != histograms->end();
+            ++entry)
+    {
+        string operation, mechanism, serial;
+        Results::SplitKey(entry->first, &operation, &mechanism, &serial);
+
+        aggregates[Results::MakeKey(operation, mechanism, COMPARISON_ALL_SERIALS)].Merge(&entry->second);
+    }
+
+    for (map<string, Histogram>::iterator entry = aggregates.begin();
+            entry != aggregates.end();
+            ++entry)
+    {
+        (*histograms)[entry->first] = entry->second;
+    }
+}
+
+double Comparison::Statistic(Histogram * histogram, int statistic) {
+
+    switch (statistic) {
+    case 0: return histogram->getMean();
+    case 1: return histogram->getPercentile(50);
+    case 2: return histogram->getPercentile(90);
+    case 3: return histogram->getPercentile(99);
+    }
+
+    return 0;
+}
+
+double Comparison::Delta(double baseline, double candidate) {
+
+    if (baseline <= 0) return 0;
+
+    return (candidate - baseline) / baseline * 100.0;
+}
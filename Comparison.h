@@ -0,0 +1,90 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+#include "stdafx.h"
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include "Histogram.h"
+#include "Results.h"
+
+using namespace std;
+
+// The exit code returned when the candidate run shows a significant regression
+#define COMPARISON_EXIT_REGRESSION  2
+
+// Histograms with fewer values than this are reported but never gate the comparison
+#define COMPARISON_MIN_COUNT        30
+
+// The serial used for the per-operation aggregate of every token
+#define COMPARISON_ALL_SERIALS      "*"
+
+// The statistics compared for each histogram
+#define COMPARISON_STATISTICS       5
+
+typedef struct {
+
+    // Values for the baseline and candidate runs
+    double baseline;
+    double candidate;
+
+    // The change from baseline to candidate, in percent
+    double delta;
+
+    // The 95% confidence interval for [delta]
+    double lower;
+    double upper;
+
+    // Whether this statistic is worse by more than the threshold, and significantly so
+    bool regression;
+
+} ComparisonRow;
+
+
+class Comparison
+{
+public:
+    // Compares a candidate results file against a baseline ([inputs] holds baseline, candidate).
+    // Returns EXIT_SUCCESS, EXIT_FAILURE on error or COMPARISON_EXIT_REGRESSION.
+    static int Run(vector<wstring> * inputs, double threshold, int resamples);
+
+    // Compares two histograms, filling [rows] (COMPARISON_STATISTICS entries) in the order
+    // mean, p50, p90, p99, throughput. Durations are in seconds. Returns true on any regression.
+    static bool Compare(Histogram * baseline, double baselineDuration,
+                        Histogram * candidate, double candidateDuration,
+                        double threshold, int resamples, ComparisonRow * rows);
+
+private:
+    // Adds a COMPARISON_ALL_SERIALS histogram for each operation and mechanism
+    static void Aggregate(map<string, Histogram> * histograms);
+
+    // Returns one of the latency statistics (0 - mean, 1 - p50, 2 - p90, 3 - p99)
+    static double Statistic(Histogram * histogram, int statistic);
+
+    // Returns the percentage change from [baseline] to [candidate] (0 if there is no baseline)
+    static double Delta(double baseline, double candidate);
+};
@@ -0,0 +1,288 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "StdAfx.h"
+#include "Coordinator.h"
+
+#include <sstream>
+
+#include "ProcessLauncher.h"
+#include "Log.h"
+
+
+Coordinator::Coordinator(void)
+{
+}
+
+
+Coordinator::~Coordinator(void)
+{
+}
+
+int Coordinator::Run(vector<wstring> * inputs, int port, int iterations, int interval, double rate, string resultsPath, bool * shutdown) {
+
+    int count = (inputs->size() == 1) ? _wtoi((*inputs)[0].c_str()) : 0;
+
+    if (count < 1) {
+        Log::error("The coordinator command needs the number of agents to wait for.\n");
+        return EXIT_FAILURE;
+    }
+
+    ULONG_PTR listener = NetLink::Listen(port);
+    if (0 == listener) return EXIT_FAILURE;
+
+    Log::info("Waiting on port %d for %d agents\n", port, count);
+
+    vector<AgentSession *> sessions;
+    int tokens = 0;
+
+    // The transactions that can be in flight at once - every worker of every token
+    int concurrency = 0;
+
+    // Poll for connections so that Ctrl-C is seen while waiting
+    while ((int)sessions.size() < count && !*shutdown) {
+
+        NetLink * link = new NetLink();
+
+        if (!link->Accept(listener, 1000)) {
+            delete link;
+            continue;
+        }
+
+        string line, command, host;
+        int protocol = 0, agentTokens = 0, agentWorkers = 0;
+
+        if (link->ReadLine(&line, COORDINATOR_HANDSHAKE_TIMEOUT)) {
+            stringstream parse(line);
+            parse >> command >> protocol >> host >> agentTokens >> agentWorkers;
+        }
+
+        if (command != "HELLO" || protocol != COORDINATOR_PROTOCOL || agentTokens < 1 || agentWorkers < 1) {
+            Log::warn("Ignoring a connection from %s that did not announce itself as a version %d agent\n",
+                      link->getPeer().c_str(), COORDINATOR_PROTOCOL);
+            delete link;
+            continue;
+        }
+
+        AgentSession * session = new AgentSession;
+        session->link = link;
+        session->host = host;
+        session->tokens = agentTokens;
+        session->workers = agentWorkers;
+        session->results = NULL;
+        session->complete = false;
+        session->iterations = 0;
+        session->reader = NULL;
+        InitializeCriticalSection(&session->lock);
+
+        sessions.push_back(session);
+        tokens += agentTokens;
+        concurrency += agentTokens * agentWorkers;
+
+        Log::info("Agent %u of %d connected from %s (%s) with %d tokens (%d workers each)\n", (unsigned)sessions.size(), count,
+                  host.c_str(), link->getPeer().c_str(), agentTokens, agentWorkers);
+    }
+
+    NetLink::CloseListener(listener);
+
+    if (*shutdown) {
+        Log::info("Cancelled before all of the agents connected\n");
+    }
+    else {
+        // Every worker gets the same period, so each agent's share of the rate follows its token and worker
+        // count. The agents pace each worker to start a transaction every period rather than waiting the
+        // interval after each one, so the rate holds whatever the transactions take (up to the period).
+        bool paced = (rate > 0);
+
+        if (paced) {
+
+            interval = (int)(1000.0 * concurrency / rate + 0.5);
+
+            Log::info("Sharing %.1f transactions per second across %d workers on %d tokens (a transaction every %d ms on each worker):\n",
+                      rate, concurrency, tokens, interval);
+
+            for (size_t i = 0; i < sessions.size(); i++) {
+                Log::info(" - %-20s %8.1f per second\n", sessions[i]->host.c_str(),
+                          rate * sessions[i]->tokens * sessions[i]->workers / concurrency);
+            }
+        }
+
+        stringstream scenario, start;
+        scenario << "SCENARIO " << iterations << " " << interval << " " << (paced ? 1 : 0);
+        start << "START " << COORDINATOR_START_DELAY;
+
+        Broadcast(&sessions, scenario.str());
+        Broadcast(&sessions, start.str());
+
+        Log::info("Running %d iterations against each of %d tokens on %d agents\n", iterations, tokens, count);
+
+        for (size_t i = 0; i < sessions.size(); i++) {
+            sessions[i]->reader = CreateThread(NULL, 0, ReaderProc, sessions[i], 0, NULL);
+            if (NULL == sessions[i]->reader) ReaderProc(sessions[i]);
+        }
+
+        // Follow the agents until all of them have finished or gone away
+        bool stopping = false;
+        DWORD reported = GetTickCount();
+
+        while (true) {
+
+            int running = 0, started = 0;
+
+            for (size_t i = 0; i < sessions.size(); i++) {
+
+                if (NULL != sessions[i]->reader && WAIT_TIMEOUT == WaitForSingleObject(sessions[i]->reader, 0)) running++;
+
+                EnterCriticalSection(&sessions[i]->lock);
+                started += sessions[i]->iterations;
+                LeaveCriticalSection(&sessions[i]->lock);
+            }
+
+            if (running == 0) break;
+
+            if (*shutdown && !stopping) {
+                Log::info("Stopping the agents\n");
+                Broadcast(&sessions, "STOP");
+                stopping = true;
+            }
+
+            if (GetTickCount() - reported >= COORDINATOR_PROGRESS_INTERVAL) {
+                Log::info("%d transactions started, %d of %d agents running\n", started, running, count);
+                reported = GetTickCount();
+            }
+
+            Sleep(1000);
+        }
+    }
+
+    // An agent that went away early still contributes the histograms it last streamed
+    Results merged;
+    int completed = 0;
+
+    for (size_t i = 0; i < sessions.size(); i++) {
+
+        AgentSession * session = sessions[i];
+
+        if (session->complete) {
+            completed++;
+        }
+        else if (!*shutdown || NULL != session->results) {
+            Log::warn("Agent %s disconnected before sending its final results%s\n", session->host.c_str(),
+                      (NULL != session->results) ? " - using its last progress" : "");
+        }
+
+        if (NULL != session->results) {
+            merged.Merge(session->results);
+            delete session->results;
+        }
+
+        if (NULL != session->reader) CloseHandle(session->reader);
+
+        DeleteCriticalSection(&session->lock);
+        delete session->link;
+        delete session;
+    }
+
+    Log::info("\n%d of %d agents completed\n", completed, count);
+
+    ProcessLauncher::Report(&merged);
+
+    if (merged.Save(resultsPath)) {
+        Log::info("Latency results written to %s\n", resultsPath.c_str());
+    }
+
+    return (completed == count) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+DWORD WINAPI Coordinator::ReaderProc(LPVOID param) {
+
+    AgentSession * session = (AgentSession *)param;
+    string line;
+
+    // Fails once the agent disconnects
+    while (session->link->ReadLine(&line, INFINITE)) {
+
+        stringstream parse(line);
+        string command;
+        size_t length = 0;
+
+        parse >> command;
+
+        if (command == "PROGRESS") {
+
+            int iterations = 0;
+            parse >> iterations >> length;
+
+            if (!ReadResults(session, length, false)) break;
+
+            EnterCriticalSection(&session->lock);
+            session->iterations = iterations;
+            LeaveCriticalSection(&session->lock);
+        }
+        else if (command == "RESULTS") {
+
+            parse >> length;
+            ReadResults(session, length, true);
+            break;
+        }
+        else {
+            Log::debug("Coordinator::ReaderProc: Ignoring '%s' from %s\n", line.c_str(), session->host.c_str());
+        }
+    }
+
+    return 0;
+}
+
+bool Coordinator::ReadResults(AgentSession * session, size_t length, bool complete) {
+
+    string data;
+    if (!session->link->ReadBlock(length, &data)) return false;
+
+    Results * results = new Results();
+    stringstream stream(data);
+
+    if (!results->Read(stream, "agent " + session->host)) {
+        delete results;
+        return false;
+    }
+
+    // Each block holds everything so far, so it replaces the last one
+    EnterCriticalSection(&session->lock);
+    Results * previous = session->results;
+    session->results = results;
+    session->complete = complete;
+    LeaveCriticalSection(&session->lock);
+
+    delete previous;
+    return true;
+}
+
+void Coordinator::Broadcast(vector<AgentSession *> * sessions, string line) {
+
+    for (size_t i = 0; i < sessions->size(); i++) {
+        if (!(*sessions)[i]->link->SendLine(line)) {
+            Log::warn("Unable to send %s to agent %s\n", line.c_str(), (*sessions)[i]->host.c_str());
+        }
+    }
+}
@@ -0,0 +1,102 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+#include "stdafx.h"
+
+#include <windows.h>
+#include <string>
+#include <vector>
+
+#include "NetLink.h"
+#include "Results.h"
+
+using namespace std;
+
+// The version of the coordinator / agent protocol, sent by the agent in its HELLO
+#define COORDINATOR_PROTOCOL            2
+
+// How long the coordinator waits for an agent to announce itself, and for the scenario once connected
+#define COORDINATOR_HANDSHAKE_TIMEOUT   30000
+
+// How far ahead of the START message the agents begin, so that they all begin together (milliseconds)
+#define COORDINATOR_START_DELAY         2000
+
+// How often an agent streams its progress and histograms to the coordinator (milliseconds)
+#define COORDINATOR_PROGRESS_INTERVAL   5000
+
+// An agent connected to the coordinator
+typedef struct {
+    NetLink * link;
+
+    // The agent's host name, number of tokens and workers per token, from its HELLO
+    string host;
+    int tokens;
+    int workers;
+
+    // The latest histograms the agent streamed, and whether they are its final results
+    Results * results;
+    bool complete;
+
+    // The number of transactions the agent has started
+    int iterations;
+
+    // The thread reading from the agent, and the lock over the fields it updates
+    HANDLE reader;
+    CRITICAL_SECTION lock;
+} AgentSession;
+
+
+// Drives a load test across several hosts. Each host runs an agent (this tool with 'agent <coordinator>')
+// which connects here; once all are connected the coordinator hands out the scenario and the share of the
+// transaction rate, starts them together, and merges the histograms they stream back.
+//
+// The protocol is text lines over TCP, so it runs as well over loopback with several agents on one host:
+//   agent -> HELLO <protocol> <host> <tokens> <workers>
+//   coord -> SCENARIO <iterations> <interval> <paced>
+//   coord -> START <delay>
+//   agent -> PROGRESS <iterations> <length>, followed by [length] bytes of results (repeated)
+//   agent -> RESULTS <length>, followed by [length] bytes of results
+//   coord -> STOP (on Ctrl-C)
+class Coordinator
+{
+public:
+    Coordinator(void);
+    ~Coordinator(void);
+
+    // Waits on [port] for the number of agents in [inputs], runs [iterations] transactions per token at
+    // [interval] ms (or sharing [rate] transactions per second, if positive) and writes the merged results
+    // to [resultsPath]. Returns a process exit code.
+    static int Run(vector<wstring> * inputs, int port, int iterations, int interval, double rate, string resultsPath, bool * shutdown);
+
+private:
+    // Reads progress and results from an agent until it disconnects
+    static DWORD WINAPI ReaderProc(LPVOID param);
+
+    // Reads a block of results announced with [length] bytes into [results]
+    static bool ReadResults(AgentSession * session, size_t length, bool complete);
+
+    // Sends [line] to every connected agent
+    static void Broadcast(vector<AgentSession *> * sessions, string line);
+};
@@ -0,0 +1,435 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "StdAfx.h"
+#include "DigestBenchmark.h"
+
+#include "PKCS11Manager.h"
+#include "Sha1.h"
+#include "Sha256.h"
+#include "Sha512.h"
+#include "Utility.h"
+#include "Log.h"
+
+// The DER DigestInfo header for a SHA-1 digest (RFC 8017)
+static const BYTE SHA1_DIGEST_INFO[] = {
+    0x30, 0x21, 0x30, 0x09, 0x06, 0x05, 0x2b, 0x0e, 0x03, 0x02, 0x1a, 0x05, 0x00, 0x04, 0x14
+};
+
+// The algorithms in the host throughput table
+#define THROUGHPUT_ALGORITHMS   6
+static const char * THROUGHPUT_NAMES[THROUGHPUT_ALGORITHMS] = { "SHA-1", "SHA-256", "SHA-384", "SHA-512", "SHA-1 x4", "SHA-256 x4" };
+
+
+DigestBenchmark::DigestBenchmark(void)
+{
+    m_Affinity = NULL;
+    m_Prepare = NULL;
+    m_Results = NULL;
+    m_Shutdown = NULL;
+    m_Iterations = 0;
+
+    InitializeCriticalSection(&m_Serialise);
+}
+
+
+DigestBenchmark::~DigestBenchmark(void)
+{
+    this->Clear();
+    DeleteCriticalSection(&m_Serialise);
+}
+
+bool DigestBenchmark::Run(vector<PKCS11Slot> * slots, map<CK_ULONG, string> * serials, vector<int> * sizes, int iterations,
+                          string pin, BatchPrepare prepare, Results * results, bool * shutdown) {
+
+    Log::debug("DigestBenchmark::Run: Called\n");
+
+    this->Clear();
+
+    m_Sizes = *sizes;
+    m_Iterations = iterations;
+    m_Prepare = prepare;
+    m_Results = results;
+    m_Shutdown = shutdown;
+
+    for (vector<PKCS11Slot>::iterator slot = slots->begin();
+            slot != slots->end();
+            ++slot)
+    {
+        DigestWorker * worker = new DigestWorker;
+        worker->benchmark = this;
+        worker->slot = new PKCS11Slot(*slot);
+        worker->serial = (*serials)[slot->id];
+        worker->pool = new SessionPool(PKCS11Manager::getFunctionList(), slot->id, 1, pin);
+        worker->thread = NULL;
+        worker->completed = 0;
+        worker->failed = 0;
+        worker->mismatched = 0;
+
+        m_Workers.push_back(worker);
+    }
+
+    if (m_Workers.empty()) {
+        Log::error("There are no tokens to compare the digests on\n");
+        return false;
+    }
+
+    if (!PKCS11Manager::isThreadSafe()) {
+        Log::warn("Digest operations will be serialised across tokens\n");
+    }
+
+    Log::info("Comparing token and host SHA-1 digests of %u payload sizes, %d payloads each, against %u tokens\n",
+              (unsigned)m_Sizes.size(), iterations, (unsigned)m_Workers.size());
+
+    for (size_t i = 0; i < m_Workers.size(); i++) {
+
+        DigestWorker * worker = m_Workers[i];
+        worker->thread = CreateThread(NULL, 0, WorkerProc, worker, CREATE_SUSPENDED, NULL);
+
+        if (NULL == worker->thread) {
+            Log::error("Unable to create a digest worker for token %s\n", worker->serial.c_str());
+            continue;
+        }
+
+        if (NULL != m_Affinity) m_Affinity->PinWorker(worker->thread, worker->serial);
+        ResumeThread(worker->thread);
+    }
+
+    bool success = true;
+
+    for (size_t i = 0; i < m_Workers.size(); i++) {
+
+        DigestWorker * worker = m_Workers[i];
+
+        if (NULL == worker->thread) {
+            success = false;
+            continue;
+        }
+
+        WaitForSingleObject(worker->thread, INFINITE);
+        worker->pool->Close();
+
+        if (worker->failed > 0 || worker->mismatched > 0) success = false;
+    }
+
+    Log::info("DIGEST COMPARISON COMPLETE\n");
+
+    return success;
+}
+
+void DigestBenchmark::SetAffinity(ThreadAffinity * affinity) {
+    m_Affinity = affinity;
+}
+
+int DigestBenchmark::WrapDigest(const BYTE * digest, BYTE * out) {
+
+    memcpy(out, SHA1_DIGEST_INFO, sizeof(SHA1_DIGEST_INFO));
+    memcpy(out + sizeof(SHA1_DIGEST_INFO), digest, SHA1_DIGEST_LENGTH);
+
+    return DIGEST_INFO_LENGTH;
+}
+
+DWORD WINAPI DigestBenchmark::WorkerProc(LPVOID param) {
+
+    DigestWorker * worker = (DigestWorker *)param;
+    worker->benchmark->Work(worker);
+
+    return 0;
+}
+
+void DigestBenchmark::Work(DigestWorker * worker) {
+
+    Log::debug("DigestBenchmark::Work: Worker for %s started\n", worker->serial.c_str());
+
+    CK_SESSION_HANDLE session;
+    CK_OBJECT_HANDLE key = 0;
+
+    if (!worker->pool->Acquire(&session, NULL)) {
+        Log::error("Unable to log into token %s, skipping it\n", worker->serial.c_str());
+        worker->failed++;
+        return;
+    }
+
+    worker->slot->AttachSession(session);
+
+    try {
+        key = m_Prepare(worker->slot);
+    }
+    catch (...) {
+        Log::error("Unable to find the signing key on token %s, skipping it\n", worker->serial.c_str());
+        worker->failed++;
+        worker->pool->Release(worker->slot->DetachSession());
+        return;
+    }
+
+    bool serialise = !PKCS11Manager::isThreadSafe();
+
+    for (size_t s = 0; s < m_Sizes.size() && !*m_Shutdown; s++) {
+
+        int size = m_Sizes[s];
+
+        // Arbitrary content - the first bytes change with each payload, so a token can't answer from a cache
+        vector<char> payload(size + sizeof(int));
+        unsigned int seed = (unsigned int)size;
+        for (int i = 0; i < size; i++) {
+            seed = seed * 1103515245 + 12345;
+            payload[i] = (char)(seed >> 16);
+        }
+
+        bool reported = false;
+
+        for (int iteration = 1; iteration <= m_Iterations && !*m_Shutdown; iteration++) {
+
+            memcpy(&payload[0], &iteration, (size < (int)sizeof(int)) ? size : sizeof(int));
+
+            BYTE tokenDigest[SHA1_DIGEST_LENGTH];
+            BYTE hostDigest[SHA1_DIGEST_LENGTH];
+
+            if (serialise) EnterCriticalSection(&m_Serialise);
+
+            // Alternate which path goes first, so neither always meets a warm token
+            bool succeeded;
+            if (iteration % 2) {
+                succeeded = this->Measure(worker, key, &payload[0], size, false, tokenDigest);
+                succeeded = this->Measure(worker, key, &payload[0], size, true, hostDigest) && succeeded;
+            } else {
+                succeeded = this->Measure(worker, key, &payload[0], size, true, hostDigest);
+                succeeded = this->Measure(worker, key, &payload[0], size, false, tokenDigest) && succeeded;
+            }
+
+            if (serialise) LeaveCriticalSection(&m_Serialise);
+
+            if (!succeeded) {
+                worker->failed++;
+                continue;
+            }
+
+            worker->completed++;
+
+            // The two paths only produce the same signature if the digests agree
+            if (0 != memcmp(tokenDigest, hostDigest, SHA1_DIGEST_LENGTH)) {
+                worker->mismatched++;
+
+                if (!reported) {
+                    Log::error("Token %s returned a SHA-1 digest of %d bytes that doesn't match the host's\n", worker->serial.c_str(), size);
+                    reported = true;
+                }
+            }
+        }
+    }
+
+    worker->pool->Release(worker->slot->DetachSession());
+
+    Log::debug("DigestBenchmark::Work: Worker for %s finished\n", worker->serial.c_str());
+}
+
+bool DigestBenchmark::Measure(DigestWorker * worker, CK_OBJECT_HANDLE key, const char * payload, int size, bool host, BYTE * digest) {
+
+    char name[32];
+
+    sprintf_s(name, sizeof(name), "DIGEST_%d", size);
+    string digestOperation(name);
+
+    sprintf_s(name, sizeof(name), "DIGEST_SIGN_%d", size);
+    string signOperation(name);
+
+    string mechanism = host ? DIGEST_HOST_MECHANISM : "CKM_SHA_1";
+    string failing = digestOperation;
+
+    BYTE info[DIGEST_INFO_LENGTH];
+    char signature[512];
+    int signatureLength = sizeof(signature);
+
+    double started = Utility::QueryMicroseconds();
+    double digested = started;
+
+    try {
+        if (host) {
+            Sha1::Hash(payload, size, digest);
+        } else {
+            int digestLength = SHA1_DIGEST_LENGTH;
+            worker->slot->GenerateDigest(payload, size, (char *)digest, &digestLength);
+        }
+
+        digested = Utility::QueryMicroseconds();
+        failing = signOperation;
+
+        int infoLength = WrapDigest(digest, info);
+        worker->slot->GenerateSignature((int)key, (const char *)info, infoLength, signature, &signatureLength);
+    }
+    catch (...) {
+        Log::debug("DigestBenchmark::Measure: %s %s failed on %s\n", failing.c_str(), mechanism.c_str(), worker->serial.c_str());
+        m_Results->RecordError(worker->serial, failing, mechanism, Utility::TakeLastError());
+        return false;
+    }
+
+    double finished = Utility::QueryMicroseconds();
+
+    m_Results->Record(worker->serial, digestOperation, mechanism, digested - started);
+    m_Results->Record(worker->serial, signOperation, mechanism, finished - started);
+
+    return true;
+}
+
+void DigestBenchmark::Report() {
+
+    if (m_Workers.empty()) return;
+
+    map<string, Histogram> * histograms = m_Results->getHistograms();
+
+    Log::info("\nDIGEST COMPARISON (SHA-1, %u tokens, %d payloads of each size):\n", (unsigned)m_Workers.size(), m_Iterations);
+    Log::info("%10s %14s %14s %14s %14s %12s %9s\n",
+              "SIZE", "TOKEN DIGEST", "HOST DIGEST", "TOKEN + SIGN", "HOST + SIGN", "SAVED", "SPEEDUP");
+
+    for (size_t s = 0; s < m_Sizes.size(); s++) {
+
+        char name[32];
+
+        sprintf_s(name, sizeof(name), "DIGEST_%d", m_Sizes[s]);
+        string digestOperation(name);
+
+        sprintf_s(name, sizeof(name), "DIGEST_SIGN_%d", m_Sizes[s]);
+        string signOperation(name);
+
+        // Every token together
+        Histogram tokenDigest, hostDigest, tokenTotal, hostTotal;
+
+        for (size_t i = 0; i < m_Workers.size(); i++) {
+
+            string serial = m_Workers[i]->serial;
+            map<string, Histogram>::iterator entry;
+
+            entry = histograms->find(Results::MakeKey(digestOperation, "CKM_SHA_1", serial));
+            if (entry != histograms->end()) tokenDigest.Merge(&entry->second);
+
+            entry = histograms->find(Results::MakeKey(digestOperation, DIGEST_HOST_MECHANISM, serial));
+            if (entry != histograms->end()) hostDigest.Merge(&entry->second);
+
+            entry = histograms->find(Results::MakeKey(signOperation, "CKM_SHA_1", serial));
+            if (entry != histograms->end()) tokenTotal.Merge(&entry->second);
+
+            entry = histograms->find(Results::MakeKey(signOperation, DIGEST_HOST_MECHANISM, serial));
+            if (entry != histograms->end()) hostTotal.Merge(&entry->second);
+        }
+
+        if (tokenTotal.getCount() == 0 || hostTotal.getCount() == 0) {
+            Log::info("%10d %14s\n", m_Sizes[s], "no results");
+            continue;
+        }
+
+        Log::info("%10d %11.3f ms %11.3f ms %11.3f ms %11.3f ms %9.3f ms %8.1fx\n",
+                  m_Sizes[s],
+                  tokenDigest.getMean() / 1000.0, hostDigest.getMean() / 1000.0,
+                  tokenTotal.getMean() / 1000.0, hostTotal.getMean() / 1000.0,
+                  (tokenTotal.getMean() - hostTotal.getMean()) / 1000.0,
+                  (hostTotal.getMean() > 0) ? tokenTotal.getMean() / hostTotal.getMean() : 0);
+    }
+
+    for (size_t i = 0; i < m_Workers.size(); i++) {
+
+        DigestWorker * worker = m_Workers[i];
+        if (worker->failed == 0 && worker->mismatched == 0) continue;
+
+        Log::warn(" - %s: %d payloads compared, %d failed, %d with mismatched digests\n",
+                  worker->serial.c_str(), worker->completed, worker->failed, worker->mismatched);
+    }
+
+    this->ReportThroughput();
+}
+
+void DigestBenchmark::ReportThroughput() {
+
+    // One buffer per lane for the multi-buffer forms
+    vector<BYTE> buffer(DIGEST_THROUGHPUT_LENGTH * SHA256_LANES);
+    for (size_t i = 0; i < buffer.size(); i++) buffer[i] = (BYTE)(i * 131 + (i >> 8));
+
+    const BYTE * lanes[SHA256_LANES];
+    BYTE digests[SHA256_LANES][SHA512_DIGEST_LENGTH];
+    BYTE * outputs[SHA256_LANES];
+
+    for (int lane = 0; lane < SHA256_LANES; lane++) {
+        lanes[lane] = &buffer[lane * DIGEST_THROUGHPUT_LENGTH];
+        outputs[lane] = digests[lane];
+    }
+
+    bool sse2 = IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE) != 0;
+
+    Log::info("\nHOST DIGEST THROUGHPUT (%d KB messages, processor features: %s):\n",
+              DIGEST_THROUGHPUT_LENGTH / 1024, Sha256::getProcessorFeatures());
+
+    for (int algorithm = 0; algorithm < THROUGHPUT_ALGORITHMS; algorithm++) {
+
+        double bytes = 0;
+        double started = Utility::QueryMicroseconds();
+
+        for (int pass = 0; pass < DIGEST_THROUGHPUT_PASSES; pass++) {
+
+            switch (algorithm) {
+            case 0:
+                Sha1::Hash(lanes[0], DIGEST_THROUGHPUT_LENGTH, digests[0]);
+                break;
+            case 1:
+                Sha256::Hash(lanes[0], DIGEST_THROUGHPUT_LENGTH, digests[0]);
+                break;
+            case 2:
+                Sha512::Hash(lanes[0], DIGEST_THROUGHPUT_LENGTH, digests[0], true);
+                break;
+            case 3:
+                Sha512::Hash(lanes[0], DIGEST_THROUGHPUT_LENGTH, digests[0]);
+                break;
+            case 4:
+                Sha1::HashMultiple(lanes, DIGEST_THROUGHPUT_LENGTH, outputs);
+                break;
+            case 5:
+                Sha256::HashMultiple(lanes, DIGEST_THROUGHPUT_LENGTH, outputs);
+                break;
+            }
+
+            bytes += (algorithm >= 4) ? DIGEST_THROUGHPUT_LENGTH * SHA256_LANES : DIGEST_THROUGHPUT_LENGTH;
+        }
+
+        double elapsed = Utility::QueryMicroseconds() - started;
+
+        const char * implementation = "portable";
+        if (algorithm == 1) implementation = Sha256::getImplementation();
+        if (algorithm >= 4) implementation = sse2 ? "SSE2, 4 lanes" : "portable, 1 lane";
+
+        // Bytes per microsecond is MB/s
+        Log::info(" - %-12s %10.1f MB/s (%s)\n", THROUGHPUT_NAMES[algorithm], (elapsed > 0) ? bytes / elapsed : 0, implementation);
+    }
+}
+
+void DigestBenchmark::Clear() {
+
+    for (size_t i = 0; i < m_Workers.size(); i++) {
+
+        if (NULL != m_Workers[i]->thread) CloseHandle(m_Workers[i]->thread);
+
+        delete m_Workers[i]->pool;
+        delete m_Workers[i]->slot;
+        delete m_Workers[i];
+    }
+
+    m_Workers.clear();
+}
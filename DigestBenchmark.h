@@ -0,0 +1,125 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+#include "stdafx.h"
+
+#include <windows.h>
+#include <string>
+#include <vector>
+#include <map>
+
+#include "PKCS11Slot.h"
+#include "SessionPool.h"
+#include "BatchJob.h"
+#include "Results.h"
+#include "ThreadAffinity.h"
+
+using namespace std;
+
+// The payload sizes compared when none are given (bytes)
+#define DIGEST_DEFAULT_SIZES        "64,1024,16384,131072"
+
+// The length of a SHA-1 DigestInfo (bytes)
+#define DIGEST_INFO_LENGTH          35
+
+// The mechanism column for digests computed on the host
+#define DIGEST_HOST_MECHANISM       "HOST_SHA_1"
+
+// The amount hashed by each algorithm for the host throughput table (bytes)
+#define DIGEST_THROUGHPUT_LENGTH    (1024 * 1024)
+#define DIGEST_THROUGHPUT_PASSES    16
+
+class DigestBenchmark;
+
+// The comparison against one token, run on its own thread
+typedef struct {
+    DigestBenchmark * benchmark;
+    PKCS11Slot * slot;
+    string serial;
+    SessionPool * pool;
+
+    HANDLE thread;
+
+    // Payloads digested and signed along both paths, payloads that failed along either, and payloads
+    // where the token's digest didn't match the host's
+    int completed;
+    int failed;
+    int mismatched;
+} DigestWorker;
+
+
+// Compares digesting on the token (C_Digest, then C_Sign over the DigestInfo) against digesting on
+// the host and sending only the DigestInfo to C_Sign, for a range of payload sizes.
+class DigestBenchmark
+{
+public:
+    DigestBenchmark(void);
+    ~DigestBenchmark(void);
+
+    // Runs [iterations] payloads of each of [sizes] bytes along both paths against every token in [slots]
+    // (identified as [serials]) on a session logged in with [pin], recording the latencies in [results].
+    // Returns true if every payload succeeded and matched.
+    bool Run(vector<PKCS11Slot> * slots, map<CK_ULONG, string> * serials, vector<int> * sizes, int iterations,
+             string pin, BatchPrepare prepare, Results * results, bool * shutdown);
+
+    // Pins the workers with [affinity] (call before Run)
+    void SetAffinity(ThreadAffinity * affinity);
+
+    // Logs the token and host digest latency for each size, and the host throughput of each algorithm
+    void Report();
+
+    // Writes the DER DigestInfo for a SHA-1 [digest] to [out] (DIGEST_INFO_LENGTH bytes), returning its length
+    static int WrapDigest(const BYTE * digest, BYTE * out);
+
+private:
+    // Thread entry point
+    static DWORD WINAPI WorkerProc(LPVOID param);
+
+    // The comparison loop for a single token
+    void Work(DigestWorker * worker);
+
+    // Digests and signs one payload along one path, recording the latencies. Returns false if it failed.
+    bool Measure(DigestWorker * worker, CK_OBJECT_HANDLE key, const char * payload, int size, bool host, BYTE * digest);
+
+    // Logs the single and multi-buffer host throughput of each algorithm
+    void ReportThroughput();
+
+    // Releases the workers and the pools
+    void Clear();
+
+private:
+    ThreadAffinity * m_Affinity;
+    BatchPrepare m_Prepare;
+    Results * m_Results;
+    bool * m_Shutdown;
+
+    // Serialises operations when the library couldn't be initialised for OS locking
+    CRITICAL_SECTION m_Serialise;
+
+    vector<int> m_Sizes;
+    int m_Iterations;
+
+    vector<DigestWorker *> m_Workers;
+};
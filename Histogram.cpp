@@ -0,0 +1,315 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "StdAfx.h"
+#include "Histogram.h"
+
+#include <math.h>
+
+
+// xorshift64* - quick, and good enough for bootstrap resampling
+static double NextRandom(unsigned long long * state) {
+
+    unsigned long long x = *state;
+    if (0 == x) x = 0x9E3779B97F4A7C15ULL;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+
+    // 53 random bits mapped into (0, 1)
+    return ((double)((x * 2685821657736338717ULL) >> 11) + 0.5) / 9007199254740992.0;
+}
+
+// Draws from a Binomial(n, p) distribution
+static unsigned long long NextBinomial(unsigned long long n, double p, unsigned long long * state) {
+
+    if (n == 0 || p <= 0) return 0;
+    if (p >= 1) return n;
+
+    // Work with the smaller tail
+    if (p > 0.5) return n - NextBinomial(n, 1 - p, state);
+
+    double mean = n * p;
+
+    if (mean < 20) {
+        // Count the successes by summing geometric waiting times
+        double logq = log(1 - p);
+        unsigned long long successes = 0;
+        double position = 0;
+
+        for (;;) {
+            position += floor(log(NextRandom(state)) / logq) + 1;
+            if (position > n) break;
+            successes++;
+        }
+
+        return successes;
+    }
+
+    // Normal approximation (Box-Muller) once the mean is large
+    double z = sqrt(-2 * log(NextRandom(state))) * cos(6.283185307179586 * NextRandom(state));
+    double value = floor(mean + z * sqrt(mean * (1 - p)) + 0.5);
+
+    if (value < 0) return 0;
+    if (value > n) return n;
+    return (unsigned long long)value;
+}
+
+
+Histogram::Histogram(void)
+{
+    this->Clear();
+}
+
+
+Histogram::~Histogram(void)
+{
+}
+
+void Histogram::Clear() {
+
+    m_Buckets.assign(HISTOGRAM_BUCKETS, 0);
+    m_Count = 0;
+    m_Total = 0;
+    m_Minimum = 0;
+    m_Maximum = 0;
+}
+
+int Histogram::BucketIndex(double microseconds) {
+
+    if (microseconds < 0) return 0;
+
+    unsigned long long value = (unsigned long long)microseconds;
+    if (value < HISTOGRAM_LINEAR_LIMIT) return (int)value;
+
+    // Position of the highest set bit
+    int exponent = 0;
+    for (unsigned long long v = value; v > 1; v >>= 1) exponent++;
+
+    int sub = (int)((value >> (exponent - HISTOGRAM_SUB_BUCKET_BITS)) & (HISTOGRAM_SUB_BUCKETS - 1));
+    int index = HISTOGRAM_LINEAR_LIMIT + (exponent - 6) * HISTOGRAM_SUB_BUCKETS + sub;
+
+    return (index < HISTOGRAM_BUCKETS) ? index : HISTOGRAM_BUCKETS - 1;
+}
+
+double Histogram::BucketValue(int index) {
+
+    if (index < HISTOGRAM_LINEAR_LIMIT) return index + 0.5;
+
+    int exponent = 6 + (index - HISTOGRAM_LINEAR_LIMIT) / HISTOGRAM_SUB_BUCKETS;
+    int sub = (index - HISTOGRAM_LINEAR_LIMIT) % HISTOGRAM_SUB_BUCKETS;
+
+    double width = ldexp(1.0, exponent - HISTOGRAM_SUB_BUCKET_BITS);
+    double lower = (HISTOGRAM_SUB_BUCKETS + sub) * width;
+
+    return lower + width / 2;
+}
+
+void Histogram::Record(double microseconds) {
+    this->Record(microseconds, 1);
+}
+
+void Histogram::Record(double microseconds, unsigned long long count) {
+
+    if (count == 0) return;
+
+    if (m_Count == 0 || microseconds < m_Minimum) m_Minimum = microseconds;
+    if (m_Count == 0 || microseconds > m_Maximum) m_Maximum = microseconds;
+
+    m_Buckets[BucketIndex(microseconds)] += count;
+    m_Count += count;
+    m_Total += microseconds * count;
+}
+
+void Histogram::Merge(Histogram * other) {
+
+    if (other->m_Count == 0) return;
+
+    if (m_Count == 0 || other->m_Minimum < m_Minimum) m_Minimum = other->m_Minimum;
+    if (m_Count == 0 || other->m_Maximum > m_Maximum) m_Maximum = other->m_Maximum;
+
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        m_Buckets[i] += other->m_Buckets[i];
+    }
+
+    m_Count += other->m_Count;
+    m_Total += other->m_Total;
+}
+
+bool Histogram::Subtract(Histogram * other) {
+
+    if (other->m_Count == 0) return true;
+
+    bool contained = (other->m_Count <= m_Count);
+    int lowest = -1, highest = -1;
+
+    m_Count = 0;
+
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+
+        if (other->m_Buckets[i] > m_Buckets[i]) {
+            contained = false;
+            m_Buckets[i] = 0;
+        } else {
+            m_Buckets[i] -= other->m_Buckets[i];
+        }
+
+        if (m_Buckets[i] == 0) continue;
+
+        if (lowest < 0) lowest = i;
+        highest = i;
+        m_Count += m_Buckets[i];
+    }
+
+    if (m_Count == 0) {
+        this->Clear();
+        return contained;
+    }
+
+    m_Total -= other->m_Total;
+    if (m_Total < 0) m_Total = 0;
+
+    // The exact extremes survive only if their buckets are still in use - otherwise
+    // the best that is known is the bucket resolution
+    if (BucketIndex(m_Minimum) != lowest) m_Minimum = BucketValue(lowest);
+    if (BucketIndex(m_Maximum) != highest) m_Maximum = BucketValue(highest);
+
+    return contained;
+}
+
+unsigned long long Histogram::getCount() {
+    return m_Count;
+}
+
+double Histogram::getMean() {
+    return (m_Count > 0) ? m_Total / m_Count : 0;
+}
+
+double Histogram::getMinimum() {
+    return m_Minimum;
+}
+
+double Histogram::getMaximum() {
+    return m_Maximum;
+}
+
+double Histogram::getPercentile(double percentile) {
+
+    if (m_Count == 0) return 0;
+    if (percentile >= 100) return m_Maximum;
+
+    unsigned long long rank = (unsigned long long)ceil(percentile / 100.0 * m_Count);
+    if (rank < 1) rank = 1;
+
+    unsigned long long seen = 0;
+
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+
+        seen += m_Buckets[i];
+
+        if (seen >= rank) {
+            double value = BucketValue(i);
+            if (value < m_Minimum) value = m_Minimum;
+            if (value > m_Maximum) value = m_Maximum;
+            return value;
+        }
+    }
+
+    return m_Maximum;
+}
+
+void Histogram::Resample(Histogram * sample, unsigned long long * seed) {
+
+    sample->Clear();
+
+    // Multinomial draw of m_Count values over the buckets, as a chain of conditional binomials
+    unsigned long long remaining = m_Count;
+    double mass = 1.0;
+
+    int last = HISTOGRAM_BUCKETS - 1;
+    while (last > 0 && m_Buckets[last] == 0) last--;
+
+    for (int i = 0; i <= last && remaining > 0; i++) {
+
+        if (m_Buckets[i] == 0) continue;
+
+        // The final bucket takes whatever is left, so rounding in [mass] can't lose values
+        double p = (double)m_Buckets[i] / m_Count;
+        unsigned long long drawn = (i == last || p >= mass) ? remaining : NextBinomial(remaining, p / mass, seed);
+
+        // Clamped the same way as getPercentile, so resampled and observed statistics agree
+        double value = BucketValue(i);
+        if (value < m_Minimum) value = m_Minimum;
+        if (value > m_Maximum) value = m_Maximum;
+
+        sample->Record(value, drawn);
+
+        remaining -= drawn;
+        mass -= p;
+    }
+}
+
+void Histogram::Write(ostream & stream) {
+
+    int used = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        if (m_Buckets[i] != 0) used++;
+    }
+
+    stream.precision(17);
+    stream << m_Count << " " << m_Total << " " << m_Minimum << " " << m_Maximum << " " << used;
+
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        if (m_Buckets[i] != 0) stream << " " << i << ":" << m_Buckets[i];
+    }
+}
+
+bool Histogram::Read(istream & stream) {
+
+    this->Clear();
+
+    int used;
+    stream >> m_Count >> m_Total >> m_Minimum >> m_Maximum >> used;
+    if (stream.fail() || used < 0) return false;
+
+    unsigned long long total = 0;
+
+    for (int i = 0; i < used; i++) {
+
+        int index;
+        char separator;
+        unsigned long long count;
+
+        stream >> index >> separator >> count;
+        if (stream.fail() || separator != ':' || index < 0 || index >= HISTOGRAM_BUCKETS) return false;
+
+        m_Buckets[index] += count;
+        total += count;
+    }
+
+    // The bucket counts must account for every value
+    return (total == m_Count);
+}
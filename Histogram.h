@@ -0,0 +1,101 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+#include "stdafx.h"
+
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+// Values below this are held exactly (one bucket per microsecond)
+#define HISTOGRAM_LINEAR_LIMIT      64
+
+// Each power of two above the linear range is split into this many buckets (~3% resolution)
+#define HISTOGRAM_SUB_BUCKETS       32
+
+// log2 of HISTOGRAM_SUB_BUCKETS
+#define HISTOGRAM_SUB_BUCKET_BITS   5
+
+// The number of buckets, covering up to 2^48 microseconds (around 9 years)
+#define HISTOGRAM_BUCKETS           (HISTOGRAM_LINEAR_LIMIT + (48 - 6) * HISTOGRAM_SUB_BUCKETS)
+
+
+// A log-linear latency histogram (in microseconds). Histograms with the same layout
+// can be merged losslessly, which is what makes them usable across runs and processes.
+class Histogram
+{
+public:
+    Histogram(void);
+    ~Histogram(void);
+
+    // Records a single latency value
+    void Record(double microseconds);
+
+    // Records [count] occurrences of a latency value
+    void Record(double microseconds, unsigned long long count);
+
+    // Adds all of the values recorded in [other] to this histogram
+    void Merge(Histogram * other);
+
+    // Removes the values recorded in [other], which should be an earlier state of this histogram.
+    // Returns false (clamping the buckets at zero) if [other] holds values this doesn't.
+    bool Subtract(Histogram * other);
+
+    // Removes all recorded values
+    void Clear();
+
+    // Returns the number of recorded values
+    unsigned long long getCount();
+
+    // Returns the mean of the recorded values (exact, not bucketed)
+    double getMean();
+
+    // Returns the smallest / largest recorded values (exact, not bucketed)
+    double getMinimum();
+    double getMaximum();
+
+    // Returns the value at the given percentile (0 - 100), to the bucket resolution
+    double getPercentile(double percentile);
+
+    // Fills [sample] with a bootstrap resample of this histogram (the same number of values,
+    // drawn with replacement). [seed] is the random state and is updated.
+    void Resample(Histogram * sample, unsigned long long * seed);
+
+    // Writes / reads the histogram as a single line of text
+    void Write(ostream & stream);
+    bool Read(istream & stream);
+
+    // Returns the bucket index for a value, and the representative value of a bucket
+    static int BucketIndex(double microseconds);
+    static double BucketValue(int index);
+
+private:
+    vector<unsigned long long> m_Buckets;
+    unsigned long long m_Count;
+    double m_Total;
+    double m_Minimum;
+    double m_Maximum;
+};
@@ -0,0 +1,207 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "StdAfx.h"
+#include "HostCrypto.h"
+
+#include <vector>
+
+#include "Log.h"
+
+// From ntstatus.h, which clashes with windows.h unless both are included with some ceremony
+#ifndef STATUS_INVALID_SIGNATURE
+#define STATUS_INVALID_SIGNATURE    ((NTSTATUS)0xC000A000L)
+#endif
+
+
+HostCrypto::HostCrypto(void)
+{
+    m_Algorithm = NULL;
+    InitializeCriticalSection(&m_Lock);
+}
+
+
+HostCrypto::~HostCrypto(void)
+{
+    for (map<string, BCRYPT_KEY_HANDLE>::iterator key = m_Keys.begin();
+            key != m_Keys.end();
+            ++key)
+    {
+        BCryptDestroyKey(key->second);
+    }
+
+    if (NULL != m_Algorithm) BCryptCloseAlgorithmProvider(m_Algorithm, 0);
+
+    DeleteCriticalSection(&m_Lock);
+}
+
+bool HostCrypto::isLoaded(string serial) {
+
+    EnterCriticalSection(&m_Lock);
+    bool loaded = m_Keys.find(serial) != m_Keys.end();
+    LeaveCriticalSection(&m_Lock);
+
+    return loaded;
+}
+
+void HostCrypto::Load(string serial, PKCS11Slot * slot, CK_OBJECT_HANDLE handle) {
+
+    Log::debug("HostCrypto::Load: Called for %s\n", serial.c_str());
+
+    // The lengths first, then the values
+    CK_ATTRIBUTE attributes[] = {
+        { CKA_MODULUS, NULL_PTR, 0 },
+        { CKA_PUBLIC_EXPONENT, NULL_PTR, 0 }
+    };
+
+    slot->QueryObject(handle, attributes, 2);
+
+    if (attributes[0].ulValueLen == 0 || attributes[0].ulValueLen == (CK_ULONG)-1 ||
+        attributes[1].ulValueLen == 0 || attributes[1].ulValueLen == (CK_ULONG)-1)
+    {
+        Log::error("HostCrypto::Load: The public key on %s is not an RSA key\n", serial.c_str());
+        throw "The public key is not an RSA key";
+    }
+
+    // The CNG public key blob is the header, then the exponent and modulus (both big-endian, as PKCS #11 holds them)
+    ULONG modulusLength = (ULONG)attributes[0].ulValueLen;
+    ULONG exponentLength = (ULONG)attributes[1].ulValueLen;
+
+    vector<BYTE> blob(sizeof(BCRYPT_RSAKEY_BLOB) + exponentLength + modulusLength);
+    BYTE * exponent = &blob[sizeof(BCRYPT_RSAKEY_BLOB)];
+    BYTE * modulus = exponent + exponentLength;
+
+    attributes[0].pValue = modulus;
+    attributes[1].pValue = exponent;
+
+    slot->QueryObject(handle, attributes, 2);
+
+    // A leading zero byte would otherwise count towards the key size
+    ULONG bits = modulusLength * 8;
+    for (ULONG i = 0; i < modulusLength && modulus[i] == 0; i++) bits -= 8;
+
+    BCRYPT_RSAKEY_BLOB * header = (BCRYPT_RSAKEY_BLOB *)&blob[0];
+    header->Magic = BCRYPT_RSAPUBLIC_MAGIC;
+    header->BitLength = bits;
+    header->cbPublicExp = exponentLength;
+    header->cbModulus = modulusLength;
+    header->cbPrime1 = 0;
+    header->cbPrime2 = 0;
+
+    EnterCriticalSection(&m_Lock);
+
+    NTSTATUS status = 0;
+
+    if (NULL == m_Algorithm) {
+        status = BCryptOpenAlgorithmProvider(&m_Algorithm, BCRYPT_RSA_ALGORITHM, NULL, 0);
+        if (!BCRYPT_SUCCESS(status)) m_Algorithm = NULL;
+    }
+
+    BCRYPT_KEY_HANDLE key = NULL;
+
+    if (BCRYPT_SUCCESS(status)) {
+        status = BCryptImportKeyPair(m_Algorithm, NULL, BCRYPT_RSAPUBLIC_BLOB, &key, &blob[0], (ULONG)blob.size(), 0);
+    }
+
+    if (BCRYPT_SUCCESS(status)) {
+
+        // Another worker on the same token may have got there first, and be using its key already
+        if (m_Keys.find(serial) != m_Keys.end()) {
+            BCryptDestroyKey(key);
+            LeaveCriticalSection(&m_Lock);
+            return;
+        }
+
+        m_Keys[serial] = key;
+    }
+
+    LeaveCriticalSection(&m_Lock);
+
+    if (!BCRYPT_SUCCESS(status)) {
+        Log::error("HostCrypto::Load: Unable to import the public key of %s (0x%08X)\n", serial.c_str(), status);
+        throw "Unable to import the public key";
+    }
+
+    Log::info("Loaded the %u bit public key of %s for host verify and encrypt\n", bits, serial.c_str());
+}
+
+BCRYPT_KEY_HANDLE HostCrypto::Find(string serial) {
+
+    EnterCriticalSection(&m_Lock);
+
+    map<string, BCRYPT_KEY_HANDLE>::iterator entry = m_Keys.find(serial);
+    BCRYPT_KEY_HANDLE key = (entry == m_Keys.end()) ? NULL : entry->second;
+
+    LeaveCriticalSection(&m_Lock);
+
+    if (NULL == key) {
+        Log::error("HostCrypto::Find: No public key has been loaded for %s\n", serial.c_str());
+        throw "No public key has been loaded";
+    }
+
+    return key;
+}
+
+void HostCrypto::EncryptData(string serial, const char * in, int inLength, char * out, int * outLength) {
+
+    Log::debug("HostCrypto::EncryptData: Called\n");
+
+    BCRYPT_KEY_HANDLE key = this->Find(serial);
+    ULONG written = 0;
+
+    NTSTATUS status = BCryptEncrypt(key, (PUCHAR)in, inLength, NULL, NULL, 0,
+                                    (PUCHAR)out, *outLength, &written, BCRYPT_PAD_PKCS1);
+
+    if (!BCRYPT_SUCCESS(status)) {
+        Log::error("HostCrypto::EncryptData: BCryptEncrypt failed (0x%08X)\n", status);
+        throw "BCryptEncrypt failed";
+    }
+
+    *outLength = (int)written;
+}
+
+bool HostCrypto::VerifySignature(string serial, const char * in, int inLength, char * signature, int signatureLength) {
+
+    Log::debug("HostCrypto::VerifySignature: Called\n");
+
+    BCRYPT_KEY_HANDLE key = this->Find(serial);
+
+    // No algorithm identifier - the data is checked as it is, without a DigestInfo around it
+    BCRYPT_PKCS1_PADDING_INFO padding;
+    padding.pszAlgId = NULL;
+
+    NTSTATUS status = BCryptVerifySignature(key, &padding, (PUCHAR)in, inLength,
+                                            (PUCHAR)signature, signatureLength, BCRYPT_PAD_PKCS1);
+
+    if (STATUS_INVALID_SIGNATURE == status) {
+        return false;
+    }
+
+    if (!BCRYPT_SUCCESS(status)) {
+        Log::error("HostCrypto::VerifySignature: BCryptVerifySignature failed (0x%08X)\n", status);
+        throw "BCryptVerifySignature failed";
+    }
+
+    return true;
+}
@@ -0,0 +1,71 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+#include "stdafx.h"
+
+#include <windows.h>
+#include <bcrypt.h>
+#include <string>
+#include <map>
+
+#include "PKCS11Slot.h"
+
+using namespace std;
+
+
+// Performs the public key operations of the load test on the host with CNG, using a copy of each
+// token's RSA public key read from the token once. The token is then only asked to do what needs
+// the private key, as it would be by a real application.
+class HostCrypto
+{
+public:
+    HostCrypto(void);
+    ~HostCrypto(void);
+
+    // Returns true if the key of token [serial] has already been loaded
+    bool isLoaded(string serial);
+
+    // Reads the RSA public key [handle] from the token in [slot] and imports it as the key of token
+    // [serial]. Throws if it can't be read or imported.
+    void Load(string serial, PKCS11Slot * slot, CK_OBJECT_HANDLE handle);
+
+    // Encrypts [in] with the key of token [serial] (PKCS #1 v1.5, as CKM_RSA_PKCS). Throws on failure.
+    void EncryptData(string serial, const char * in, int inLength, char * out, int * outLength);
+
+    // Verifies a PKCS #1 v1.5 [signature] over [in] as given (no DigestInfo, as CKM_RSA_PKCS) with the
+    // key of token [serial]. Returns false if the signature is invalid, throws on any other failure.
+    bool VerifySignature(string serial, const char * in, int inLength, char * signature, int signatureLength);
+
+private:
+    // Returns the key of token [serial], throwing if it hasn't been loaded
+    BCRYPT_KEY_HANDLE Find(string serial);
+
+private:
+    BCRYPT_ALG_HANDLE m_Algorithm;
+    CRITICAL_SECTION m_Lock;
+
+    // The imported keys, by token serial. A key handle is safe to use from several threads at once.
+    map<string, BCRYPT_KEY_HANDLE> m_Keys;
+};
@@ -0,0 +1,141 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "StdAfx.h"
+#include "IdentityCache.h"
+
+#include <fstream>
+#include <sstream>
+
+#include "Log.h"
+
+
+IdentityCache::IdentityCache(void)
+{
+    InitializeCriticalSection(&m_Lock);
+}
+
+
+IdentityCache::~IdentityCache(void)
+{
+    DeleteCriticalSection(&m_Lock);
+}
+
+void IdentityCache::Load(string path) {
+
+    Log::debug("IdentityCache::Load: Reading %s\n", path.c_str());
+
+    EnterCriticalSection(&m_Lock);
+
+    m_Path = path;
+    m_Serials.clear();
+
+    ifstream in(path.c_str());
+    if (!in.is_open()) {
+        LeaveCriticalSection(&m_Lock);
+        return;
+    }
+
+    string header;
+    int version = 0;
+    in >> header >> version;
+
+    if (header != IDENTITY_HEADER || version != IDENTITY_VERSION) {
+        Log::warn("Ignoring %s, it is not a version %d identity cache\n", path.c_str(), IDENTITY_VERSION);
+        LeaveCriticalSection(&m_Lock);
+        return;
+    }
+
+    // One token per line - the key, a tab and the serial
+    string line;
+    while (getline(in, line)) {
+
+        size_t separator = line.find_last_of('\t');
+        if (separator == string::npos) continue;
+
+        m_Serials[line.substr(0, separator)] = line.substr(separator + 1);
+    }
+
+    Log::info("Read %u token identities from %s, cached tokens will not have their serials re-read\n",
+              (unsigned)m_Serials.size(), path.c_str());
+
+    LeaveCriticalSection(&m_Lock);
+}
+
+string IdentityCache::MakeKey(string reader, PKCS11Token * token, string keyId) {
+
+    stringstream key;
+    key << reader << '\t' << token->label << '\t' << token->model << '\t' << token->serial << '\t' << keyId;
+    return key.str();
+}
+
+bool IdentityCache::Find(string key, string * serial) {
+
+    EnterCriticalSection(&m_Lock);
+
+    map<string, string>::iterator found = m_Serials.find(key);
+    bool result = (found != m_Serials.end());
+    if (result) *serial = found->second;
+
+    LeaveCriticalSection(&m_Lock);
+
+    return result;
+}
+
+void IdentityCache::Add(string key, string serial) {
+
+    EnterCriticalSection(&m_Lock);
+
+    m_Serials[key] = serial;
+    if (!m_Path.empty()) this->Save();
+
+    LeaveCriticalSection(&m_Lock);
+}
+
+void IdentityCache::Detach() {
+
+    EnterCriticalSection(&m_Lock);
+    m_Path.clear();
+    LeaveCriticalSection(&m_Lock);
+}
+
+void IdentityCache::Save() {
+
+    ofstream o(m_Path.c_str(), ios_base::trunc | ios_base::out);
+    if (!o.is_open()) {
+        Log::warn("Unable to write the identity cache %s\n", m_Path.c_str());
+        return;
+    }
+
+    o << IDENTITY_HEADER << " " << IDENTITY_VERSION << endl;
+
+    for (map<string, string>::iterator entry = m_Serials.begin();
+            entry != m_Serials.end();
+            ++entry)
+    {
+        o << entry->first << '\t' << entry->second << endl;
+    }
+
+    o.close();
+}
@@ -0,0 +1,73 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+#include "stdafx.h"
+
+#include <windows.h>
+#include <string>
+#include <map>
+
+#include "PKCS11Slot.h"
+
+using namespace std;
+
+// The first line of an identity cache file, followed by the format version
+#define IDENTITY_HEADER     "PKCS11LOADTEST-IDENTITY"
+#define IDENTITY_VERSION    1
+
+
+// Remembers the serial resolved for each token, so that a restart only needs C_GetTokenInfo
+// rather than a session, certificate search and CPLC query per token.
+class IdentityCache
+{
+public:
+    IdentityCache(void);
+    ~IdentityCache(void);
+
+    // Loads the cache from [path]. A missing file is an empty cache.
+    void Load(string path);
+
+    // Builds the cache key for a token - the reader (slot description), the token
+    // label, model and serial from C_GetTokenInfo, and the key identifier in use.
+    static string MakeKey(string reader, PKCS11Token * token, string keyId);
+
+    // Looks up a token. Returns false if it isn't cached.
+    bool Find(string key, string * serial);
+
+    // Adds (or replaces) a token and rewrites the cache file
+    void Add(string key, string serial);
+
+    // Keeps later additions in memory only, for processes that share the file with others
+    void Detach();
+
+private:
+    // Writes the cache file. Must be called with m_Lock held.
+    void Save();
+
+private:
+    CRITICAL_SECTION m_Lock;
+    string m_Path;
+    map<string, string> m_Serials;
+};
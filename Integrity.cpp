@@ -0,0 +1,192 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "StdAfx.h"
+#include "Integrity.h"
+
+#include <string.h>
+#include <intrin.h>
+#include <emmintrin.h>
+#include <nmmintrin.h>
+
+#include "Log.h"
+
+// The reflected CRC-32C (Castagnoli) polynomial, as used by the SSE4.2 CRC32 instruction
+#define CRC32C_POLYNOMIAL       0x82F63B78
+
+// -1 until the processor has been checked, then whether it has SSE4.2
+static volatile LONG _sse42 = -1;
+
+static UINT32 _table[256];
+
+
+Integrity::Integrity(void)
+{
+    InitializeCriticalSection(&m_Lock);
+}
+
+
+Integrity::~Integrity(void)
+{
+    DeleteCriticalSection(&m_Lock);
+}
+
+bool Integrity::Record(string serial, string check, bool passed) {
+
+    EnterCriticalSection(&m_Lock);
+
+    map<string, IntegrityCount> * checks = &m_Counts[serial];
+
+    if (checks->find(check) == checks->end()) {
+        IntegrityCount count = { 0, 0 };
+        (*checks)[check] = count;
+    }
+
+    IntegrityCount * count = &(*checks)[check];
+    count->checked++;
+    if (!passed) count->mismatched++;
+
+    LeaveCriticalSection(&m_Lock);
+
+    if (!passed) {
+        Log::error("INTEGRITY - %s %s mismatch\n", serial.c_str(), check.c_str());
+    }
+
+    return passed;
+}
+
+void Integrity::Report() {
+
+    EnterCriticalSection(&m_Lock);
+
+    if (m_Counts.empty()) {
+        LeaveCriticalSection(&m_Lock);
+        return;
+    }
+
+    Log::info("\nINTEGRITY CHECKS:\n");
+    Log::info("%-20s %-12s %10s %10s\n", "SERIAL", "CHECK", "CHECKED", "MISMATCHED");
+
+    for (map<string, map<string, IntegrityCount> >::iterator token = m_Counts.begin();
+            token != m_Counts.end();
+            ++token)
+    {
+        for (map<string, IntegrityCount>::iterator check = token->second.begin();
+                check != token->second.end();
+                ++check)
+        {
+            Log::info("%-20s %-12s %10d %10d%s\n", token->first.c_str(), check->first.c_str(),
+                      check->second.checked, check->second.mismatched,
+                      (check->second.mismatched > 0) ? " - CORRUPTION" : "");
+        }
+    }
+
+    LeaveCriticalSection(&m_Lock);
+}
+
+void Integrity::QueryCounts(map<string, map<string, IntegrityCount> > * counts) {
+
+    EnterCriticalSection(&m_Lock);
+    *counts = m_Counts;
+    LeaveCriticalSection(&m_Lock);
+}
+
+void Integrity::RestoreCounts(map<string, map<string, IntegrityCount> > * counts) {
+
+    EnterCriticalSection(&m_Lock);
+    m_Counts = *counts;
+    LeaveCriticalSection(&m_Lock);
+}
+
+bool Integrity::Equal(const void * first, const void * second, size_t length) {
+
+    const BYTE * a = (const BYTE *)first;
+    const BYTE * b = (const BYTE *)second;
+    size_t i = 0;
+
+    for (; i + 16 <= length; i += 16) {
+
+        __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) != 0xFFFF) return false;
+    }
+
+    for (; i < length; i++) {
+        if (a[i] != b[i]) return false;
+    }
+
+    return true;
+}
+
+UINT32 Integrity::Fingerprint(const void * data, size_t length) {
+
+    // CPUID leaf 1 ECX bit 20. Every thread arrives at the same answer, so a race here is harmless.
+    if (_sse42 < 0) {
+
+        int info[4] = { 0, 0, 0, 0 };
+        __cpuid(info, 1);
+        bool sse42 = (info[2] & (1 << 20)) != 0;
+
+        if (!sse42) {
+            for (UINT32 n = 0; n < 256; n++) {
+                UINT32 crc = n;
+                for (int k = 0; k < 8; k++) crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLYNOMIAL : crc >> 1;
+                _table[n] = crc;
+            }
+        }
+
+        InterlockedExchange(&_sse42, sse42 ? 1 : 0);
+    }
+
+    const BYTE * in = (const BYTE *)data;
+
+    if (_sse42 == 0) return FingerprintPortable(in, length);
+
+    UINT32 crc = 0xFFFFFFFF;
+    size_t i = 0;
+
+    for (; i + 4 <= length; i += 4) {
+        UINT32 word;
+        memcpy(&word, in + i, sizeof(word));
+        crc = _mm_crc32_u32(crc, word);
+    }
+
+    for (; i < length; i++) {
+        crc = _mm_crc32_u8(crc, in[i]);
+    }
+
+    return ~crc;
+}
+
+UINT32 Integrity::FingerprintPortable(const BYTE * data, size_t length) {
+
+    UINT32 crc = 0xFFFFFFFF;
+
+    for (size_t i = 0; i < length; i++) {
+        crc = _table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
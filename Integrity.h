@@ -0,0 +1,82 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+#include "stdafx.h"
+
+#include <windows.h>
+#include <string>
+#include <map>
+
+using namespace std;
+
+// The checks made on each transaction, and the operations a mismatch is recorded as
+#define INTEGRITY_DIGEST        "DIGEST"
+#define INTEGRITY_SIGNATURE     "SIGNATURE"
+#define INTEGRITY_DECRYPT       "DECRYPT"
+
+typedef struct {
+    // The number of transactions checked, and the number that failed the check
+    int checked;
+    int mismatched;
+} IntegrityCount;
+
+
+// Cross-checks the results of each transaction - the token's digest against the host's, the
+// signature against the public key and the decrypted data against the original - and counts the
+// mismatches for each token. The comparisons are cheap enough to make on every transaction.
+class Integrity
+{
+public:
+    Integrity(void);
+    ~Integrity(void);
+
+    // Counts a [check] of a transaction on token [serial], and whether it [passed]. Returns [passed].
+    bool Record(string serial, string check, bool passed);
+
+    // Logs the checks and mismatches of each token
+    void Report();
+
+    // Copies the counts of every token into [counts], by serial then check
+    void QueryCounts(map<string, map<string, IntegrityCount> > * counts);
+
+    // Restores the counts an earlier leg of a resumed run reached
+    void RestoreCounts(map<string, map<string, IntegrityCount> > * counts);
+
+    // Returns true if [length] bytes at [first] and [second] are the same (compared 16 bytes at a time)
+    static bool Equal(const void * first, const void * second, size_t length);
+
+    // Returns the CRC-32C of [length] bytes of [data], with the SSE4.2 CRC32 instruction where available
+    static UINT32 Fingerprint(const void * data, size_t length);
+
+private:
+    // The table driven CRC-32C, for processors without SSE4.2
+    static UINT32 FingerprintPortable(const BYTE * data, size_t length);
+
+private:
+    CRITICAL_SECTION m_Lock;
+
+    // By token serial, then check
+    map<string, map<string, IntegrityCount> > m_Counts;
+};
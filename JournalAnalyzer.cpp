@@ -0,0 +1,611 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "StdAfx.h"
+#include "JournalAnalyzer.h"
+
+#include <string.h>
+#include <time.h>
+
+#include "Utility.h"
+#include "Log.h"
+
+
+JournalAnalyzer::JournalAnalyzer(void)
+{
+    m_Chunks = NULL;
+    m_Next = 0;
+}
+
+
+JournalAnalyzer::~JournalAnalyzer(void)
+{
+}
+
+bool JournalAnalyzer::Run(vector<wstring> * inputs) {
+
+    Log::debug("JournalAnalyzer::Run: Called\n");
+
+    if (inputs->size() == 0) {
+        Log::error("At least one journal file must be supplied to analyze.\n");
+        return false;
+    }
+
+    double started = Utility::QueryMicroseconds();
+
+    // Expand any wildcards and split each journal into chunks
+    vector<JournalChunk> chunks;
+    unsigned long long totalBytes = 0;
+    int files = 0;
+
+    for (size_t i = 0; i < inputs->size(); i++) {
+
+        wstring pattern = (*inputs)[i];
+        wstring directory;
+        size_t separator = pattern.find_last_of(L"\\/");
+        if (separator != wstring::npos) directory = pattern.substr(0, separator + 1);
+
+        WIN32_FIND_DATA found;
+        HANDLE search = FindFirstFile(pattern.c_str(), &found);
+
+        if (INVALID_HANDLE_VALUE == search) {
+            Log::error("Unable to find journal '%S'\n", pattern.c_str());
+            return false;
+        }
+
+        do {
+            if (found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
+
+            unsigned long long size = ((unsigned long long)found.nFileSizeHigh << 32) | found.nFileSizeLow;
+            if (size == 0) continue;
+
+            files++;
+            totalBytes += size;
+
+            for (unsigned long long offset = 0; offset < size; offset += ANALYZER_CHUNK_SIZE) {
+
+                JournalChunk chunk;
+                chunk.path = directory + found.cFileName;
+                chunk.offset = offset;
+                chunk.length = (size - offset < ANALYZER_CHUNK_SIZE) ? (size - offset) : ANALYZER_CHUNK_SIZE;
+                chunk.fileSize = size;
+                chunk.summary.lines = 0;
+                chunk.summary.malformed = 0;
+                chunk.failed = false;
+
+                chunks.push_back(chunk);
+            }
+
+        } while (FindNextFile(search, &found));
+
+        FindClose(search);
+    }
+
+    if (chunks.size() == 0) {
+        Log::error("The supplied journals are empty.\n");
+        return false;
+    }
+
+    // One worker per processor, pulling chunks from a shared index
+    SYSTEM_INFO system;
+    GetSystemInfo(&system);
+
+    DWORD threadCount = system.dwNumberOfProcessors;
+    if (threadCount < 1) threadCount = 1;
+    if (threadCount > chunks.size()) threadCount = (DWORD)chunks.size();
+    if (threadCount > MAXIMUM_WAIT_OBJECTS) threadCount = MAXIMUM_WAIT_OBJECTS;
+
+    JournalAnalyzer context;
+    context.m_Chunks = &chunks;
+
+    vector<HANDLE> threads;
+    for (DWORD i = 0; i < threadCount; i++) {
+        HANDLE thread = CreateThread(NULL, 0, ThreadProc, &context, 0, NULL);
+        if (NULL != thread) threads.push_back(thread);
+    }
+
+    // If no threads could be started, do the work here
+    if (threads.size() == 0) {
+        ThreadProc(&context);
+    } else {
+        WaitForMultipleObjects((DWORD)threads.size(), &threads[0], TRUE, INFINITE);
+        for (size_t i = 0; i < threads.size(); i++) CloseHandle(threads[i]);
+    }
+
+    // Merge in journal order, so that failure ordinals and streaks line up
+    JournalSummary total;
+    total.lines = 0;
+    total.malformed = 0;
+
+    for (size_t i = 0; i < chunks.size(); i++) {
+        if (chunks[i].failed) {
+            Log::error("Unable to read '%S' at offset %llu\n", chunks[i].path.c_str(), chunks[i].offset);
+            return false;
+        }
+        Merge(&total, &chunks[i].summary);
+    }
+
+    double elapsed = (Utility::QueryMicroseconds() - started) / 1000000.0;
+
+    Log::info("JOURNAL ANALYSIS - %llu records from %d file(s), %.1f MB in %.2fs (%.1f MB/s, %u threads)\n",
+              total.lines, files, totalBytes / 1048576.0, elapsed,
+              (elapsed > 0) ? totalBytes / 1048576.0 / elapsed : 0, threadCount);
+
+    if (total.malformed > 0) {
+        Log::warn("%llu malformed lines were skipped\n", total.malformed);
+    }
+
+    Report(&total);
+    return true;
+}
+
+DWORD WINAPI JournalAnalyzer::ThreadProc(LPVOID param) {
+
+    JournalAnalyzer * context = (JournalAnalyzer *)param;
+
+    for (;;) {
+        LONG index = InterlockedIncrement(&context->m_Next) - 1;
+        if (index >= (LONG)context->m_Chunks->size()) break;
+
+        ProcessChunk(&(*context->m_Chunks)[index]);
+    }
+
+    return 0;
+}
+
+void JournalAnalyzer::ProcessChunk(JournalChunk * chunk) {
+
+    HANDLE file = CreateFile(chunk->path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                             NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+    if (INVALID_HANDLE_VALUE == file) {
+        chunk->failed = true;
+        return;
+    }
+
+    HANDLE mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (NULL == mapping) {
+        CloseHandle(file);
+        chunk->failed = true;
+        return;
+    }
+
+    SYSTEM_INFO system;
+    GetSystemInfo(&system);
+
+    // Map from the byte before the chunk (to see whether the chunk starts on a line boundary)
+    // through to the overlap, so the final line can be completed.
+    unsigned long long first = (chunk->offset > 0) ? chunk->offset - 1 : 0;
+    unsigned long long aligned = first - (first % system.dwAllocationGranularity);
+    unsigned long long last = chunk->offset + chunk->length + ANALYZER_CHUNK_OVERLAP;
+    if (last > chunk->fileSize) last = chunk->fileSize;
+
+    SIZE_T size = (SIZE_T)(last - aligned);
+    const char * base = (const char *)MapViewOfFile(mapping, FILE_MAP_READ,
+                        (DWORD)(aligned >> 32), (DWORD)(aligned & 0xFFFFFFFF), size);
+
+    if (NULL == base) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        chunk->failed = true;
+        return;
+    }
+
+    const char * begin = base + (chunk->offset - aligned);
+    const char * end = begin + chunk->length;
+    const char * limit = base + size;
+
+    // A line that straddles the start of the chunk belongs to the previous chunk
+    if (chunk->offset > 0 && begin[-1] != '\n') {
+        const char * eol = (const char *)memchr(begin, '\n', limit - begin);
+        begin = (NULL != eol) ? eol + 1 : limit;
+    }
+
+    if (begin < end) {
+        Parse(begin, end, limit, &chunk->summary);
+    }
+
+    UnmapViewOfFile(base);
+    CloseHandle(mapping);
+    CloseHandle(file);
+}
+
+bool JournalAnalyzer::ParseTimestamp(const char * text, size_t length, long long * result) {
+
+    // YYYY-MM-DD.HH:MM:SS
+    if (length != 19 || text[4] != '-' || text[7] != '-' || text[10] != '.' || text[13] != ':' || text[16] != ':') {
+        return false;
+    }
+
+    static const int positions[] = { 0, 1, 2, 3, 5, 6, 8, 9, 11, 12, 14, 15, 17, 18 };
+    for (int i = 0; i < 14; i++) {
+        if (text[positions[i]] < '0' || text[positions[i]] > '9') return false;
+    }
+
+#define DIGITS2(p) ((text[p] - '0') * 10 + (text[(p) + 1] - '0'))
+
+    int year = DIGITS2(0) * 100 + DIGITS2(2);
+    int month = DIGITS2(5);
+    int day = DIGITS2(8);
+    int hour = DIGITS2(11);
+    int minute = DIGITS2(14);
+    int second = DIGITS2(17);
+
+#undef DIGITS2
+
+    if (month < 1 || month > 12 || day < 1 || day > 31) return false;
+
+    // Days since 1970-01-01 in the proleptic Gregorian calendar
+    year -= (month <= 2) ? 1 : 0;
+    long long era = year / 400;
+    long long yearOfEra = year - era * 400;
+    long long dayOfYear = (153 * (month + ((month > 2) ? -3 : 9)) + 2) / 5 + day - 1;
+    long long dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    long long days = era * 146097 + dayOfEra - 719468;
+
+    *result = days * 86400 + hour * 3600 + minute * 60 + second;
+    return true;
+}
+
+void JournalAnalyzer::Parse(const char * begin, const char * end, const char * limit, JournalSummary * summary) {
+
+    // Journals are normally a single serial and a handful of operation names, so
+    // remember the last lookups rather than building a string for every line.
+    string serialName;
+    SerialSummary * serial = NULL;
+
+    string operationName;
+    OperationCount * operation = NULL;
+
+    // Every mode journals a unique iteration per transaction of a serial (the shared iteration count, the
+    // batch item or the signed file), but only the load test journals a LOGIN in every transaction
+    IterationWindow * window = NULL;
+    vector<TransactionStart> * starts = NULL;
+
+    const char * p = begin;
+
+    while (p < end) {
+
+        const char * eol = (const char *)memchr(p, '\n', limit - p);
+        const char * lineEnd = (NULL != eol) ? eol : limit;
+        const char * next = (NULL != eol) ? eol + 1 : limit;
+
+        // Split out TIMESTAMP,SERIAL,ITERATION,OPERATION,OUTCOME - the hex payload is never touched
+        const char * fields[5];
+        size_t lengths[5];
+        int count = 0;
+
+        const char * q = p;
+        while (count < 5) {
+            const char * comma = (const char *)memchr(q, ',', lineEnd - q);
+            const char * fieldEnd = (NULL != comma) ? comma : lineEnd;
+
+            fields[count] = q;
+            lengths[count] = fieldEnd - q;
+            count++;
+
+            if (NULL == comma) break;
+            q = comma + 1;
+        }
+
+        if (count == 5 && lengths[4] > 0 && fields[4][lengths[4] - 1] == '\r') lengths[4]--;
+
+        long long timestamp;
+        bool success = (count == 5) && (lengths[4] == 7) && (0 == memcmp(fields[4], "SUCCESS", 7));
+        bool failure = (count == 5) && (lengths[4] == 4) && (0 == memcmp(fields[4], "FAIL", 4));
+
+        if ((!success && !failure) || !ParseTimestamp(fields[0], lengths[0], &timestamp)) {
+            // Ignore blank lines, count anything else
+            if (lineEnd > p && !(lineEnd - p == 1 && *p == '\r')) summary->malformed++;
+            p = next;
+            continue;
+        }
+
+        summary->lines++;
+
+        // Serial
+        if (NULL == serial || serialName.size() != lengths[1] || 0 != memcmp(serialName.data(), fields[1], lengths[1])) {
+
+            serialName.assign(fields[1], lengths[1]);
+            map<string, SerialSummary>::iterator found = summary->serials.find(serialName);
+
+            if (found == summary->serials.end()) {
+                SerialSummary empty;
+                empty.records = 0;
+                empty.firstTimestamp = timestamp;
+                empty.lastTimestamp = timestamp;
+                found = summary->serials.insert(make_pair(serialName, empty)).first;
+            }
+
+            serial = &found->second;
+            window = &summary->windows[serialName];
+            starts = &summary->starts[serialName];
+        }
+
+        // Operation
+        if (NULL == operation || operationName.size() != lengths[3] || 0 != memcmp(operationName.data(), fields[3], lengths[3])) {
+
+            operationName.assign(fields[3], lengths[3]);
+            map<string, OperationCount>::iterator found = summary->operations.find(operationName);
+
+            if (found == summary->operations.end()) {
+                OperationCount empty = { 0, 0 };
+                found = summary->operations.insert(make_pair(operationName, empty)).first;
+            }
+
+            operation = &found->second;
+        }
+
+        if (success) {
+            operation->success++;
+        } else {
+            operation->failure++;
+
+            JournalFailure entry;
+            entry.ordinal = serial->records;
+            entry.timestamp = timestamp;
+            serial->failures.push_back(entry);
+        }
+
+        serial->records++;
+        if (timestamp < serial->firstTimestamp) serial->firstTimestamp = timestamp;
+        if (timestamp > serial->lastTimestamp) serial->lastTimestamp = timestamp;
+
+        // Throughput per hour - a transaction is counted at the first line of its iteration
+        HourlyCount * hour = &summary->hours[timestamp / 3600];
+        hour->operations++;
+
+        long long iteration = 0;
+        for (size_t i = 0; i < lengths[2] && fields[2][i] >= '0' && fields[2][i] <= '9'; i++) {
+            iteration = iteration * 10 + (fields[2][i] - '0');
+        }
+
+        if (BeginsTransaction(window, iteration)) {
+            hour->transactions++;
+
+            // Only a transaction within the window of the part before can have been counted there too
+            if (starts->size() < ANALYZER_ITERATION_WINDOW) {
+                TransactionStart start = { iteration, timestamp / 3600 };
+                starts->push_back(start);
+            }
+        }
+
+        p = next;
+    }
+}
+
+bool JournalAnalyzer::BeginsTransaction(IterationWindow * window, long long iteration) {
+
+    // The first line of the serial, or a new run that has started counting again
+    if (window->seen.empty() || iteration < window->highest - ANALYZER_ITERATION_WINDOW) {
+        window->seen.clear();
+        window->highest = iteration;
+        window->seen.insert(iteration);
+        return true;
+    }
+
+    if (!window->seen.insert(iteration).second) return false;
+
+    if (iteration > window->highest) {
+        window->highest = iteration;
+
+        // Forget the iterations that have fallen out of the window
+        window->seen.erase(window->seen.begin(), window->seen.lower_bound(iteration - ANALYZER_ITERATION_WINDOW));
+    }
+
+    return true;
+}
+
+void JournalAnalyzer::Merge(JournalSummary * target, JournalSummary * source) {
+
+    target->lines += source->lines;
+    target->malformed += source->malformed;
+
+    for (map<string, OperationCount>::iterator op = source->operations.begin();
+            op != source->operations.end();
+            ++op)
+    {
+        map<string, OperationCount>::iterator found = target->operations.find(op->first);
+        if (found == target->operations.end()) {
+            target->operations[op->first] = op->second;
+        } else {
+            found->second.success += op->second.success;
+            found->second.failure += op->second.failure;
+        }
+    }
+
+    for (map<string, SerialSummary>::iterator serial = source->serials.begin();
+            serial != source->serials.end();
+            ++serial)
+    {
+        map<string, SerialSummary>::iterator found = target->serials.find(serial->first);
+        if (found == target->serials.end()) {
+            target->serials[serial->first] = serial->second;
+            continue;
+        }
+
+        SerialSummary * summary = &found->second;
+
+        // Failure ordinals continue on from the records already seen for this serial
+        for (size_t i = 0; i < serial->second.failures.size(); i++) {
+            JournalFailure entry = serial->second.failures[i];
+            entry.ordinal += summary->records;
+            summary->failures.push_back(entry);
+        }
+
+        summary->records += serial->second.records;
+        if (serial->second.firstTimestamp < summary->firstTimestamp) summary->firstTimestamp = serial->second.firstTimestamp;
+        if (serial->second.lastTimestamp > summary->lastTimestamp) summary->lastTimestamp = serial->second.lastTimestamp;
+    }
+
+    for (map<long long, HourlyCount>::iterator hour = source->hours.begin();
+            hour != source->hours.end();
+            ++hour)
+    {
+        HourlyCount * count = &target->hours[hour->first];
+        count->operations += hour->second.operations;
+        count->transactions += hour->second.transactions;
+    }
+
+    // A transaction straddling the two parts was counted in both, so it is taken off again
+    for (map<string, vector<TransactionStart> >::iterator serial = source->starts.begin();
+            serial != source->starts.end();
+            ++serial)
+    {
+        map<string, IterationWindow>::iterator window = target->windows.find(serial->first);
+
+        if (window == target->windows.end()) {
+            target->starts[serial->first] = serial->second;
+            continue;
+        }
+
+        for (size_t i = 0; i < serial->second.size(); i++) {
+
+            TransactionStart * start = &serial->second[i];
+
+            // A new run of the serial, which the earlier part can't have seen
+            if (start->iteration < window->second.highest - ANALYZER_ITERATION_WINDOW) break;
+
+            if (window->second.seen.find(start->iteration) != window->second.seen.end()) {
+                target->hours[start->hour].transactions--;
+            }
+        }
+    }
+
+    // Carry the iterations seen on to the next part
+    for (map<string, IterationWindow>::iterator serial = source->windows.begin();
+            serial != source->windows.end();
+            ++serial)
+    {
+        map<string, IterationWindow>::iterator found = target->windows.find(serial->first);
+
+        if (found == target->windows.end() || serial->second.highest < found->second.highest - ANALYZER_ITERATION_WINDOW) {
+            target->windows[serial->first] = serial->second;
+            continue;
+        }
+
+        IterationWindow * window = &found->second;
+        window->seen.insert(serial->second.seen.begin(), serial->second.seen.end());
+        if (serial->second.highest > window->highest) window->highest = serial->second.highest;
+        window->seen.erase(window->seen.begin(), window->seen.lower_bound(window->highest - ANALYZER_ITERATION_WINDOW));
+    }
+}
+
+// Formats a duration in seconds as [d] hh:mm:ss
+static string FormatDuration(long long seconds) {
+
+    char buffer[64];
+
+    if (seconds < 0) seconds = 0;
+
+    long long days = seconds / 86400;
+    seconds %= 86400;
+
+    if (days > 0) {
+        sprintf_s(buffer, sizeof(buffer), "%lldd %02lld:%02lld:%02lld", days, seconds / 3600, (seconds / 60) % 60, seconds % 60);
+    } else {
+        sprintf_s(buffer, sizeof(buffer), "%02lld:%02lld:%02lld", seconds / 3600, (seconds / 60) % 60, seconds % 60);
+    }
+
+    return buffer;
+}
+
+void JournalAnalyzer::Report(JournalSummary * summary) {
+
+    // Failure rates per operation
+    Log::info("\n%-20s %14s %10s %12s\n", "OPERATION", "TOTAL", "FAILED", "FAILURE RATE");
+
+    for (map<string, OperationCount>::iterator op = summary->operations.begin();
+            op != summary->operations.end();
+            ++op)
+    {
+        unsigned long long total = op->second.success + op->second.failure;
+        Log::info("%-20s %14llu %10llu %11.4f%%\n", op->first.c_str(), total, op->second.failure,
+                  (total > 0) ? 100.0 * op->second.failure / total : 0);
+    }
+
+    // Reliability per card
+    Log::info("\n%-20s %12s %9s %16s %16s %14s %16s\n",
+              "SERIAL", "RECORDS", "FAILURES", "SPAN", "MTBF", "LONGEST STREAK", "STREAK DURATION");
+
+    for (map<string, SerialSummary>::iterator serial = summary->serials.begin();
+            serial != summary->serials.end();
+            ++serial)
+    {
+        SerialSummary * s = &serial->second;
+        vector<JournalFailure> * failures = &s->failures;
+        long long span = s->lastTimestamp - s->firstTimestamp;
+
+        // The longest run of successful operations between failures (or the ends of the journal)
+        unsigned long long streak;
+        long long streakDuration;
+
+        if (failures->empty()) {
+            streak = s->records;
+            streakDuration = span;
+        } else {
+            streak = (*failures)[0].ordinal;
+            streakDuration = (*failures)[0].timestamp - s->firstTimestamp;
+
+            for (size_t i = 1; i < failures->size(); i++) {
+                unsigned long long gap = (*failures)[i].ordinal - (*failures)[i - 1].ordinal - 1;
+                if (gap > streak) {
+                    streak = gap;
+                    streakDuration = (*failures)[i].timestamp - (*failures)[i - 1].timestamp;
+                }
+            }
+
+            unsigned long long tail = s->records - failures->back().ordinal - 1;
+            if (tail > streak) {
+                streak = tail;
+                streakDuration = s->lastTimestamp - failures->back().timestamp;
+            }
+        }
+
+        string mtbf = failures->empty() ? string("> ") + FormatDuration(span) : FormatDuration(span / (long long)failures->size());
+
+        Log::info("%-20s %12llu %9u %16s %16s %14llu %16s\n", serial->first.c_str(), s->records,
+                  (unsigned int)failures->size(), FormatDuration(span).c_str(), mtbf.c_str(),
+                  streak, FormatDuration(streakDuration).c_str());
+    }
+
+    // Throughput per hour
+    Log::info("\n%-20s %14s %14s\n", "HOUR", "OPERATIONS", "TRANSACTIONS");
+
+    for (map<long long, HourlyCount>::iterator hour = summary->hours.begin();
+            hour != summary->hours.end();
+            ++hour)
+    {
+        // The journal timestamps are local time, so format them back without any conversion
+        time_t when = (time_t)(hour->first * 3600);
+        struct tm tstruct;
+        char buffer[32];
+        gmtime_s(&tstruct, &when);
+        strftime(buffer, sizeof(buffer), "%Y-%m-%d.%H:00", &tstruct);
+
+        Log::info("%-20s %14llu %14llu\n", buffer, hour->second.operations, hour->second.transactions);
+    }
+
+    Log::info("\n");
+}
@@ -0,0 +1,143 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+#include "stdafx.h"
+
+#include <windows.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+
+using namespace std;
+
+// The amount of each journal parsed by a single worker
+#define ANALYZER_CHUNK_SIZE     (16 * 1024 * 1024)
+
+// The extra bytes mapped past the end of a chunk so its last line can be completed
+#define ANALYZER_CHUNK_OVERLAP  (64 * 1024)
+
+// How far behind the highest iteration of a serial a transaction's first line can appear (concurrent
+// workers journal out of order). An iteration further back than this starts a new run of the serial.
+#define ANALYZER_ITERATION_WINDOW   4096
+
+typedef struct {
+    unsigned long long success;
+    unsigned long long failure;
+} OperationCount;
+
+typedef struct {
+    // The position of the failure in the journal (operation ordinal, counting from 0)
+    unsigned long long ordinal;
+
+    // The failure timestamp (seconds since the epoch, local time)
+    long long timestamp;
+} JournalFailure;
+
+typedef struct {
+    unsigned long long records;
+    long long firstTimestamp;
+    long long lastTimestamp;
+    vector<JournalFailure> failures;
+} SerialSummary;
+
+typedef struct {
+    unsigned long long operations;
+    unsigned long long transactions;
+} HourlyCount;
+
+// The iterations of a serial already counted as transactions, within ANALYZER_ITERATION_WINDOW of the highest
+typedef struct {
+    long long highest;
+    set<long long> seen;
+} IterationWindow;
+
+// A transaction counted in a part of a journal, which may have begun in the part before
+typedef struct {
+    long long iteration;
+    long long hour;
+} TransactionStart;
+
+// The aggregates for a contiguous part of one or more journals
+typedef struct {
+    unsigned long long lines;
+    unsigned long long malformed;
+    map<string, OperationCount> operations;
+    map<string, SerialSummary> serials;
+    map<long long, HourlyCount> hours;
+
+    // The iterations of each serial at the end of the part, and the first transactions counted in it - so
+    // that a transaction straddling two parts is only counted once when they are merged
+    map<string, IterationWindow> windows;
+    map<string, vector<TransactionStart> > starts;
+} JournalSummary;
+
+// A unit of work - a range of one journal file
+typedef struct {
+    wstring path;
+    unsigned long long offset;
+    unsigned long long length;
+    unsigned long long fileSize;
+    JournalSummary summary;
+    bool failed;
+} JournalChunk;
+
+
+class JournalAnalyzer
+{
+public:
+    JournalAnalyzer(void);
+    ~JournalAnalyzer(void);
+
+    // Analyses the supplied journals (wildcards are expanded) and prints the report.
+    static bool Run(vector<wstring> * inputs);
+
+    // Parses a block of journal text. Only lines starting in [begin, end) are consumed,
+    // but the final line may run on up to [limit].
+    static void Parse(const char * begin, const char * end, const char * limit, JournalSummary * summary);
+
+    // Appends [source] to [target]; [source] must follow [target] in journal order.
+    static void Merge(JournalSummary * target, JournalSummary * source);
+
+    // Prints the report for a merged summary
+    static void Report(JournalSummary * summary);
+
+private:
+    // Worker thread entry point
+    static DWORD WINAPI ThreadProc(LPVOID param);
+
+    // Maps and parses a single chunk
+    static void ProcessChunk(JournalChunk * chunk);
+
+    // Converts a journal timestamp (YYYY-MM-DD.HH:MM:SS) to seconds since the epoch
+    static bool ParseTimestamp(const char * text, size_t length, long long * result);
+
+    // Returns true the first time [iteration] is seen in [window], i.e. on the first line of a transaction
+    static bool BeginsTransaction(IterationWindow * window, long long iteration);
+
+private:
+    vector<JournalChunk> * m_Chunks;
+    volatile LONG m_Next;
+};
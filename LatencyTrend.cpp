@@ -0,0 +1,300 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "StdAfx.h"
+#include "LatencyTrend.h"
+
+#include <fstream>
+#include <iomanip>
+#include <math.h>
+#include <string.h>
+
+#include "Statistics.h"
+#include "Log.h"
+
+
+LatencyTrend::LatencyTrend(void)
+{
+    m_WindowSize = TREND_DEFAULT_WINDOW;
+    InitializeCriticalSection(&m_Lock);
+}
+
+
+LatencyTrend::~LatencyTrend(void)
+{
+    DeleteCriticalSection(&m_Lock);
+}
+
+void LatencyTrend::SetWindowSize(int iterations) {
+
+    if (iterations < 1) {
+        Log::warn("LatencyTrend::SetWindowSize: Invalid window size %d, ignoring\n", iterations);
+        return;
+    }
+
+    m_WindowSize = iterations;
+}
+
+void LatencyTrend::Record(string serial, int iteration, string operation, double microseconds) {
+
+    if (iteration < 1) return;
+
+    int index = (iteration - 1) / m_WindowSize;
+
+    EnterCriticalSection(&m_Lock);
+
+    vector<LatencyWindow> * windows = &m_Windows[serial][operation];
+
+    // Iterations complete out of order with concurrent workers, so find the window that owns this one
+    // (searching back from the newest), and start it if there is none
+    vector<LatencyWindow>::iterator position = windows->end();
+    while (position != windows->begin() && (position - 1)->firstIteration > iteration) --position;
+
+    if (position == windows->begin() || (position - 1)->lastIteration < iteration) {
+
+        LatencyWindow window;
+        window.firstIteration = index * m_WindowSize + 1;
+        window.lastIteration = (index + 1) * m_WindowSize;
+        window.count = 0;
+        window.total = 0;
+        window.sumSquares = 0;
+        window.minimum = microseconds;
+        window.maximum = microseconds;
+
+        position = windows->insert(position, window);
+    } else {
+        --position;
+    }
+
+    LatencyWindow * window = &(*position);
+    window->count++;
+    window->total += microseconds;
+    window->sumSquares += microseconds * microseconds;
+    if (microseconds < window->minimum) window->minimum = microseconds;
+    if (microseconds > window->maximum) window->maximum = microseconds;
+
+    // Persist the report each time a token moves into a new window, so the completed
+    // windows survive an abnormal termination of a long soak run
+    map<string, int>::iterator saved = m_Saved.find(serial);
+    if (saved == m_Saved.end()) {
+        m_Saved[serial] = index;
+    }
+    else if (index > saved->second) {
+        saved->second = index;
+        this->Save(serial);
+    }
+
+    LeaveCriticalSection(&m_Lock);
+}
+
+void LatencyTrend::QueryWindows(map<string, map<string, vector<LatencyWindow> > > * windows) {
+
+    EnterCriticalSection(&m_Lock);
+    *windows = m_Windows;
+    LeaveCriticalSection(&m_Lock);
+}
+
+void LatencyTrend::RestoreWindows(map<string, map<string, vector<LatencyWindow> > > * windows) {
+
+    EnterCriticalSection(&m_Lock);
+
+    m_Windows = *windows;
+    m_Saved.clear();
+
+    // Carry on from the last window of each token, rather than rewriting its report before it has moved on
+    for (map<string, map<string, vector<LatencyWindow> > >::iterator card = m_Windows.begin();
+            card != m_Windows.end();
+            ++card)
+    {
+        for (map<string, vector<LatencyWindow> >::iterator op = card->second.begin();
+                op != card->second.end();
+                ++op)
+        {
+            if (op->second.empty()) continue;
+
+            int index = (op->second.back().lastIteration - 1) / m_WindowSize;
+            if (m_Saved.find(card->first) == m_Saved.end() || index > m_Saved[card->first]) m_Saved[card->first] = index;
+        }
+    }
+
+    LeaveCriticalSection(&m_Lock);
+}
+
+void LatencyTrend::Analyse(vector<LatencyWindow> * windows, LatencyTrendResult * result) {
+
+    memset(result, 0, sizeof(LatencyTrendResult));
+
+    vector<double> x, means;
+    vector<int> starts;
+
+    for (size_t i = 0; i < windows->size(); i++) {
+
+        LatencyWindow * window = &(*windows)[i];
+        if (window->count == 0) continue;
+
+        x.push_back((window->firstIteration + window->lastIteration) / 2.0);
+        means.push_back(window->total / window->count);
+        starts.push_back(window->firstIteration);
+    }
+
+    // Linear trend of the window means against the iteration count
+    RegressionResult regression;
+    if (Statistics::LinearRegression(&x, &means, &regression)) {
+        result->slope = regression.slope * 1000;
+        result->tStatistic = regression.tStatistic;
+        result->isSignificant = Statistics::IsSignificantGrowth(&regression);
+    }
+
+    // Change-point: pick the split that best separates the means of the two segments
+    // (the least-squares single change-point), then test the shift with Welch's t-test.
+    int k = (int)means.size();
+    if (k < 2 * TREND_MIN_SEGMENT) return;
+
+    double total = 0;
+    for (int i = 0; i < k; i++) total += means[i];
+
+    double prefix = 0;
+    double bestScore = -1;
+    int best = 0;
+
+    for (int t = 1; t < k; t++) {
+
+        prefix += means[t - 1];
+
+        if (t < TREND_MIN_SEGMENT || (k - t) < TREND_MIN_SEGMENT) continue;
+
+        double before = prefix / t;
+        double after = (total - prefix) / (k - t);
+        double score = ((double)t * (k - t) / k) * (after - before) * (after - before);
+
+        if (score > bestScore) {
+            bestScore = score;
+            best = t;
+        }
+    }
+
+    vector<double> before(means.begin(), means.begin() + best);
+    vector<double> after(means.begin() + best, means.end());
+
+    result->meanBefore = Statistics::Mean(&before);
+    result->meanAfter = Statistics::Mean(&after);
+    result->changeIteration = starts[best];
+
+    double error = sqrt(Statistics::Variance(&before) / before.size() + Statistics::Variance(&after) / after.size());
+    double shift = result->meanAfter - result->meanBefore;
+
+    if (error > 0) {
+        result->changeTStatistic = shift / error;
+    } else {
+        result->changeTStatistic = (shift != 0) ? ((shift > 0) ? HUGE_VAL : -HUGE_VAL) : 0;
+    }
+
+    result->hasChangePoint = (fabs(result->changeTStatistic) >= STATISTICS_SIGNIFICANT_T);
+}
+
+void LatencyTrend::Save(string serial) {
+
+    string path = serial + ".trend";
+    ofstream o(path.c_str(), ios_base::trunc | ios_base::out);
+
+    o << fixed << setprecision(1);
+    o << "# Latency trend for " << serial << " in windows of " << m_WindowSize << " iterations (microseconds)" << endl;
+    o << "# WINDOW,OPERATION,FIRST_ITERATION,LAST_ITERATION,COUNT,MEAN,MIN,MAX,STDDEV" << endl;
+    o << "# TREND,OPERATION,SLOPE_PER_1000,T,SIGNIFICANT,CHANGE_ITERATION,MEAN_BEFORE,MEAN_AFTER,CHANGE_T,CHANGE_SIGNIFICANT" << endl;
+
+    map<string, vector<LatencyWindow> > * operations = &m_Windows[serial];
+
+    for (map<string, vector<LatencyWindow> >::iterator op = operations->begin();
+            op != operations->end();
+            ++op)
+    {
+        for (size_t i = 0; i < op->second.size(); i++) {
+
+            LatencyWindow * window = &op->second[i];
+            double mean = window->total / window->count;
+            double variance = (window->count > 1) ?
+                              (window->sumSquares - window->count * mean * mean) / (window->count - 1) : 0;
+            if (variance < 0) variance = 0;
+
+            o << "WINDOW," << op->first << "," << window->firstIteration << "," << window->lastIteration << ","
+              << window->count << "," << mean << "," << window->minimum << "," << window->maximum << ","
+              << sqrt(variance) << endl;
+        }
+
+        LatencyTrendResult result;
+        Analyse(&op->second, &result);
+
+        o << "TREND," << op->first << "," << result.slope << "," << result.tStatistic << ","
+          << (result.isSignificant ? "YES" : "NO") << ",";
+
+        if (result.changeIteration > 0) {
+            o << result.changeIteration << "," << result.meanBefore << "," << result.meanAfter << ","
+              << result.changeTStatistic << "," << (result.hasChangePoint ? "YES" : "NO") << endl;
+        } else {
+            o << ",,,," << endl;
+        }
+    }
+
+    o.close();
+}
+
+void LatencyTrend::Report() {
+
+    EnterCriticalSection(&m_Lock);
+
+    for (map<string, map<string, vector<LatencyWindow> > >::iterator card = m_Windows.begin();
+            card != m_Windows.end();
+            ++card)
+    {
+        this->Save(card->first);
+
+        Log::info("LATENCY TREND FOR %s (see %s.trend):\n", card->first.c_str(), card->first.c_str());
+
+        for (map<string, vector<LatencyWindow> >::iterator op = card->second.begin();
+                op != card->second.end();
+                ++op)
+        {
+            LatencyTrendResult result;
+            Analyse(&op->second, &result);
+
+            int count = 0;
+            double total = 0;
+            for (size_t i = 0; i < op->second.size(); i++) {
+                count += op->second[i].count;
+                total += op->second[i].total;
+            }
+
+            Log::info(" - %-16s mean %10.1fus, trend %+8.1fus per 1000 iterations%s\n",
+                      op->first.c_str(), (count > 0) ? total / count : 0, result.slope,
+                      result.isSignificant ? " - DEGRADING" : "");
+
+            if (result.hasChangePoint) {
+                Log::info("   %-16s change at iteration %d: %.1fus -> %.1fus\n",
+                          "", result.changeIteration, result.meanBefore, result.meanAfter);
+            }
+        }
+    }
+
+    LeaveCriticalSection(&m_Lock);
+}
@@ -0,0 +1,110 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+#include "stdafx.h"
+
+#include <windows.h>
+#include <string>
+#include <vector>
+#include <map>
+
+using namespace std;
+
+// The default number of iterations aggregated into each latency window
+#define TREND_DEFAULT_WINDOW    100
+
+// The minimum number of windows either side of a change-point before it is considered
+#define TREND_MIN_SEGMENT       3
+
+typedef struct {
+
+    // The range of iterations covered by this window
+    int firstIteration;
+    int lastIteration;
+
+    // Latency aggregates (microseconds)
+    int count;
+    double total;
+    double sumSquares;
+    double minimum;
+    double maximum;
+
+} LatencyWindow;
+
+typedef struct {
+
+    // Least-squares trend of the window means, in microseconds per 1000 iterations
+    double slope;
+    double tStatistic;
+    bool isSignificant;
+
+    // The most likely single shift in the window means
+    bool hasChangePoint;
+    int changeIteration;
+    double meanBefore;
+    double meanAfter;
+    double changeTStatistic;
+
+} LatencyTrendResult;
+
+
+class LatencyTrend
+{
+public:
+    LatencyTrend(void);
+    ~LatencyTrend(void);
+
+    // Sets the number of iterations aggregated into each window
+    void SetWindowSize(int iterations);
+
+    // Records a single successful operation latency for a token.
+    void Record(string serial, int iteration, string operation, double microseconds);
+
+    // Writes the <serial>.trend report for every token and logs a per-card summary.
+    void Report();
+
+    // Copies the windows of every token into [windows], by serial then operation
+    void QueryWindows(map<string, map<string, vector<LatencyWindow> > > * windows);
+
+    // Restores the windows an earlier leg of a resumed run reached, so the .trend reports cover the whole run
+    void RestoreWindows(map<string, map<string, vector<LatencyWindow> > > * windows);
+
+    // Fits the trend and change-point for a series of windows.
+    static void Analyse(vector<LatencyWindow> * windows, LatencyTrendResult * result);
+
+private:
+    // Writes the <serial>.trend report for a single token. The lock must be held.
+    void Save(string serial);
+
+private:
+    int m_WindowSize;
+    CRITICAL_SECTION m_Lock;
+
+    // Windows, indexed by serial then operation
+    map<string, map<string, vector<LatencyWindow> > > m_Windows;
+
+    // The last window index persisted to disk for each serial
+    map<string, int> m_Saved;
+};
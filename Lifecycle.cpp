@@ -0,0 +1,289 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "StdAfx.h"
+#include "Lifecycle.h"
+
+#include "PKCS11Slot.h"
+#include "Statistics.h"
+#include "Utility.h"
+#include "Log.h"
+
+// The steps of a cycle, in the order they are made
+static const char * STEP_NAMES[LIFECYCLE_STEP_COUNT] = {
+    "LOAD_LIBRARY", "GET_FUNCTION_LIST", "INITIALIZE", "GET_SLOT_LIST", "OPEN_SESSION",
+    "LOGIN", "LOGOUT", "CLOSE_SESSION", "FINALIZE", "UNLOAD"
+};
+
+// The steps up to the first login, which make up the cold start of an application
+#define LIFECYCLE_COLD_STEPS    6
+
+// The process measures tracked across the cycles
+static const char * MEASURE_NAMES[PROCESS_MEASURE_COUNT] = { "Working Set", "Private Bytes", "Handles", "Threads" };
+static const char * MEASURE_UNITS[PROCESS_MEASURE_COUNT] = { "KB", "KB", "handles", "threads" };
+static const double MEASURE_SCALE[PROCESS_MEASURE_COUNT] = { 1024.0, 1024.0, 1.0, 1.0 };
+
+
+Lifecycle::Lifecycle(void)
+{
+}
+
+
+Lifecycle::~Lifecycle(void)
+{
+}
+
+int Lifecycle::Run(wstring library, string pin, int cycles, int interval, string resultsPath, bool * shutdown) {
+
+    Log::debug("Lifecycle::Run: Called\n");
+
+    Log::info("Loading and unloading %S %d times, %d milliseconds apart\n", library.c_str(), cycles, interval);
+
+    Results results;
+    vector<ProcessSample> samples;
+    bool login = true;
+    int completed = 0;
+
+    // A baseline before the library has ever been loaded
+    ProcessSample sample;
+    ProcessSampler::QuerySample(&sample);
+    sample.iteration = 0;
+    samples.push_back(sample);
+
+    results.Start();
+
+    for (int cycle = 1; cycle <= cycles && !*shutdown; cycle++) {
+
+        if (!Cycle(library, pin, &login, &results)) break;
+        completed++;
+
+        // Taken with the library unloaded, so anything still held is what Finalize and FreeLibrary left behind
+        ProcessSampler::QuerySample(&sample);
+        sample.iteration = cycle;
+        samples.push_back(sample);
+
+        Log::debug("Lifecycle::Run: Cycle %d, WS %.0f, Private %.0f, Handles %.0f, Threads %.0f\n",
+                   cycle, sample.workingSet, sample.privateBytes, sample.handleCount, sample.threadCount);
+
+        if (cycle < cycles && interval > 0) Sleep(interval);
+    }
+
+    results.Stop();
+
+    if (completed == 0) {
+        Log::error("The library could not be loaded, aborting ...\n");
+        return EXIT_FAILURE;
+    }
+
+    Report(&results, &samples);
+
+    // Replace any earlier lifecycle results and failure counts in the file, keeping the load test results
+    // (and their period) beside them
+    Results combined;
+
+    if (GetFileAttributesA(resultsPath.c_str()) != INVALID_FILE_ATTRIBUTES) {
+        if (!combined.Load(resultsPath)) return EXIT_FAILURE;
+    }
+
+    combined.Replace(LIFECYCLE_MECHANISM, &results);
+
+    if (!combined.Save(resultsPath)) return EXIT_FAILURE;
+    Log::info("\nLifecycle results written to %s\n", resultsPath.c_str());
+
+    return EXIT_SUCCESS;
+}
+
+bool Lifecycle::Cycle(wstring library, string pin, bool * login, Results * results) {
+
+    PKCS11LoadTimes times;
+    PKCS11Manager * manager = NULL;
+
+    try {
+        manager = PKCS11Manager::Create(library.c_str(), &times);
+    }
+    catch (...) {
+        Log::error("Unable to load and initialise %S\n", library.c_str());
+        return false;
+    }
+
+    results->Record(LIFECYCLE_SERIAL, "LOAD_LIBRARY", LIFECYCLE_MECHANISM, times.load);
+    results->Record(LIFECYCLE_SERIAL, "GET_FUNCTION_LIST", LIFECYCLE_MECHANISM, times.functionList);
+    results->Record(LIFECYCLE_SERIAL, "INITIALIZE", LIFECYCLE_MECHANISM, times.initialize);
+
+    CK_FUNCTION_LIST * functions = PKCS11Manager::getFunctionList();
+
+    // The slot list as an application first fetches it - the count, then the IDs
+    CK_ULONG count = 0;
+    vector<CK_SLOT_ID> ids;
+
+    double started = Utility::QueryMicroseconds();
+    CK_RV result = functions->C_GetSlotList(CK_TRUE, NULL_PTR, &count);
+
+    if (CKR_OK == result && count > 0) {
+        ids.resize(count);
+        result = functions->C_GetSlotList(CK_TRUE, &ids[0], &count);
+    }
+
+    double elapsed = Utility::QueryMicroseconds() - started;
+
+    if (CKR_OK == result) {
+        results->Record(LIFECYCLE_SERIAL, "GET_SLOT_LIST", LIFECYCLE_MECHANISM, elapsed);
+    } else {
+        results->RecordError(LIFECYCLE_SERIAL, "GET_SLOT_LIST", LIFECYCLE_MECHANISM, result);
+    }
+
+    // The first session and login on the first token found
+    if (CKR_OK == result && count > 0) {
+
+        PKCS11Slot slot(functions);
+        slot.id = ids[0];
+        slot.isTokenPresent = true;
+
+        try {
+            started = Utility::QueryMicroseconds();
+            slot.OpenSession(false);
+            results->Record(LIFECYCLE_SERIAL, "OPEN_SESSION", LIFECYCLE_MECHANISM, Utility::QueryMicroseconds() - started);
+        }
+        catch (...) {
+            results->RecordError(LIFECYCLE_SERIAL, "OPEN_SESSION", LIFECYCLE_MECHANISM, Utility::TakeLastError());
+        }
+
+        bool loggedIn = false;
+
+        if (slot.isSessionOpen() && *login) {
+            try {
+                started = Utility::QueryMicroseconds();
+                slot.Login(&pin);
+                results->Record(LIFECYCLE_SERIAL, "LOGIN", LIFECYCLE_MECHANISM, Utility::QueryMicroseconds() - started);
+                loggedIn = true;
+            }
+            catch (...) {
+                CK_RV code = Utility::TakeLastError();
+                results->RecordError(LIFECYCLE_SERIAL, "LOGIN", LIFECYCLE_MECHANISM, code);
+
+                *login = false;
+                Log::warn("The login failed (%s), the remaining cycles will not log in\n", Utility::ErrorToString(code));
+            }
+        }
+
+        if (loggedIn) {
+            try {
+                started = Utility::QueryMicroseconds();
+                slot.Logout();
+                results->Record(LIFECYCLE_SERIAL, "LOGOUT", LIFECYCLE_MECHANISM, Utility::QueryMicroseconds() - started);
+            }
+            catch (...) {
+                results->RecordError(LIFECYCLE_SERIAL, "LOGOUT", LIFECYCLE_MECHANISM, Utility::TakeLastError());
+            }
+        }
+
+        if (slot.isSessionOpen()) {
+            try {
+                started = Utility::QueryMicroseconds();
+                slot.CloseSession();
+                results->Record(LIFECYCLE_SERIAL, "CLOSE_SESSION", LIFECYCLE_MECHANISM, Utility::QueryMicroseconds() - started);
+            }
+            catch (...) {
+                results->RecordError(LIFECYCLE_SERIAL, "CLOSE_SESSION", LIFECYCLE_MECHANISM, Utility::TakeLastError());
+            }
+        }
+    }
+    else if (CKR_OK == result) {
+        Log::debug("Lifecycle::Cycle: No tokens are present, only the library is measured\n");
+    }
+
+    PKCS11Manager::Destroy(&times);
+    delete manager;
+
+    results->Record(LIFECYCLE_SERIAL, "FINALIZE", LIFECYCLE_MECHANISM, times.finalize);
+    results->Record(LIFECYCLE_SERIAL, "UNLOAD", LIFECYCLE_MECHANISM, times.unload);
+
+    return true;
+}
+
+void Lifecycle::Report(Results * results, vector<ProcessSample> * samples) {
+
+    map<string, Histogram> * histograms = results->getHistograms();
+    map<string, ErrorCounts> * errors = results->getErrors();
+
+    Log::info("\nLIBRARY LIFECYCLE (%u cycles):\n", (unsigned)samples->size() - 1);
+    Log::info("%-20s %8s %12s %12s %12s %12s %8s\n", "STEP", "COUNT", "MEAN", "P50", "P99", "MAX", "FAILED");
+
+    double cold = 0;
+
+    for (int i = 0; i < LIFECYCLE_STEP_COUNT; i++) {
+
+        string key = Results::MakeKey(STEP_NAMES[i], LIFECYCLE_MECHANISM, LIFECYCLE_SERIAL);
+
+        unsigned long long failed = 0;
+        if (errors->find(key) != errors->end()) {
+            ErrorCounts * counts = &(*errors)[key];
+            for (ErrorCounts::iterator code = counts->begin(); code != counts->end(); ++code) failed += code->second;
+        }
+
+        if (histograms->find(key) == histograms->end()) {
+            Log::info("%-20s %8s %12s %12s %12s %12s %8llu\n", STEP_NAMES[i], "-", "-", "-", "-", "-", failed);
+            continue;
+        }
+
+        Histogram * histogram = &(*histograms)[key];
+
+        Log::info("%-20s %8llu %9.2f ms %9.2f ms %9.2f ms %9.2f ms %8llu\n", STEP_NAMES[i], histogram->getCount(),
+                  histogram->getMean() / 1000.0, histogram->getPercentile(50) / 1000.0,
+                  histogram->getPercentile(99) / 1000.0, histogram->getMaximum() / 1000.0, failed);
+
+        if (i < LIFECYCLE_COLD_STEPS) cold += histogram->getMean();
+    }
+
+    // What an application waits for before it can first use the token
+    Log::info("%-20s %8s %9.2f ms\n", "(cold start)", "", cold / 1000.0);
+
+    // The first cycle is left out of the trend - it pulls in the dependencies that stay loaded with the process
+    vector<double> x;
+    vector<double> y[PROCESS_MEASURE_COUNT];
+
+    for (size_t i = 2; i < samples->size(); i++) {
+        x.push_back((double)(*samples)[i].iteration);
+        y[0].push_back((*samples)[i].workingSet);
+        y[1].push_back((*samples)[i].privateBytes);
+        y[2].push_back((*samples)[i].handleCount);
+        y[3].push_back((*samples)[i].threadCount);
+    }
+
+    Log::info("\nPROCESS GROWTH PER CYCLE (after the first):\n");
+
+    for (int i = 0; i < PROCESS_MEASURE_COUNT; i++) {
+
+        RegressionResult regression;
+
+        if (!Statistics::LinearRegression(&x, &y[i], &regression)) {
+            Log::info(" - %-14s insufficient cycles\n", MEASURE_NAMES[i]);
+            continue;
+        }
+
+        Log::info(" - %-14s %+10.2f %s per cycle (t = %.1f)%s\n",
+                  MEASURE_NAMES[i], regression.slope / MEASURE_SCALE[i], MEASURE_UNITS[i], regression.tStatistic,
+                  Statistics::IsSignificantGrowth(&regression) ? " - POSSIBLE LEAK IN FINALIZE" : "");
+    }
+}
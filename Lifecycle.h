@@ -0,0 +1,68 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+#include "stdafx.h"
+
+#include <windows.h>
+#include <string>
+#include <vector>
+
+#include "PKCS11Manager.h"
+#include "ProcessSampler.h"
+#include "Results.h"
+
+using namespace std;
+
+// The mechanism and serial columns the lifecycle steps are recorded under in the results file
+// (the serial is fixed, so that the results of two library versions can be compared)
+#define LIFECYCLE_MECHANISM     "LIFECYCLE"
+#define LIFECYCLE_SERIAL        "LIBRARY"
+
+// The number of steps timed in each cycle
+#define LIFECYCLE_STEP_COUNT    10
+
+
+// Measures the cold path of an application starting against the library: each cycle loads the
+// module, initialises it, lists the slots, opens the first session and logs in, then logs out,
+// finalizes and unloads it again. The process memory and handles are sampled after each cycle, so
+// that anything C_Finalize or FreeLibrary leaves behind shows up as growth.
+class Lifecycle
+{
+public:
+    Lifecycle(void);
+    ~Lifecycle(void);
+
+    // Runs [cycles] load / unload cycles of [library], [interval] milliseconds apart, logging in with [pin],
+    // and adds the step histograms to the results file. Returns a process exit code.
+    static int Run(wstring library, string pin, int cycles, int interval, string resultsPath, bool * shutdown);
+
+private:
+    // Runs a single cycle, recording each step into [results]. [login] is cleared if the login fails,
+    // so that a wrong PIN isn't retried into locking the token. Returns false if the library can't be loaded.
+    static bool Cycle(wstring library, string pin, bool * login, Results * results);
+
+    // Prints the latency of each step, and the growth in process memory and handles per cycle
+    static void Report(Results * results, vector<ProcessSample> * samples);
+};
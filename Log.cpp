@@ -31,6 +31,20 @@ THE SOFTWARE.
 // Static member definitions
 int Log::m_LogLevel = LOG_DEFAULT_LEVEL;
 
+void Log::Write(const char * prefix, const char * format, va_list args)
+{
+    // Format the whole message first and emit it with a single call, so that
+    // messages from the slot worker threads don't interleave part way through a line
+    char buffer[LOG_MAX_MESSAGE];
+    _vsnprintf_s(buffer, sizeof(buffer), _TRUNCATE, format, args);
+
+#ifdef LOG_FORCE_LF
+    printf("%s%s\n", prefix, buffer);
+#else
+    printf("%s%s", prefix, buffer);
+#endif
+}
+
 void Log::debug(const char * format, ...)
 {
     if (m_LogLevel < LOG_DEBUG) return;
@@ -38,12 +52,7 @@ void Log::debug(const char * format, ...)
     va_list args;
     va_start(args, format);
 
-    printf("DEBUG - ");
-    vprintf(format, args);
-
-#ifdef LOG_FORCE_LF
-    printf("\n");
-#endif
+    Write("DEBUG - ", format, args);
 
     va_end(args);
 }
@@ -55,11 +64,7 @@ void Log::warn(const char * format, ...)
     va_list args;
     va_start(args, format);
 
-    printf("WARN - ");
-    vprintf(format, args);
-#ifdef LOG_FORCE_LF
-    printf("\n");
-#endif
+    Write("WARN - ", format, args);
 
     va_end(args);
 }
@@ -71,11 +76,7 @@ void Log::error(const char * format, ...)
     va_list args;
     va_start(args, format);
 
-    printf("ERR - ");
-    vprintf(format, args);
-#ifdef LOG_FORCE_LF
-    printf("\n");
-#endif
+    Write("ERR - ", format, args);
 
     va_end(args);
 }
@@ -87,10 +88,7 @@ void Log::info(const char * format, ...)
     va_list args;
     va_start(args, format);
 
-    vprintf(format, args);
-#ifdef LOG_FORCE_LF
-    printf("\n");
-#endif
+    Write("", format, args);
 
     va_end(args);
 }
@@ -102,11 +100,7 @@ void Log::notice(const char * format, ...)
     va_list args;
     va_start(args, format);
 
-    printf("NOTICE - ");
-    vprintf(format, args);
-#ifdef LOG_FORCE_LF
-    printf("\n");
-#endif
+    Write("NOTICE - ", format, args);
 
     va_end(args);
 }
@@ -32,9 +32,13 @@ THE SOFTWARE.
 #include <fcntl.h>
 #include <errno.h>
 #include <string.h>
+#include <stdarg.h>
 
 #define LOG_DEFAULT_LEVEL   LOG_INFO
 
+// The longest message that will be written (longer messages are truncated)
+#define LOG_MAX_MESSAGE     4096
+
 #define	LOG_EMERG	0	/* system is unusable */
 #define	LOG_ALERT	1	/* action must be taken immediately */
 #define	LOG_CRIT	2	/* critical conditions */
@@ -57,6 +61,9 @@ public:
     static void setLevel(int level);
     static int getLevel();
 
+private:
+    static void Write(const char * prefix, const char * format, va_list args);
+
 private:
     static int m_LogLevel;
 };
@@ -0,0 +1,296 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "StdAfx.h"
+
+// Winsock 2 must come before anything that includes windows.h
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#include "NetLink.h"
+
+#include <stdlib.h>
+
+#include "Log.h"
+
+static bool m_Initialised = false;
+
+
+NetLink::NetLink(void)
+{
+    m_Socket = INVALID_SOCKET;
+}
+
+
+NetLink::~NetLink(void)
+{
+    this->Close();
+}
+
+bool NetLink::Initialise() {
+
+    if (m_Initialised) return true;
+
+    WSADATA data;
+    int result = WSAStartup(MAKEWORD(2, 2), &data);
+
+    if (0 != result) {
+        Log::error("Unable to load Winsock (%d)\n", result);
+        return false;
+    }
+
+    m_Initialised = true;
+    return true;
+}
+
+bool NetLink::Connect(string address, int port) {
+
+    if (!Initialise()) return false;
+
+    string host = address;
+    size_t colon = address.rfind(':');
+
+    if (colon != string::npos) {
+        host = address.substr(0, colon);
+        port = atoi(address.substr(colon + 1).c_str());
+    }
+
+    char service[16];
+    sprintf_s(service, sizeof(service), "%d", port);
+
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+
+    addrinfo * addresses = NULL;
+    if (0 != getaddrinfo(host.c_str(), service, &hints, &addresses)) {
+        Log::error("Unable to resolve %s (%d)\n", host.c_str(), WSAGetLastError());
+        return false;
+    }
+
+    SOCKET s = INVALID_SOCKET;
+
+    for (addrinfo * candidate = addresses; candidate != NULL; candidate = candidate->ai_next) {
+
+        s = socket(candidate->ai_family, candidate->ai_socktype, candidate->ai_protocol);
+        if (INVALID_SOCKET == s) continue;
+
+        if (0 == connect(s, candidate->ai_addr, (int)candidate->ai_addrlen)) break;
+
+        closesocket(s);
+        s = INVALID_SOCKET;
+    }
+
+    freeaddrinfo(addresses);
+
+    if (INVALID_SOCKET == s) {
+        Log::error("Unable to connect to %s:%d (%d)\n", host.c_str(), port, WSAGetLastError());
+        return false;
+    }
+
+    // The protocol is a handful of short lines, so don't hold them back
+    BOOL noDelay = TRUE;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char *)&noDelay, sizeof(noDelay));
+
+    m_Socket = s;
+    m_Peer = host + ":" + service;
+    m_Buffer.clear();
+
+    return true;
+}
+
+ULONG_PTR NetLink::Listen(int port) {
+
+    if (!Initialise()) return 0;
+
+    SOCKET s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (INVALID_SOCKET == s) {
+        Log::error("Unable to create the listening socket (%d)\n", WSAGetLastError());
+        return 0;
+    }
+
+    sockaddr_in local;
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = htons((unsigned short)port);
+
+    if (SOCKET_ERROR == bind(s, (sockaddr *)&local, sizeof(local)) || SOCKET_ERROR == listen(s, SOMAXCONN)) {
+        Log::error("Unable to listen on port %d (%d)\n", port, WSAGetLastError());
+        closesocket(s);
+        return 0;
+    }
+
+    return (ULONG_PTR)s;
+}
+
+void NetLink::CloseListener(ULONG_PTR listener) {
+    if (0 != listener) closesocket((SOCKET)listener);
+}
+
+bool NetLink::Accept(ULONG_PTR listener, DWORD timeout) {
+
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET((SOCKET)listener, &readable);
+
+    timeval wait = { (long)(timeout / 1000), (long)((timeout % 1000) * 1000) };
+    if (select(0, &readable, NULL, NULL, &wait) <= 0) return false;
+
+    sockaddr_in remote;
+    int length = sizeof(remote);
+
+    SOCKET s = accept((SOCKET)listener, (sockaddr *)&remote, &length);
+    if (INVALID_SOCKET == s) return false;
+
+    BOOL noDelay = TRUE;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char *)&noDelay, sizeof(noDelay));
+
+    char port[16];
+    sprintf_s(port, sizeof(port), "%u", ntohs(remote.sin_port));
+
+    m_Socket = s;
+    m_Peer = string(inet_ntoa(remote.sin_addr)) + ":" + port;
+    m_Buffer.clear();
+
+    return true;
+}
+
+bool NetLink::SendLine(string line) {
+
+    line += "\n";
+    return this->SendBlock(&line);
+}
+
+bool NetLink::SendBlock(string * data) {
+
+    if (INVALID_SOCKET == m_Socket) return false;
+
+    size_t offset = 0;
+
+    while (offset < data->size()) {
+
+        int sent = send((SOCKET)m_Socket, data->c_str() + offset, (int)(data->size() - offset), 0);
+
+        if (SOCKET_ERROR == sent) {
+            Log::debug("NetLink::SendBlock: send to %s failed (%d)\n", m_Peer.c_str(), WSAGetLastError());
+            this->Close();
+            return false;
+        }
+
+        offset += sent;
+    }
+
+    return true;
+}
+
+bool NetLink::ReadLine(string * line, DWORD timeout) {
+
+    DWORD started = GetTickCount();
+
+    while (true) {
+
+        size_t end = m_Buffer.find('\n');
+
+        if (end != string::npos) {
+            *line = m_Buffer.substr(0, end);
+            m_Buffer.erase(0, end + 1);
+
+            // Tolerate CRLF from a hand-driven connection (e.g. telnet)
+            if (!line->empty() && (*line)[line->size() - 1] == '\r') line->erase(line->size() - 1);
+            return true;
+        }
+
+        if (INVALID_SOCKET == m_Socket) return false;
+
+        DWORD elapsed = GetTickCount() - started;
+        DWORD remaining = (INFINITE == timeout) ? INFINITE : ((elapsed >= timeout) ? 0 : timeout - elapsed);
+
+        int ready = this->WaitReadable(remaining);
+        if (ready == 0) return false;
+
+        if (ready < 0 || !this->Receive()) {
+            this->Close();
+            return false;
+        }
+    }
+}
+
+bool NetLink::ReadBlock(size_t length, string * data) {
+
+    while (m_Buffer.size() < length) {
+        if (INVALID_SOCKET == m_Socket || !this->Receive()) {
+            this->Close();
+            return false;
+        }
+    }
+
+    *data = m_Buffer.substr(0, length);
+    m_Buffer.erase(0, length);
+
+    return true;
+}
+
+bool NetLink::isOpen() {
+    return INVALID_SOCKET != m_Socket;
+}
+
+string NetLink::getPeer() {
+    return m_Peer;
+}
+
+void NetLink::Close() {
+
+    if (INVALID_SOCKET == m_Socket) return;
+
+    shutdown((SOCKET)m_Socket, SD_BOTH);
+    closesocket((SOCKET)m_Socket);
+    m_Socket = INVALID_SOCKET;
+}
+
+int NetLink::WaitReadable(DWORD timeout) {
+
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET((SOCKET)m_Socket, &readable);
+
+    timeval wait = { (long)(timeout / 1000), (long)((timeout % 1000) * 1000) };
+    int result = select(0, &readable, NULL, NULL, (INFINITE == timeout) ? NULL : &wait);
+
+    return (result == SOCKET_ERROR) ? -1 : result;
+}
+
+bool NetLink::Receive() {
+
+    char buffer[4096];
+    int received = recv((SOCKET)m_Socket, buffer, sizeof(buffer), 0);
+
+    // 0 is an orderly close by the other end
+    if (received <= 0) return false;
+
+    m_Buffer.append(buffer, received);
+    return true;
+}
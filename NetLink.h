@@ -0,0 +1,92 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+#include "stdafx.h"
+
+#include <windows.h>
+#include <string>
+
+using namespace std;
+
+// The TCP port the coordinator listens on unless told otherwise
+#define NETLINK_DEFAULT_PORT    7011
+
+
+// A line-oriented TCP connection between the coordinator and an agent.
+// The socket is held as a ULONG_PTR so that users of this header don't need the Winsock headers.
+class NetLink
+{
+public:
+    NetLink(void);
+    ~NetLink(void);
+
+    // Loads Winsock. Safe to call more than once.
+    static bool Initialise();
+
+    // Connects to [address], a host name or IP address optionally followed by ":port"
+    bool Connect(string address, int port);
+
+    // Starts listening on [port] on all interfaces. Returns 0 on failure.
+    static ULONG_PTR Listen(int port);
+
+    // Closes a socket returned by Listen
+    static void CloseListener(ULONG_PTR listener);
+
+    // Waits up to [timeout] milliseconds for a connection on [listener]
+    bool Accept(ULONG_PTR listener, DWORD timeout);
+
+    // Sends a line (the terminator is added)
+    bool SendLine(string line);
+
+    // Sends raw data, such as a block announced in a preceding line
+    bool SendBlock(string * data);
+
+    // Reads a line (without its terminator), waiting up to [timeout] milliseconds (INFINITE to block).
+    // Returns false on a timeout or once the connection has failed or been closed - see isOpen.
+    bool ReadLine(string * line, DWORD timeout);
+
+    // Reads exactly [length] bytes of raw data
+    bool ReadBlock(size_t length, string * data);
+
+    // Returns false once the connection has failed or been closed
+    bool isOpen();
+
+    // Returns the address of the other end
+    string getPeer();
+
+    void Close();
+
+private:
+    // Waits up to [timeout] milliseconds for data. Returns 1 if there is some, 0 on a timeout and -1 on failure.
+    int WaitReadable(DWORD timeout);
+
+    // Receives whatever is available into m_Buffer. Returns false if the connection has closed.
+    bool Receive();
+
+private:
+    ULONG_PTR m_Socket;
+    string m_Buffer;
+    string m_Peer;
+};
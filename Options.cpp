@@ -1,6 +1,14 @@
 #include "StdAfx.h"
 #include "Options.h"
 
+#include <algorithm>
+
+#include "NetLink.h"
+#include "Snapshot.h"
+#include "SigningPipeline.h"
+#include "DigestBenchmark.h"
+#include "CircuitBreaker.h"
+#include "Warmup.h"
 #include "Log.h"
 #include "Utility.h"
 
@@ -10,6 +18,28 @@
 #define DEFAULT_KEYIDLENGTH     0;
 #define DEFAULT_MAX_ITERATIONS  9999999;
 #define DEFAULT_INTERVAL        1000;
+#define DEFAULT_SAMPLE_INTERVAL 0;
+#define DEFAULT_TREND_WINDOW    100;
+#define DEFAULT_WARMUP          0;
+#define DEFAULT_RESULTS_FILE    "results.txt";
+#define DEFAULT_THRESHOLD       10.0;
+#define DEFAULT_RESAMPLES       1000;
+#define DEFAULT_CALIBRATION     100;
+#define DEFAULT_PROCESSES       1;
+#define DEFAULT_PORT            NETLINK_DEFAULT_PORT;
+#define DEFAULT_RATE            0;
+#define DEFAULT_SNAPSHOT        0;
+#define DEFAULT_DURATION        0;
+#define DEFAULT_CHECKPOINT      0;
+#define DEFAULT_PERCENTILE      SNAPSHOT_PERCENTILE;
+#define DEFAULT_WORKERS         1;
+#define DEFAULT_BATCH           0;
+#define DEFAULT_HASHERS         1;
+#define DEFAULT_QUEUE_DEPTH     PIPELINE_QUEUE_DEPTH;
+#define DEFAULT_SESSIONS        0;
+#define DEFAULT_DIGEST_SIZES    DIGEST_DEFAULT_SIZES;
+#define DEFAULT_BREAKER         BREAKER_DEFAULT_FAILURES;
+#define DEFAULT_BACKOFF         BREAKER_DEFAULT_BACKOFF;
 
 Options::Options()
 {
@@ -17,6 +47,39 @@ Options::Options()
     KeyIdLength = DEFAULT_KEYIDLENGTH;
     MaxIterations = DEFAULT_MAX_ITERATIONS;
     Interval = DEFAULT_INTERVAL;
+    SampleInterval = DEFAULT_SAMPLE_INTERVAL;
+    TrendWindow = DEFAULT_TREND_WINDOW;
+    Warmup = DEFAULT_WARMUP;
+    ResultsFile = DEFAULT_RESULTS_FILE;
+    Threshold = DEFAULT_THRESHOLD;
+    Resamples = DEFAULT_RESAMPLES;
+    IdentityFile = "";
+    Transport = false;
+    Offload = false;
+    Fingerprint = false;
+    Isolate = false;
+    CalibrationIterations = DEFAULT_CALIBRATION;
+    Processes = DEFAULT_PROCESSES;
+    ChildIndex = 0;
+    ChildCount = 0;
+    ChildPipe = 0;
+    Port = DEFAULT_PORT;
+    Rate = DEFAULT_RATE;
+    SnapshotInterval = DEFAULT_SNAPSHOT;
+    Duration = DEFAULT_DURATION;
+    CheckpointInterval = DEFAULT_CHECKPOINT;
+    Resume = false;
+    Percentile = DEFAULT_PERCENTILE;
+    Workers = DEFAULT_WORKERS;
+    BatchItems = DEFAULT_BATCH;
+    Hashers = DEFAULT_HASHERS;
+    QueueDepth = DEFAULT_QUEUE_DEPTH;
+    Sessions = DEFAULT_SESSIONS;
+    Breaker = DEFAULT_BREAKER;
+    Backoff = DEFAULT_BACKOFF;
+
+    string sizes = DEFAULT_DIGEST_SIZES;
+    ParseSizes(sizes, &DigestSizes);
 }
 
 
@@ -33,12 +96,33 @@ bool Options::Parse(int argc, _TCHAR* argv[])
 
     for (int i = 1; i < argc; i++) {
 
-        // Check for the starting '-'
+        // The first argument may name a subcommand, in which case any further
+        // arguments without a starting '-' are its inputs
         if (argv[i][0] != '-') {
+
+            if (i == 1) {
+                wstring buffer = wstring(argv[i]);
+                Command = string(buffer.begin(), buffer.end());
+                transform(Command.begin(), Command.end(), Command.begin(), ::tolower);
+                Log::debug("Setting the Command to %s\n", Command.c_str());
+                continue;
+            }
+
+            if (!Command.empty()) {
+                Inputs.push_back(wstring(argv[i]));
+                continue;
+            }
+
             Log::error("Invalid start character in argument %d, expected '-', got '%c'\n", i, argv[i][0]);
             return false;
         }
 
+        // Check for a long-form argument
+        if (argv[i][1] == '-') {
+            if (!ParseLong(argc, argv, &i)) return false;
+            continue;
+        }
+
         switch ( argv[i][1] )
         {
         case 'H': // Library Path
@@ -56,7 +140,7 @@ bool Options::Parse(int argc, _TCHAR* argv[])
         case 'P': // PIN
             if (argc <= i + 1) return false;
             PIN = wstring(argv[++i]);
-            Log::debug("Setting the PIN to %S (length %d)\n", PIN.c_str(), PIN.size());
+            Log::debug("Setting the PIN to %S (length %d)\n", PIN.c_str(), (int)PIN.size());
             break;
 
         case 'K': // Key Identifier
@@ -102,3 +186,309 @@ bool Options::Parse(int argc, _TCHAR* argv[])
 
     return true;
 }
+
+bool Options::ParseLong(int argc, _TCHAR* argv[], int * i)
+{
+    wstring name = wstring(&argv[*i][2]);
+
+    if (name == L"sample") {
+        if (argc <= *i + 1) return false;
+        SampleInterval = _wtoi(argv[++(*i)]);
+        Log::debug("Setting the process sample interval to %d seconds\n", SampleInterval);
+        return true;
+    }
+
+    if (name == L"snapshot") {
+        if (argc <= *i + 1) return false;
+        SnapshotInterval = _wtoi(argv[++(*i)]);
+        Log::debug("Setting the snapshot interval to %d seconds\n", SnapshotInterval);
+        return true;
+    }
+
+    if (name == L"warmup") {
+        if (argc <= *i + 1) return false;
+        wstring value = wstring(argv[++(*i)]);
+
+        if (value == L"auto") {
+            Warmup = WARMUP_AUTO;
+            Log::debug("Detecting the end of each token's warm-up\n");
+        } else {
+            Warmup = _wtoi(value.c_str());
+            if (Warmup < 0) return false;
+            Log::debug("Setting the warm-up to %d transactions\n", Warmup);
+        }
+        return true;
+    }
+
+    if (name == L"duration") {
+        if (argc <= *i + 1) return false;
+        wstring value = wstring(argv[++(*i)]);
+        if (!ParseDuration(string(value.begin(), value.end()), &Duration)) return false;
+        Log::debug("Setting the run duration to %d seconds\n", Duration);
+        return true;
+    }
+
+    if (name == L"checkpoint") {
+        if (argc <= *i + 1) return false;
+        CheckpointInterval = _wtoi(argv[++(*i)]);
+        if (CheckpointInterval < 0) return false;
+        Log::debug("Setting the checkpoint interval to %d seconds\n", CheckpointInterval);
+        return true;
+    }
+
+    if (name == L"resume") {
+        Resume = true;
+        Log::debug("Resuming from the last checkpoint\n");
+        return true;
+    }
+
+    if (name == L"percentile") {
+        if (argc <= *i + 1) return false;
+        Percentile = _wtof(argv[++(*i)]);
+        Log::debug("Setting the query percentile to %.1f\n", Percentile);
+        return true;
+    }
+
+    if (name == L"window") {
+        if (argc <= *i + 1) return false;
+        TrendWindow = _wtoi(argv[++(*i)]);
+        Log::debug("Setting the latency trend window to %d iterations\n", TrendWindow);
+        return true;
+    }
+
+    if (name == L"results") {
+        if (argc <= *i + 1) return false;
+        wstring path = argv[++(*i)];
+        ResultsFile = string(path.begin(), path.end());
+        Log::debug("Setting the results file to %s\n", ResultsFile.c_str());
+        return true;
+    }
+
+    if (name == L"threshold") {
+        if (argc <= *i + 1) return false;
+        Threshold = _wtof(argv[++(*i)]);
+        Log::debug("Setting the regression threshold to %.1f%%\n", Threshold);
+        return true;
+    }
+
+    if (name == L"resamples") {
+        if (argc <= *i + 1) return false;
+        Resamples = _wtoi(argv[++(*i)]);
+        Log::debug("Setting the bootstrap resample count to %d\n", Resamples);
+        return true;
+    }
+
+    if (name == L"affinity" || name == L"service-affinity") {
+        if (argc <= *i + 1) return false;
+        wstring buffer = argv[++(*i)];
+        string value(buffer.begin(), buffer.end());
+
+        if (name == L"affinity") {
+            WorkerAffinity = value;
+        } else {
+            ServiceAffinity = value;
+        }
+
+        Log::debug("Setting the %S to '%s'\n", name.c_str(), value.c_str());
+        return true;
+    }
+
+    if (name == L"processes") {
+        if (argc <= *i + 1) return false;
+        Processes = _wtoi(argv[++(*i)]);
+        Log::debug("Setting the number of processes to %d\n", Processes);
+        return true;
+    }
+
+    if (name == L"batch") {
+        if (argc <= *i + 1) return false;
+        BatchItems = _wtoi(argv[++(*i)]);
+        if (BatchItems < 0) return false;
+        Log::debug("Setting the batch to %d items\n", BatchItems);
+        return true;
+    }
+
+    if (name == L"output") {
+        if (argc <= *i + 1) return false;
+        wstring path = argv[++(*i)];
+        OutputDirectory = string(path.begin(), path.end());
+        Log::debug("Setting the output directory to '%s'\n", OutputDirectory.c_str());
+        return true;
+    }
+
+    if (name == L"hashers") {
+        if (argc <= *i + 1) return false;
+        Hashers = _wtoi(argv[++(*i)]);
+        if (Hashers < 1) return false;
+        Log::debug("Setting the hashers to %d\n", Hashers);
+        return true;
+    }
+
+    if (name == L"queue") {
+        if (argc <= *i + 1) return false;
+        QueueDepth = _wtoi(argv[++(*i)]);
+        if (QueueDepth < 1) return false;
+        Log::debug("Setting the queue depth to %d\n", QueueDepth);
+        return true;
+    }
+
+    if (name == L"sizes") {
+        if (argc <= *i + 1) return false;
+        wstring list = argv[++(*i)];
+        if (!ParseSizes(string(list.begin(), list.end()), &DigestSizes)) return false;
+        Log::debug("Setting the digest payload sizes to %s\n", string(list.begin(), list.end()).c_str());
+        return true;
+    }
+
+    if (name == L"workers") {
+        if (argc <= *i + 1) return false;
+        Workers = _wtoi(argv[++(*i)]);
+        if (Workers < 1) return false;
+        Log::debug("Setting the workers per token to %d\n", Workers);
+        return true;
+    }
+
+    if (name == L"sessions") {
+        if (argc <= *i + 1) return false;
+        Sessions = _wtoi(argv[++(*i)]);
+        if (Sessions < 0) return false;
+        Log::debug("Setting the session pool size to %d\n", Sessions);
+        return true;
+    }
+
+    if (name == L"breaker") {
+        if (argc <= *i + 1) return false;
+        Breaker = _wtoi(argv[++(*i)]);
+        if (Breaker < 0) return false;
+        Log::debug("Setting the circuit breaker to %d consecutive failures\n", Breaker);
+        return true;
+    }
+
+    if (name == L"backoff") {
+        if (argc <= *i + 1) return false;
+        Backoff = _wtoi(argv[++(*i)]);
+        if (Backoff < 1) return false;
+        Log::debug("Setting the circuit breaker backoff to %d milliseconds\n", Backoff);
+        return true;
+    }
+
+    if (name == L"port") {
+        if (argc <= *i + 1) return false;
+        Port = _wtoi(argv[++(*i)]);
+        if (Port < 1 || Port > 65535) return false;
+        Log::debug("Setting the coordinator port to %d\n", Port);
+        return true;
+    }
+
+    if (name == L"rate") {
+        if (argc <= *i + 1) return false;
+        Rate = _wtof(argv[++(*i)]);
+        Log::debug("Setting the total transaction rate to %.1f per second\n", Rate);
+        return true;
+    }
+
+    if (name == L"child") {
+        if (argc <= *i + 1) return false;
+        if (2 != swscanf_s(argv[++(*i)], L"%d/%d", &ChildIndex, &ChildCount)) return false;
+        if (ChildCount < 1 || ChildIndex < 0 || ChildIndex >= ChildCount) return false;
+        return true;
+    }
+
+    if (name == L"child-pipe") {
+        if (argc <= *i + 1) return false;
+        ChildPipe = (ULONG_PTR)_wcstoui64(argv[++(*i)], NULL, 10);
+        return true;
+    }
+
+    if (name == L"calibrate") {
+        if (argc <= *i + 1) return false;
+        CalibrationIterations = _wtoi(argv[++(*i)]);
+        Log::debug("Setting the calibration to %d transactions\n", CalibrationIterations);
+        return true;
+    }
+
+    if (name == L"offload") {
+        Offload = true;
+        Log::debug("Enabling host public key operations\n");
+        return true;
+    }
+
+    if (name == L"fingerprint") {
+        Fingerprint = true;
+        Log::debug("Journaling data fingerprints instead of hex\n");
+        return true;
+    }
+
+    if (name == L"deadline") {
+        if (argc <= *i + 1) return false;
+        wstring spec = wstring(argv[++(*i)]);
+        Deadline = string(spec.begin(), spec.end());
+        Log::debug("Setting the call deadline to %s\n", Deadline.c_str());
+        return true;
+    }
+
+    if (name == L"isolate") {
+        Isolate = true;
+        Log::debug("Enabling isolation of stalled tokens\n");
+        return true;
+    }
+
+    if (name == L"transport") {
+        Transport = true;
+        Log::debug("Enabling transport attribution\n");
+        return true;
+    }
+
+    if (name == L"cache") {
+        if (argc <= *i + 1) return false;
+        wstring path = argv[++(*i)];
+        IdentityFile = (path == L"none") ? "" : string(path.begin(), path.end());
+        Log::debug("Setting the identity cache to '%s'\n", IdentityFile.c_str());
+        return true;
+    }
+
+    Log::error("Unknown argument '--%S'\n", name.c_str());
+    return false;
+}
+
+bool Options::ParseSizes(string list, vector<int> * sizes)
+{
+    vector<int> parsed;
+    stringstream stream(list);
+    string item;
+
+    while (getline(stream, item, ',')) {
+
+        if (item.empty() || item.find_first_not_of("0123456789") != string::npos) {
+            Log::error("Invalid payload size '%s'\n", item.c_str());
+            return false;
+        }
+
+        parsed.push_back(atoi(item.c_str()));
+    }
+
+    if (parsed.empty()) return false;
+
+    *sizes = parsed;
+    return true;
+}
+
+bool Options::ParseDuration(string value, int * seconds)
+{
+    size_t digits = value.find_first_not_of("0123456789");
+    string unit = (digits == string::npos) ? "" : value.substr(digits);
+    int multiplier = 0;
+
+    if (unit.empty() || unit == "s") multiplier = 1;
+    else if (unit == "m") multiplier = 60;
+    else if (unit == "h") multiplier = 3600;
+    else if (unit == "d") multiplier = 86400;
+
+    if (value.empty() || digits == 0 || multiplier == 0) {
+        Log::error("Invalid duration '%s'\n", value.c_str());
+        return false;
+    }
+
+    *seconds = atoi(value.substr(0, digits).c_str()) * multiplier;
+    return true;
+}
@@ -28,6 +28,7 @@ THE SOFTWARE.
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <vector>
 
 using namespace std;
 
@@ -41,10 +42,26 @@ public:
     // Parse the command-line arguments into the Options instance
     bool Parse(int argc, _TCHAR* argv[]);
 
+private:
+    // Parse a single long-form (--name) argument, advancing [i] past any value it consumes
+    bool ParseLong(int argc, _TCHAR* argv[], int * i);
+
+    // Parse a comma separated list of payload sizes (bytes) into [sizes]
+    static bool ParseSizes(string list, vector<int> * sizes);
+
+    // Parse a duration in seconds, or with an 's', 'm', 'h' or 'd' suffix, into [seconds]
+    static bool ParseDuration(string value, int * seconds);
+
 public:
     // Argument - The name of this executable (passed through as argv[0])
     string EXEName;
 
+    // Argument - The subcommand to run instead of the load test (lower case, empty for the load test)
+    string Command;
+
+    // Argument - The inputs (typically file paths) supplied to the subcommand
+    vector<wstring> Inputs;
+
     // Argument - The path to the PKCS11 library
     wstring PKCS11Library;
 
@@ -62,5 +79,101 @@ public:
 
     // Argument - The period of time to wait between each process
     int Interval;
+
+    // Argument - The period in seconds between process memory/handle samples (0 disables sampling)
+    int SampleInterval;
+
+    // Argument - The interval in seconds between latency snapshots (0 disables)
+    int SnapshotInterval;
+
+    // Argument - The wall-clock length of the load test in seconds, over every resumed leg (0 runs until -C is reached)
+    int Duration;
+
+    // Argument - The interval in seconds between checkpoints of the run (0 disables)
+    int CheckpointInterval;
+
+    // Argument - Carry on the run from its last checkpoint
+    bool Resume;
+
+    // Argument - The percentile reported by the snapshot query command
+    double Percentile;
+
+    // Argument - The number of iterations aggregated into each latency trend window
+    int TrendWindow;
+
+    // Argument - The transactions on each token kept out of the results as warm-up (WARMUP_AUTO to detect it, 0 disables)
+    int Warmup;
+
+    // Argument - The file the latency histograms are written to at the end of the load test
+    string ResultsFile;
+
+    // Argument - The percentage change treated as a regression by the compare command
+    double Threshold;
+
+    // Argument - The number of bootstrap resamples used for the compare confidence intervals
+    int Resamples;
+
+    // Argument - The file token identities are cached in between runs (empty when caching is disabled)
+    string IdentityFile;
+
+    // Argument - Time the library's SCardTransmit calls and attribute them to each operation
+    bool Transport;
+
+    // Argument - Verify and encrypt with a host copy of each token's public key, leaving the token only the private key operations
+    bool Offload;
+
+    // Argument - Journal a fingerprint (length and CRC-32C) of each operation's data instead of a hex dump
+    bool Fingerprint;
+
+    // Argument - The deadline (milliseconds) for a single PKCS#11 call, with optional per-operation overrides (empty disables the watchdog)
+    string Deadline;
+
+    // Argument - Take a token out of the run when one of its calls stalls past its deadline
+    bool Isolate;
+
+    // Argument - The number of processes the tokens are shared between (1 runs them all in this process)
+    int Processes;
+
+    // Argument - The TCP port the coordinator listens on and agents connect to
+    int Port;
+
+    // Argument - The total transactions per second the coordinator shares between the agents (0 leaves each token at -I)
+    double Rate;
+
+    // Internal - Set by the launcher when starting a child process: which share of the tokens it
+    // drives (index of count, count 0 when not a child) and the pipe it returns its results over
+    int ChildIndex;
+    int ChildCount;
+    ULONG_PTR ChildPipe;
+
+    // Argument - The number of transactions run against the no-op library to measure the harness overhead
+    int CalibrationIterations;
+
+    // Argument - The total number of signatures shared between every token, instead of -C transactions each (0 disables)
+    int BatchItems;
+
+    // Argument - The directory the sign command writes signatures to (empty for the input directory)
+    string OutputDirectory;
+
+    // Argument - The number of hashing threads, and the capacity of the queues between the stages, of the sign command
+    int Hashers;
+    int QueueDepth;
+
+    // Argument - The payload sizes (bytes) the digest command compares token and host digests at
+    vector<int> DigestSizes;
+
+    // Argument - The number of worker threads transacting against each token concurrently
+    int Workers;
+
+    // Argument - The number of pooled sessions shared by each token's workers (0 opens a session per transaction)
+    int Sessions;
+
+    // Argument - The consecutive failures that hold a token back (0 retries a failing token at the full rate), and the first backoff in milliseconds
+    int Breaker;
+    int Backoff;
+
+    // Argument - The processors the token workers and the service threads are pinned to (empty to leave unpinned)
+    string WorkerAffinity;
+    string ServiceAffinity;
 };
 
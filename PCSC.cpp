@@ -43,6 +43,7 @@ http://creativecommons.org/licenses/by-nc-sa/3.0/
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 extern "C"
 {
@@ -54,6 +55,19 @@ extern "C"
 #endif
 }
 
+// A CPLC query for one reader, run on its own thread
+typedef struct {
+    string reader;
+    string serial;
+    bool success;
+} CPLCQuery;
+
+// The context shared by all queries - each query still connects its own card handle
+static SCARDCONTEXT m_Context = 0;
+static CRITICAL_SECTION m_ContextLock;
+static bool m_Initialised = false;
+
+
 PCSC::PCSC(void)
 {
 }
@@ -83,6 +97,180 @@ bool IsCommandOK(BYTE * response, int len) {
     return ((response[len - 2] == 0x90) && (response[len-1] == 0x00));
 }
 
+void PCSC::Initialise() {
+
+    if (m_Initialised) return;
+
+    InitializeCriticalSection(&m_ContextLock);
+    m_Initialised = true;
+}
+
+void PCSC::Release() {
+
+    if (!m_Initialised) return;
+
+    EnterCriticalSection(&m_ContextLock);
+    if (0 != m_Context) {
+        SCardReleaseContext(m_Context);
+        m_Context = 0;
+    }
+    LeaveCriticalSection(&m_ContextLock);
+}
+
+ULONG_PTR PCSC::AcquireContext() {
+
+    Initialise();
+
+    EnterCriticalSection(&m_ContextLock);
+
+    // The context is lost if the smart card service restarts (which Windows does when the
+    // last reader is unplugged), so check it each time rather than failing every later query
+    if (0 != m_Context && SCARD_S_SUCCESS != SCardIsValidContext(m_Context)) {
+        Log::debug("PCSC::AcquireContext: Context is no longer valid, establishing a new one\n");
+        SCardReleaseContext(m_Context);
+        m_Context = 0;
+    }
+
+    if (0 == m_Context) {
+        LONG rv = SCardEstablishContext(SCARD_SCOPE_SYSTEM, NULL, NULL, &m_Context);
+        if (SCARD_S_SUCCESS != rv) {
+            m_Context = 0;
+            LeaveCriticalSection(&m_ContextLock);
+            CHECK("SCardEstablishContext", rv);
+        }
+    }
+
+    SCARDCONTEXT context = m_Context;
+    LeaveCriticalSection(&m_ContextLock);
+
+    return context;
+}
+
+int PCSC::QueryCPLC(vector<string> * readers, map<string, string> * serials) {
+
+    Log::debug("PCSC::QueryCPLC: Querying %u readers\n", (unsigned)readers->size());
+
+    // Establish the shared context up front, rather than racing for it in the threads
+    try {
+        AcquireContext();
+    }
+    catch (...) {
+        Log::error("Unable to establish a PC/SC context\n");
+        return 0;
+    }
+
+    vector<CPLCQuery> queries(readers->size());
+    vector<HANDLE> threads(readers->size(), (HANDLE)NULL);
+
+    for (size_t i = 0; i < readers->size(); i++) {
+        queries[i].reader = (*readers)[i];
+        queries[i].success = false;
+        threads[i] = CreateThread(NULL, 0, QueryProc, &queries[i], 0, NULL);
+
+        // Fall back to querying inline if a thread can't be created
+        if (NULL == threads[i]) QueryProc(&queries[i]);
+    }
+
+    int count = 0;
+
+    for (size_t i = 0; i < readers->size(); i++) {
+
+        if (NULL != threads[i]) {
+            WaitForSingleObject(threads[i], INFINITE);
+            CloseHandle(threads[i]);
+        }
+
+        if (queries[i].success) {
+            (*serials)[queries[i].reader] = queries[i].serial;
+            count++;
+        }
+    }
+
+    return count;
+}
+
+DWORD WINAPI PCSC::QueryProc(LPVOID param) {
+
+    CPLCQuery * query = (CPLCQuery *)param;
+
+    try {
+        query->serial = QueryCPLC(query->reader);
+        query->success = true;
+    }
+    catch (...) {
+        Log::debug("PCSC::QueryProc: Unable to read the CPLC from '%s'\n", query->reader.c_str());
+    }
+
+    return 0;
+}
+
+void PCSC::ListReaders(vector<string> * readers) {
+
+    SCARDCONTEXT hContext = AcquireContext();
+    DWORD length = 0;
+
+    LONG rv = SCardListReaders(hContext, NULL, NULL, &length);
+    CHECK("SCardListReaders", rv);
+
+    vector<char> buffer(length + 1, 0);
+    rv = SCardListReaders(hContext, NULL, &buffer[0], &length);
+    CHECK("SCardListReaders", rv);
+
+    // A multi-string - each name is terminated, and the list ends with an empty name
+    for (const char * name = &buffer[0]; *name != 0; name += strlen(name) + 1) {
+        readers->push_back(string(name));
+    }
+}
+
+ULONG_PTR PCSC::Connect(string reader, DWORD * protocol) {
+
+    SCARDHANDLE hCard;
+    SCARDCONTEXT hContext = AcquireContext();
+
+    LONG rv = SCardConnect(hContext, reader.c_str(), SCARD_SHARE_SHARED,
+                           SCARD_PROTOCOL_T0 | SCARD_PROTOCOL_T1, &hCard, protocol);
+    CHECK("SCardConnect", rv);
+
+    return hCard;
+}
+
+void PCSC::Transmit(ULONG_PTR card, DWORD protocol, vector<BYTE> * command, vector<BYTE> * response) {
+
+    SCARD_IO_REQUEST pioSendPci = (protocol == SCARD_PROTOCOL_T0) ? *SCARD_PCI_T0 : *SCARD_PCI_T1;
+    BYTE cmdGetResponse[] = { 0x00, 0xC0, 0x00, 0x00, 0x00 };
+
+    response->resize(PCSC_MAX_RESPONSE);
+
+    DWORD dwRecvLength = (DWORD)response->size();
+    LONG rv = SCardTransmit(card, &pioSendPci, &(*command)[0], (DWORD)command->size(), NULL, &(*response)[0], &dwRecvLength);
+    CHECK("SCardTransmit", rv);
+
+    DWORD total = dwRecvLength;
+
+    // Collect the rest of the response while the card reports more bytes available
+    while (total >= 2 && (*response)[total - 2] == 0x61 && total + 256 <= response->size()) {
+
+        cmdGetResponse[4] = (*response)[total - 1];
+        total -= 2;
+
+        dwRecvLength = (DWORD)(response->size() - total);
+        rv = SCardTransmit(card, &pioSendPci, cmdGetResponse, sizeof(cmdGetResponse), NULL, &(*response)[total], &dwRecvLength);
+        CHECK("SCardTransmit", rv);
+
+        total += dwRecvLength;
+    }
+
+    response->resize(total);
+}
+
+void PCSC::Disconnect(ULONG_PTR card) {
+
+    LONG rv = SCardDisconnect(card, SCARD_LEAVE_CARD);
+    if (SCARD_S_SUCCESS != rv) {
+        Log::debug("PCSC::Disconnect: SCardDisconnect failed (%s)\n", GetPCSCErrorString(rv));
+    }
+}
+
 string PCSC::QueryCPLC(string reader) {
 
     LONG rv;
@@ -100,89 +288,78 @@ string PCSC::QueryCPLC(string reader) {
     BYTE cmdGetData1[] = { 0x00, 0xCA, 0x9F, 0x7F };
     BYTE cmdGetData2[] = { 0x80, 0xCA, 0x9F, 0x7F, 00 };
 
-    rv = SCardEstablishContext(SCARD_SCOPE_SYSTEM, NULL, NULL, &hContext);
-    CHECK("SCardEstablishContext", rv);
-
-#ifdef SCARD_AUTOALLOCATE
-// dwReaders = SCARD_AUTOALLOCATE;
-//rv = SCardListReaders(hContext, NULL, (LPTSTR)&mszReaders, &dwReaders);
-//CHECK("SCardListReaders", rv);
-#else
-    rv = SCardListReaders(hContext, NULL, NULL, &dwReaders);
-    CHECK("SCardListReaders", rv);
-
-    mszReaders = calloc(dwReaders, sizeof(char));
-    rv = SCardListReaders(hContext, NULL, mszReaders, &dwReaders);
-    CHECK("SCardListReaders", rv);
-#endif
-// printf("reader name: %s\n", mszReaders);
+    hContext = AcquireContext();
 
     rv = SCardConnect(hContext, reader.c_str(), SCARD_SHARE_SHARED,
                       SCARD_PROTOCOL_T0 | SCARD_PROTOCOL_T1, &hCard, &dwActiveProtocol);
     CHECK("SCardConnect", rv);
 
-    switch(dwActiveProtocol)
-    {
-    case SCARD_PROTOCOL_T0:
-        pioSendPci = *SCARD_PCI_T0;
-        break;
+    // Make sure the card handle is released whichever APDU fails
+    try {
 
-    case SCARD_PROTOCOL_T1:
-        pioSendPci = *SCARD_PCI_T1;
-        break;
-    }
+        switch(dwActiveProtocol)
+        {
+        case SCARD_PROTOCOL_T0:
+            pioSendPci = *SCARD_PCI_T0;
+            break;
 
-// AID 1
-    dwRecvLength = sizeof(pbRecvBuffer);
-    rv = SCardTransmit(hCard, &pioSendPci, cmdSelectAid1, sizeof(cmdSelectAid1), NULL, pbRecvBuffer, &dwRecvLength);
-    CHECK("SCardTransmit", rv);
+        case SCARD_PROTOCOL_T1:
+            pioSendPci = *SCARD_PCI_T1;
+            break;
+        }
 
-    if (!IsCommandOK(pbRecvBuffer, dwRecvLength)) {
-        // Attempt with AID 2
+// AID 1
         dwRecvLength = sizeof(pbRecvBuffer);
-        rv = SCardTransmit(hCard, &pioSendPci, cmdSelectAid2, sizeof(cmdSelectAid2), NULL, pbRecvBuffer, &dwRecvLength);
+        rv = SCardTransmit(hCard, &pioSendPci, cmdSelectAid1, sizeof(cmdSelectAid1), NULL, pbRecvBuffer, &dwRecvLength);
         CHECK("SCardTransmit", rv);
-    }
+
+        if (!IsCommandOK(pbRecvBuffer, dwRecvLength)) {
+            // Attempt with AID 2
+            dwRecvLength = sizeof(pbRecvBuffer);
+            rv = SCardTransmit(hCard, &pioSendPci, cmdSelectAid2, sizeof(cmdSelectAid2), NULL, pbRecvBuffer, &dwRecvLength);
+            CHECK("SCardTransmit", rv);
+        }
 
 #if defined(DEBUG)
-    printf("response: ");
+        printf("response: ");
 
-    for(i=0; i<dwRecvLength; i++) {
-        printf("%02X ", pbRecvBuffer[i]);
-    }
+        for(i=0; i<dwRecvLength; i++) {
+            printf("%02X ", pbRecvBuffer[i]);
+        }
 
-    printf("\n");
+        printf("\n");
 #endif
 
-    dwRecvLength = sizeof(pbRecvBuffer);
-    rv = SCardTransmit(hCard, &pioSendPci, cmdGetData1, sizeof(cmdGetData1), NULL, pbRecvBuffer, &dwRecvLength);
-    CHECK("SCardTransmit", rv)
+        dwRecvLength = sizeof(pbRecvBuffer);
+        rv = SCardTransmit(hCard, &pioSendPci, cmdGetData1, sizeof(cmdGetData1), NULL, pbRecvBuffer, &dwRecvLength);
+        CHECK("SCardTransmit", rv)
 
 
-    if (!IsCommandOK(pbRecvBuffer, dwRecvLength)) {
-        // Attempt with GetData 2
-        dwRecvLength = sizeof(pbRecvBuffer);
-        rv = SCardTransmit(hCard, &pioSendPci, cmdGetData2, sizeof(cmdGetData2), NULL, pbRecvBuffer, &dwRecvLength);
-        CHECK("SCardTransmit", rv);
-    }
+        if (!IsCommandOK(pbRecvBuffer, dwRecvLength)) {
+            // Attempt with GetData 2
+            dwRecvLength = sizeof(pbRecvBuffer);
+            rv = SCardTransmit(hCard, &pioSendPci, cmdGetData2, sizeof(cmdGetData2), NULL, pbRecvBuffer, &dwRecvLength);
+            CHECK("SCardTransmit", rv);
+        }
 
 #if defined(DEBUG)
-    printf("RX: ");
+        printf("RX: ");
 
-    for(i=0; i<dwRecvLength; i++) {
-        printf("%02X ", pbRecvBuffer[i]);
-    }
+        for(i=0; i<dwRecvLength; i++) {
+            printf("%02X ", pbRecvBuffer[i]);
+        }
 
-    printf("\n");
+        printf("\n");
 #endif
+    }
+    catch (...) {
+        SCardDisconnect(hCard, SCARD_LEAVE_CARD);
+        throw;
+    }
 
     rv = SCardDisconnect(hCard, SCARD_LEAVE_CARD);
     CHECK("SCardDisconnect", rv);
 
-    rv = SCardReleaseContext(hContext);
-
-    CHECK("SCardReleaseContext", rv);
-
 
     // Parse the CPLC
     if (dwRecvLength == 0x2C) {
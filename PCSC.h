@@ -26,7 +26,13 @@ THE SOFTWARE.
 #include "stdafx.h"
 
 #include "Log.h"
+#include <windows.h>
 #include <string>
+#include <vector>
+#include <map>
+
+// The largest response Transmit accepts (an extended length APDU plus the status word)
+#define PCSC_MAX_RESPONSE       (65536 + 2)
 
 using namespace std;
 
@@ -36,7 +42,37 @@ public:
     PCSC(void);
     ~PCSC(void);
 
+    // Prepares the context shared by all PC/SC queries. Must be called before any other threads use PCSC.
+    static void Initialise();
+
+    // Releases the shared context
+    static void Release();
+
     // Helper function to retrieve the GlobalPlatform CPLC IC Serial Number given a supplied reader name.
     static string QueryCPLC(string reader);
+
+    // Retrieves the CPLC IC Serial Number of each of [readers] in parallel, one thread per reader.
+    // Readers that fail are left out of [serials]. Returns the number of serials retrieved.
+    static int QueryCPLC(vector<string> * readers, map<string, string> * serials);
+
+    // Lists the readers known to the smart card service
+    static void ListReaders(vector<string> * readers);
+
+    // Connects to the card in [reader] using the shared context, returning the card handle
+    static ULONG_PTR Connect(string reader, DWORD * protocol);
+
+    // Sends a command APDU to the card, returning the response including the status word.
+    // A 61XX status is followed by GET RESPONSE, so [response] always holds the complete reply.
+    static void Transmit(ULONG_PTR card, DWORD protocol, vector<BYTE> * command, vector<BYTE> * response);
+
+    // Releases a card handle returned by Connect
+    static void Disconnect(ULONG_PTR card);
+
+private:
+    // Returns the shared context, establishing it again if it is no longer valid
+    static ULONG_PTR AcquireContext();
+
+    // Thread entry point for the parallel query
+    static DWORD WINAPI QueryProc(LPVOID param);
 };
 
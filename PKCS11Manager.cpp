@@ -42,6 +42,9 @@ HINSTANCE PKCS11Manager::hPKCS11 = NULL;
 // PKCS11 Function Pointer
 CK_FUNCTION_LIST * PKCS11Manager::pPKCS11 = NULL;
 
+// Whether the library is using OS locking (i.e. can be called from the slot worker threads concurrently)
+bool PKCS11Manager::m_ThreadSafe = false;
+
 // TODO: Create ERR valeus for all exceptions thrown
 
 PKCS11Manager::PKCS11Manager(void)
@@ -54,19 +57,23 @@ PKCS11Manager::~PKCS11Manager(void)
     this->Destroy();
 }
 
-PKCS11Manager* PKCS11Manager::Create(LPCTSTR libraryPath) {
+PKCS11Manager* PKCS11Manager::Create(LPCTSTR libraryPath, PKCS11LoadTimes * times) {
 
     // Has this object already been created? If so, just pass it back
     if (m_Instance != NULL) {
         return m_Instance;
     }
 
+    if (NULL != times) memset(times, 0, sizeof(PKCS11LoadTimes));
+
     // Attempt to load the library via the supplied module path
+    double started = Utility::QueryMicroseconds();
     hPKCS11 = LoadLibrary(libraryPath);
+    if (NULL != times) times->load = Utility::QueryMicroseconds() - started;
 
     if (NULL == hPKCS11) {
         Log::error("PKCS11Manager::Create: Unable to load the supplied PKCS11 module.\n");
-        throw;
+        throw "Unable to load the PKCS11 module";
     }
 
     // Load the reference to C_GetFunctionList
@@ -78,13 +85,16 @@ PKCS11Manager* PKCS11Manager::Create(LPCTSTR libraryPath) {
         Log::error("PKCS11Manager::Create: GetProcAddress on C_GetFunctionList failed.\n");
         FreeLibrary(hPKCS11);
         hPKCS11 = NULL;
-        throw;
+        throw "C_GetFunctionList is not exported";
     }
 
     // Call C_GetFunctionList
     CK_RV result;
 
+    started = Utility::QueryMicroseconds();
     result = (*pC_GetFunctionList) (&pPKCS11);
+    if (NULL != times) times->functionList = Utility::QueryMicroseconds() - started;
+
     if (result != CKR_OK)
     {
         FreeLibrary(hPKCS11);
@@ -95,8 +105,22 @@ PKCS11Manager* PKCS11Manager::Create(LPCTSTR libraryPath) {
         Utility::ThrowOnError(result, "PKCS11Manager::Create", "C_GetFunctionList");
     }
 
-    // Call C_Initialize;
-    result = pPKCS11->C_Initialize(NULL_PTR);
+    // Call C_Initialize, asking for OS locking since each slot is driven from its own thread
+    CK_C_INITIALIZE_ARGS initArgs;
+    memset(&initArgs, 0, sizeof(initArgs));
+    initArgs.flags = CKF_OS_LOCKING_OK;
+
+    started = Utility::QueryMicroseconds();
+    result = pPKCS11->C_Initialize(&initArgs);
+    m_ThreadSafe = (result == CKR_OK);
+
+    if (result == CKR_CANT_LOCK) {
+        Log::warn("PKCS11Manager::Create: The library does not support OS locking, calls will be serialised.\n");
+        result = pPKCS11->C_Initialize(NULL_PTR);
+    }
+
+    if (NULL != times) times->initialize = Utility::QueryMicroseconds() - started;
+
     if (result != CKR_OK) {
 
         FreeLibrary(hPKCS11);
@@ -134,16 +158,23 @@ PKCS11Manager* PKCS11Manager::Create(LPCTSTR libraryPath) {
 
 
 
-void PKCS11Manager::Destroy() {
+void PKCS11Manager::Destroy(PKCS11LoadTimes * times) {
 
     if (NULL == hPKCS11) return;
 
+    double started = Utility::QueryMicroseconds();
     pPKCS11->C_Finalize(NULL_PTR);
+    if (NULL != times) times->finalize = Utility::QueryMicroseconds() - started;
+
+    started = Utility::QueryMicroseconds();
     FreeLibrary(hPKCS11);
+    if (NULL != times) times->unload = Utility::QueryMicroseconds() - started;
 
     pPKCS11 = NULL;
     hPKCS11 = NULL;
 
+    // Otherwise a later Create would hand back this instance with the library unloaded
+    m_Instance = NULL;
 }
 
 int PKCS11Manager::QuerySlots(bool tokenPresent, vector<PKCS11Slot> * slots) {
@@ -163,20 +194,13 @@ int PKCS11Manager::QuerySlots(bool tokenPresent, vector<PKCS11Slot> * slots) {
     // Retrieve the slot info
     for (CK_ULONG i = 0; i < count; i++) {
 
-        CK_SLOT_INFO info;
         PKCS11Slot slot(this->pPKCS11);
 
-        CK_RV result;
-        result = pPKCS11->C_GetSlotInfo(slotIds[i], &info);
-        Utility::ThrowOnError(result, "PKCS11Manager::QuerySlots", "C_GetSlotInfo");
-
-        slot.id = slotIds[i];
-        slot.manufacturer = Utility::CK_UTF8CHARtoString(info.manufacturerID, 32);
-        slot.description = Utility::CK_UTF8CHARtoString(info.slotDescription, 64);
-
-        slot.isTokenPresent = (bool)((info.flags & CKF_TOKEN_PRESENT) != 0);
-        slot.isTokenRemovable = (bool)((info.flags & CKF_REMOVABLE_DEVICE) != 0);
-        slot.isHardware = (bool)((info.flags & CKF_HW_SLOT) != 0);
+        if (!this->QuerySlot(slotIds[i], &slot)) {
+            Log::error("PKCS11Manager::QuerySlots: C_GetSlotInfo failed for slot %u\n", slotIds[i]);
+            delete [] slotIds;
+            throw "C_GetSlotInfo failed";
+        }
 
         Log::debug("PKCS11Manager::QuerySlots: ADDING SLOT %u\n", slot.id);
         Log::debug("PKCS11Manager::QuerySlots: Manufacturer = %s\n", slot.manufacturer.c_str());
@@ -185,5 +209,44 @@ int PKCS11Manager::QuerySlots(bool tokenPresent, vector<PKCS11Slot> * slots) {
         slots->push_back(slot);
     }
 
+    delete [] slotIds;
+
     return count;
+}
+
+bool PKCS11Manager::QuerySlot(CK_SLOT_ID id, PKCS11Slot * slot) {
+
+    CK_SLOT_INFO info;
+
+    CK_RV result;
+    result = pPKCS11->C_GetSlotInfo(id, &info);
+    if (result != CKR_OK) {
+        Log::debug("PKCS11Manager::QuerySlot: C_GetSlotInfo for slot %u failed with %s\n", id, Utility::ErrorToString(result));
+        return false;
+    }
+
+    slot->id = id;
+    slot->manufacturer = Utility::CK_UTF8CHARtoString(info.manufacturerID, 32);
+    slot->description = Utility::CK_UTF8CHARtoString(info.slotDescription, 64);
+
+    slot->isTokenPresent = (bool)((info.flags & CKF_TOKEN_PRESENT) != 0);
+    slot->isTokenRemovable = (bool)((info.flags & CKF_REMOVABLE_DEVICE) != 0);
+    slot->isHardware = (bool)((info.flags & CKF_HW_SLOT) != 0);
+
+    return true;
+}
+
+CK_RV PKCS11Manager::PollSlotEvent(CK_SLOT_ID * slot) {
+
+    // NOTE: The blocking form of C_WaitForSlotEvent can only be interrupted by C_Finalize, which
+    // would leave the watcher thread inside the library at shutdown, so it is always polled.
+    return pPKCS11->C_WaitForSlotEvent(CKF_DONT_BLOCK, slot, NULL_PTR);
+}
+
+bool PKCS11Manager::isThreadSafe() {
+    return m_ThreadSafe;
+}
+
+CK_FUNCTION_LIST * PKCS11Manager::getFunctionList() {
+    return pPKCS11;
 }
\ No newline at end of file
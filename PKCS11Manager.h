@@ -34,12 +34,25 @@ THE SOFTWARE.
 
 using namespace std;
 
+// The time (microseconds) taken by each step of loading and unloading the library
+typedef struct {
+    // LoadLibrary, C_GetFunctionList and C_Initialize (including the retry without OS locking)
+    double load;
+    double functionList;
+    double initialize;
+
+    // C_Finalize and FreeLibrary
+    double finalize;
+    double unload;
+} PKCS11LoadTimes;
+
 class PKCS11Manager
 {
 private:
     static PKCS11Manager * m_Instance;
     static HINSTANCE hPKCS11;
     static CK_FUNCTION_LIST * pPKCS11;
+    static bool m_ThreadSafe;
 
 private:
     PKCS11Manager(void);
@@ -47,12 +60,28 @@ private:
 public:
     ~PKCS11Manager(void);
 
-    // Singleton creation / reference method.
-    static PKCS11Manager* Create(LPCTSTR libraryPath);
-    static void Destroy();
+    // Singleton creation / reference method. Each step of loading the library is timed into [times] when it isn't NULL.
+    static PKCS11Manager* Create(LPCTSTR libraryPath, PKCS11LoadTimes * times = NULL);
+
+    // Finalizes and unloads the library, timing each step into [times] when it isn't NULL. The next Create
+    // loads the library afresh; the instance itself is released by deleting it.
+    static void Destroy(PKCS11LoadTimes * times = NULL);
 
     // List the available slots
     int QuerySlots(bool tokenPresent, vector<PKCS11Slot> * slots);
 
+    // Query a single slot. Returns false if the slot no longer exists.
+    bool QuerySlot(CK_SLOT_ID id, PKCS11Slot * slot);
+
+    // Checks for a slot event without blocking. Returns CKR_OK with [slot] set,
+    // CKR_NO_EVENT if nothing has changed, or the library error.
+    CK_RV PollSlotEvent(CK_SLOT_ID * slot);
+
+    // Returns true if the library was initialised for use from multiple threads
+    static bool isThreadSafe();
+
+    // Returns the library function list (for constructing PKCS11Slot instances)
+    static CK_FUNCTION_LIST * getFunctionList();
+
 public:
 };
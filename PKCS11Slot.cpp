@@ -74,6 +74,7 @@ void PKCS11Slot::QueryToken(PKCS11Token * token) {
     token->label = Utility::CK_UTF8CHARtoString(info.label, 32);
     token->manufacturer = Utility::CK_UTF8CHARtoString(info.manufacturerID, 32);
     token->model = Utility::CK_UTF8CHARtoString(info.model, 16);
+    token->serial = Utility::CK_UTF8CHARtoString(info.serialNumber, 16);
     token->isLoginRequired = ((info.flags & CKF_LOGIN_REQUIRED) != 0);
     token->hasRNG = ((info.flags & CKF_RNG) != 0);
 
@@ -142,6 +143,31 @@ void PKCS11Slot::CloseSession() {
 
 }
 
+void PKCS11Slot::AttachSession(CK_SESSION_HANDLE session) {
+
+    if (NULL != m_SessionHandle) {
+        Log::warn("PKCS11Slot::AttachSession: Replacing an open session\n");
+    }
+
+    m_SessionHandle = session;
+}
+
+CK_SESSION_HANDLE PKCS11Slot::DetachSession() {
+
+    CK_SESSION_HANDLE session = m_SessionHandle;
+    m_SessionHandle = NULL;
+
+    return session;
+}
+
+bool PKCS11Slot::isSessionOpen() {
+    return NULL != m_SessionHandle;
+}
+
+CK_SESSION_HANDLE PKCS11Slot::getSession() {
+    return m_SessionHandle;
+}
+
 void PKCS11Slot::Login(string * pin) {
 
     Log::debug("PKCS11Slot::Login: Called\n");
@@ -326,13 +352,15 @@ bool PKCS11Slot::VerifySignature(int key, const char * in, int inLength, char *
     Utility::ThrowOnError(result, "PKCS11Slot::VerifySignature", "C_VerifyInit");
 
     result = m_pPKCS11->C_Verify(m_SessionHandle, (CK_BYTE_PTR)in, inLength, (CK_BYTE_PTR)signature, signatureLength);
-    Utility::ThrowOnError(result, "PKCS11Slot::VerifySignature", "C_Verify");
 
-    // Check for the specific invalid signature response
+    // Check for the specific invalid signature response (before it would be thrown as an error)
     if (CKR_SIGNATURE_INVALID == result) {
+        Log::debug("PKCS11Slot::VerifySignature: The signature is invalid\n");
         return false;
     }
 
+    Utility::ThrowOnError(result, "PKCS11Slot::VerifySignature", "C_Verify");
+
     // We must have succeeded!
     return true;
 }
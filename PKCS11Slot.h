@@ -73,6 +73,18 @@ public:
     // Close a session to the token
     void CloseSession();
 
+    // Uses a session opened elsewhere (such as a SessionPool) for the following operations
+    void AttachSession(CK_SESSION_HANDLE session);
+
+    // Stops using an attached session without closing it, and returns it
+    CK_SESSION_HANDLE DetachSession();
+
+    // Returns true if a session is open or attached
+    bool isSessionOpen();
+
+    // Returns the session in use (NULL if none)
+    CK_SESSION_HANDLE getSession();
+
     // Log into the token using the USER pin
     void Login(string * pin);
 
@@ -91,7 +103,7 @@ public:
     // Generate a signature for the supplied data using the specified key handle
     void GenerateSignature(int key, const char * in, int inLength, char * out, int * outLength);
 
-    // Verify a supplied signature for the given data using the specified key
+    // Verify a supplied signature for the given data using the specified key. Returns false if the signature is invalid.
     bool VerifySignature(int key, const char * in, int inLength, char * signature, int signatureLength);
 
     // Encrypt data using the specified public key
@@ -0,0 +1,211 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "StdAfx.h"
+#include "ProcessLauncher.h"
+
+#include <sstream>
+
+#include "Log.h"
+
+
+ProcessLauncher::ProcessLauncher(void)
+{
+}
+
+
+ProcessLauncher::~ProcessLauncher(void)
+{
+}
+
+bool ProcessLauncher::Run(int count, Results * results) {
+
+    Log::debug("ProcessLauncher::Run: Starting %d processes\n", count);
+
+    vector<ChildProcess> children(count);
+    wstring commandLine = GetCommandLine();
+    int started = 0;
+
+    for (int i = 0; i < count; i++) {
+
+        children[i].index = i;
+        children[i].process = NULL;
+        children[i].pipe = NULL;
+        children[i].reader = NULL;
+
+        // The write end is inherited by the child; the read end stays with us
+        SECURITY_ATTRIBUTES attributes = { sizeof(SECURITY_ATTRIBUTES), NULL, TRUE };
+        HANDLE readEnd, writeEnd;
+
+        if (!CreatePipe(&readEnd, &writeEnd, &attributes, 0)) {
+            Log::error("Unable to create the results pipe for process %d (%u)\n", i, GetLastError());
+            continue;
+        }
+
+        SetHandleInformation(readEnd, HANDLE_FLAG_INHERIT, 0);
+
+        wstringstream arguments;
+        arguments << commandLine << L" --child " << i << L"/" << count << L" --child-pipe " << (ULONG_PTR)writeEnd;
+
+        wstring line = arguments.str();
+        vector<wchar_t> buffer(line.begin(), line.end());
+        buffer.push_back(0);
+
+        STARTUPINFO startup;
+        PROCESS_INFORMATION information;
+        memset(&startup, 0, sizeof(startup));
+        startup.cb = sizeof(startup);
+
+        BOOL created = CreateProcess(NULL, &buffer[0], NULL, NULL, TRUE, 0, NULL, NULL, &startup, &information);
+
+        // Only the child may hold the write end, or the pipe would never report the child's exit.
+        // Closing it before the next child is created also keeps it from being inherited there.
+        CloseHandle(writeEnd);
+
+        if (!created) {
+            Log::error("Unable to start load test process %d (%u)\n", i, GetLastError());
+            CloseHandle(readEnd);
+            continue;
+        }
+
+        CloseHandle(information.hThread);
+        children[i].process = information.hProcess;
+        children[i].pipe = readEnd;
+        children[i].reader = CreateThread(NULL, 0, ReaderProc, &children[i], 0, NULL);
+
+        if (NULL == children[i].reader) ReaderProc(&children[i]);
+
+        Log::info("Started load test process %d of %d (PID %u)\n", i + 1, count, information.dwProcessId);
+        started++;
+    }
+
+    // The merged run takes its period from the children, which don't count their own startup
+    int completed = 0;
+
+    for (int i = 0; i < count; i++) {
+
+        ChildProcess * child = &children[i];
+        if (NULL == child->process) continue;
+
+        WaitForSingleObject(child->process, INFINITE);
+
+        DWORD exitCode = EXIT_FAILURE;
+        GetExitCodeProcess(child->process, &exitCode);
+        CloseHandle(child->process);
+
+        if (NULL != child->reader) {
+            WaitForSingleObject(child->reader, INFINITE);
+            CloseHandle(child->reader);
+        }
+
+        CloseHandle(child->pipe);
+
+        if (child->data.empty()) {
+            Log::warn("Process %d sent no results (exit code %u)\n", i + 1, exitCode);
+            if (EXIT_SUCCESS == exitCode) completed++;
+            continue;
+        }
+
+        Results childResults;
+        stringstream stream(child->data);
+        stringstream name;
+        name << "process " << i + 1;
+
+        if (!childResults.Read(stream, name.str())) continue;
+
+        results->Merge(&childResults);
+        if (EXIT_SUCCESS == exitCode) completed++;
+    }
+
+    Log::info("\n%d of %d load test processes completed\n", completed, count);
+    return (started == count) && (completed == count);
+}
+
+DWORD WINAPI ProcessLauncher::ReaderProc(LPVOID param) {
+
+    ChildProcess * child = (ChildProcess *)param;
+    char buffer[4096];
+    DWORD read = 0;
+
+    // Fails with ERROR_BROKEN_PIPE once the child has exited
+    while (ReadFile(child->pipe, buffer, sizeof(buffer), &read, NULL) && read > 0) {
+        child->data.append(buffer, read);
+    }
+
+    return 0;
+}
+
+bool ProcessLauncher::SendResults(ULONG_PTR pipe, Results * results) {
+
+    stringstream stream;
+    results->Write(stream);
+
+    string data = stream.str();
+    size_t offset = 0;
+    bool success = true;
+
+    while (offset < data.size()) {
+
+        DWORD written = 0;
+        if (!WriteFile((HANDLE)pipe, data.c_str() + offset, (DWORD)(data.size() - offset), &written, NULL)) {
+            Log::error("Unable to send the results to the launcher (%u)\n", GetLastError());
+            success = false;
+            break;
+        }
+
+        offset += written;
+    }
+
+    CloseHandle((HANDLE)pipe);
+    return success;
+}
+
+void ProcessLauncher::Report(Results * results) {
+
+    map<string, Histogram> * histograms = results->getHistograms();
+    map<string, Histogram> operations;
+
+    for (map<string, Histogram>::iterator entry = histograms->begin();
+            entry != histograms->end();
+            ++entry)
+    {
+        string operation, mechanism, serial;
+        Results::SplitKey(entry->first, &operation, &mechanism, &serial);
+        operations[operation].Merge(&entry->second);
+    }
+
+    double duration = results->getDuration();
+
+    Log::info("\nALL TOKENS (%.0f seconds):\n", duration);
+    Log::info("%-20s %10s %10s %10s %10s\n", "OPERATION", "COUNT", "OPS/S", "MEAN", "P99");
+
+    for (map<string, Histogram>::iterator entry = operations.begin();
+            entry != operations.end();
+            ++entry)
+    {
+        Log::info("%-20s %10llu %10.1f %7.1f ms %7.1f ms\n", entry->first.c_str(), entry->second.getCount(),
+                  (duration > 0) ? entry->second.getCount() / duration : 0,
+                  entry->second.getMean() / 1000.0, entry->second.getPercentile(99) / 1000.0);
+    }
+}
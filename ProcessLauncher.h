@@ -0,0 +1,71 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+#include "stdafx.h"
+
+#include <windows.h>
+#include <string>
+#include <vector>
+
+#include "Results.h"
+
+using namespace std;
+
+// A load test process started by the launcher
+typedef struct {
+    int index;
+    HANDLE process;
+
+    // The read end of the pipe the child sends its results over, and the thread draining it
+    HANDLE pipe;
+    HANDLE reader;
+
+    // Everything the child sent
+    string data;
+} ChildProcess;
+
+
+// Runs the load test in several processes, each with its own instance of the PKCS#11 library,
+// so that a library that serialises on a global lock can still drive its tokens in parallel.
+class ProcessLauncher
+{
+public:
+    ProcessLauncher(void);
+    ~ProcessLauncher(void);
+
+    // Starts [count] copies of this executable with the same arguments, each driving every [count]th
+    // token, and merges the results they send back into [results]. Returns true if all of them completed.
+    static bool Run(int count, Results * results);
+
+    // Sends a child's results to the launcher over the pipe it was given, and closes the pipe
+    static bool SendResults(ULONG_PTR pipe, Results * results);
+
+    // Logs the combined throughput and latency of each operation across all tokens
+    static void Report(Results * results);
+
+private:
+    // Reads everything a child sends until it exits
+    static DWORD WINAPI ReaderProc(LPVOID param);
+};
@@ -0,0 +1,261 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "StdAfx.h"
+#include "ProcessSampler.h"
+
+#include <fstream>
+#include <psapi.h>
+#include <tlhelp32.h>
+
+#include "Utility.h"
+#include "Log.h"
+
+// Display names and reporting units for each of the measures
+static const char * MEASURE_NAMES[PROCESS_MEASURE_COUNT] = { "Working Set", "Private Bytes", "Handles", "Threads" };
+static const char * MEASURE_UNITS[PROCESS_MEASURE_COUNT] = { "KB", "KB", "handles", "threads" };
+static const double MEASURE_SCALE[PROCESS_MEASURE_COUNT] = { 1024.0, 1024.0, 1.0, 1.0 };
+
+
+ProcessSampler::ProcessSampler(void)
+{
+    m_Thread = NULL;
+    m_StopEvent = NULL;
+    m_Interval = 0;
+    m_Iteration = NULL;
+    m_Affinity = NULL;
+    m_Cpu = 0;
+    m_Wall = 0;
+
+    for (int i = 0; i < PROCESS_MEASURE_COUNT; i++) m_Flagged[i] = false;
+
+    InitializeCriticalSection(&m_Lock);
+}
+
+
+ProcessSampler::~ProcessSampler(void)
+{
+    this->Stop();
+    DeleteCriticalSection(&m_Lock);
+}
+
+void ProcessSampler::Start(int interval, volatile LONG * iteration) {
+
+    Log::debug("ProcessSampler::Start: Called\n");
+
+    if (NULL != m_Thread) {
+        Log::warn("ProcessSampler::Start: Sampler is already running, ignoring\n");
+        return;
+    }
+
+    m_Interval = interval;
+    m_Iteration = iteration;
+
+    // Take a baseline sample before any load has been applied
+    this->Sample();
+
+    m_StopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    m_Thread = CreateThread(NULL, 0, ThreadProc, this, CREATE_SUSPENDED, NULL);
+
+    if (NULL == m_Thread) {
+        Log::error("ProcessSampler::Start: Unable to create the sampler thread\n");
+        CloseHandle(m_StopEvent);
+        m_StopEvent = NULL;
+        return;
+    }
+
+    if (NULL != m_Affinity) m_Affinity->PinService(m_Thread, "process sampler");
+    ResumeThread(m_Thread);
+
+    Log::info("Sampling process memory and handle counts every %d seconds to %s\n", interval, PROCESS_SAMPLE_FILE);
+}
+
+void ProcessSampler::Stop() {
+
+    if (NULL == m_Thread) return;
+
+    Log::debug("ProcessSampler::Stop: Called\n");
+
+    SetEvent(m_StopEvent);
+    WaitForSingleObject(m_Thread, INFINITE);
+    ThreadAffinity::QueryThreadTimes(m_Thread, &m_Cpu, &m_Wall);
+
+    CloseHandle(m_Thread);
+    CloseHandle(m_StopEvent);
+    m_Thread = NULL;
+    m_StopEvent = NULL;
+
+    // Final sample so that the trend covers the whole run
+    this->Sample();
+}
+
+void ProcessSampler::SetAffinity(ThreadAffinity * affinity) {
+    m_Affinity = affinity;
+}
+
+DWORD WINAPI ProcessSampler::ThreadProc(LPVOID param) {
+
+    ProcessSampler * sampler = (ProcessSampler *)param;
+
+    while (WAIT_TIMEOUT == WaitForSingleObject(sampler->m_StopEvent, sampler->m_Interval * 1000)) {
+        sampler->Sample();
+    }
+
+    return 0;
+}
+
+void ProcessSampler::QuerySample(ProcessSample * sample) {
+
+    memset(sample, 0, sizeof(ProcessSample));
+
+    HANDLE process = GetCurrentProcess();
+
+    // Memory counters (the _EX form carries the private bytes)
+    PROCESS_MEMORY_COUNTERS_EX counters;
+    memset(&counters, 0, sizeof(counters));
+    counters.cb = sizeof(counters);
+
+    if (GetProcessMemoryInfo(process, (PPROCESS_MEMORY_COUNTERS)&counters, sizeof(counters))) {
+        sample->workingSet = (double)counters.WorkingSetSize;
+        sample->privateBytes = (double)counters.PrivateUsage;
+    } else {
+        Log::debug("ProcessSampler::QuerySample: GetProcessMemoryInfo failed (%u)\n", GetLastError());
+    }
+
+    // Handle count
+    DWORD handles = 0;
+    if (GetProcessHandleCount(process, &handles)) {
+        sample->handleCount = (double)handles;
+    }
+
+    // Thread count (there is no direct call, so walk a thread snapshot)
+    HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+    if (INVALID_HANDLE_VALUE != snapshot) {
+
+        THREADENTRY32 entry;
+        entry.dwSize = sizeof(entry);
+        DWORD pid = GetCurrentProcessId();
+        int threads = 0;
+
+        if (Thread32First(snapshot, &entry)) {
+            do {
+                if (entry.th32OwnerProcessID == pid) threads++;
+            } while (Thread32Next(snapshot, &entry));
+        }
+
+        sample->threadCount = (double)threads;
+        CloseHandle(snapshot);
+    }
+}
+
+void ProcessSampler::Sample() {
+
+    ProcessSample sample;
+    QuerySample(&sample);
+    sample.iteration = (NULL != m_Iteration) ? *m_Iteration : 0;
+
+    Log::debug("ProcessSampler::Sample: Iteration %d, WS %.0f, Private %.0f, Handles %.0f, Threads %.0f\n",
+               sample.iteration, sample.workingSet, sample.privateBytes, sample.handleCount, sample.threadCount);
+
+    // Append to the sample file
+    ofstream o(PROCESS_SAMPLE_FILE, ios_base::app | ios_base::out);
+    o << Utility::CurrentDateTime() << "," << sample.iteration << ","
+      << (unsigned long long)sample.workingSet << "," << (unsigned long long)sample.privateBytes << ","
+      << (unsigned long)sample.handleCount << "," << (unsigned long)sample.threadCount << endl;
+    o.close();
+
+    RegressionResult results[PROCESS_MEASURE_COUNT];
+
+    EnterCriticalSection(&m_Lock);
+    m_Samples.push_back(sample);
+    this->Analyse(results);
+    LeaveCriticalSection(&m_Lock);
+
+    // Flag each measure once when it starts growing significantly, and again if it recovers
+    for (int i = 0; i < PROCESS_MEASURE_COUNT; i++) {
+
+        bool growing = Statistics::IsSignificantGrowth(&results[i]);
+
+        if (growing && !m_Flagged[i]) {
+            Log::warn("Possible leak - %s is growing by %.2f %s per 1000 transactions (t = %.1f, %d samples)\n",
+                      MEASURE_NAMES[i], results[i].slope * 1000 / MEASURE_SCALE[i], MEASURE_UNITS[i],
+                      results[i].tStatistic, results[i].count);
+        }
+        else if (!growing && m_Flagged[i]) {
+            Log::notice("%s is no longer growing significantly\n", MEASURE_NAMES[i]);
+        }
+
+        m_Flagged[i] = growing;
+    }
+}
+
+void ProcessSampler::Analyse(RegressionResult * results) {
+
+    vector<double> x;
+    vector<double> y[PROCESS_MEASURE_COUNT];
+
+    for (size_t i = 0; i < m_Samples.size(); i++) {
+        x.push_back((double)m_Samples[i].iteration);
+        y[0].push_back(m_Samples[i].workingSet);
+        y[1].push_back(m_Samples[i].privateBytes);
+        y[2].push_back(m_Samples[i].handleCount);
+        y[3].push_back(m_Samples[i].threadCount);
+    }
+
+    for (int i = 0; i < PROCESS_MEASURE_COUNT; i++) {
+        Statistics::LinearRegression(&x, &y[i], &results[i]);
+    }
+}
+
+void ProcessSampler::Report() {
+
+    RegressionResult results[PROCESS_MEASURE_COUNT];
+    size_t count;
+
+    EnterCriticalSection(&m_Lock);
+    count = m_Samples.size();
+    this->Analyse(results);
+    LeaveCriticalSection(&m_Lock);
+
+    if (count == 0) return;
+
+    Log::info("PROCESS RESOURCE TREND (%u samples):\n", (unsigned)count);
+
+    for (int i = 0; i < PROCESS_MEASURE_COUNT; i++) {
+
+        if (results[i].count < 3) {
+            Log::info(" - %-14s insufficient samples\n", MEASURE_NAMES[i]);
+            continue;
+        }
+
+        Log::info(" - %-14s %+10.2f %s per 1000 transactions (t = %.1f)%s\n",
+                  MEASURE_NAMES[i],
+                  results[i].slope * 1000 / MEASURE_SCALE[i],
+                  MEASURE_UNITS[i],
+                  results[i].tStatistic,
+                  Statistics::IsSignificantGrowth(&results[i]) ? " - SIGNIFICANT GROWTH" : "");
+    }
+
+    Log::info(" - %-14s %10.2f s CPU (%.2f%%)\n", "Sampler thread", m_Cpu / 1000000.0, (m_Wall > 0) ? m_Cpu * 100.0 / m_Wall : 0);
+}
@@ -0,0 +1,112 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+#include "stdafx.h"
+
+#include <windows.h>
+#include <string>
+#include <vector>
+
+#include "Statistics.h"
+#include "ThreadAffinity.h"
+
+using namespace std;
+
+// The file that process samples are appended to (CSV, same conventions as the token journals)
+#define PROCESS_SAMPLE_FILE     "process.log"
+
+// The number of measures tracked for each sample
+#define PROCESS_MEASURE_COUNT   4
+
+typedef struct {
+
+    // The number of transactions started (across all tokens) when the sample was taken
+    int iteration;
+
+    // Resident set (Working Set) in bytes
+    double workingSet;
+
+    // Committed private bytes
+    double privateBytes;
+
+    // Open kernel handle count
+    double handleCount;
+
+    // Number of threads owned by the process
+    double threadCount;
+
+} ProcessSample;
+
+
+class ProcessSampler
+{
+public:
+    ProcessSampler(void);
+    ~ProcessSampler(void);
+
+    // Starts the background sampler, taking a sample every [interval] seconds.
+    // The value pointed to by [iteration] (the transaction count) is recorded against each sample.
+    void Start(int interval, volatile LONG * iteration);
+
+    // Stops the background sampler, taking one final sample.
+    void Stop();
+
+    // Pins the sampler thread with [affinity] (call before Start)
+    void SetAffinity(ThreadAffinity * affinity);
+
+    // Logs the growth (per 1000 transactions) of each measure and whether it is significant.
+    void Report();
+
+    // Takes a single sample of the current process.
+    static void QuerySample(ProcessSample * sample);
+
+private:
+    // Background thread entry point
+    static DWORD WINAPI ThreadProc(LPVOID param);
+
+    // Takes a sample, appends it to the sample file and re-evaluates the growth trends.
+    void Sample();
+
+    // Fits each measure against the iteration count. [results] must hold PROCESS_MEASURE_COUNT entries.
+    void Analyse(RegressionResult * results);
+
+private:
+    HANDLE m_Thread;
+    HANDLE m_StopEvent;
+    CRITICAL_SECTION m_Lock;
+
+    int m_Interval;
+    volatile LONG * m_Iteration;
+    ThreadAffinity * m_Affinity;
+
+    // The CPU and wall time used by the sampler thread (microseconds)
+    double m_Cpu;
+    double m_Wall;
+
+    vector<ProcessSample> m_Samples;
+
+    // Tracks which measures have already been flagged, so the warning is only issued on a change
+    bool m_Flagged[PROCESS_MEASURE_COUNT];
+};
@@ -0,0 +1,403 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "StdAfx.h"
+#include "Results.h"
+
+#include <fstream>
+#include <sstream>
+#include <time.h>
+
+#include "Utility.h"
+#include "Log.h"
+
+
+Results::Results(void)
+{
+    m_StartTime = 0;
+    m_EndTime = 0;
+    m_Started = 0;
+    m_Duration = 0;
+
+    InitializeCriticalSection(&m_Lock);
+}
+
+
+Results::~Results(void)
+{
+    DeleteCriticalSection(&m_Lock);
+}
+
+void Results::Start() {
+    m_StartTime = (long long)time(NULL);
+    m_Started = Utility::QueryMicroseconds();
+}
+
+void Results::Resume() {
+    m_EndTime = 0;
+    m_Started = Utility::QueryMicroseconds() - m_Duration * 1000000.0;
+}
+
+void Results::Stop() {
+    m_EndTime = (long long)time(NULL);
+    m_Duration = (Utility::QueryMicroseconds() - m_Started) / 1000000.0;
+}
+
+string Results::MakeKey(string operation, string mechanism, string serial) {
+    return operation + " " + mechanism + " " + serial;
+}
+
+void Results::SplitKey(string key, string * operation, string * mechanism, string * serial) {
+
+    stringstream buffer(key);
+    buffer >> *operation >> *mechanism >> *serial;
+}
+
+void Results::Record(string serial, string operation, string mechanism, double microseconds) {
+
+    string key = MakeKey(operation, mechanism, serial);
+
+    EnterCriticalSection(&m_Lock);
+    m_Histograms[key].Record(microseconds);
+    LeaveCriticalSection(&m_Lock);
+}
+
+void Results::RecordError(string serial, string operation, string mechanism, unsigned long code) {
+
+    string key = MakeKey(operation, mechanism, serial);
+
+    EnterCriticalSection(&m_Lock);
+    m_Errors[key][code]++;
+    LeaveCriticalSection(&m_Lock);
+}
+
+void Results::Merge(Results * other) {
+
+    EnterCriticalSection(&m_Lock);
+
+    for (map<string, Histogram>::iterator entry = other->m_Histograms.begin();
+            entry != other->m_Histograms.end();
+            ++entry)
+    {
+        m_Histograms[entry->first].Merge(&entry->second);
+    }
+
+    for (map<string, ErrorCounts>::iterator entry = other->m_Errors.begin();
+            entry != other->m_Errors.end();
+            ++entry)
+    {
+        ErrorCounts * counts = &m_Errors[entry->first];
+
+        for (ErrorCounts::iterator code = entry->second.begin(); code != entry->second.end(); ++code) {
+            (*counts)[code->first] += code->second;
+        }
+    }
+
+    // The merged period covers both, but the busy time is the longest of the two,
+    // since merged results normally come from workers running side by side
+    if (m_StartTime == 0 || (other->m_StartTime != 0 && other->m_StartTime < m_StartTime)) m_StartTime = other->m_StartTime;
+    if (other->m_EndTime > m_EndTime) m_EndTime = other->m_EndTime;
+    if (other->m_Duration > m_Duration) m_Duration = other->m_Duration;
+
+    LeaveCriticalSection(&m_Lock);
+}
+
+void Results::Replace(string mechanism, Results * other) {
+
+    EnterCriticalSection(&m_Lock);
+
+    bool empty = m_Histograms.empty() && m_Errors.empty();
+
+    map<string, Histogram>::iterator histogram = m_Histograms.begin();
+    while (histogram != m_Histograms.end()) {
+        string operation, entryMechanism, serial;
+        SplitKey(histogram->first, &operation, &entryMechanism, &serial);
+
+        if (entryMechanism == mechanism) {
+            m_Histograms.erase(histogram++);
+        } else {
+            ++histogram;
+        }
+    }
+
+    map<string, ErrorCounts>::iterator errors = m_Errors.begin();
+    while (errors != m_Errors.end()) {
+        string operation, entryMechanism, serial;
+        SplitKey(errors->first, &operation, &entryMechanism, &serial);
+
+        if (entryMechanism == mechanism) {
+            m_Errors.erase(errors++);
+        } else {
+            ++errors;
+        }
+    }
+
+    for (map<string, Histogram>::iterator entry = other->m_Histograms.begin();
+            entry != other->m_Histograms.end();
+            ++entry)
+    {
+        m_Histograms[entry->first].Merge(&entry->second);
+    }
+
+    for (map<string, ErrorCounts>::iterator entry = other->m_Errors.begin();
+            entry != other->m_Errors.end();
+            ++entry)
+    {
+        ErrorCounts * counts = &m_Errors[entry->first];
+
+        for (ErrorCounts::iterator code = entry->second.begin(); code != entry->second.end(); ++code) {
+            (*counts)[code->first] += code->second;
+        }
+    }
+
+    // The rates of the results already here are over their own period, not the one just measured
+    if (empty) {
+        m_StartTime = other->m_StartTime;
+        m_EndTime = other->m_EndTime;
+        m_Duration = other->m_Duration;
+    }
+
+    LeaveCriticalSection(&m_Lock);
+}
+
+bool Results::Subtract(Results * earlier) {
+
+    bool contained = true;
+
+    EnterCriticalSection(&m_Lock);
+
+    for (map<string, Histogram>::iterator entry = earlier->m_Histograms.begin();
+            entry != earlier->m_Histograms.end();
+            ++entry)
+    {
+        if (!m_Histograms[entry->first].Subtract(&entry->second)) contained = false;
+    }
+
+    for (map<string, ErrorCounts>::iterator entry = earlier->m_Errors.begin();
+            entry != earlier->m_Errors.end();
+            ++entry)
+    {
+        ErrorCounts * counts = &m_Errors[entry->first];
+
+        for (ErrorCounts::iterator code = entry->second.begin(); code != entry->second.end(); ++code) {
+
+            unsigned long long * count = &(*counts)[code->first];
+
+            if (code->second > *count) {
+                contained = false;
+                *count = 0;
+            } else {
+                *count -= code->second;
+            }
+
+            if (*count == 0) counts->erase(code->first);
+        }
+
+        if (counts->empty()) m_Errors.erase(entry->first);
+    }
+
+    // Drop what the interval didn't touch
+    map<string, Histogram>::iterator entry = m_Histograms.begin();
+    while (entry != m_Histograms.end()) {
+        if (entry->second.getCount() == 0) {
+            m_Histograms.erase(entry++);
+        } else {
+            ++entry;
+        }
+    }
+
+    // The interval runs from the end of the earlier copy
+    m_StartTime = earlier->m_EndTime;
+    m_Duration -= earlier->m_Duration;
+    if (m_Duration < 0) m_Duration = 0;
+
+    LeaveCriticalSection(&m_Lock);
+
+    return contained;
+}
+
+void Results::Capture(Results * copy) {
+
+    EnterCriticalSection(&m_Lock);
+
+    copy->m_Histograms = m_Histograms;
+    copy->m_Errors = m_Errors;
+    copy->m_StartTime = m_StartTime;
+
+    // Still recording, so the period ends now
+    if (m_EndTime == 0) {
+        copy->m_EndTime = (long long)time(NULL);
+        copy->m_Duration = (Utility::QueryMicroseconds() - m_Started) / 1000000.0;
+    } else {
+        copy->m_EndTime = m_EndTime;
+        copy->m_Duration = m_Duration;
+    }
+
+    LeaveCriticalSection(&m_Lock);
+}
+
+double Results::getDuration() {
+    return m_Duration;
+}
+
+long long Results::getStartTime() {
+    return m_StartTime;
+}
+
+long long Results::getEndTime() {
+    return m_EndTime;
+}
+
+void Results::SetPeriod(long long startTime, long long endTime, double duration) {
+    m_StartTime = startTime;
+    m_EndTime = endTime;
+    m_Duration = duration;
+}
+
+map<string, Histogram> * Results::getHistograms() {
+    return &m_Histograms;
+}
+
+map<string, ErrorCounts> * Results::getErrors() {
+    return &m_Errors;
+}
+
+bool Results::Save(string path) {
+
+    Log::debug("Results::Save: Writing %s\n", path.c_str());
+
+    ofstream o(path.c_str(), ios_base::trunc | ios_base::out);
+    if (!o.is_open()) {
+        Log::error("Unable to write the results file %s\n", path.c_str());
+        return false;
+    }
+
+    this->Write(o);
+
+    o.close();
+    return !o.fail();
+}
+
+void Results::Write(ostream & o) {
+
+    EnterCriticalSection(&m_Lock);
+
+    o.precision(17);
+    o << RESULTS_HEADER << " " << RESULTS_VERSION << endl;
+    o << "START " << m_StartTime << endl;
+    o << "END " << m_EndTime << endl;
+    o << "DURATION " << m_Duration << endl;
+
+    for (map<string, Histogram>::iterator entry = m_Histograms.begin();
+            entry != m_Histograms.end();
+            ++entry)
+    {
+        o << "HISTOGRAM " << entry->first << " ";
+        entry->second.Write(o);
+        o << endl;
+    }
+
+    for (map<string, ErrorCounts>::iterator entry = m_Errors.begin();
+            entry != m_Errors.end();
+            ++entry)
+    {
+        for (ErrorCounts::iterator code = entry->second.begin(); code != entry->second.end(); ++code) {
+            o << "ERROR " << entry->first << " 0x" << hex << code->first << dec << " " << code->second << endl;
+        }
+    }
+
+    LeaveCriticalSection(&m_Lock);
+}
+
+bool Results::Load(string path) {
+
+    Log::debug("Results::Load: Reading %s\n", path.c_str());
+
+    ifstream in(path.c_str());
+    if (!in.is_open()) {
+        Log::error("Unable to open the results file %s\n", path.c_str());
+        return false;
+    }
+
+    return this->Read(in, path);
+}
+
+bool Results::Read(istream & in, string name) {
+
+    string header;
+    int version = 0;
+    in >> header >> version;
+
+    if (header != RESULTS_HEADER || version < 1 || version > RESULTS_VERSION) {
+        Log::error("%s is not a version 1 to %d results file\n", name.c_str(), RESULTS_VERSION);
+        return false;
+    }
+
+    string line;
+    while (getline(in, line)) {
+
+        stringstream buffer(line);
+        string type;
+        buffer >> type;
+
+        if (type == "START") {
+            buffer >> m_StartTime;
+        }
+        else if (type == "END") {
+            buffer >> m_EndTime;
+        }
+        else if (type == "DURATION") {
+            buffer >> m_Duration;
+        }
+        else if (type == "HISTOGRAM") {
+
+            string operation, mechanism, serial;
+            buffer >> operation >> mechanism >> serial;
+
+            Histogram * histogram = &m_Histograms[MakeKey(operation, mechanism, serial)];
+            if (!histogram->Read(buffer)) {
+                Log::error("%s contains an invalid histogram for %s %s %s\n",
+                           name.c_str(), operation.c_str(), mechanism.c_str(), serial.c_str());
+                return false;
+            }
+        }
+        else if (type == "ERROR") {
+
+            string operation, mechanism, serial;
+            unsigned long code = 0;
+            unsigned long long count = 0;
+
+            buffer >> operation >> mechanism >> serial >> hex >> code >> dec >> count;
+            if (buffer.fail()) {
+                Log::error("%s contains an invalid error count for %s %s %s\n",
+                           name.c_str(), operation.c_str(), mechanism.c_str(), serial.c_str());
+                return false;
+            }
+
+            m_Errors[MakeKey(operation, mechanism, serial)][code] = count;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,120 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+#include "stdafx.h"
+
+#include <windows.h>
+#include <string>
+#include <map>
+
+#include "Histogram.h"
+
+using namespace std;
+
+// The first line of a results file, followed by the format version.
+// Version 2 added the CK_RV counters; version 1 files are still read.
+#define RESULTS_HEADER          "PKCS11LOADTEST-RESULTS"
+#define RESULTS_VERSION         2
+
+// The number of failures of an operation against each CK_RV (CKR_OK counts failures raised by the
+// harness itself, such as a key that wasn't found)
+typedef map<unsigned long, unsigned long long> ErrorCounts;
+
+
+// Latency histograms for a run, keyed by operation, mechanism and token serial.
+class Results
+{
+public:
+    Results(void);
+    ~Results(void);
+
+    // Marks the start and end of the measured period
+    void Start();
+    void Stop();
+
+    // Continues the measured period of results read from a checkpoint, counting the time already measured
+    void Resume();
+
+    // Records the latency of a successful operation
+    void Record(string serial, string operation, string mechanism, double microseconds);
+
+    // Counts a failed operation against the CK_RV it failed with
+    void RecordError(string serial, string operation, string mechanism, unsigned long code);
+
+    // Adds the histograms from [other] and extends the measured period to cover both
+    void Merge(Results * other);
+
+    // Replaces the histograms and failure counts recorded under [mechanism] with those in [other]. The
+    // measured period is kept, since [other] was measured separately - unless these results are empty.
+    void Replace(string mechanism, Results * other);
+
+    // Removes the values in [earlier], an earlier copy of these results, leaving the interval between
+    // the two. Returns false if [earlier] holds values these results don't.
+    bool Subtract(Results * earlier);
+
+    // Copies everything recorded so far into [copy], ending its period now if still recording
+    void Capture(Results * copy);
+
+    // Writes / reads the results file
+    bool Save(string path);
+    bool Load(string path);
+
+    // Writes / reads the results file format on a stream. [name] identifies the source in errors.
+    void Write(ostream & stream);
+    bool Read(istream & stream, string name);
+
+    // Returns the length of the measured period in seconds
+    double getDuration();
+
+    // Returns the wall-clock start / end of the measured period (seconds since the epoch)
+    long long getStartTime();
+    long long getEndTime();
+
+    // Replaces the measured period
+    void SetPeriod(long long startTime, long long endTime, double duration);
+
+    // Returns the histograms. Not synchronised - only use once recording has finished.
+    map<string, Histogram> * getHistograms();
+
+    // Returns the failure counts, keyed as the histograms. Not synchronised, as above.
+    map<string, ErrorCounts> * getErrors();
+
+    // Builds a histogram key, and splits one back into its parts
+    static string MakeKey(string operation, string mechanism, string serial);
+    static void SplitKey(string key, string * operation, string * mechanism, string * serial);
+
+private:
+    CRITICAL_SECTION m_Lock;
+    map<string, Histogram> m_Histograms;
+    map<string, ErrorCounts> m_Errors;
+
+    // Wall-clock start / end of the measured period (seconds since the epoch)
+    long long m_StartTime;
+    long long m_EndTime;
+
+    // Elapsed time of the measured period
+    double m_Started;
+    double m_Duration;
+};
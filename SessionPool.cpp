@@ -0,0 +1,213 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "StdAfx.h"
+#include "SessionPool.h"
+
+#include "Utility.h"
+#include "Log.h"
+
+
+SessionPool::SessionPool(CK_FUNCTION_LIST * pPKCS11, CK_SLOT_ID slot, int size, string pin)
+{
+    m_pPKCS11 = pPKCS11;
+    m_Slot = slot;
+    m_Pin = pin;
+
+    m_Statistics.size = size;
+    m_Statistics.opened = 0;
+    m_Statistics.recycled = 0;
+
+    // Sessions are opened the first time they are handed out
+    m_Free.assign(size, (CK_SESSION_HANDLE)NULL);
+    m_Available = CreateSemaphore(NULL, size, size, NULL);
+
+    InitializeCriticalSection(&m_Lock);
+}
+
+
+SessionPool::~SessionPool(void)
+{
+    this->Close();
+    CloseHandle(m_Available);
+    DeleteCriticalSection(&m_Lock);
+}
+
+bool SessionPool::Acquire(CK_SESSION_HANDLE * session, HANDLE cancel) {
+
+    double started = Utility::QueryMicroseconds();
+
+    HANDLE handles[2] = { m_Available, cancel };
+    if (WAIT_OBJECT_0 != WaitForMultipleObjects((NULL != cancel) ? 2 : 1, handles, FALSE, INFINITE)) return false;
+
+    double acquired = Utility::QueryMicroseconds();
+
+    EnterCriticalSection(&m_Lock);
+    CK_SESSION_HANDLE candidate = m_Free.back();
+    m_Free.pop_back();
+    m_Statistics.wait.Record(acquired - started);
+    LeaveCriticalSection(&m_Lock);
+
+    // A session that has outlived its token (or been logged out) is replaced rather than handed out
+    if (NULL != candidate && !this->Check(candidate)) {
+        m_pPKCS11->C_CloseSession(candidate);
+        candidate = NULL;
+    }
+
+    if (NULL == candidate) {
+        try {
+            candidate = this->Open();
+        }
+        catch (...) {
+            Log::error("Unable to open a pooled session on slot %u\n", m_Slot);
+
+            EnterCriticalSection(&m_Lock);
+            m_Free.push_back((CK_SESSION_HANDLE)NULL);
+            LeaveCriticalSection(&m_Lock);
+
+            ReleaseSemaphore(m_Available, 1, NULL);
+            return false;
+        }
+    }
+
+    EnterCriticalSection(&m_Lock);
+    m_Acquired[candidate] = Utility::QueryMicroseconds();
+    LeaveCriticalSection(&m_Lock);
+
+    *session = candidate;
+    return true;
+}
+
+void SessionPool::Release(CK_SESSION_HANDLE session) {
+
+    EnterCriticalSection(&m_Lock);
+
+    map<CK_SESSION_HANDLE, double>::iterator acquired = m_Acquired.find(session);
+
+    if (acquired == m_Acquired.end()) {
+        LeaveCriticalSection(&m_Lock);
+        Log::warn("SessionPool::Release: Session %u was not handed out by this pool\n", session);
+        return;
+    }
+
+    m_Statistics.hold.Record(Utility::QueryMicroseconds() - acquired->second);
+    m_Acquired.erase(acquired);
+    m_Free.push_back(session);
+
+    LeaveCriticalSection(&m_Lock);
+
+    ReleaseSemaphore(m_Available, 1, NULL);
+}
+
+void SessionPool::Discard(CK_SESSION_HANDLE session) {
+
+    EnterCriticalSection(&m_Lock);
+
+    map<CK_SESSION_HANDLE, double>::iterator acquired = m_Acquired.find(session);
+
+    if (acquired == m_Acquired.end()) {
+        LeaveCriticalSection(&m_Lock);
+        Log::warn("SessionPool::Discard: Session %u was not handed out by this pool\n", session);
+        return;
+    }
+
+    m_Acquired.erase(acquired);
+    m_Free.push_back((CK_SESSION_HANDLE)NULL);
+
+    LeaveCriticalSection(&m_Lock);
+
+    ReleaseSemaphore(m_Available, 1, NULL);
+}
+
+void SessionPool::Close() {
+
+    Log::debug("SessionPool::Close: Called\n");
+
+    EnterCriticalSection(&m_Lock);
+
+    if (!m_Acquired.empty()) {
+        Log::warn("SessionPool::Close: %u sessions on slot %u are still in use\n", (unsigned)m_Acquired.size(), m_Slot);
+    }
+
+    // Errors are expected here if the token has gone, and there is nothing more to do about them
+    for (size_t i = 0; i < m_Free.size(); i++) {
+        if (NULL != m_Free[i]) {
+            m_pPKCS11->C_CloseSession(m_Free[i]);
+            m_Free[i] = NULL;
+        }
+    }
+
+    LeaveCriticalSection(&m_Lock);
+}
+
+void SessionPool::QueryStatistics(SessionPoolStatistics * statistics) {
+
+    EnterCriticalSection(&m_Lock);
+    *statistics = m_Statistics;
+    LeaveCriticalSection(&m_Lock);
+}
+
+bool SessionPool::Check(CK_SESSION_HANDLE session) {
+
+    CK_SESSION_INFO info;
+    CK_RV result = m_pPKCS11->C_GetSessionInfo(session, &info);
+
+    if (CKR_OK == result && (CKS_RO_USER_FUNCTIONS == info.state || CKS_RW_USER_FUNCTIONS == info.state)) return true;
+
+    Log::info("Replacing a pooled session on slot %u (%s)\n", m_Slot,
+              (CKR_OK == result) ? "no longer logged in" : Utility::ErrorToString(result));
+
+    EnterCriticalSection(&m_Lock);
+    m_Statistics.recycled++;
+    m_Statistics.reasons[result]++;
+    LeaveCriticalSection(&m_Lock);
+
+    return false;
+}
+
+CK_SESSION_HANDLE SessionPool::Open() {
+
+    CK_SESSION_HANDLE session;
+    CK_RV result;
+
+    result = m_pPKCS11->C_OpenSession(m_Slot, CKF_SERIAL_SESSION, NULL_PTR, NULL_PTR, &session);
+    Utility::ThrowOnError(result, "SessionPool::Open", "C_OpenSession");
+
+    // The login state is shared by every session with the token, so another pooled session may
+    // already have established it
+    result = m_pPKCS11->C_Login(session, CKU_USER, (CK_UTF8CHAR *)m_Pin.c_str(), m_Pin.length());
+
+    if (CKR_OK != result && CKR_USER_ALREADY_LOGGED_IN != result) {
+        m_pPKCS11->C_CloseSession(session);
+        Utility::ThrowOnError(result, "SessionPool::Open", "C_Login");
+    }
+
+    EnterCriticalSection(&m_Lock);
+    m_Statistics.opened++;
+    LeaveCriticalSection(&m_Lock);
+
+    Log::debug("SessionPool::Open: Opened session %u on slot %u\n", session, m_Slot);
+
+    return session;
+}
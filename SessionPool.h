@@ -0,0 +1,104 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+#include "stdafx.h"
+
+#include <windows.h>
+#include <string>
+#include <vector>
+#include <map>
+
+#include "include/cryptoki.h"
+#include "Histogram.h"
+
+using namespace std;
+
+// The counters and timings of a session pool, for reporting
+typedef struct {
+    int size;
+
+    // Sessions opened (including replacements) and replaced after failing the health check
+    int opened;
+    int recycled;
+
+    // The failed health checks, by the CK_RV from C_GetSessionInfo (CKR_OK when the session was no longer logged in)
+    map<CK_RV, int> reasons;
+
+    // Time spent waiting for a free session, and holding one (microseconds)
+    Histogram wait;
+    Histogram hold;
+} SessionPoolStatistics;
+
+
+// A fixed number of sessions with one token, kept open and logged in between transactions and shared
+// by the token's workers. Each session is checked with C_GetSessionInfo before it is handed out and
+// replaced if the check fails (e.g. CKR_SESSION_HANDLE_INVALID or CKR_DEVICE_REMOVED after the card
+// was pulled). The time workers wait for a session shows whether the pool, rather than the token,
+// is limiting the throughput.
+class SessionPool
+{
+public:
+    SessionPool(CK_FUNCTION_LIST * pPKCS11, CK_SLOT_ID slot, int size, string pin);
+    ~SessionPool(void);
+
+    // Waits for a free session, returning false if [cancel] is signalled first or a replacement
+    // session can't be opened and logged in.
+    bool Acquire(CK_SESSION_HANDLE * session, HANDLE cancel);
+
+    // Returns a session to the pool
+    void Release(CK_SESSION_HANDLE session);
+
+    // Drops a session handed out by Acquire that has been closed elsewhere (by the watchdog), without
+    // closing it again. A replacement is opened by a later Acquire.
+    void Discard(CK_SESSION_HANDLE session);
+
+    // Closes every session (none may be in use)
+    void Close();
+
+    // Returns a copy of the counters and timings
+    void QueryStatistics(SessionPoolStatistics * statistics);
+
+private:
+    // Returns true if [session] is still open and logged in
+    bool Check(CK_SESSION_HANDLE session);
+
+    // Opens and logs in a new session
+    CK_SESSION_HANDLE Open();
+
+private:
+    CK_FUNCTION_LIST * m_pPKCS11;
+    CK_SLOT_ID m_Slot;
+    string m_Pin;
+
+    // Counts the free sessions
+    HANDLE m_Available;
+    CRITICAL_SECTION m_Lock;
+
+    // The free sessions (NULL for one not opened yet), and when each session in use was handed out
+    vector<CK_SESSION_HANDLE> m_Free;
+    map<CK_SESSION_HANDLE, double> m_Acquired;
+
+    SessionPoolStatistics m_Statistics;
+};
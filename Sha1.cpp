@@ -0,0 +1,261 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "StdAfx.h"
+#include "Sha1.h"
+
+#include <string.h>
+#include <emmintrin.h>
+
+
+static const UINT32 SHA1_H0[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+static const UINT32 SHA1_K[4] = { 0x5a827999, 0x6ed9eba1, 0x8f1bbcdc, 0xca62c1d6 };
+
+#define ROTL(x, n)      (((x) << (n)) | ((x) >> (32 - (n))))
+
+// The same operations on four lanes at once
+#define VROTL(x, n)     _mm_or_si128(_mm_slli_epi32(x, n), _mm_srli_epi32(x, 32 - (n)))
+#define VADD(a, b)      _mm_add_epi32(a, b)
+#define VXOR(a, b)      _mm_xor_si128(a, b)
+#define VAND(a, b)      _mm_and_si128(a, b)
+#define VANDNOT(a, b)   _mm_andnot_si128(a, b)
+#define VOR(a, b)       _mm_or_si128(a, b)
+
+#define LOAD32(p)       (((UINT32)(p)[0] << 24) | ((UINT32)(p)[1] << 16) | ((UINT32)(p)[2] << 8) | (UINT32)(p)[3])
+
+
+Sha1::Sha1(void)
+{
+    this->Reset();
+}
+
+
+Sha1::~Sha1(void)
+{
+}
+
+void Sha1::Reset() {
+
+    memcpy(m_State, SHA1_H0, sizeof(m_State));
+    m_Buffered = 0;
+    m_Length = 0;
+}
+
+void Sha1::Update(const void * data, size_t length) {
+
+    const BYTE * in = (const BYTE *)data;
+    m_Length += length;
+
+    // Top up a partial block first
+    if (m_Buffered > 0) {
+
+        size_t take = SHA1_BLOCK_LENGTH - m_Buffered;
+        if (take > length) take = length;
+
+        memcpy(m_Buffer + m_Buffered, in, take);
+        m_Buffered += take;
+        in += take;
+        length -= take;
+
+        if (m_Buffered < SHA1_BLOCK_LENGTH) return;
+
+        Transform(m_State, m_Buffer, 1);
+        m_Buffered = 0;
+    }
+
+    // Whole blocks straight from the input
+    size_t blocks = length / SHA1_BLOCK_LENGTH;
+    if (blocks > 0) {
+        Transform(m_State, in, blocks);
+        in += blocks * SHA1_BLOCK_LENGTH;
+        length -= blocks * SHA1_BLOCK_LENGTH;
+    }
+
+    if (length > 0) {
+        memcpy(m_Buffer, in, length);
+        m_Buffered = length;
+    }
+}
+
+void Sha1::Final(BYTE * digest) {
+
+    unsigned long long bits = m_Length * 8;
+
+    // The padding - a single 1 bit, zeros, then the message length in bits (big-endian)
+    BYTE padding[SHA1_BLOCK_LENGTH * 2];
+    memset(padding, 0, sizeof(padding));
+    padding[0] = 0x80;
+
+    size_t padLength = (m_Buffered < 56) ? (56 - m_Buffered) : (120 - m_Buffered);
+
+    BYTE length[8];
+    for (int i = 0; i < 8; i++) length[i] = (BYTE)(bits >> (56 - i * 8));
+
+    this->Update(padding, padLength);
+    this->Update(length, sizeof(length));
+
+    for (int i = 0; i < 5; i++) {
+        digest[i * 4] = (BYTE)(m_State[i] >> 24);
+        digest[i * 4 + 1] = (BYTE)(m_State[i] >> 16);
+        digest[i * 4 + 2] = (BYTE)(m_State[i] >> 8);
+        digest[i * 4 + 3] = (BYTE)m_State[i];
+    }
+
+    this->Reset();
+}
+
+void Sha1::Hash(const void * data, size_t length, BYTE * digest) {
+
+    Sha1 hash;
+    hash.Update(data, length);
+    hash.Final(digest);
+}
+
+void Sha1::Transform(UINT32 * state, const BYTE * data, size_t count) {
+
+    UINT32 w[80];
+
+    while (count--) {
+
+        for (int t = 0; t < 16; t++) w[t] = LOAD32(data + t * 4);
+        for (int t = 16; t < 80; t++) w[t] = ROTL(w[t - 3] ^ w[t - 8] ^ w[t - 14] ^ w[t - 16], 1);
+
+        UINT32 a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+
+        for (int t = 0; t < 80; t++) {
+
+            UINT32 f;
+            if (t < 20)         f = (b & c) | (~b & d);
+            else if (t < 40)    f = b ^ c ^ d;
+            else if (t < 60)    f = (b & c) | (b & d) | (c & d);
+            else                f = b ^ c ^ d;
+
+            UINT32 temp = ROTL(a, 5) + f + e + SHA1_K[t / 20] + w[t];
+            e = d;
+            d = c;
+            c = ROTL(b, 30);
+            b = a;
+            a = temp;
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+
+        data += SHA1_BLOCK_LENGTH;
+    }
+}
+
+// One block of each lane. [blocks] holds a pointer per lane.
+static void TransformMultiple(__m128i * state, const BYTE * const * blocks) {
+
+    __m128i w[80];
+
+    for (int t = 0; t < 16; t++) {
+        w[t] = _mm_set_epi32((int)LOAD32(blocks[3] + t * 4), (int)LOAD32(blocks[2] + t * 4),
+                             (int)LOAD32(blocks[1] + t * 4), (int)LOAD32(blocks[0] + t * 4));
+    }
+
+    for (int t = 16; t < 80; t++) {
+        w[t] = VROTL(VXOR(VXOR(w[t - 3], w[t - 8]), VXOR(w[t - 14], w[t - 16])), 1);
+    }
+
+    __m128i a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+
+    for (int t = 0; t < 80; t++) {
+
+        __m128i f;
+        if (t < 20)         f = VOR(VAND(b, c), VANDNOT(b, d));
+        else if (t < 40)    f = VXOR(VXOR(b, c), d);
+        else if (t < 60)    f = VOR(VOR(VAND(b, c), VAND(b, d)), VAND(c, d));
+        else                f = VXOR(VXOR(b, c), d);
+
+        __m128i temp = VADD(VADD(VROTL(a, 5), f), VADD(VADD(e, _mm_set1_epi32((int)SHA1_K[t / 20])), w[t]));
+        e = d;
+        d = c;
+        c = VROTL(b, 30);
+        b = a;
+        a = temp;
+    }
+
+    state[0] = VADD(state[0], a);
+    state[1] = VADD(state[1], b);
+    state[2] = VADD(state[2], c);
+    state[3] = VADD(state[3], d);
+    state[4] = VADD(state[4], e);
+}
+
+void Sha1::HashMultiple(const BYTE * const * data, size_t length, BYTE * const * digests) {
+
+    // Every x64 processor has SSE2, but a 32-bit build may still meet one without
+    if (!IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE)) {
+        for (int lane = 0; lane < SHA1_LANES; lane++) Hash(data[lane], length, digests[lane]);
+        return;
+    }
+
+    __m128i state[5];
+    for (int i = 0; i < 5; i++) state[i] = _mm_set1_epi32((int)SHA1_H0[i]);
+
+    const BYTE * blocks[SHA1_LANES];
+    size_t whole = length / SHA1_BLOCK_LENGTH;
+
+    for (size_t block = 0; block < whole; block++) {
+        for (int lane = 0; lane < SHA1_LANES; lane++) blocks[lane] = data[lane] + block * SHA1_BLOCK_LENGTH;
+        TransformMultiple(state, blocks);
+    }
+
+    // The messages are the same length, so they all pad to the same number of final blocks
+    BYTE tail[SHA1_LANES][SHA1_BLOCK_LENGTH * 2];
+    size_t remainder = length % SHA1_BLOCK_LENGTH;
+    size_t tailLength = (remainder < 56) ? SHA1_BLOCK_LENGTH : SHA1_BLOCK_LENGTH * 2;
+    unsigned long long bits = (unsigned long long)length * 8;
+
+    for (int lane = 0; lane < SHA1_LANES; lane++) {
+        memset(tail[lane], 0, sizeof(tail[lane]));
+        memcpy(tail[lane], data[lane] + whole * SHA1_BLOCK_LENGTH, remainder);
+        tail[lane][remainder] = 0x80;
+        for (int i = 0; i < 8; i++) tail[lane][tailLength - 8 + i] = (BYTE)(bits >> (56 - i * 8));
+    }
+
+    for (size_t offset = 0; offset < tailLength; offset += SHA1_BLOCK_LENGTH) {
+        for (int lane = 0; lane < SHA1_LANES; lane++) blocks[lane] = tail[lane] + offset;
+        TransformMultiple(state, blocks);
+    }
+
+    UINT32 words[SHA1_LANES];
+
+    for (int i = 0; i < 5; i++) {
+
+        _mm_storeu_si128((__m128i *)words, state[i]);
+
+        for (int lane = 0; lane < SHA1_LANES; lane++) {
+            digests[lane][i * 4] = (BYTE)(words[lane] >> 24);
+            digests[lane][i * 4 + 1] = (BYTE)(words[lane] >> 16);
+            digests[lane][i * 4 + 2] = (BYTE)(words[lane] >> 8);
+            digests[lane][i * 4 + 3] = (BYTE)words[lane];
+        }
+    }
+}
@@ -0,0 +1,72 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+#include "stdafx.h"
+
+#include <windows.h>
+
+// The length of a SHA-1 digest (bytes)
+#define SHA1_DIGEST_LENGTH      20
+
+// The length of a SHA-1 input block (bytes)
+#define SHA1_BLOCK_LENGTH       64
+
+// The number of messages hashed together by HashMultiple
+#define SHA1_LANES              4
+
+
+// An incremental SHA-1 hash (FIPS 180-4), with a multi-buffer form that hashes several messages
+// of the same length at once in the lanes of the SSE2 registers.
+class Sha1
+{
+public:
+    Sha1(void);
+    ~Sha1(void);
+
+    // Adds [length] bytes to the hash
+    void Update(const void * data, size_t length);
+
+    // Completes the hash, writing SHA1_DIGEST_LENGTH bytes to [digest]. The hash is reset afterwards.
+    void Final(BYTE * digest);
+
+    // Hashes [length] bytes in one call
+    static void Hash(const void * data, size_t length, BYTE * digest);
+
+    // Hashes SHA1_LANES messages of [length] bytes each, writing a digest for each
+    static void HashMultiple(const BYTE * const * data, size_t length, BYTE * const * digests);
+
+private:
+    // Restores the initial hash value
+    void Reset();
+
+    // Processes [count] whole blocks
+    static void Transform(UINT32 * state, const BYTE * data, size_t count);
+
+private:
+    UINT32 m_State[5];
+    BYTE m_Buffer[SHA1_BLOCK_LENGTH];
+    size_t m_Buffered;
+    unsigned long long m_Length;
+};
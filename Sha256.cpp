@@ -0,0 +1,409 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "StdAfx.h"
+#include "Sha256.h"
+
+#include <string.h>
+#include <intrin.h>
+#include <emmintrin.h>
+
+#ifdef SHA256_SHANI
+#include <immintrin.h>
+#endif
+
+
+// The block function for this processor, chosen on first use
+typedef void (*Sha256Transform)(UINT32 * state, const BYTE * data, size_t count);
+
+static Sha256Transform _transform = NULL;
+static const char * _implementation = "portable";
+static char _features[64] = "";
+
+static const UINT32 SHA256_K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const UINT32 SHA256_H0[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+#define ROTR(x, n)      (((x) >> (n)) | ((x) << (32 - (n))))
+#define CH(x, y, z)     (((x) & (y)) ^ (~(x) & (z)))
+#define MAJ(x, y, z)    (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+#define SIGMA0(x)       (ROTR(x, 2) ^ ROTR(x, 13) ^ ROTR(x, 22))
+#define SIGMA1(x)       (ROTR(x, 6) ^ ROTR(x, 11) ^ ROTR(x, 25))
+#define GAMMA0(x)       (ROTR(x, 7) ^ ROTR(x, 18) ^ ((x) >> 3))
+#define GAMMA1(x)       (ROTR(x, 17) ^ ROTR(x, 19) ^ ((x) >> 10))
+
+// The same functions on four lanes at once (SSE2 has no rotate, so each is two shifts)
+#define VROTR(x, n)     _mm_or_si128(_mm_srli_epi32(x, n), _mm_slli_epi32(x, 32 - (n)))
+#define VADD(a, b)      _mm_add_epi32(a, b)
+#define VXOR(a, b)      _mm_xor_si128(a, b)
+#define VAND(a, b)      _mm_and_si128(a, b)
+#define VCH(x, y, z)    _mm_xor_si128(_mm_and_si128(x, y), _mm_andnot_si128(x, z))
+#define VMAJ(x, y, z)   VXOR(VXOR(VAND(x, y), VAND(x, z)), VAND(y, z))
+#define VSIGMA0(x)      VXOR(VXOR(VROTR(x, 2), VROTR(x, 13)), VROTR(x, 22))
+#define VSIGMA1(x)      VXOR(VXOR(VROTR(x, 6), VROTR(x, 11)), VROTR(x, 25))
+#define VGAMMA0(x)      VXOR(VXOR(VROTR(x, 7), VROTR(x, 18)), _mm_srli_epi32(x, 3))
+#define VGAMMA1(x)      VXOR(VXOR(VROTR(x, 17), VROTR(x, 19)), _mm_srli_epi32(x, 10))
+
+#define LOAD32(p)       (((UINT32)(p)[0] << 24) | ((UINT32)(p)[1] << 16) | ((UINT32)(p)[2] << 8) | (UINT32)(p)[3])
+
+
+Sha256::Sha256(void)
+{
+    Initialise();
+    this->Reset();
+}
+
+
+Sha256::~Sha256(void)
+{
+}
+
+void Sha256::Reset() {
+
+    memcpy(m_State, SHA256_H0, sizeof(m_State));
+    m_Buffered = 0;
+    m_Length = 0;
+}
+
+void Sha256::Update(const void * data, size_t length) {
+
+    const BYTE * in = (const BYTE *)data;
+    m_Length += length;
+
+    // Top up a partial block first
+    if (m_Buffered > 0) {
+
+        size_t take = SHA256_BLOCK_LENGTH - m_Buffered;
+        if (take > length) take = length;
+
+        memcpy(m_Buffer + m_Buffered, in, take);
+        m_Buffered += take;
+        in += take;
+        length -= take;
+
+        if (m_Buffered < SHA256_BLOCK_LENGTH) return;
+
+        _transform(m_State, m_Buffer, 1);
+        m_Buffered = 0;
+    }
+
+    // Whole blocks straight from the input
+    size_t blocks = length / SHA256_BLOCK_LENGTH;
+    if (blocks > 0) {
+        _transform(m_State, in, blocks);
+        in += blocks * SHA256_BLOCK_LENGTH;
+        length -= blocks * SHA256_BLOCK_LENGTH;
+    }
+
+    if (length > 0) {
+        memcpy(m_Buffer, in, length);
+        m_Buffered = length;
+    }
+}
+
+void Sha256::Final(BYTE * digest) {
+
+    unsigned long long bits = m_Length * 8;
+
+    // The padding - a single 1 bit, zeros, then the message length in bits (big-endian)
+    BYTE padding[SHA256_BLOCK_LENGTH * 2];
+    memset(padding, 0, sizeof(padding));
+    padding[0] = 0x80;
+
+    size_t padLength = (m_Buffered < 56) ? (56 - m_Buffered) : (120 - m_Buffered);
+
+    BYTE length[8];
+    for (int i = 0; i < 8; i++) length[i] = (BYTE)(bits >> (56 - i * 8));
+
+    this->Update(padding, padLength);
+    this->Update(length, sizeof(length));
+
+    for (int i = 0; i < 8; i++) {
+        digest[i * 4] = (BYTE)(m_State[i] >> 24);
+        digest[i * 4 + 1] = (BYTE)(m_State[i] >> 16);
+        digest[i * 4 + 2] = (BYTE)(m_State[i] >> 8);
+        digest[i * 4 + 3] = (BYTE)m_State[i];
+    }
+
+    this->Reset();
+}
+
+void Sha256::Hash(const void * data, size_t length, BYTE * digest) {
+
+    Sha256 hash;
+    hash.Update(data, length);
+    hash.Final(digest);
+}
+
+// One block of each lane. [blocks] holds a pointer per lane.
+static void TransformMultiple(__m128i * state, const BYTE * const * blocks) {
+
+    __m128i w[64];
+
+    for (int t = 0; t < 16; t++) {
+        w[t] = _mm_set_epi32((int)LOAD32(blocks[3] + t * 4), (int)LOAD32(blocks[2] + t * 4),
+                             (int)LOAD32(blocks[1] + t * 4), (int)LOAD32(blocks[0] + t * 4));
+    }
+
+    for (int t = 16; t < 64; t++) {
+        w[t] = VADD(VADD(VGAMMA1(w[t - 2]), w[t - 7]), VADD(VGAMMA0(w[t - 15]), w[t - 16]));
+    }
+
+    __m128i a = state[0], b = state[1], c = state[2], d = state[3];
+    __m128i e = state[4], f = state[5], g = state[6], h = state[7];
+
+    for (int t = 0; t < 64; t++) {
+
+        __m128i t1 = VADD(VADD(h, VSIGMA1(e)), VADD(VCH(e, f, g), VADD(_mm_set1_epi32((int)SHA256_K[t]), w[t])));
+        __m128i t2 = VADD(VSIGMA0(a), VMAJ(a, b, c));
+
+        h = g;
+        g = f;
+        f = e;
+        e = VADD(d, t1);
+        d = c;
+        c = b;
+        b = a;
+        a = VADD(t1, t2);
+    }
+
+    state[0] = VADD(state[0], a);
+    state[1] = VADD(state[1], b);
+    state[2] = VADD(state[2], c);
+    state[3] = VADD(state[3], d);
+    state[4] = VADD(state[4], e);
+    state[5] = VADD(state[5], f);
+    state[6] = VADD(state[6], g);
+    state[7] = VADD(state[7], h);
+}
+
+void Sha256::HashMultiple(const BYTE * const * data, size_t length, BYTE * const * digests) {
+
+    // Every x64 processor has SSE2, but a 32-bit build may still meet one without
+    if (!IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE)) {
+        for (int lane = 0; lane < SHA256_LANES; lane++) Hash(data[lane], length, digests[lane]);
+        return;
+    }
+
+    __m128i state[8];
+    for (int i = 0; i < 8; i++) state[i] = _mm_set1_epi32((int)SHA256_H0[i]);
+
+    const BYTE * blocks[SHA256_LANES];
+    size_t whole = length / SHA256_BLOCK_LENGTH;
+
+    for (size_t block = 0; block < whole; block++) {
+        for (int lane = 0; lane < SHA256_LANES; lane++) blocks[lane] = data[lane] + block * SHA256_BLOCK_LENGTH;
+        TransformMultiple(state, blocks);
+    }
+
+    // The messages are the same length, so they all pad to the same number of final blocks
+    BYTE tail[SHA256_LANES][SHA256_BLOCK_LENGTH * 2];
+    size_t remainder = length % SHA256_BLOCK_LENGTH;
+    size_t tailLength = (remainder < 56) ? SHA256_BLOCK_LENGTH : SHA256_BLOCK_LENGTH * 2;
+    unsigned long long bits = (unsigned long long)length * 8;
+
+    for (int lane = 0; lane < SHA256_LANES; lane++) {
+        memset(tail[lane], 0, sizeof(tail[lane]));
+        memcpy(tail[lane], data[lane] + whole * SHA256_BLOCK_LENGTH, remainder);
+        tail[lane][remainder] = 0x80;
+        for (int i = 0; i < 8; i++) tail[lane][tailLength - 8 + i] = (BYTE)(bits >> (56 - i * 8));
+    }
+
+    for (size_t offset = 0; offset < tailLength; offset += SHA256_BLOCK_LENGTH) {
+        for (int lane = 0; lane < SHA256_LANES; lane++) blocks[lane] = tail[lane] + offset;
+        TransformMultiple(state, blocks);
+    }
+
+    UINT32 words[SHA256_LANES];
+
+    for (int i = 0; i < 8; i++) {
+
+        _mm_storeu_si128((__m128i *)words, state[i]);
+
+        for (int lane = 0; lane < SHA256_LANES; lane++) {
+            digests[lane][i * 4] = (BYTE)(words[lane] >> 24);
+            digests[lane][i * 4 + 1] = (BYTE)(words[lane] >> 16);
+            digests[lane][i * 4 + 2] = (BYTE)(words[lane] >> 8);
+            digests[lane][i * 4 + 3] = (BYTE)words[lane];
+        }
+    }
+}
+
+const char * Sha256::getImplementation() {
+    Initialise();
+    return _implementation;
+}
+
+const char * Sha256::getProcessorFeatures() {
+    Initialise();
+    return _features;
+}
+
+void Sha256::Initialise() {
+
+    if (NULL != _transform) return;
+
+    // CPUID leaf 1 ECX: SSSE3 (bit 9), SSE4.1 (bit 19). Leaf 7 EBX: AVX2 (bit 5), SHA (bit 29).
+    int info[4] = { 0, 0, 0, 0 };
+    __cpuid(info, 0);
+    int leaves = info[0];
+
+    bool ssse3 = false, sse41 = false, avx2 = false, sha = false;
+
+    __cpuid(info, 1);
+    ssse3 = (info[2] & (1 << 9)) != 0;
+    sse41 = (info[2] & (1 << 19)) != 0;
+
+    if (leaves >= 7) {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+        sha = (info[1] & (1 << 29)) != 0;
+    }
+
+    _features[0] = '\0';
+    if (ssse3) strcat_s(_features, sizeof(_features), "SSSE3 ");
+    if (sse41) strcat_s(_features, sizeof(_features), "SSE4.1 ");
+    if (avx2) strcat_s(_features, sizeof(_features), "AVX2 ");
+    if (sha) strcat_s(_features, sizeof(_features), "SHA ");
+    if (_features[0] == '\0') strcat_s(_features, sizeof(_features), "none");
+
+    Sha256Transform transform = TransformPortable;
+
+#ifdef SHA256_SHANI
+    if (sha && ssse3 && sse41) {
+        transform = TransformExtensions;
+        _implementation = "SHA extensions";
+    }
+#endif
+
+    // Every thread arrives at the same answer, so a race here is harmless
+    _transform = transform;
+}
+
+void Sha256::TransformPortable(UINT32 * state, const BYTE * data, size_t count) {
+
+    UINT32 w[64];
+
+    while (count--) {
+
+        for (int t = 0; t < 16; t++) {
+            w[t] = ((UINT32)data[t * 4] << 24) | ((UINT32)data[t * 4 + 1] << 16) | ((UINT32)data[t * 4 + 2] << 8) | (UINT32)data[t * 4 + 3];
+        }
+
+        for (int t = 16; t < 64; t++) {
+            w[t] = GAMMA1(w[t - 2]) + w[t - 7] + GAMMA0(w[t - 15]) + w[t - 16];
+        }
+
+        UINT32 a = state[0], b = state[1], c = state[2], d = state[3];
+        UINT32 e = state[4], f = state[5], g = state[6], h = state[7];
+
+        for (int t = 0; t < 64; t++) {
+
+            UINT32 t1 = h + SIGMA1(e) + CH(e, f, g) + SHA256_K[t] + w[t];
+            UINT32 t2 = SIGMA0(a) + MAJ(a, b, c);
+
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+
+        data += SHA256_BLOCK_LENGTH;
+    }
+}
+
+#ifdef SHA256_SHANI
+void Sha256::TransformExtensions(UINT32 * state, const BYTE * data, size_t count) {
+
+    // Byte swaps each 32-bit word of the message to big-endian
+    const __m128i swap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    // The instructions work on the state as ABEF and CDGH
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xB1);
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1B);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+    while (count--) {
+
+        __m128i abef = state0;
+        __m128i cdgh = state1;
+        __m128i w[4];
+
+        for (int i = 0; i < 16; i++) {
+
+            // Four rounds at a time - the first sixteen words are the message, the rest are scheduled
+            if (i < 4) {
+                w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + i * 16)), swap);
+            } else {
+                __m128i next = _mm_sha256msg1_epu32(w[i % 4], w[(i + 1) % 4]);
+                next = _mm_add_epi32(next, _mm_alignr_epi8(w[(i + 3) % 4], w[(i + 2) % 4], 4));
+                w[i % 4] = _mm_sha256msg2_epu32(next, w[(i + 3) % 4]);
+            }
+
+            __m128i message = _mm_add_epi32(w[i % 4], _mm_loadu_si128((const __m128i *)&SHA256_K[i * 4]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, message);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(message, 0x0E));
+        }
+
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+
+        data += SHA256_BLOCK_LENGTH;
+    }
+
+    // Back to ABCD and EFGH
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+    state1 = _mm_alignr_epi8(state1, tmp, 8);
+
+    _mm_storeu_si128((__m128i *)&state[0], state0);
+    _mm_storeu_si128((__m128i *)&state[4], state1);
+}
+#endif
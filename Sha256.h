@@ -0,0 +1,89 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+#include "stdafx.h"
+
+#include <windows.h>
+
+// The length of a SHA-256 digest (bytes)
+#define SHA256_DIGEST_LENGTH    32
+
+// The length of a SHA-256 input block (bytes)
+#define SHA256_BLOCK_LENGTH     64
+
+// The number of messages hashed together by HashMultiple
+#define SHA256_LANES            4
+
+// The SHA extensions are only available as intrinsics from Visual Studio 2015 onwards. Older
+// toolsets use the portable implementation on every processor.
+#if defined(_MSC_VER) && (_MSC_VER >= 1900) && !defined(SHA256_SHANI)
+#define SHA256_SHANI
+#endif
+
+
+// An incremental SHA-256 hash (FIPS 180-4). The block function is chosen once for the processor:
+// the SHA extensions where they are available, otherwise a portable implementation.
+class Sha256
+{
+public:
+    Sha256(void);
+    ~Sha256(void);
+
+    // Adds [length] bytes to the hash
+    void Update(const void * data, size_t length);
+
+    // Completes the hash, writing SHA256_DIGEST_LENGTH bytes to [digest]. The hash is reset afterwards.
+    void Final(BYTE * digest);
+
+    // Hashes [length] bytes in one call
+    static void Hash(const void * data, size_t length, BYTE * digest);
+
+    // Hashes SHA256_LANES messages of [length] bytes each, one per lane of the SSE2 registers,
+    // writing a digest for each
+    static void HashMultiple(const BYTE * const * data, size_t length, BYTE * const * digests);
+
+    // Returns the name of the block function in use, and of the relevant processor extensions present
+    static const char * getImplementation();
+    static const char * getProcessorFeatures();
+
+private:
+    // Restores the initial hash value
+    void Reset();
+
+    // Selects the block function for this processor
+    static void Initialise();
+
+    // Processes [count] whole blocks
+    static void TransformPortable(UINT32 * state, const BYTE * data, size_t count);
+#ifdef SHA256_SHANI
+    static void TransformExtensions(UINT32 * state, const BYTE * data, size_t count);
+#endif
+
+private:
+    UINT32 m_State[8];
+    BYTE m_Buffer[SHA256_BLOCK_LENGTH];
+    size_t m_Buffered;
+    unsigned long long m_Length;
+};
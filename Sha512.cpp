@@ -0,0 +1,210 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "StdAfx.h"
+#include "Sha512.h"
+
+#include <string.h>
+
+
+static const UINT64 SHA512_K[80] = {
+    0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+    0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL, 0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+    0xd807aa98a3030242ULL, 0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+    0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+    0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL, 0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+    0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+    0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+    0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL, 0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+    0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+    0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+    0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL, 0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+    0xd192e819d6ef5218ULL, 0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+    0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+    0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL, 0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+    0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+    0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+    0xca273eceea26619cULL, 0xd186b8c721c0c207ULL, 0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+    0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+    0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+    0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL, 0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL
+};
+
+static const UINT64 SHA512_H0[8] = {
+    0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+    0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+};
+
+static const UINT64 SHA384_H0[8] = {
+    0xcbbb9d5dc1059ed8ULL, 0x629a292a367cd507ULL, 0x9159015a3070dd17ULL, 0x152fecd8f70e5939ULL,
+    0x67332667ffc00b31ULL, 0x8eb44a8768581511ULL, 0xdb0c2e0d64f98fa7ULL, 0x47b5481dbefa4fa4ULL
+};
+
+#define ROTR(x, n)      (((x) >> (n)) | ((x) << (64 - (n))))
+#define CH(x, y, z)     (((x) & (y)) ^ (~(x) & (z)))
+#define MAJ(x, y, z)    (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+#define SIGMA0(x)       (ROTR(x, 28) ^ ROTR(x, 34) ^ ROTR(x, 39))
+#define SIGMA1(x)       (ROTR(x, 14) ^ ROTR(x, 18) ^ ROTR(x, 41))
+#define GAMMA0(x)       (ROTR(x, 1) ^ ROTR(x, 8) ^ ((x) >> 7))
+#define GAMMA1(x)       (ROTR(x, 19) ^ ROTR(x, 61) ^ ((x) >> 6))
+
+
+Sha512::Sha512(bool truncated)
+{
+    m_Truncated = truncated;
+    this->Reset();
+}
+
+
+Sha512::~Sha512(void)
+{
+}
+
+void Sha512::Reset() {
+
+    memcpy(m_State, m_Truncated ? SHA384_H0 : SHA512_H0, sizeof(m_State));
+    m_Buffered = 0;
+    m_Length = 0;
+}
+
+int Sha512::getDigestLength() {
+    return m_Truncated ? SHA384_DIGEST_LENGTH : SHA512_DIGEST_LENGTH;
+}
+
+void Sha512::Update(const void * data, size_t length) {
+
+    const BYTE * in = (const BYTE *)data;
+    m_Length += length;
+
+    // Top up a partial block first
+    if (m_Buffered > 0) {
+
+        size_t take = SHA512_BLOCK_LENGTH - m_Buffered;
+        if (take > length) take = length;
+
+        memcpy(m_Buffer + m_Buffered, in, take);
+        m_Buffered += take;
+        in += take;
+        length -= take;
+
+        if (m_Buffered < SHA512_BLOCK_LENGTH) return;
+
+        Transform(m_State, m_Buffer, 1);
+        m_Buffered = 0;
+    }
+
+    // Whole blocks straight from the input
+    size_t blocks = length / SHA512_BLOCK_LENGTH;
+    if (blocks > 0) {
+        Transform(m_State, in, blocks);
+        in += blocks * SHA512_BLOCK_LENGTH;
+        length -= blocks * SHA512_BLOCK_LENGTH;
+    }
+
+    if (length > 0) {
+        memcpy(m_Buffer, in, length);
+        m_Buffered = length;
+    }
+}
+
+void Sha512::Final(BYTE * digest) {
+
+    unsigned long long bits = m_Length * 8;
+
+    // The padding - a single 1 bit, zeros, then the message length as a 128-bit big-endian count
+    // (the upper half is always zero here)
+    BYTE padding[SHA512_BLOCK_LENGTH * 2];
+    memset(padding, 0, sizeof(padding));
+    padding[0] = 0x80;
+
+    size_t padLength = (m_Buffered < 112) ? (112 - m_Buffered) : (240 - m_Buffered);
+
+    BYTE length[16];
+    memset(length, 0, sizeof(length));
+    for (int i = 0; i < 8; i++) length[8 + i] = (BYTE)(bits >> (56 - i * 8));
+
+    this->Update(padding, padLength);
+    this->Update(length, sizeof(length));
+
+    int words = this->getDigestLength() / 8;
+
+    for (int i = 0; i < words; i++) {
+        for (int j = 0; j < 8; j++) digest[i * 8 + j] = (BYTE)(m_State[i] >> (56 - j * 8));
+    }
+
+    this->Reset();
+}
+
+void Sha512::Hash(const void * data, size_t length, BYTE * digest, bool truncated) {
+
+    Sha512 hash(truncated);
+    hash.Update(data, length);
+    hash.Final(digest);
+}
+
+void Sha512::Transform(UINT64 * state, const BYTE * data, size_t count) {
+
+    UINT64 w[80];
+
+    while (count--) {
+
+        for (int t = 0; t < 16; t++) {
+            w[t] = 0;
+            for (int j = 0; j < 8; j++) w[t] = (w[t] << 8) | data[t * 8 + j];
+        }
+
+        for (int t = 16; t < 80; t++) {
+            w[t] = GAMMA1(w[t - 2]) + w[t - 7] + GAMMA0(w[t - 15]) + w[t - 16];
+        }
+
+        UINT64 a = state[0], b = state[1], c = state[2], d = state[3];
+        UINT64 e = state[4], f = state[5], g = state[6], h = state[7];
+
+        for (int t = 0; t < 80; t++) {
+
+            UINT64 t1 = h + SIGMA1(e) + CH(e, f, g) + SHA512_K[t] + w[t];
+            UINT64 t2 = SIGMA0(a) + MAJ(a, b, c);
+
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+
+        data += SHA512_BLOCK_LENGTH;
+    }
+}
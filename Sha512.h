@@ -0,0 +1,71 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+#include "stdafx.h"
+
+#include <windows.h>
+
+// The length of a SHA-512 and SHA-384 digest (bytes)
+#define SHA512_DIGEST_LENGTH    64
+#define SHA384_DIGEST_LENGTH    48
+
+// The length of a SHA-512 input block (bytes)
+#define SHA512_BLOCK_LENGTH     128
+
+
+// An incremental SHA-512 hash (FIPS 180-4). SHA-384 is the same function with a different
+// initial hash value and a truncated digest, so it is selected with [truncated].
+class Sha512
+{
+public:
+    Sha512(bool truncated = false);
+    ~Sha512(void);
+
+    // Adds [length] bytes to the hash
+    void Update(const void * data, size_t length);
+
+    // Completes the hash, writing getDigestLength() bytes to [digest]. The hash is reset afterwards.
+    void Final(BYTE * digest);
+
+    // Returns SHA384_DIGEST_LENGTH for the truncated form, otherwise SHA512_DIGEST_LENGTH
+    int getDigestLength();
+
+    // Hashes [length] bytes in one call
+    static void Hash(const void * data, size_t length, BYTE * digest, bool truncated = false);
+
+private:
+    // Restores the initial hash value
+    void Reset();
+
+    // Processes [count] whole blocks
+    static void Transform(UINT64 * state, const BYTE * data, size_t count);
+
+private:
+    bool m_Truncated;
+    UINT64 m_State[8];
+    BYTE m_Buffer[SHA512_BLOCK_LENGTH];
+    size_t m_Buffered;
+    unsigned long long m_Length;
+};
@@ -0,0 +1,731 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "StdAfx.h"
+#include "SigningPipeline.h"
+
+#include <fstream>
+
+#include "PKCS11Manager.h"
+#include "Utility.h"
+#include "Log.h"
+
+// The DER DigestInfo header for a SHA-256 digest (RFC 8017), so that a CKM_RSA_PKCS signature
+// over it is a standard PKCS #1 v1.5 signature
+static const BYTE SHA256_DIGEST_INFO[] = {
+    0x30, 0x31, 0x30, 0x0d, 0x06, 0x09, 0x60, 0x86, 0x48, 0x01, 0x65, 0x03, 0x04, 0x02, 0x01, 0x05, 0x00, 0x04, 0x20
+};
+
+// The page size used to fault the mapped files in
+#define PIPELINE_PAGE_SIZE      4096
+
+
+SigningQueue::SigningQueue(string name, int capacity)
+{
+    m_Name = name;
+    m_Capacity = capacity;
+    m_Closed = false;
+    m_Count = 0;
+    m_Peak = 0;
+    m_Full = 0;
+    m_Blocked = 0;
+    m_Starved = 0;
+
+    m_Free = CreateSemaphore(NULL, capacity, capacity, NULL);
+    m_Used = CreateSemaphore(NULL, 0, capacity + 1, NULL);
+
+    InitializeCriticalSection(&m_Lock);
+}
+
+
+SigningQueue::~SigningQueue(void)
+{
+    CloseHandle(m_Free);
+    CloseHandle(m_Used);
+    DeleteCriticalSection(&m_Lock);
+}
+
+void SigningQueue::Push(SigningItem * item) {
+
+    double blocked = 0;
+
+    // Only time the waits that actually block
+    if (WAIT_TIMEOUT == WaitForSingleObject(m_Free, 0)) {
+        double started = Utility::QueryMicroseconds();
+        WaitForSingleObject(m_Free, INFINITE);
+        blocked = Utility::QueryMicroseconds() - started;
+    }
+
+    EnterCriticalSection(&m_Lock);
+
+    m_Items.push_back(item);
+    m_Count++;
+    if ((int)m_Items.size() > m_Peak) m_Peak = (int)m_Items.size();
+
+    if (blocked > 0) {
+        m_Full++;
+        m_Blocked += blocked;
+    }
+
+    LeaveCriticalSection(&m_Lock);
+
+    ReleaseSemaphore(m_Used, 1, NULL);
+}
+
+SigningItem * SigningQueue::Pop() {
+
+    double started = Utility::QueryMicroseconds();
+    WaitForSingleObject(m_Used, INFINITE);
+    double waited = Utility::QueryMicroseconds() - started;
+
+    EnterCriticalSection(&m_Lock);
+
+    m_Starved += waited;
+
+    // Only a closed queue is signalled with nothing in it - pass the signal on to the next consumer
+    if (m_Items.empty()) {
+        LeaveCriticalSection(&m_Lock);
+        ReleaseSemaphore(m_Used, 1, NULL);
+        return NULL;
+    }
+
+    SigningItem * item = m_Items.front();
+    m_Items.pop_front();
+
+    LeaveCriticalSection(&m_Lock);
+
+    ReleaseSemaphore(m_Free, 1, NULL);
+
+    return item;
+}
+
+void SigningQueue::Close() {
+
+    EnterCriticalSection(&m_Lock);
+    bool closed = m_Closed;
+    m_Closed = true;
+    LeaveCriticalSection(&m_Lock);
+
+    if (!closed) ReleaseSemaphore(m_Used, 1, NULL);
+}
+
+string SigningQueue::getName() {
+    return m_Name;
+}
+
+int SigningQueue::getCapacity() {
+    return m_Capacity;
+}
+
+int SigningQueue::getCount() {
+    return m_Count;
+}
+
+int SigningQueue::getPeak() {
+    return m_Peak;
+}
+
+int SigningQueue::getFull() {
+    return m_Full;
+}
+
+double SigningQueue::getBlocked() {
+    return m_Blocked;
+}
+
+double SigningQueue::getStarved() {
+    return m_Starved;
+}
+
+
+SigningPipeline::SigningPipeline(void)
+{
+    m_Affinity = NULL;
+    m_Prepare = NULL;
+    m_Sign = NULL;
+    m_Shutdown = NULL;
+    m_Read = NULL;
+    m_Hashed = NULL;
+    m_Signed = NULL;
+    m_Hashers = 0;
+    m_Signers = 0;
+    m_HasherCount = 0;
+    m_Files = 0;
+    m_Written = 0;
+    m_Unreadable = 0;
+    m_Bytes = 0;
+    m_ReadBusy = 0;
+    m_HashBusy = 0;
+    m_WriteBusy = 0;
+    m_Started = 0;
+    m_Elapsed = 0;
+
+    InitializeCriticalSection(&m_Lock);
+    InitializeCriticalSection(&m_Serialise);
+}
+
+
+SigningPipeline::~SigningPipeline(void)
+{
+    this->Clear();
+    DeleteCriticalSection(&m_Serialise);
+    DeleteCriticalSection(&m_Lock);
+}
+
+bool SigningPipeline::Run(string directory, string output, vector<PKCS11Slot> * slots, map<CK_ULONG, string> * serials,
+                          int workers, int hashers, int depth, string pin, BatchPrepare prepare, PipelineSign sign, bool * shutdown) {
+
+    Log::debug("SigningPipeline::Run: Called\n");
+
+    this->Clear();
+
+    m_Directory = directory;
+    m_Output = output.empty() ? directory : output;
+    m_Prepare = prepare;
+    m_Sign = sign;
+    m_Shutdown = shutdown;
+    m_Files = 0;
+    m_Written = 0;
+    m_Unreadable = 0;
+    m_Bytes = 0;
+    m_ReadBusy = 0;
+    m_HashBusy = 0;
+    m_WriteBusy = 0;
+
+    if (workers < 1) workers = 1;
+    if (hashers < 1) hashers = 1;
+    if (depth < 1) depth = PIPELINE_QUEUE_DEPTH;
+
+    if (slots->empty()) {
+        Log::error("There are no tokens to sign with\n");
+        return false;
+    }
+
+    if (m_Output != directory && !CreateDirectoryA(m_Output.c_str(), NULL) && ERROR_ALREADY_EXISTS != GetLastError()) {
+        Log::error("Unable to create the output directory %s\n", m_Output.c_str());
+        return false;
+    }
+
+    m_Read = new SigningQueue("read > hash", depth);
+    m_Hashed = new SigningQueue("hash > sign", depth);
+    m_Signed = new SigningQueue("sign > write", depth);
+
+    // Each signer holds one session for the whole run
+    for (vector<PKCS11Slot>::iterator slot = slots->begin();
+            slot != slots->end();
+            ++slot)
+    {
+        SessionPool * pool = new SessionPool(PKCS11Manager::getFunctionList(), slot->id, workers, pin);
+        m_Pools[slot->id] = pool;
+
+        for (int index = 0; index < workers; index++) {
+
+            PipelineSigner * signer = new PipelineSigner;
+            signer->pipeline = this;
+            signer->slot = new PKCS11Slot(*slot);
+            signer->serial = (*serials)[slot->id];
+            signer->pool = pool;
+            signer->thread = NULL;
+            signer->completed = 0;
+            signer->failed = 0;
+            signer->busy = 0;
+
+            m_Workers.push_back(signer);
+        }
+    }
+
+    Log::info("Signing the files in %s with %u tokens (%d signers each, %d hashers, SHA-256 %s)\n",
+              directory.c_str(), (unsigned)slots->size(), workers, hashers, Sha256::getImplementation());
+
+    if (!PKCS11Manager::isThreadSafe()) {
+        Log::warn("Signatures will be serialised across tokens\n");
+    }
+
+    m_Started = Utility::QueryMicroseconds();
+    m_HasherCount = hashers;
+    m_Hashers = hashers;
+    m_Signers = (LONG)m_Workers.size();
+
+    vector<HANDLE> threads;
+    map<string, int> indexes;
+
+    // The consumers first, so the reader never finds a stage missing
+    threads.push_back(this->StartStage(WriterProc, this, "pipeline writer"));
+
+    for (size_t i = 0; i < m_Workers.size(); i++) {
+
+        PipelineSigner * signer = m_Workers[i];
+        signer->thread = CreateThread(NULL, 0, SignerProc, signer, CREATE_SUSPENDED, NULL);
+
+        if (NULL == signer->thread) {
+            Log::error("Unable to create a signer for token %s\n", signer->serial.c_str());
+            if (0 == InterlockedDecrement(&m_Signers)) m_Signed->Close();
+            continue;
+        }
+
+        if (NULL != m_Affinity) {
+            int index = indexes[signer->serial]++;
+            if (index == 0) {
+                m_Affinity->PinWorker(signer->thread, signer->serial);
+            } else {
+                char suffix[16];
+                sprintf_s(suffix, sizeof(suffix), "/%d", index);
+                m_Affinity->PinWorker(signer->thread, signer->serial + suffix);
+            }
+        }
+
+        ResumeThread(signer->thread);
+    }
+
+    for (int i = 0; i < hashers; i++) {
+        threads.push_back(this->StartStage(HasherProc, this, "pipeline hasher"));
+    }
+
+    threads.push_back(this->StartStage(ReaderProc, this, "pipeline reader"));
+
+    // The writer is the last to finish
+    for (size_t i = 0; i < threads.size(); i++) {
+        if (NULL == threads[i]) continue;
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+    }
+
+    for (size_t i = 0; i < m_Workers.size(); i++) {
+        if (NULL != m_Workers[i]->thread) WaitForSingleObject(m_Workers[i]->thread, INFINITE);
+    }
+
+    m_Elapsed = Utility::QueryMicroseconds() - m_Started;
+
+    for (map<CK_SLOT_ID, SessionPool *>::iterator pool = m_Pools.begin();
+            pool != m_Pools.end();
+            ++pool)
+    {
+        pool->second->Close();
+    }
+
+    Log::info("SIGNING COMPLETE - %d of %d files signed\n", m_Written, m_Files);
+
+    return m_Written == m_Files && m_Unreadable == 0;
+}
+
+void SigningPipeline::SetAffinity(ThreadAffinity * affinity) {
+    m_Affinity = affinity;
+}
+
+HANDLE SigningPipeline::StartStage(LPTHREAD_START_ROUTINE proc, LPVOID param, const char * name) {
+
+    HANDLE thread = CreateThread(NULL, 0, proc, param, CREATE_SUSPENDED, NULL);
+
+    if (NULL == thread) {
+        Log::error("Unable to create the %s thread\n", name);
+        throw "Unable to create a pipeline stage";
+    }
+
+    if (NULL != m_Affinity) m_Affinity->PinService(thread, name);
+    ResumeThread(thread);
+
+    return thread;
+}
+
+void SigningPipeline::Report() {
+
+    if (NULL == m_Read) return;
+
+    double elapsed = m_Elapsed / 1000000.0;
+    double megabytes = m_Bytes / (1024.0 * 1024.0);
+
+    Log::info("\nSIGNING PIPELINE (%d files, %.1f MB in %.2f s):\n", m_Files, megabytes, elapsed);
+    Log::info(" - %.1f signatures/s, %.1f MB/s hashed with %s (processor: %s)\n",
+              (elapsed > 0) ? m_Written / elapsed : 0, (elapsed > 0) ? megabytes / elapsed : 0,
+              Sha256::getImplementation(), Sha256::getProcessorFeatures());
+    Log::info(" - %d signed, %d failed, %d unreadable\n", m_Written, m_Files - m_Written - m_Unreadable, m_Unreadable);
+
+    // Backpressure shows up as producers blocked on a full queue, starvation as consumers waiting on an empty one
+    Log::info("%-14s %9s %8s %6s %6s %16s %16s\n", "QUEUE", "CAPACITY", "ITEMS", "PEAK", "FULL", "PRODUCER BLOCKED", "CONSUMER WAITED");
+
+    SigningQueue * queues[3] = { m_Read, m_Hashed, m_Signed };
+
+    for (int i = 0; i < 3; i++) {
+        Log::info("%-14s %9d %8d %6d %6d %14.2f s %14.2f s\n",
+                  queues[i]->getName().c_str(), queues[i]->getCapacity(), queues[i]->getCount(), queues[i]->getPeak(),
+                  queues[i]->getFull(), queues[i]->getBlocked() / 1000000.0, queues[i]->getStarved() / 1000000.0);
+    }
+
+    // The busy share of each stage, per thread
+    double signerBusy = 0;
+    for (size_t i = 0; i < m_Workers.size(); i++) signerBusy += m_Workers[i]->busy;
+
+    Log::info("%-14s %8s %7s\n", "STAGE", "THREADS", "BUSY");
+    Log::info("%-14s %8d %6.1f%%\n", "read", 1, (m_Elapsed > 0) ? m_ReadBusy * 100.0 / m_Elapsed : 0);
+    Log::info("%-14s %8d %6.1f%%\n", "hash", m_HasherCount, (m_Elapsed > 0) ? m_HashBusy * 100.0 / (m_Elapsed * m_HasherCount) : 0);
+    Log::info("%-14s %8u %6.1f%%\n", "sign", (unsigned)m_Workers.size(), (m_Elapsed > 0) ? signerBusy * 100.0 / (m_Elapsed * m_Workers.size()) : 0);
+    Log::info("%-14s %8d %6.1f%%\n", "write", 1, (m_Elapsed > 0) ? m_WriteBusy * 100.0 / m_Elapsed : 0);
+
+    // Each token's share
+    map<string, int> completed, failed;
+    for (size_t i = 0; i < m_Workers.size(); i++) {
+        completed[m_Workers[i]->serial] += m_Workers[i]->completed;
+        failed[m_Workers[i]->serial] += m_Workers[i]->failed;
+    }
+
+    for (map<string, int>::iterator token = completed.begin();
+            token != completed.end();
+            ++token)
+    {
+        Log::info(" - %-20s %8d signed (%.1f/s), %d failed\n", token->first.c_str(), token->second,
+                  (elapsed > 0) ? token->second / elapsed : 0, failed[token->first]);
+    }
+
+    // The signers waiting on the hashers for more than a tenth of the run means the tokens were starved
+    double starved = (m_Elapsed > 0 && !m_Workers.empty()) ? m_Hashed->getStarved() / (m_Elapsed * m_Workers.size()) : 0;
+
+    if (starved > 0.1) {
+        Log::warn("The tokens waited %.0f%% of the time for digests - reading or hashing limited the run (try more --hashers)\n",
+                  starved * 100.0);
+    } else {
+        Log::info("The tokens were kept busy - signing limited the run\n");
+    }
+}
+
+DWORD WINAPI SigningPipeline::ReaderProc(LPVOID param) {
+    ((SigningPipeline *)param)->Read();
+    return 0;
+}
+
+DWORD WINAPI SigningPipeline::HasherProc(LPVOID param) {
+    ((SigningPipeline *)param)->Hash();
+    return 0;
+}
+
+DWORD WINAPI SigningPipeline::SignerProc(LPVOID param) {
+    PipelineSigner * signer = (PipelineSigner *)param;
+    signer->pipeline->Sign(signer);
+    return 0;
+}
+
+DWORD WINAPI SigningPipeline::WriterProc(LPVOID param) {
+    ((SigningPipeline *)param)->Write();
+    return 0;
+}
+
+void SigningPipeline::Read() {
+
+    WIN32_FIND_DATAA entry;
+    string pattern = m_Directory + "\\*";
+
+    HANDLE find = FindFirstFileA(pattern.c_str(), &entry);
+
+    if (INVALID_HANDLE_VALUE == find) {
+        Log::error("Unable to list the files in %s\n", m_Directory.c_str());
+        m_Read->Close();
+        return;
+    }
+
+    size_t extension = strlen(PIPELINE_SIGNATURE_EXTENSION);
+
+    do {
+        if (entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
+
+        // Signatures from an earlier run
+        string name(entry.cFileName);
+        if (name.length() > extension && name.compare(name.length() - extension, extension, PIPELINE_SIGNATURE_EXTENSION) == 0) continue;
+
+        SigningItem * item = new SigningItem;
+        item->name = name;
+        item->index = ++m_Files;
+        item->file = INVALID_HANDLE_VALUE;
+        item->mapping = NULL;
+        item->view = NULL;
+        item->size = 0;
+        item->signatureLength = 0;
+        item->failed = false;
+
+        double started = Utility::QueryMicroseconds();
+        bool mapped = this->Map(item);
+        m_ReadBusy += Utility::QueryMicroseconds() - started;
+
+        if (!mapped) {
+            Log::error("Unable to read %s, it will not be signed\n", name.c_str());
+            m_Unreadable++;
+            delete item;
+            continue;
+        }
+
+        m_Read->Push(item);
+
+    } while (!*m_Shutdown && FindNextFileA(find, &entry));
+
+    FindClose(find);
+
+    m_Read->Close();
+
+    Log::debug("SigningPipeline::Read: %d files read\n", m_Files);
+}
+
+bool SigningPipeline::Map(SigningItem * item) {
+
+    string path = m_Directory + "\\" + item->name;
+
+    item->file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (INVALID_HANDLE_VALUE == item->file) return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(item->file, &size)) {
+        this->Unmap(item);
+        return false;
+    }
+
+    item->size = (unsigned long long)size.QuadPart;
+
+    // An empty file can't be mapped, and doesn't need to be
+    if (item->size == 0) return true;
+
+    item->mapping = CreateFileMappingA(item->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (NULL == item->mapping) {
+        this->Unmap(item);
+        return false;
+    }
+
+    SIZE_T length = (SIZE_T)((item->size < PIPELINE_VIEW_SIZE) ? item->size : PIPELINE_VIEW_SIZE);
+
+    item->view = (const BYTE *)MapViewOfFile(item->mapping, FILE_MAP_READ, 0, 0, length);
+    if (NULL == item->view) {
+        this->Unmap(item);
+        return false;
+    }
+
+    // Touch every page, so the disk reads happen here rather than stalling the hashers
+    volatile BYTE touched = 0;
+    for (SIZE_T offset = 0; offset < length; offset += PIPELINE_PAGE_SIZE) touched ^= item->view[offset];
+
+    return true;
+}
+
+void SigningPipeline::Unmap(SigningItem * item) {
+
+    if (NULL != item->view) UnmapViewOfFile(item->view);
+    if (NULL != item->mapping) CloseHandle(item->mapping);
+    if (INVALID_HANDLE_VALUE != item->file) CloseHandle(item->file);
+
+    item->view = NULL;
+    item->mapping = NULL;
+    item->file = INVALID_HANDLE_VALUE;
+}
+
+void SigningPipeline::Hash() {
+
+    Sha256 hash;
+    SigningItem * item;
+
+    while (NULL != (item = m_Read->Pop())) {
+
+        double started = Utility::QueryMicroseconds();
+        unsigned long long offset = 0;
+
+        // Files larger than a view are hashed a window at a time
+        while (offset < item->size && !item->failed) {
+
+            SIZE_T length = (SIZE_T)((item->size - offset < PIPELINE_VIEW_SIZE) ? item->size - offset : PIPELINE_VIEW_SIZE);
+
+            if (offset > 0) {
+                UnmapViewOfFile(item->view);
+                item->view = (const BYTE *)MapViewOfFile(item->mapping, FILE_MAP_READ,
+                                                         (DWORD)(offset >> 32), (DWORD)(offset & 0xFFFFFFFF), length);
+
+                if (NULL == item->view) {
+                    Log::error("Unable to map %s at offset %llu\n", item->name.c_str(), offset);
+                    item->failed = true;
+                    break;
+                }
+            }
+
+            hash.Update(item->view, length);
+            offset += length;
+        }
+
+        hash.Final(item->digest);
+        this->Unmap(item);
+
+        double elapsed = Utility::QueryMicroseconds() - started;
+
+        EnterCriticalSection(&m_Lock);
+        m_HashBusy += elapsed;
+        m_Bytes += item->size;
+        LeaveCriticalSection(&m_Lock);
+
+        m_Hashed->Push(item);
+    }
+
+    if (0 == InterlockedDecrement(&m_Hashers)) m_Hashed->Close();
+}
+
+void SigningPipeline::Sign(PipelineSigner * signer) {
+
+    CK_SESSION_HANDLE session;
+    CK_OBJECT_HANDLE key = 0;
+    bool ready = false;
+    bool attached = false;
+    bool serialise = !PKCS11Manager::isThreadSafe();
+
+    // Opening and logging in the session and finding the key are library calls too
+    if (serialise) EnterCriticalSection(&m_Serialise);
+
+    if (signer->pool->Acquire(&session, NULL)) {
+
+        signer->slot->AttachSession(session);
+        attached = true;
+
+        try {
+            key = m_Prepare(signer->slot);
+            ready = true;
+        }
+        catch (...) {
+            Log::error("Unable to prepare token %s for signing, leaving the files to the other tokens\n", signer->serial.c_str());
+        }
+    }
+
+    if (serialise) LeaveCriticalSection(&m_Serialise);
+
+    char digestInfo[sizeof(SHA256_DIGEST_INFO) + SHA256_DIGEST_LENGTH];
+    memcpy(digestInfo, SHA256_DIGEST_INFO, sizeof(SHA256_DIGEST_INFO));
+
+    int failures = 0;
+    SigningItem * item;
+
+    while (ready && NULL != (item = m_Hashed->Pop())) {
+
+        if (!item->failed) {
+
+            memcpy(digestInfo + sizeof(SHA256_DIGEST_INFO), item->digest, SHA256_DIGEST_LENGTH);
+            item->signatureLength = sizeof(item->signature);
+            item->serial = signer->serial;
+
+            bool success = false;
+
+            if (serialise) EnterCriticalSection(&m_Serialise);
+
+            double started = Utility::QueryMicroseconds();
+
+            try {
+                success = m_Sign(signer->slot, signer->serial, key, digestInfo, sizeof(digestInfo),
+                                 item->signature, &item->signatureLength, item->index);
+            }
+            catch (...) {
+                Log::error("Unhandled exception signing %s on %s ...\n", item->name.c_str(), signer->serial.c_str());
+            }
+
+            signer->busy += Utility::QueryMicroseconds() - started;
+
+            if (serialise) LeaveCriticalSection(&m_Serialise);
+
+            if (success) {
+                signer->completed++;
+                failures = 0;
+            } else {
+                signer->failed++;
+                failures++;
+                item->failed = true;
+            }
+        }
+
+        m_Signed->Push(item);
+
+        // Most likely the token has gone - leave the rest to the other tokens
+        if (failures >= BATCH_FAILURE_LIMIT) {
+            Log::warn("Token %s failed %d signatures in a row, leaving the rest of the files to the other tokens\n",
+                      signer->serial.c_str(), failures);
+            break;
+        }
+    }
+
+    if (attached) signer->pool->Release(signer->slot->DetachSession());
+
+    // Once every signer has stopped, anything still to come is passed on unsigned so the hashers aren't left blocked
+    if (0 == InterlockedDecrement(&m_Signers)) {
+
+        while (NULL != (item = m_Hashed->Pop())) {
+            item->failed = true;
+            m_Signed->Push(item);
+        }
+
+        m_Signed->Close();
+    }
+}
+
+void SigningPipeline::Write() {
+
+    SigningItem * item;
+
+    while (NULL != (item = m_Signed->Pop())) {
+
+        if (!item->failed) {
+
+            double started = Utility::QueryMicroseconds();
+
+            string path = m_Output + "\\" + item->name + PIPELINE_SIGNATURE_EXTENSION;
+            ofstream o(path.c_str(), ios_base::out | ios_base::binary | ios_base::trunc);
+            o.write(item->signature, item->signatureLength);
+            o.close();
+
+            if (o.fail()) {
+                Log::error("Unable to write the signature of %s to %s\n", item->name.c_str(), path.c_str());
+            } else {
+                m_Written++;
+                Log::debug("SigningPipeline::Write: %s signed by %s\n", item->name.c_str(), item->serial.c_str());
+            }
+
+            m_WriteBusy += Utility::QueryMicroseconds() - started;
+        }
+
+        delete item;
+    }
+}
+
+void SigningPipeline::Clear() {
+
+    for (size_t i = 0; i < m_Workers.size(); i++) {
+        if (NULL != m_Workers[i]->thread) CloseHandle(m_Workers[i]->thread);
+        delete m_Workers[i]->slot;
+        delete m_Workers[i];
+    }
+
+    m_Workers.clear();
+
+    for (map<CK_SLOT_ID, SessionPool *>::iterator pool = m_Pools.begin();
+            pool != m_Pools.end();
+            ++pool)
+    {
+        delete pool->second;
+    }
+
+    m_Pools.clear();
+
+    delete m_Read;
+    delete m_Hashed;
+    delete m_Signed;
+
+    m_Read = NULL;
+    m_Hashed = NULL;
+    m_Signed = NULL;
+}
@@ -0,0 +1,229 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+#include "stdafx.h"
+
+#include <windows.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+
+#include "PKCS11Slot.h"
+#include "SessionPool.h"
+#include "BatchJob.h"
+#include "Sha256.h"
+#include "ThreadAffinity.h"
+
+using namespace std;
+
+// The default capacity of the queues between the stages
+#define PIPELINE_QUEUE_DEPTH    16
+
+// The most of a file mapped at once (a multiple of the allocation granularity)
+#define PIPELINE_VIEW_SIZE      (16 * 1024 * 1024)
+
+// Appended to the name of a file for its detached signature
+#define PIPELINE_SIGNATURE_EXTENSION    ".sig"
+
+// Signs a DER DigestInfo, returning true if it succeeded
+typedef bool (*PipelineSign)(PKCS11Slot * slot, string serial, CK_OBJECT_HANDLE key,
+                             const char * in, int inLength, char * out, int * outLength, int item);
+
+// A file passing through the pipeline
+typedef struct {
+    // The file name, relative to the input directory, and its position in the run
+    string name;
+    int index;
+
+    // The file and the first window of it, mapped by the reader (the view is NULL for an empty file)
+    HANDLE file;
+    HANDLE mapping;
+    const BYTE * view;
+    unsigned long long size;
+
+    BYTE digest[SHA256_DIGEST_LENGTH];
+
+    // The detached signature, and the token that made it
+    char signature[512];
+    int signatureLength;
+    string serial;
+
+    bool failed;
+} SigningItem;
+
+
+// A bounded queue between two stages of the pipeline. The time producers spend blocked on a full
+// queue is the backpressure from the next stage, and the time consumers spend waiting on an empty
+// one is starvation by the previous stage.
+class SigningQueue
+{
+public:
+    SigningQueue(string name, int capacity);
+    ~SigningQueue(void);
+
+    // Adds an item, waiting while the queue is full
+    void Push(SigningItem * item);
+
+    // Takes the next item, waiting while the queue is empty. Returns NULL once the queue has been
+    // closed and drained.
+    SigningItem * Pop();
+
+    // Marks the end of the items (called once the last producer has finished)
+    void Close();
+
+    string getName();
+    int getCapacity();
+
+    // The items passed through, and the most that were queued at once
+    int getCount();
+    int getPeak();
+
+    // The pushes that found the queue full, and the total time producers and consumers waited (microseconds)
+    int getFull();
+    double getBlocked();
+    double getStarved();
+
+private:
+    string m_Name;
+    int m_Capacity;
+
+    // Count the free places and the queued items
+    HANDLE m_Free;
+    HANDLE m_Used;
+    CRITICAL_SECTION m_Lock;
+
+    deque<SigningItem *> m_Items;
+    bool m_Closed;
+
+    int m_Count;
+    int m_Peak;
+    int m_Full;
+    double m_Blocked;
+    double m_Starved;
+};
+
+
+class SigningPipeline;
+
+// A signer thread, holding one session with its token for the whole run
+typedef struct {
+    SigningPipeline * pipeline;
+    PKCS11Slot * slot;
+    string serial;
+    SessionPool * pool;
+    HANDLE thread;
+
+    int completed;
+    int failed;
+
+    // Time spent signing (microseconds)
+    double busy;
+} PipelineSigner;
+
+
+// Signs every file in a directory with the token-resident key, writing a detached signature next
+// to each (or into an output directory). Four stages run concurrently, joined by bounded queues:
+// the reader maps the files into memory and faults them in, the hashers compute the SHA-256
+// digests, the signers (one or more per token) sign them, and the writer saves the signatures.
+class SigningPipeline
+{
+public:
+    SigningPipeline(void);
+    ~SigningPipeline(void);
+
+    // Runs the pipeline over the files in [directory], writing the signatures to [output] (the input
+    // directory when empty). [workers] signers run per token, [hashers] hashing threads and [depth]
+    // places in each queue. Returns true if every file was signed.
+    bool Run(string directory, string output, vector<PKCS11Slot> * slots, map<CK_ULONG, string> * serials,
+             int workers, int hashers, int depth, string pin, BatchPrepare prepare, PipelineSign sign, bool * shutdown);
+
+    // Pins the signers with [affinity], and the other stages as service threads (call before Run)
+    void SetAffinity(ThreadAffinity * affinity);
+
+    // Logs the throughput, the backpressure on each queue and which stage limited the run
+    void Report();
+
+private:
+    // Thread entry points
+    static DWORD WINAPI ReaderProc(LPVOID param);
+    static DWORD WINAPI HasherProc(LPVOID param);
+    static DWORD WINAPI SignerProc(LPVOID param);
+    static DWORD WINAPI WriterProc(LPVOID param);
+
+    // The stages
+    void Read();
+    void Hash();
+    void Sign(PipelineSigner * signer);
+    void Write();
+
+    // Opens and maps the first window of a file, faulting its pages in. Returns false if it can't be read.
+    bool Map(SigningItem * item);
+
+    // Releases the mapping and the file
+    void Unmap(SigningItem * item);
+
+    // Starts a stage thread, pinned as a service thread
+    HANDLE StartStage(LPTHREAD_START_ROUTINE proc, LPVOID param, const char * name);
+
+    // Releases the signers, pools and queues
+    void Clear();
+
+private:
+    ThreadAffinity * m_Affinity;
+    BatchPrepare m_Prepare;
+    PipelineSign m_Sign;
+    bool * m_Shutdown;
+
+    string m_Directory;
+    string m_Output;
+
+    SigningQueue * m_Read;
+    SigningQueue * m_Hashed;
+    SigningQueue * m_Signed;
+
+    // The hashers and signers still running (the last of each closes its output queue)
+    volatile LONG m_Hashers;
+    volatile LONG m_Signers;
+    int m_HasherCount;
+
+    vector<PipelineSigner *> m_Workers;
+    map<CK_SLOT_ID, SessionPool *> m_Pools;
+
+    // Counters for the report
+    int m_Files;
+    int m_Written;
+    int m_Unreadable;
+    unsigned long long m_Bytes;
+    double m_ReadBusy;
+    double m_HashBusy;
+    double m_WriteBusy;
+    double m_Started;
+    double m_Elapsed;
+    CRITICAL_SECTION m_Lock;
+
+    // Serialises the signers' calls when the library couldn't be initialised for OS locking
+    CRITICAL_SECTION m_Serialise;
+};
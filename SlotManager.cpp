@@ -0,0 +1,835 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "StdAfx.h"
+#include "SlotManager.h"
+
+#include <algorithm>
+
+#include "Utility.h"
+#include "Log.h"
+
+
+SlotManager::SlotManager(void)
+{
+    m_PKCS11 = NULL;
+    m_Resolver = NULL;
+    m_Transaction = NULL;
+    m_Results = NULL;
+    m_Affinity = NULL;
+    m_Breaker = NULL;
+    m_Iterations = 0;
+    m_Interval = 0;
+    m_Paced = false;
+    m_WorkersPerToken = 1;
+    m_Sessions = 0;
+    m_Watcher = NULL;
+    m_StopEvent = NULL;
+    m_WatcherCpu = 0;
+    m_WatcherWall = 0;
+    m_SlotEvents = false;
+
+    InitializeCriticalSection(&m_Lock);
+    InitializeCriticalSection(&m_Serialise);
+}
+
+
+SlotManager::~SlotManager(void)
+{
+    this->Stop();
+
+    for (map<CK_SLOT_ID, SessionPool *>::iterator pool = m_Pools.begin();
+            pool != m_Pools.end();
+            ++pool)
+    {
+        delete pool->second;
+    }
+
+    DeleteCriticalSection(&m_Serialise);
+    DeleteCriticalSection(&m_Lock);
+}
+
+void SlotManager::Start(PKCS11Manager * pkcs11, vector<PKCS11Slot> * slots, map<CK_ULONG, string> * serials,
+                        int iterations, int interval, SlotResolver resolver, SlotTransaction transaction, Results * results) {
+
+    Log::debug("SlotManager::Start: Called\n");
+
+    if (NULL != m_Watcher) {
+        Log::warn("SlotManager::Start: Already running, ignoring\n");
+        return;
+    }
+
+    m_PKCS11 = pkcs11;
+    m_Iterations = iterations;
+    m_Interval = interval;
+    m_Resolver = resolver;
+    m_Transaction = transaction;
+    m_Results = results;
+
+    // The current state is already known, so discard anything queued up before now. This also
+    // tells us whether the library supports slot events at all.
+    CK_SLOT_ID id;
+    CK_RV result;
+    int discarded = 0;
+
+    while (CKR_OK == (result = m_PKCS11->PollSlotEvent(&id)) && discarded < 256) discarded++;
+
+    m_SlotEvents = (CKR_OK == result || CKR_NO_EVENT == result);
+
+    if (!m_SlotEvents) {
+        Log::info("C_WaitForSlotEvent is not available (%s), polling the slot list for token changes\n",
+                  Utility::ErrorToString(result));
+
+        vector<CK_SLOT_ID> changed;
+        this->Poll(&changed);
+    }
+
+    if (!PKCS11Manager::isThreadSafe()) {
+        Log::warn("Transactions will be serialised across tokens\n");
+    }
+
+    EnterCriticalSection(&m_Lock);
+
+    for (vector<PKCS11Slot>::iterator slot = slots->begin();
+            slot != slots->end();
+            ++slot)
+    {
+        string tokenSerial;
+        try {
+            PKCS11Token token;
+            slot->QueryToken(&token);
+            tokenSerial = token.serial;
+        }
+        catch (...) {
+            Log::warn("Unable to query the token in slot %u\n", slot->id);
+        }
+
+        this->StartWorker(new PKCS11Slot(*slot), (*serials)[slot->id], tokenSerial);
+    }
+
+    LeaveCriticalSection(&m_Lock);
+
+    m_StopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    m_Watcher = CreateThread(NULL, 0, WatcherProc, this, CREATE_SUSPENDED, NULL);
+
+    if (NULL == m_Watcher) {
+        Log::error("SlotManager::Start: Unable to create the slot watcher thread, token changes will not be followed\n");
+        return;
+    }
+
+    if (NULL != m_Affinity) m_Affinity->PinService(m_Watcher, "slot watcher");
+    ResumeThread(m_Watcher);
+}
+
+void SlotManager::SetAffinity(ThreadAffinity * affinity) {
+    m_Affinity = affinity;
+}
+
+void SlotManager::SetSessions(int workers, int sessions, string pin) {
+    m_WorkersPerToken = (workers > 0) ? workers : 1;
+    m_Sessions = sessions;
+    m_Pin = pin;
+}
+
+void SlotManager::SetBreaker(CircuitBreaker * breaker) {
+    m_Breaker = breaker;
+}
+
+void SlotManager::SetPacing(bool paced) {
+    m_Paced = paced;
+}
+
+bool SlotManager::Wait(DWORD timeout) {
+
+    if (NULL != m_StopEvent) {
+        WaitForSingleObject(m_StopEvent, timeout);
+    }
+
+    double now = Utility::QueryMicroseconds();
+    bool done = true;
+
+    EnterCriticalSection(&m_Lock);
+
+    // Any worker still transacting
+    for (size_t i = 0; i < m_Workers.size(); i++) {
+        if (!m_Workers[i]->stopping && WAIT_TIMEOUT == WaitForSingleObject(m_Workers[i]->thread, 0)) done = false;
+    }
+
+    // Any token waiting to be identified
+    if (!m_Pending.empty()) done = false;
+
+    // Any unfinished token that has been pulled recently enough to be worth waiting for
+    for (map<string, TokenHistory>::iterator token = m_Tokens.begin();
+            token != m_Tokens.end();
+            ++token)
+    {
+        TokenHistory * history = &token->second;
+
+        if (history->removed > 0 && history->iterations < m_Iterations &&
+                now - history->removed < SLOTMANAGER_REINSERT_GRACE * 1000000.0) {
+            done = false;
+        }
+    }
+
+    LeaveCriticalSection(&m_Lock);
+
+    return done;
+}
+
+void SlotManager::Stop() {
+
+    if (NULL == m_StopEvent) return;
+
+    Log::debug("SlotManager::Stop: Called\n");
+
+    SetEvent(m_StopEvent);
+
+    if (NULL != m_Watcher) {
+        WaitForSingleObject(m_Watcher, INFINITE);
+        ThreadAffinity::QueryThreadTimes(m_Watcher, &m_WatcherCpu, &m_WatcherWall);
+        CloseHandle(m_Watcher);
+        m_Watcher = NULL;
+    }
+
+    EnterCriticalSection(&m_Lock);
+    for (size_t i = 0; i < m_Workers.size(); i++) {
+        m_Workers[i]->stopping = true;
+        SetEvent(m_Workers[i]->stopEvent);
+    }
+    LeaveCriticalSection(&m_Lock);
+
+    this->Reap(true);
+
+    // Every session has been released now that the workers are gone
+    for (map<CK_SLOT_ID, SessionPool *>::iterator pool = m_Pools.begin();
+            pool != m_Pools.end();
+            ++pool)
+    {
+        pool->second->Close();
+    }
+
+    CloseHandle(m_StopEvent);
+    m_StopEvent = NULL;
+}
+
+void SlotManager::QueryIterations(map<string, int> * iterations) {
+
+    EnterCriticalSection(&m_Lock);
+
+    for (map<string, TokenHistory>::iterator token = m_Tokens.begin();
+            token != m_Tokens.end();
+            ++token)
+    {
+        (*iterations)[token->first] = token->second.iterations;
+    }
+
+    LeaveCriticalSection(&m_Lock);
+}
+
+void SlotManager::RestoreIterations(map<string, int> * iterations) {
+
+    EnterCriticalSection(&m_Lock);
+
+    for (map<string, int>::iterator token = iterations->begin();
+            token != iterations->end();
+            ++token)
+    {
+        TokenHistory history;
+        history.iterations = token->second;
+        history.removals = 0;
+        history.isolated = false;
+        history.removed = 0;
+        history.cpu = 0;
+        history.wall = 0;
+        m_Tokens[token->first] = history;
+    }
+
+    LeaveCriticalSection(&m_Lock);
+}
+
+void SlotManager::Isolate(string serial) {
+
+    EnterCriticalSection(&m_Lock);
+
+    int workers = 0;
+    for (size_t i = 0; i < m_Workers.size(); i++) {
+        if (m_Workers[i]->serial == serial && !m_Workers[i]->isolated) {
+            m_Workers[i]->stopping = true;
+            m_Workers[i]->isolated = true;
+            SetEvent(m_Workers[i]->stopEvent);
+            workers++;
+        }
+    }
+
+    if (m_Tokens.find(serial) != m_Tokens.end()) m_Tokens[serial].isolated = true;
+
+    LeaveCriticalSection(&m_Lock);
+
+    if (workers > 0) Log::warn("Token %s isolated, %d worker(s) stopped\n", serial.c_str(), workers);
+}
+
+void SlotManager::Report() {
+
+    EnterCriticalSection(&m_Lock);
+
+    Log::info("\nTOKENS (changes detected by %s):\n", m_SlotEvents ? "C_WaitForSlotEvent" : "slot list polling");
+    Log::info("%-20s %12s %9s %14s %14s %14s %14s %10s %6s\n",
+              "SERIAL", "TRANSACTIONS", "REMOVALS", "MEAN OUTAGE", "MAX OUTAGE", "MEAN RECOVERY", "MAX RECOVERY", "CPU", "CPU %");
+
+    for (map<string, TokenHistory>::iterator token = m_Tokens.begin();
+            token != m_Tokens.end();
+            ++token)
+    {
+        TokenHistory * history = &token->second;
+
+        Log::info("%-20s %12d %9d %12.1f s %12.1f s %12.1f s %12.1f s %8.1f s %5.1f%%%s\n",
+                  token->first.c_str(), history->iterations, history->removals,
+                  history->outage.getMean() / 1000000.0, history->outage.getMaximum() / 1000000.0,
+                  history->recovery.getMean() / 1000000.0, history->recovery.getMaximum() / 1000000.0,
+                  history->cpu / 1000000.0, (history->wall > 0) ? history->cpu * 100.0 / history->wall : 0,
+                  history->isolated ? " (ISOLATED)" : ((history->removed > 0) ? " (NOT RECOVERED)" : ""));
+    }
+
+    // A worker near 100% is CPU bound in the library or the harness rather than waiting on the card
+    Log::info("%-20s %12s %9s %14s %14s %14s %14s %8.1f s %5.1f%%\n", "(slot watcher)", "", "", "", "", "", "",
+              m_WatcherCpu / 1000000.0, (m_WatcherWall > 0) ? m_WatcherCpu * 100.0 / m_WatcherWall : 0);
+
+    if (!m_Pools.empty()) {
+
+        // Workers spending a large share of their time waiting for a session need a bigger pool,
+        // not a faster token
+        Log::info("\nSESSION POOLS (%d workers per token):\n", m_WorkersPerToken);
+        Log::info("%-20s %9s %7s %9s %10s %12s %12s %12s %8s\n",
+                  "SERIAL", "SESSIONS", "OPENED", "RECYCLED", "ACQUIRES", "MEAN WAIT", "P99 WAIT", "MEAN HOLD", "WAITING");
+
+        for (map<CK_SLOT_ID, SessionPool *>::iterator pool = m_Pools.begin();
+                pool != m_Pools.end();
+                ++pool)
+        {
+            SessionPoolStatistics statistics;
+            pool->second->QueryStatistics(&statistics);
+
+            double wait = statistics.wait.getMean() * statistics.wait.getCount();
+            double hold = statistics.hold.getMean() * statistics.hold.getCount();
+
+            Log::info("%-20s %9d %7d %9d %10llu %9.2f ms %9.2f ms %9.2f ms %7.1f%%\n",
+                      m_PoolTokens[pool->first].c_str(), statistics.size, statistics.opened, statistics.recycled,
+                      statistics.wait.getCount(), statistics.wait.getMean() / 1000.0,
+                      statistics.wait.getPercentile(99) / 1000.0, statistics.hold.getMean() / 1000.0,
+                      (wait + hold > 0) ? wait * 100.0 / (wait + hold) : 0);
+
+            for (map<CK_RV, int>::iterator reason = statistics.reasons.begin();
+                    reason != statistics.reasons.end();
+                    ++reason)
+            {
+                Log::info("%-20s   recycled %d after %s\n", "", reason->second,
+                          (CKR_OK == reason->first) ? "a logout" : Utility::ErrorToString(reason->first));
+            }
+        }
+    }
+
+    LeaveCriticalSection(&m_Lock);
+}
+
+DWORD WINAPI SlotManager::WatcherProc(LPVOID param) {
+
+    SlotManager * manager = (SlotManager *)param;
+
+    while (WAIT_TIMEOUT == WaitForSingleObject(manager->m_StopEvent, SLOTMANAGER_POLL_INTERVAL)) {
+
+        vector<CK_SLOT_ID> changed;
+        manager->Poll(&changed);
+
+        for (size_t i = 0; i < changed.size(); i++) {
+            manager->SlotChanged(changed[i]);
+        }
+
+        manager->Reap(false);
+        manager->StartPending();
+    }
+
+    return 0;
+}
+
+DWORD WINAPI SlotManager::WorkerProc(LPVOID param) {
+
+    SlotWorker * worker = (SlotWorker *)param;
+    worker->manager->Work(worker);
+
+    return 0;
+}
+
+void SlotManager::Work(SlotWorker * worker) {
+
+    Log::debug("SlotManager::Work: Worker for %s started\n", worker->serial.c_str());
+
+    EnterCriticalSection(&m_Lock);
+    SessionPool * pool = (m_Pools.find(worker->slot->id) != m_Pools.end()) ? m_Pools[worker->slot->id] : NULL;
+    LeaveCriticalSection(&m_Lock);
+
+    while (!worker->stopping) {
+
+        // An open breaker holds the token back without using up its iterations
+        DWORD wait = (NULL != m_Breaker) ? m_Breaker->Admit(worker->serial) : 0;
+
+        if (BREAKER_LOCKED == wait) break;
+
+        if (wait > 0) {
+            WaitForSingleObject(worker->stopEvent, wait);
+            continue;
+        }
+
+        double began = Utility::QueryMicroseconds();
+
+        bool success = false;
+        bool ran = false;
+        bool serialise = !PKCS11Manager::isThreadSafe();
+        bool guarded = (NULL != m_Breaker && m_Breaker->isEnabled());
+
+        if (serialise) EnterCriticalSection(&m_Serialise);
+
+        // With a pool, the transaction runs on a pooled session that is already logged in
+        CK_SESSION_HANDLE session = NULL;
+        bool pooled = (NULL != pool);
+        bool acquired = true;
+        CK_RV refused = CKR_OK;
+
+        if (pooled) {
+            Utility::TakeLastFailure();
+            acquired = pool->Acquire(&session, worker->stopEvent);
+
+            // Unlike a cancelled wait, a session that couldn't be opened or logged in is a failure of the token
+            if (!acquired) refused = Utility::TakeLastFailure();
+            if (!acquired && CKR_OK == refused && !worker->stopping) refused = CKR_GENERAL_ERROR;
+        }
+
+        // A refused session is left to the breaker rather than using up an iteration - without
+        // one it still counts, so that a bad PIN isn't retried for ever
+        bool counted = acquired || (CKR_OK != refused && !guarded);
+        int iteration = 0;
+
+        EnterCriticalSection(&m_Lock);
+        TokenHistory * history = &m_Tokens[worker->serial];
+        if (counted && history->iterations < m_Iterations) iteration = ++history->iterations;
+        LeaveCriticalSection(&m_Lock);
+
+        if (acquired && iteration > 0) {
+
+            if (pooled) worker->slot->AttachSession(session);
+
+            Utility::TakeLastFailure();
+            ran = true;
+
+            try {
+                success = m_Transaction(worker->slot, worker->serial, iteration);
+            }
+            catch (...) {
+                Log::error("Unhandled exception during processing of %s ...\n", worker->serial.c_str());
+            }
+
+            if (pooled) {
+                // A session the watchdog closed under a stalled call is dropped rather than handed out again
+                CK_SESSION_HANDLE released = worker->slot->DetachSession();
+
+                if (NULL != released) {
+                    pool->Release(released);
+                } else {
+                    pool->Discard(session);
+                }
+            }
+        }
+        else if (acquired && pooled) {
+            pool->Release(session);
+        }
+
+        if (serialise) LeaveCriticalSection(&m_Serialise);
+
+        if (NULL != m_Breaker) {
+            if (ran) {
+                m_Breaker->Record(worker->serial, success, success ? CKR_OK : Utility::TakeLastFailure());
+            } else if (CKR_OK != refused) {
+                m_Breaker->Record(worker->serial, false, refused);
+            } else {
+                m_Breaker->Cancel(worker->serial);
+            }
+        }
+
+        // Either the token's iterations are used up or the worker is being stopped
+        if (!ran && CKR_OK == refused) {
+            if (acquired) break;
+            continue;
+        }
+
+        if (counted && iteration == 0) break;
+
+        if (success) {
+
+            // The first success after a reinsertion is the end of the recovery
+            EnterCriticalSection(&m_Lock);
+            if (history->removed > 0) {
+
+                double recovery = Utility::QueryMicroseconds() - history->removed;
+                history->recovery.Record(recovery);
+                history->removed = 0;
+
+                if (NULL != m_Results) m_Results->Record(worker->serial, "RECOVERY", "-", recovery);
+
+                Log::info("Token %s recovered %.1f seconds after it was removed\n", worker->serial.c_str(), recovery / 1000000.0);
+            }
+            LeaveCriticalSection(&m_Lock);
+        }
+        else {
+
+            // Don't wait for the watcher to notice a pulled card - stop before the remaining
+            // iterations are burnt on failures
+            PKCS11Slot probe(PKCS11Manager::getFunctionList());
+
+            if (!m_PKCS11->QuerySlot(worker->slot->id, &probe) || !probe.isTokenPresent) {
+                EnterCriticalSection(&m_Lock);
+                if (!worker->stopping) this->RetireWorker(worker);
+                LeaveCriticalSection(&m_Lock);
+                break;
+            }
+        }
+
+        if (iteration >= m_Iterations) break;
+
+        // Paced workers only wait out what is left of the period
+        DWORD pause = m_Interval;
+
+        if (m_Paced) {
+            double elapsed = (Utility::QueryMicroseconds() - began) / 1000.0;
+            pause = (elapsed < m_Interval) ? (DWORD)(m_Interval - elapsed) : 0;
+        }
+
+        WaitForSingleObject(worker->stopEvent, pause);
+    }
+
+    Log::debug("SlotManager::Work: Worker for %s finished\n", worker->serial.c_str());
+}
+
+void SlotManager::Poll(vector<CK_SLOT_ID> * changed) {
+
+    if (m_SlotEvents) {
+
+        CK_SLOT_ID id;
+        CK_RV result;
+
+        while (CKR_OK == (result = m_PKCS11->PollSlotEvent(&id))) {
+            if (find(changed->begin(), changed->end(), id) == changed->end()) changed->push_back(id);
+        }
+
+        if (CKR_NO_EVENT != result) {
+            Log::debug("SlotManager::Poll: C_WaitForSlotEvent returned %s\n", Utility::ErrorToString(result));
+        }
+
+        return;
+    }
+
+    // Fallback - compare the slots with tokens against the last poll
+    vector<PKCS11Slot> slots;
+    try {
+        m_PKCS11->QuerySlots(true, &slots);
+    }
+    catch (...) {
+        Log::debug("SlotManager::Poll: Unable to list the slots\n");
+        return;
+    }
+
+    vector<CK_SLOT_ID> present;
+    for (size_t i = 0; i < slots.size(); i++) present.push_back(slots[i].id);
+    sort(present.begin(), present.end());
+
+    set_symmetric_difference(m_Present.begin(), m_Present.end(), present.begin(), present.end(), back_inserter(*changed));
+    m_Present = present;
+}
+
+void SlotManager::SlotChanged(CK_SLOT_ID id) {
+
+    PKCS11Slot slot(PKCS11Manager::getFunctionList());
+    bool present = m_PKCS11->QuerySlot(id, &slot) && slot.isTokenPresent;
+
+    string tokenSerial;
+    if (present) {
+        try {
+            PKCS11Token token;
+            slot.QueryToken(&token);
+            tokenSerial = token.serial;
+        }
+        catch (...) {
+            Log::debug("SlotManager::SlotChanged: Unable to query the token in slot %u\n", id);
+        }
+    }
+
+    EnterCriticalSection(&m_Lock);
+
+    SlotWorker * worker = this->FindWorker(id);
+
+    if (NULL != worker && present && worker->tokenSerial == tokenSerial) {
+        // The same token is still there (a spurious event, or a re-seat faster than a poll)
+        Log::debug("SlotManager::SlotChanged: Slot %u still holds token %s\n", id, worker->serial.c_str());
+    }
+    else {
+        if (NULL != worker) this->RetireWorker(worker);
+
+        if (present && m_Pending.find(id) == m_Pending.end()) {
+            Log::info("Token inserted into slot %u (%s)\n", id, slot.description.c_str());
+
+            PendingSlot pending;
+            pending.inserted = Utility::QueryMicroseconds();
+            pending.attempts = 0;
+            m_Pending[id] = pending;
+        }
+        else if (!present) {
+            m_Pending.erase(id);
+        }
+    }
+
+    LeaveCriticalSection(&m_Lock);
+}
+
+void SlotManager::StartPending() {
+
+    // Only start on slots whose previous worker has completely finished with the token
+    vector<CK_SLOT_ID> ready;
+
+    EnterCriticalSection(&m_Lock);
+    for (map<CK_SLOT_ID, PendingSlot>::iterator pending = m_Pending.begin();
+            pending != m_Pending.end();
+            ++pending)
+    {
+        bool busy = false;
+        for (size_t i = 0; i < m_Workers.size(); i++) {
+            if (m_Workers[i]->slot->id == pending->first) busy = true;
+        }
+
+        if (!busy) ready.push_back(pending->first);
+    }
+    LeaveCriticalSection(&m_Lock);
+
+    for (size_t i = 0; i < ready.size(); i++) {
+
+        CK_SLOT_ID id = ready[i];
+        PKCS11Slot * slot = new PKCS11Slot(PKCS11Manager::getFunctionList());
+        string serial, tokenSerial;
+        bool resolved = false;
+
+        if (m_PKCS11->QuerySlot(id, slot) && slot->isTokenPresent) {
+            try {
+                PKCS11Token token;
+                slot->QueryToken(&token);
+                tokenSerial = token.serial;
+                serial = m_Resolver(slot);
+                resolved = true;
+            }
+            catch (...) {
+                Log::debug("SlotManager::StartPending: Unable to identify the token in slot %u yet\n", id);
+            }
+        }
+        else {
+            // Gone again before it could be identified
+            EnterCriticalSection(&m_Lock);
+            m_Pending.erase(id);
+            LeaveCriticalSection(&m_Lock);
+
+            delete slot;
+            continue;
+        }
+
+        EnterCriticalSection(&m_Lock);
+
+        PendingSlot * pending = &m_Pending[id];
+
+        if (!resolved) {
+            // A freshly inserted card can take a moment to power up, so give it a few polls
+            if (++pending->attempts >= SLOTMANAGER_RESOLVE_ATTEMPTS) {
+                Log::error("Unable to identify the token in slot %u, it will not be used\n", id);
+                m_Pending.erase(id);
+            }
+
+            LeaveCriticalSection(&m_Lock);
+            delete slot;
+            continue;
+        }
+
+        TokenHistory * history = &m_Tokens[serial];
+
+        if (history->removed > 0) {
+            double outage = pending->inserted - history->removed;
+            history->outage.Record(outage);
+            Log::info("Token %s reinserted into slot %u after %.1f seconds\n", serial.c_str(), id, outage / 1000000.0);
+        }
+        else {
+            Log::info("New token %s in slot %u\n", serial.c_str(), id);
+        }
+
+        m_Pending.erase(id);
+
+        if (history->iterations >= m_Iterations) {
+            Log::info("Token %s has already completed %d iterations\n", serial.c_str(), history->iterations);
+            history->removed = 0;
+            delete slot;
+        }
+        else if (history->isolated) {
+            Log::info("Token %s was isolated after a stalled call, it will not be used\n", serial.c_str());
+            history->removed = 0;
+            delete slot;
+        }
+        else {
+            this->StartWorker(slot, serial, tokenSerial);
+        }
+
+        LeaveCriticalSection(&m_Lock);
+    }
+}
+
+void SlotManager::StartWorker(PKCS11Slot * slot, string serial, string tokenSerial) {
+
+    // Create the history on first sight, so it starts from a known state
+    if (m_Tokens.find(serial) == m_Tokens.end()) {
+        TokenHistory history;
+        history.iterations = 0;
+        history.removals = 0;
+        history.isolated = false;
+        history.removed = 0;
+        history.cpu = 0;
+        history.wall = 0;
+        m_Tokens[serial] = history;
+    }
+
+    if (m_Sessions > 0 && m_Pools.find(slot->id) == m_Pools.end()) {
+        m_Pools[slot->id] = new SessionPool(PKCS11Manager::getFunctionList(), slot->id, m_Sessions, m_Pin);
+    }
+    m_PoolTokens[slot->id] = serial;
+
+    for (int index = 0; index < m_WorkersPerToken; index++) {
+
+        SlotWorker * worker = new SlotWorker;
+        worker->manager = this;
+        worker->slot = (index == 0) ? slot : new PKCS11Slot(*slot);
+        worker->serial = serial;
+        worker->tokenSerial = tokenSerial;
+        worker->stopping = false;
+        worker->isolated = false;
+        worker->stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        worker->thread = CreateThread(NULL, 0, WorkerProc, worker, CREATE_SUSPENDED, NULL);
+
+        if (NULL == worker->thread) {
+            Log::error("Unable to create the worker thread for token %s\n", serial.c_str());
+            CloseHandle(worker->stopEvent);
+            delete worker->slot;
+            delete worker;
+            return;
+        }
+
+        // Pinned before it runs, so no part of the first transaction is measured on another processor.
+        // Additional workers are placed as tokens of their own.
+        if (NULL != m_Affinity) {
+            if (index == 0) {
+                m_Affinity->PinWorker(worker->thread, serial);
+            } else {
+                char suffix[16];
+                sprintf_s(suffix, sizeof(suffix), "/%d", index);
+                m_Affinity->PinWorker(worker->thread, serial + suffix);
+            }
+        }
+        ResumeThread(worker->thread);
+
+        Log::debug("SlotManager::StartWorker: Started worker %d for %s in slot %u\n", index, serial.c_str(), slot->id);
+        m_Workers.push_back(worker);
+    }
+}
+
+void SlotManager::RetireWorker(SlotWorker * worker) {
+
+    CK_SLOT_ID id = worker->slot->id;
+
+    for (size_t i = 0; i < m_Workers.size(); i++) {
+        if (m_Workers[i]->slot->id == id && !m_Workers[i]->stopping) {
+            m_Workers[i]->stopping = true;
+            SetEvent(m_Workers[i]->stopEvent);
+        }
+    }
+
+    TokenHistory * history = &m_Tokens[worker->serial];
+    history->removals++;
+    history->removed = Utility::QueryMicroseconds();
+
+    Log::warn("Token %s removed from slot %u after %d iterations\n", worker->serial.c_str(), worker->slot->id, history->iterations);
+}
+
+SlotWorker * SlotManager::FindWorker(CK_SLOT_ID id) {
+
+    for (size_t i = 0; i < m_Workers.size(); i++) {
+        if (m_Workers[i]->slot->id == id && !m_Workers[i]->stopping) return m_Workers[i];
+    }
+
+    return NULL;
+}
+
+void SlotManager::Reap(bool wait) {
+
+    vector<SlotWorker *> finished;
+
+    EnterCriticalSection(&m_Lock);
+
+    for (vector<SlotWorker *>::iterator worker = m_Workers.begin();
+            worker != m_Workers.end();
+            )
+    {
+        bool exited = (WAIT_OBJECT_0 == WaitForSingleObject((*worker)->thread, 0));
+
+        if (exited || (wait && !(*worker)->isolated)) {
+            finished.push_back(*worker);
+            worker = m_Workers.erase(worker);
+        } else {
+            if (wait) {
+                Log::warn("Abandoning the isolated worker for %s, it is still blocked in the library\n", (*worker)->serial.c_str());
+            }
+            ++worker;
+        }
+    }
+
+    LeaveCriticalSection(&m_Lock);
+
+    // Wait outside the lock, since the workers take it
+    for (size_t i = 0; i < finished.size(); i++) {
+
+        WaitForSingleObject(finished[i]->thread, INFINITE);
+
+        double cpu, wall;
+        if (ThreadAffinity::QueryThreadTimes(finished[i]->thread, &cpu, &wall)) {
+            EnterCriticalSection(&m_Lock);
+            m_Tokens[finished[i]->serial].cpu += cpu;
+            m_Tokens[finished[i]->serial].wall += wall;
+            LeaveCriticalSection(&m_Lock);
+        }
+
+        CloseHandle(finished[i]->thread);
+        CloseHandle(finished[i]->stopEvent);
+
+        delete finished[i]->slot;
+        delete finished[i];
+    }
+}
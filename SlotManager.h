@@ -0,0 +1,221 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+#include "stdafx.h"
+
+#include <windows.h>
+#include <string>
+#include <vector>
+#include <map>
+
+#include "PKCS11Manager.h"
+#include "PKCS11Slot.h"
+#include "Histogram.h"
+#include "Results.h"
+#include "ThreadAffinity.h"
+#include "SessionPool.h"
+#include "CircuitBreaker.h"
+
+using namespace std;
+
+// The period between checks for slot events (milliseconds)
+#define SLOTMANAGER_POLL_INTERVAL       250
+
+// The number of attempts made to identify a newly inserted token before giving up on it
+#define SLOTMANAGER_RESOLVE_ATTEMPTS    8
+
+// How long (seconds) a removed token that hasn't finished its iterations keeps the run open
+#define SLOTMANAGER_REINSERT_GRACE      300
+
+// Resolves the serial number used to journal a token. Throws if the token can't be identified.
+typedef string (*SlotResolver)(PKCS11Slot * slot);
+
+// Performs one transaction against a token. Returns true if every operation succeeded.
+typedef bool (*SlotTransaction)(PKCS11Slot * slot, string serial, int iteration);
+
+class SlotManager;
+
+// A thread driving the transactions for a single token
+typedef struct {
+    SlotManager * manager;
+    PKCS11Slot * slot;
+    string serial;
+
+    // The token serial from C_GetTokenInfo, to tell a re-seated card from a different one
+    string tokenSerial;
+
+    HANDLE thread;
+    HANDLE stopEvent;
+    volatile bool stopping;
+
+    // Abandoned by Isolate - the thread may never return from the library, so it is not waited on
+    volatile bool isolated;
+} SlotWorker;
+
+// The history of a token across removals and reinsertions (keyed by journal serial)
+typedef struct {
+    // The number of transactions performed on the token
+    int iterations;
+
+    int removals;
+
+    // Taken out of the run after a stalled call (it isn't restarted on reinsertion)
+    bool isolated;
+
+    // When the token was last removed (0 while it is present)
+    double removed;
+
+    // Time from removal to reinsertion, and from removal to the first successful transaction after it
+    Histogram outage;
+    Histogram recovery;
+
+    // The CPU and wall time used by the token's workers (microseconds)
+    double cpu;
+    double wall;
+} TokenHistory;
+
+// A slot that has had a token inserted and is waiting to be identified
+typedef struct {
+    double inserted;
+    int attempts;
+} PendingSlot;
+
+
+// Runs worker threads for each token and follows tokens being removed and reinserted.
+class SlotManager
+{
+public:
+    SlotManager(void);
+    ~SlotManager(void);
+
+    // Starts a worker for each of [slots] (already identified as [serials]) and the slot watcher.
+    // Each token performs [iterations] transactions, [interval] milliseconds apart.
+    // Recovery times are also recorded into [results] when it isn't NULL.
+    void Start(PKCS11Manager * pkcs11, vector<PKCS11Slot> * slots, map<CK_ULONG, string> * serials,
+               int iterations, int interval, SlotResolver resolver, SlotTransaction transaction, Results * results);
+
+    // Waits up to [timeout] milliseconds for the run to finish. Returns true once every
+    // token has completed its iterations (or has been gone for longer than the grace period).
+    bool Wait(DWORD timeout);
+
+    // Stops the watcher and all workers, waiting for any transaction in progress to complete
+    void Stop();
+
+    // Pins the workers and the watcher with [affinity] (call before Start)
+    void SetAffinity(ThreadAffinity * affinity);
+
+    // Runs [workers] threads against each token. When [sessions] is non-zero they share a pool of that
+    // many sessions, logged in with [pin], instead of opening a session per transaction (call before Start)
+    void SetSessions(int workers, int sessions, string pin);
+
+    // Holds back the workers of tokens that keep failing with [breaker] (call before Start)
+    void SetBreaker(CircuitBreaker * breaker);
+
+    // When [paced], each worker starts a transaction every interval, rather than waiting the interval
+    // after each transaction completes (call before Start)
+    void SetPacing(bool paced);
+
+    // Copies the transactions started on each token so far into [iterations], by journal serial
+    void QueryIterations(map<string, int> * iterations);
+
+    // Carries on the transaction counts of a resumed run, so each token only runs its remaining iterations (call before Start)
+    void RestoreIterations(map<string, int> * iterations);
+
+    // Takes a token out of the run after a call on it has stalled. Its workers are asked to stop, and any
+    // that stay blocked in the library are abandoned rather than waited on by Stop.
+    void Isolate(string serial);
+
+    // Logs the removals, recovery times and CPU use for each token
+    void Report();
+
+private:
+    // Thread entry points
+    static DWORD WINAPI WatcherProc(LPVOID param);
+    static DWORD WINAPI WorkerProc(LPVOID param);
+
+    // The transaction loop for a single worker
+    void Work(SlotWorker * worker);
+
+    // Collects the slots that have changed since the last call
+    void Poll(vector<CK_SLOT_ID> * changed);
+
+    // Reconciles a changed slot with its worker
+    void SlotChanged(CK_SLOT_ID id);
+
+    // Identifies the tokens waiting in m_Pending and starts their workers
+    void StartPending();
+
+    // Creates and starts the workers for a token, taking ownership of [slot]. Must be called with m_Lock held.
+    void StartWorker(PKCS11Slot * slot, string serial, string tokenSerial);
+
+    // Asks every worker on a token's slot to stop and records the removal of the token. Must be called with m_Lock held.
+    void RetireWorker(SlotWorker * worker);
+
+    // Returns the running (not stopping) worker for a slot, or NULL. Must be called with m_Lock held.
+    SlotWorker * FindWorker(CK_SLOT_ID id);
+
+    // Releases workers whose threads have exited
+    void Reap(bool wait);
+
+private:
+    PKCS11Manager * m_PKCS11;
+    SlotResolver m_Resolver;
+    SlotTransaction m_Transaction;
+    Results * m_Results;
+    ThreadAffinity * m_Affinity;
+    CircuitBreaker * m_Breaker;
+
+    int m_Iterations;
+    int m_Interval;
+    bool m_Paced;
+
+    int m_WorkersPerToken;
+    int m_Sessions;
+    string m_Pin;
+
+    HANDLE m_Watcher;
+    HANDLE m_StopEvent;
+
+    // The CPU and wall time used by the watcher (microseconds)
+    double m_WatcherCpu;
+    double m_WatcherWall;
+    CRITICAL_SECTION m_Lock;
+
+    // Serialises transactions when the library couldn't be initialised for OS locking
+    CRITICAL_SECTION m_Serialise;
+
+    // Whether C_WaitForSlotEvent is available (otherwise the slot list is compared on each poll)
+    bool m_SlotEvents;
+    vector<CK_SLOT_ID> m_Present;
+
+    vector<SlotWorker *> m_Workers;
+    map<CK_SLOT_ID, PendingSlot> m_Pending;
+    map<string, TokenHistory> m_Tokens;
+
+    // The session pool for each slot (kept across reinsertions, since the health check replaces
+    // the stale sessions) and the token it was last used by
+    map<CK_SLOT_ID, SessionPool *> m_Pools;
+    map<CK_SLOT_ID, string> m_PoolTokens;
+};
@@ -0,0 +1,347 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "StdAfx.h"
+#include "Snapshot.h"
+
+#include <fstream>
+#include <sstream>
+#include <time.h>
+
+#include "ProcessLauncher.h"
+#include "Utility.h"
+#include "Log.h"
+
+
+Snapshot::Snapshot(void)
+{
+    m_Thread = NULL;
+    m_StopEvent = NULL;
+    m_Interval = 0;
+    m_Affinity = NULL;
+    m_Results = NULL;
+    m_Written = 0;
+}
+
+
+Snapshot::~Snapshot(void)
+{
+    this->Stop();
+}
+
+void Snapshot::Start(string path, int interval, Results * results) {
+
+    Log::debug("Snapshot::Start: Called\n");
+
+    if (NULL != m_Thread) {
+        Log::warn("Snapshot::Start: Snapshots are already being written, ignoring\n");
+        return;
+    }
+
+    m_Path = path;
+    m_Interval = interval;
+    m_Results = results;
+    m_Written = 0;
+
+    // The first interval starts from nothing
+    m_Results->Capture(&m_Previous);
+
+    m_StopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    m_Thread = CreateThread(NULL, 0, ThreadProc, this, CREATE_SUSPENDED, NULL);
+
+    if (NULL == m_Thread) {
+        Log::error("Snapshot::Start: Unable to create the snapshot thread\n");
+        CloseHandle(m_StopEvent);
+        m_StopEvent = NULL;
+        return;
+    }
+
+    if (NULL != m_Affinity) m_Affinity->PinService(m_Thread, "snapshot writer");
+    ResumeThread(m_Thread);
+
+    Log::info("Appending latency snapshots every %d seconds to %s\n", interval, path.c_str());
+}
+
+void Snapshot::Stop() {
+
+    if (NULL == m_Thread) return;
+
+    Log::debug("Snapshot::Stop: Called\n");
+
+    SetEvent(m_StopEvent);
+    WaitForSingleObject(m_Thread, INFINITE);
+
+    CloseHandle(m_Thread);
+    CloseHandle(m_StopEvent);
+    m_Thread = NULL;
+    m_StopEvent = NULL;
+
+    // Final snapshot so that the intervals cover the whole run
+    this->Write();
+
+    Log::debug("Snapshot::Stop: %d snapshots written to %s\n", m_Written, m_Path.c_str());
+}
+
+void Snapshot::SetAffinity(ThreadAffinity * affinity) {
+    m_Affinity = affinity;
+}
+
+DWORD WINAPI Snapshot::ThreadProc(LPVOID param) {
+
+    Snapshot * snapshot = (Snapshot *)param;
+
+    while (WAIT_TIMEOUT == WaitForSingleObject(snapshot->m_StopEvent, snapshot->m_Interval * 1000)) {
+        snapshot->Write();
+    }
+
+    return 0;
+}
+
+void Snapshot::Write() {
+
+    Results current, interval;
+
+    m_Results->Capture(&current);
+    current.Capture(&interval);
+
+    if (!interval.Subtract(&m_Previous)) {
+        Log::warn("The results went backwards since the last snapshot - the interval is incomplete\n");
+    }
+
+    current.Capture(&m_Previous);
+
+    if (Append(m_Path, &interval)) m_Written++;
+}
+
+bool Snapshot::Append(string path, Results * results) {
+
+    ofstream o(path.c_str(), ios_base::app | ios_base::out);
+    if (!o.is_open()) {
+        Log::error("Unable to append to the snapshot file %s\n", path.c_str());
+        return false;
+    }
+
+    results->Write(o);
+
+    o.close();
+    return !o.fail();
+}
+
+int Snapshot::Load(string path, Results * results) {
+
+    Log::debug("Snapshot::Load: Reading %s\n", path.c_str());
+
+    ifstream in(path.c_str());
+    if (!in.is_open()) {
+        Log::error("Unable to open %s\n", path.c_str());
+        return -1;
+    }
+
+    // Each block starts with the results header
+    int blocks = 0;
+    string line, block;
+
+    while (true) {
+
+        bool more = !getline(in, line).fail();
+
+        if (!more || line.compare(0, strlen(RESULTS_HEADER), RESULTS_HEADER) == 0) {
+
+            if (!block.empty()) {
+
+                Results part;
+                stringstream stream(block);
+                stringstream name;
+                name << path << " (block " << blocks + 1 << ")";
+
+                if (!part.Read(stream, name.str())) return -1;
+
+                results->Merge(&part);
+                blocks++;
+            }
+
+            block.clear();
+        }
+
+        if (!more) break;
+
+        block += line;
+        block += "\n";
+    }
+
+    return blocks;
+}
+
+bool Snapshot::LoadAll(vector<string> * paths, Results * results) {
+
+    int blocks = 0;
+
+    for (size_t i = 0; i < paths->size(); i++) {
+
+        int loaded = Load((*paths)[i], results);
+        if (loaded < 0) return false;
+
+        blocks += loaded;
+    }
+
+    // Blocks from one file follow each other and blocks from different files may overlap, so
+    // the only period that holds for both is the wall-clock span of all of them
+    if (blocks > 1) {
+        results->SetPeriod(results->getStartTime(), results->getEndTime(),
+                           (double)(results->getEndTime() - results->getStartTime()));
+    }
+
+    Log::info("Read %d blocks from %u files, %s to %s\n", blocks, (unsigned)paths->size(),
+              FormatTime(results->getStartTime()).c_str(), FormatTime(results->getEndTime()).c_str());
+    return true;
+}
+
+int Snapshot::Run(vector<wstring> * inputs, string resultsPath, double percentile) {
+
+    Log::debug("Snapshot::Run: Called\n");
+
+    string action = inputs->empty() ? "" : string((*inputs)[0].begin(), (*inputs)[0].end());
+
+    vector<string> paths;
+    for (size_t i = 1; i < inputs->size(); i++) {
+        paths.push_back(string((*inputs)[i].begin(), (*inputs)[i].end()));
+    }
+
+    if (percentile <= 0 || percentile > 100) {
+        Log::error("The percentile must be greater than 0 and at most 100.\n");
+        return EXIT_FAILURE;
+    }
+
+    if (action == "merge" && !paths.empty()) {
+
+        Results merged;
+        if (!LoadAll(&paths, &merged)) return EXIT_FAILURE;
+
+        ProcessLauncher::Report(&merged);
+
+        if (!merged.Save(resultsPath)) return EXIT_FAILURE;
+
+        Log::info("Merged results written to %s\n", resultsPath.c_str());
+        return EXIT_SUCCESS;
+    }
+
+    if (action == "diff" && paths.size() == 2) {
+
+        Results later, earlier;
+        vector<string> laterPath(1, paths[0]), earlierPath(1, paths[1]);
+
+        if (!LoadAll(&laterPath, &later) || !LoadAll(&earlierPath, &earlier)) return EXIT_FAILURE;
+
+        if (!later.Subtract(&earlier)) {
+            Log::warn("%s holds values that %s doesn't - it is not an earlier state of the same results\n",
+                      paths[1].c_str(), paths[0].c_str());
+        }
+
+        Log::info("\nDIFFERENCE %s to %s (%.0f seconds):\n", FormatTime(later.getStartTime()).c_str(),
+                  FormatTime(later.getEndTime()).c_str(), later.getDuration());
+
+        Query(&later, percentile);
+
+        if (!later.Save(resultsPath)) return EXIT_FAILURE;
+
+        Log::info("Difference written to %s\n", resultsPath.c_str());
+        return EXIT_SUCCESS;
+    }
+
+    if (action == "query" && !paths.empty()) {
+
+        Results merged;
+        if (!LoadAll(&paths, &merged)) return EXIT_FAILURE;
+
+        Query(&merged, percentile);
+        return EXIT_SUCCESS;
+    }
+
+    Log::error("Use 'snapshot merge <file> [file ...]', 'snapshot diff <later> <earlier>' or 'snapshot query <file> [file ...]'.\n");
+    return EXIT_FAILURE;
+}
+
+void Snapshot::Query(Results * results, double percentile) {
+
+    map<string, Histogram> * histograms = results->getHistograms();
+    map<string, ErrorCounts> * errors = results->getErrors();
+    double duration = results->getDuration();
+
+    char heading[16];
+    sprintf_s(heading, sizeof(heading), "P%g", percentile);
+
+    Log::info("\n%-20s %-14s %-16s %10s %8s %10s %10s %10s\n",
+              "OPERATION", "MECHANISM", "SERIAL", "COUNT", "OPS/S", "MEAN", heading, "MAX");
+
+    for (map<string, Histogram>::iterator entry = histograms->begin();
+            entry != histograms->end();
+            ++entry)
+    {
+        string operation, mechanism, serial;
+        Results::SplitKey(entry->first, &operation, &mechanism, &serial);
+
+        Histogram * histogram = &entry->second;
+
+        Log::info("%-20s %-14s %-16s %10llu %8.1f %7.1f ms %7.1f ms %7.1f ms\n",
+                  operation.c_str(), mechanism.c_str(), serial.c_str(), histogram->getCount(),
+                  (duration > 0) ? histogram->getCount() / duration : 0,
+                  histogram->getMean() / 1000.0, histogram->getPercentile(percentile) / 1000.0,
+                  histogram->getMaximum() / 1000.0);
+    }
+
+    if (errors->empty()) return;
+
+    Log::info("\n%-20s %-14s %-16s %-32s %10s\n", "OPERATION", "MECHANISM", "SERIAL", "FAILURE", "COUNT");
+
+    for (map<string, ErrorCounts>::iterator entry = errors->begin();
+            entry != errors->end();
+            ++entry)
+    {
+        string operation, mechanism, serial;
+        Results::SplitKey(entry->first, &operation, &mechanism, &serial);
+
+        for (ErrorCounts::iterator code = entry->second.begin(); code != entry->second.end(); ++code) {
+
+            // CKR_OK is a failure raised by the harness rather than the library
+            string name = (CKR_OK == code->first) ? "(not a PKCS#11 error)" : Utility::ErrorToString(code->first);
+
+            Log::info("%-20s %-14s %-16s %-32s %10llu\n", operation.c_str(), mechanism.c_str(), serial.c_str(),
+                      name.c_str(), code->second);
+        }
+    }
+}
+
+string Snapshot::FormatTime(long long time) {
+
+    if (time == 0) return "(unknown)";
+
+    time_t value = (time_t)time;
+    struct tm local;
+    char buffer[32];
+
+    localtime_s(&local, &value);
+    strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &local);
+
+    return buffer;
+}
@@ -0,0 +1,104 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+#include "stdafx.h"
+
+#include <windows.h>
+#include <string>
+#include <vector>
+
+#include "Results.h"
+#include "ThreadAffinity.h"
+
+using namespace std;
+
+// The file interval snapshots are appended to during a load test
+#define SNAPSHOT_FILE           "snapshots.txt"
+
+// The percentile the snapshot query reports unless told otherwise
+#define SNAPSHOT_PERCENTILE     99.0
+
+
+// Interval snapshots of the latency histograms and CK_RV counters.
+//
+// A snapshot file is a series of results blocks (the results file format), each holding only what
+// was recorded between its START and END. Blocks merge losslessly, so the intervals of a long run,
+// or the runs of many processes or hosts, can be combined without going back to the journals.
+// A results file is a snapshot file with a single block.
+class Snapshot
+{
+public:
+    Snapshot(void);
+    ~Snapshot(void);
+
+    // Starts appending what is recorded in [results] to [path] every [interval] seconds
+    void Start(string path, int interval, Results * results);
+
+    // Stops the writer, appending the final interval
+    void Stop();
+
+    // Pins the writer thread with [affinity] (call before Start)
+    void SetAffinity(ThreadAffinity * affinity);
+
+    // Runs the snapshot command. [inputs] holds the action (merge, diff or query) and the files.
+    // Merged and diffed results are written to [resultsPath]. Returns a process exit code.
+    static int Run(vector<wstring> * inputs, string resultsPath, double percentile);
+
+    // Merges every block in [path] into [results]. Returns the number of blocks, or -1 on error.
+    static int Load(string path, Results * results);
+
+    // Appends [results] to [path] as a block
+    static bool Append(string path, Results * results);
+
+private:
+    // Background thread entry point
+    static DWORD WINAPI ThreadProc(LPVOID param);
+
+    // Appends everything recorded since the last snapshot
+    void Write();
+
+    // Merges every block of the files in [paths] into [results]. Returns false on error.
+    static bool LoadAll(vector<string> * paths, Results * results);
+
+    // Logs the count, throughput, mean, [percentile] and maximum of each histogram, and the failures
+    static void Query(Results * results, double percentile);
+
+    // Formats a wall-clock time (seconds since the epoch)
+    static string FormatTime(long long time);
+
+private:
+    HANDLE m_Thread;
+    HANDLE m_StopEvent;
+
+    string m_Path;
+    int m_Interval;
+    ThreadAffinity * m_Affinity;
+
+    // The results being recorded, and a copy of them as of the last snapshot
+    Results * m_Results;
+    Results m_Previous;
+
+    int m_Written;
+};
@@ -0,0 +1,158 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "StdAfx.h"
+#include "Statistics.h"
+
+#include <math.h>
+#include <string.h>
+
+
+double Statistics::Mean(vector<double> * values) {
+
+    if (values->size() == 0) return 0;
+
+    double sum = 0;
+    for (size_t i = 0; i < values->size(); i++) {
+        sum += (*values)[i];
+    }
+
+    return sum / values->size();
+}
+
+double Statistics::Variance(vector<double> * values) {
+
+    if (values->size() < 2) return 0;
+
+    double mean = Mean(values);
+    double sum = 0;
+
+    for (size_t i = 0; i < values->size(); i++) {
+        double delta = (*values)[i] - mean;
+        sum += delta * delta;
+    }
+
+    return sum / (values->size() - 1);
+}
+
+bool Statistics::LinearRegression(vector<double> * x, vector<double> * y, RegressionResult * result) {
+
+    memset(result, 0, sizeof(RegressionResult));
+
+    size_t n = (x->size() < y->size()) ? x->size() : y->size();
+    result->count = (int)n;
+
+    // A slope with a standard error needs at least one residual degree of freedom
+    if (n < 3) return false;
+
+    double meanX = 0, meanY = 0;
+    for (size_t i = 0; i < n; i++) {
+        meanX += (*x)[i];
+        meanY += (*y)[i];
+    }
+    meanX /= n;
+    meanY /= n;
+
+    // Centred sums of squares (numerically safer than the raw-sum formulation
+    // when x is a large, slowly increasing iteration counter)
+    double sxx = 0, sxy = 0, syy = 0;
+    for (size_t i = 0; i < n; i++) {
+        double dx = (*x)[i] - meanX;
+        double dy = (*y)[i] - meanY;
+        sxx += dx * dx;
+        sxy += dx * dy;
+        syy += dy * dy;
+    }
+
+    if (sxx == 0) return false;
+
+    result->slope = sxy / sxx;
+    result->intercept = meanY - result->slope * meanX;
+
+    double residual = (syy - result->slope * sxy) / (n - 2);
+    if (residual < 0) residual = 0;
+
+    result->standardError = sqrt(residual / sxx);
+
+    if (result->standardError > 0) {
+        result->tStatistic = result->slope / result->standardError;
+    } else {
+        // A perfect fit - any non-zero slope is as significant as it gets
+        result->tStatistic = (result->slope > 0) ? HUGE_VAL : ((result->slope < 0) ? -HUGE_VAL : 0);
+    }
+
+    return true;
+}
+
+bool Statistics::IsSignificantGrowth(RegressionResult * result) {
+
+    if (result->count < 10) return false;
+
+    return (result->slope > 0) && (result->tStatistic >= STATISTICS_SIGNIFICANT_T);
+}
+
+int Statistics::TruncationPoint(vector<double> * values, int batch) {
+
+    if (batch < 1) batch = 1;
+
+    // Batch means (a partial batch at the end is left out)
+    vector<double> means;
+    for (size_t i = 0; i + batch <= values->size(); i += batch) {
+
+        double sum = 0;
+        for (int j = 0; j < batch; j++) sum += (*values)[i + j];
+
+        means.push_back(sum / batch);
+    }
+
+    size_t count = means.size();
+    if (count < 2) return -1;
+
+    // Suffix sums, so each truncation is evaluated in constant time
+    vector<double> sums(count + 1, 0), squares(count + 1, 0);
+    for (size_t i = count; i > 0; i--) {
+        sums[i - 1] = sums[i] + means[i - 1];
+        squares[i - 1] = squares[i] + means[i - 1] * means[i - 1];
+    }
+
+    size_t best = 0;
+    double lowest = HUGE_VAL;
+
+    for (size_t d = 0; d <= count / 2; d++) {
+
+        double remaining = (double)(count - d);
+        double mean = sums[d] / remaining;
+        double deviation = squares[d] - remaining * mean * mean;
+        if (deviation < 0) deviation = 0;
+
+        double mser = deviation / (remaining * remaining);
+
+        if (mser < lowest) {
+            lowest = mser;
+            best = d;
+        }
+    }
+
+    return (int)best * batch;
+}
@@ -0,0 +1,73 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+#include "stdafx.h"
+
+#include <vector>
+
+using namespace std;
+
+// The minimum t-statistic for a regression slope to be considered significant.
+// A one-sided test at roughly the 1% level once there are 10 or more samples.
+#define STATISTICS_SIGNIFICANT_T    3.0
+
+typedef struct {
+
+    // Number of (x, y) pairs used in the fit
+    int count;
+
+    // Least-squares fit of y = intercept + slope * x
+    double slope;
+    double intercept;
+
+    // Standard error of the slope and the resulting t-statistic (slope / standardError)
+    double standardError;
+    double tStatistic;
+
+} RegressionResult;
+
+
+class Statistics
+{
+public:
+
+    // Returns the arithmetic mean of the supplied values (0 if empty)
+    static double Mean(vector<double> * values);
+
+    // Returns the sample variance of the supplied values (0 if fewer than two)
+    static double Variance(vector<double> * values);
+
+    // Performs an ordinary least-squares fit of y against x.
+    // Returns false if there are fewer than three points or x has no spread.
+    static bool LinearRegression(vector<double> * x, vector<double> * y, RegressionResult * result);
+
+    // Returns true if the regression shows a statistically significant positive slope.
+    static bool IsSignificantGrowth(RegressionResult * result);
+
+    // Returns the number of initial values to discard as warm-up, by the MSER-[batch] rule: the values are
+    // averaged in batches, and the truncation that minimises the standard error of the remaining mean is
+    // chosen from the first half. Returns -1 if there are fewer than two batches.
+    static int TruncationPoint(vector<double> * values, int batch);
+};
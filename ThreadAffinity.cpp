@@ -0,0 +1,253 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "StdAfx.h"
+#include "ThreadAffinity.h"
+
+#include <sstream>
+#include <stdlib.h>
+#include <algorithm>
+
+#include "Log.h"
+
+// Converts a FILETIME (100 ns units) to microseconds
+static double FileTimeToMicroseconds(FILETIME * time) {
+    return (double)(((unsigned long long)time->dwHighDateTime << 32) | time->dwLowDateTime) / 10.0;
+}
+
+// Formats a processor list for logging
+static string FormatList(vector<int> * processors) {
+
+    stringstream buffer;
+
+    for (size_t i = 0; i < processors->size(); i++) {
+        if (i > 0) buffer << ",";
+        buffer << (*processors)[i];
+    }
+
+    return buffer.str();
+}
+
+
+ThreadAffinity::ThreadAffinity(void)
+{
+    m_Enabled = false;
+    m_Services = 0;
+
+    InitializeCriticalSection(&m_Lock);
+}
+
+
+ThreadAffinity::~ThreadAffinity(void)
+{
+    DeleteCriticalSection(&m_Lock);
+}
+
+bool ThreadAffinity::Configure(string workers, string services) {
+
+    Log::debug("ThreadAffinity::Configure: Workers '%s', services '%s'\n", workers.c_str(), services.c_str());
+
+    DWORD_PTR available = 0, system = 0;
+    if (!GetProcessAffinityMask(GetCurrentProcess(), &available, &system)) {
+        Log::error("Unable to read the process affinity mask (%u)\n", GetLastError());
+        return false;
+    }
+
+    vector<int> serviceList;
+
+    if (!services.empty()) {
+        if (!ParseList(services, &serviceList)) {
+            Log::error("Invalid service thread processor list '%s'\n", services.c_str());
+            return false;
+        }
+    }
+
+    m_Workers.clear();
+
+    if (workers == AFFINITY_AUTO) {
+
+        vector<int> ordered;
+        this->BuildDefault(&ordered);
+
+        // Keep the service threads off the worker processors where there are enough to go round
+        if (serviceList.empty() && ordered.size() > 1) {
+            serviceList.push_back(ordered[0]);
+        }
+
+        for (size_t i = 0; i < ordered.size(); i++) {
+            if (ordered.size() > serviceList.size() &&
+                    find(serviceList.begin(), serviceList.end(), ordered[i]) != serviceList.end()) continue;
+            m_Workers.push_back(ordered[i]);
+        }
+    }
+    else if (!ParseList(workers, &m_Workers)) {
+        Log::error("Invalid worker processor list '%s'\n", workers.c_str());
+        return false;
+    }
+
+    if (m_Workers.empty()) {
+        Log::error("No processors are available for the workers\n");
+        return false;
+    }
+
+    // Without a service list the service threads share the worker processors
+    if (serviceList.empty()) serviceList = m_Workers;
+
+    m_Services = 0;
+
+    for (size_t i = 0; i < m_Workers.size() + serviceList.size(); i++) {
+
+        int processor = (i < m_Workers.size()) ? m_Workers[i] : serviceList[i - m_Workers.size()];
+
+        if (processor >= (int)(sizeof(DWORD_PTR) * 8) || 0 == (available & ((DWORD_PTR)1 << processor))) {
+            Log::error("Processor %d is not available to this process\n", processor);
+            return false;
+        }
+
+        if (i >= m_Workers.size()) m_Services |= (DWORD_PTR)1 << processor;
+    }
+
+    Log::info("Pinning token workers to processors %s and service threads to %s\n",
+              FormatList(&m_Workers).c_str(), FormatList(&serviceList).c_str());
+
+    m_Enabled = true;
+    return true;
+}
+
+bool ThreadAffinity::isEnabled() {
+    return m_Enabled;
+}
+
+void ThreadAffinity::PinWorker(HANDLE thread, string serial) {
+
+    if (!m_Enabled) return;
+
+    EnterCriticalSection(&m_Lock);
+
+    if (m_Assigned.find(serial) == m_Assigned.end()) {
+        size_t next = m_Assigned.size();
+        m_Assigned[serial] = next;
+    }
+
+    int processor = m_Workers[m_Assigned[serial] % m_Workers.size()];
+
+    LeaveCriticalSection(&m_Lock);
+
+    if (0 == SetThreadAffinityMask(thread, (DWORD_PTR)1 << processor)) {
+        Log::warn("Unable to pin the worker for %s to processor %d (%u)\n", serial.c_str(), processor, GetLastError());
+        return;
+    }
+
+    Log::debug("ThreadAffinity::PinWorker: %s on processor %d\n", serial.c_str(), processor);
+}
+
+void ThreadAffinity::PinService(HANDLE thread, const char * name) {
+
+    if (!m_Enabled) return;
+
+    if (0 == SetThreadAffinityMask(thread, m_Services)) {
+        Log::warn("Unable to pin the %s thread (%u)\n", name, GetLastError());
+    }
+}
+
+bool ThreadAffinity::QueryThreadTimes(HANDLE thread, double * cpu, double * wall) {
+
+    FILETIME creation, exit, kernel, user;
+
+    if (!GetThreadTimes(thread, &creation, &exit, &kernel, &user)) return false;
+
+    *cpu = FileTimeToMicroseconds(&kernel) + FileTimeToMicroseconds(&user);
+
+    // The exit time is only defined once the thread has finished
+    if (WAIT_OBJECT_0 != WaitForSingleObject(thread, 0)) {
+        GetSystemTimeAsFileTime(&exit);
+    }
+
+    *wall = FileTimeToMicroseconds(&exit) - FileTimeToMicroseconds(&creation);
+    return true;
+}
+
+bool ThreadAffinity::ParseList(string text, vector<int> * processors) {
+
+    stringstream buffer(text);
+    string range;
+
+    while (getline(buffer, range, ',')) {
+
+        if (range.empty() || range.find_first_not_of("0123456789-") != string::npos) return false;
+
+        size_t dash = range.find('-');
+        string from = range.substr(0, dash);
+        string to = (dash == string::npos) ? from : range.substr(dash + 1);
+
+        if (dash == 0 || dash == range.length() - 1) return false;
+
+        // Out of range processors are rejected before a range is expanded (or a long number overflows)
+        int limit = (int)(sizeof(DWORD_PTR) * 8);
+        if (from.length() > 4 || to.length() > 4) return false;
+
+        int first = atoi(from.c_str());
+        int last = atoi(to.c_str());
+
+        if (first >= limit || last >= limit || last < first) return false;
+
+        for (int i = first; i <= last; i++) {
+            if (find(processors->begin(), processors->end(), i) == processors->end()) processors->push_back(i);
+        }
+    }
+
+    return !processors->empty();
+}
+
+void ThreadAffinity::BuildDefault(vector<int> * processors) {
+
+    DWORD_PTR available = 0, system = 0;
+    GetProcessAffinityMask(GetCurrentProcess(), &available, &system);
+
+    ULONG highest = 0;
+    if (!GetNumaHighestNodeNumber(&highest)) highest = 0;
+
+    DWORD_PTR remaining = available;
+
+    for (ULONG node = 0; node <= highest; node++) {
+
+        ULONGLONG mask = 0;
+        if (!GetNumaNodeProcessorMask((UCHAR)node, &mask)) continue;
+
+        for (int i = 0; i < (int)(sizeof(DWORD_PTR) * 8); i++) {
+            DWORD_PTR bit = (DWORD_PTR)1 << i;
+            if ((mask & bit) && (remaining & bit)) {
+                processors->push_back(i);
+                remaining &= ~bit;
+            }
+        }
+    }
+
+    // Anything the NUMA query didn't cover (or everything, if it failed)
+    for (int i = 0; i < (int)(sizeof(DWORD_PTR) * 8); i++) {
+        if (remaining & ((DWORD_PTR)1 << i)) processors->push_back(i);
+    }
+
+    Log::debug("ThreadAffinity::BuildDefault: %u NUMA nodes, processor order %s\n", highest + 1, FormatList(processors).c_str());
+}
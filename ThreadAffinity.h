@@ -0,0 +1,83 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+#include "stdafx.h"
+
+#include <windows.h>
+#include <string>
+#include <vector>
+#include <map>
+
+using namespace std;
+
+// The layout chosen by "--affinity auto"
+#define AFFINITY_AUTO           "auto"
+
+
+// Pins the slot workers and the service threads (slot watcher, process sampler) to processors,
+// so that scheduler migration doesn't add to the measured latency.
+// Only the processors of the process's own processor group (at most 64) are used.
+class ThreadAffinity
+{
+public:
+    ThreadAffinity(void);
+    ~ThreadAffinity(void);
+
+    // Sets the processors for the workers - "auto" or a list such as "2-5,8" - and for the service
+    // threads (a list, or empty for the first processor not given to a worker). Returns false if
+    // either is invalid or names a processor the process can't run on.
+    bool Configure(string workers, string services);
+
+    // Returns true once Configure has succeeded
+    bool isEnabled();
+
+    // Pins a slot worker. Tokens are spread over the worker processors in the order they are first
+    // seen, and a reinserted token goes back to the processor it had.
+    void PinWorker(HANDLE thread, string serial);
+
+    // Pins a service thread
+    void PinService(HANDLE thread, const char * name);
+
+    // Returns the CPU (user + kernel) and wall time of [thread] so far, in microseconds
+    static bool QueryThreadTimes(HANDLE thread, double * cpu, double * wall);
+
+    // Parses a processor list such as "0-3,6". Returns false if it is malformed or names a processor past the
+    // processor group (64).
+    static bool ParseList(string text, vector<int> * processors);
+
+private:
+    // Orders the available processors node by node, so the workers fill one NUMA node before the next
+    void BuildDefault(vector<int> * processors);
+
+private:
+    CRITICAL_SECTION m_Lock;
+    bool m_Enabled;
+
+    vector<int> m_Workers;
+    DWORD_PTR m_Services;
+
+    // The index into m_Workers given to each token
+    map<string, size_t> m_Assigned;
+};
@@ -0,0 +1,273 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "StdAfx.h"
+#include "TransportMonitor.h"
+
+#ifdef WIN32
+#undef UNICODE
+#endif
+
+#include <psapi.h>
+
+#include "Utility.h"
+#include "Log.h"
+
+extern "C"
+{
+#include <winscard.h>
+}
+
+// The transmits made on one thread since its last operation was recorded
+typedef struct {
+    int count;
+    double start[TRANSPORT_MAX_INTERVALS];
+    double wire[TRANSPORT_MAX_INTERVALS];
+    unsigned int transmits[TRANSPORT_MAX_INTERVALS];
+} TransmitLog;
+
+typedef LONG (WINAPI * SCardTransmitProc)(SCARDHANDLE, const SCARD_IO_REQUEST *, LPCBYTE, DWORD, SCARD_IO_REQUEST *, LPBYTE, LPDWORD);
+
+static SCardTransmitProc m_Transmit = NULL;
+static vector<TransportPatch> m_Patches;
+static bool m_Installed = false;
+
+static CRITICAL_SECTION m_Lock;
+static map<pair<string, string>, TransportAttribution> m_Attribution;
+
+// Every transmit seen, and those that fell inside a recorded operation
+static volatile LONG m_Transmits = 0;
+static unsigned long long m_Attributed = 0;
+
+// Each worker thread keeps its own log, so the hook never takes a lock
+static __declspec(thread) TransmitLog m_Log;
+
+
+TransportMonitor::TransportMonitor(void)
+{
+}
+
+
+TransportMonitor::~TransportMonitor(void)
+{
+}
+
+static LONG WINAPI HookTransmit(SCARDHANDLE hCard, const SCARD_IO_REQUEST * pioSendPci, LPCBYTE pbSendBuffer, DWORD cbSendLength,
+                                SCARD_IO_REQUEST * pioRecvPci, LPBYTE pbRecvBuffer, LPDWORD pcbRecvLength) {
+
+    double started = Utility::QueryMicroseconds();
+    LONG rv = m_Transmit(hCard, pioSendPci, pbSendBuffer, cbSendLength, pioRecvPci, pbRecvBuffer, pcbRecvLength);
+    double elapsed = Utility::QueryMicroseconds() - started;
+
+    InterlockedIncrement(&m_Transmits);
+
+    if (m_Log.count < TRANSPORT_MAX_INTERVALS) {
+        m_Log.start[m_Log.count] = started;
+        m_Log.wire[m_Log.count] = elapsed;
+        m_Log.transmits[m_Log.count] = 1;
+        m_Log.count++;
+    } else {
+        m_Log.wire[TRANSPORT_MAX_INTERVALS - 1] += elapsed;
+        m_Log.transmits[TRANSPORT_MAX_INTERVALS - 1]++;
+    }
+
+    return rv;
+}
+
+bool TransportMonitor::Install() {
+
+    Log::debug("TransportMonitor::Install: Called\n");
+
+    if (m_Installed) return true;
+
+    HMODULE winscard = GetModuleHandleA("winscard.dll");
+    if (NULL == winscard) {
+        Log::warn("The PKCS#11 library has not loaded winscard.dll - transport attribution is not available\n");
+        return false;
+    }
+
+    void * target = (void *)GetProcAddress(winscard, "SCardTransmit");
+    if (NULL == target) {
+        Log::warn("Unable to locate SCardTransmit - transport attribution is not available\n");
+        return false;
+    }
+
+    m_Transmit = (SCardTransmitProc)target;
+    InitializeCriticalSection(&m_Lock);
+
+    HMODULE modules[1024];
+    DWORD needed = 0;
+
+    if (!EnumProcessModules(GetCurrentProcess(), modules, sizeof(modules), &needed)) {
+        Log::error("TransportMonitor::Install: EnumProcessModules failed (%u)\n", GetLastError());
+        DeleteCriticalSection(&m_Lock);
+        return false;
+    }
+
+    if (needed > sizeof(modules)) needed = sizeof(modules);
+
+    // Our own PC/SC calls (the CPLC and APDU replay) are not part of any PKCS#11 operation
+    HMODULE self = GetModuleHandleA(NULL);
+    int patched = 0;
+
+    for (DWORD i = 0; i < needed / sizeof(HMODULE); i++) {
+        if (modules[i] == self || modules[i] == winscard) continue;
+        patched += PatchModule(modules[i], target, (void *)HookTransmit);
+    }
+
+    if (patched == 0) {
+        Log::warn("No module imports SCardTransmit directly - transport attribution is not available\n");
+        DeleteCriticalSection(&m_Lock);
+        return false;
+    }
+
+    m_Installed = true;
+    Log::info("Timing SCardTransmit in %d import table entries\n", patched);
+
+    return true;
+}
+
+void TransportMonitor::Remove() {
+
+    if (!m_Installed) return;
+
+    for (size_t i = 0; i < m_Patches.size(); i++) {
+        WriteSlot(m_Patches[i].slot, m_Patches[i].original);
+    }
+
+    m_Patches.clear();
+    m_Installed = false;
+}
+
+bool TransportMonitor::isInstalled() {
+    return m_Installed;
+}
+
+int TransportMonitor::PatchModule(HMODULE module, void * target, void * replacement) {
+
+    BYTE * base = (BYTE *)module;
+
+    IMAGE_DOS_HEADER * dos = (IMAGE_DOS_HEADER *)base;
+    if (dos->e_magic != IMAGE_DOS_SIGNATURE) return 0;
+
+    IMAGE_NT_HEADERS * nt = (IMAGE_NT_HEADERS *)(base + dos->e_lfanew);
+    if (nt->Signature != IMAGE_NT_SIGNATURE) return 0;
+
+    IMAGE_DATA_DIRECTORY * directory = &nt->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_IMPORT];
+    if (directory->VirtualAddress == 0) return 0;
+
+    int patched = 0;
+
+    // The bound addresses are compared rather than the names, so forwarded and ordinal imports are caught too
+    for (IMAGE_IMPORT_DESCRIPTOR * import = (IMAGE_IMPORT_DESCRIPTOR *)(base + directory->VirtualAddress);
+            import->Name != 0;
+            import++)
+    {
+        for (IMAGE_THUNK_DATA * thunk = (IMAGE_THUNK_DATA *)(base + import->FirstThunk);
+                thunk->u1.Function != 0;
+                thunk++)
+        {
+            void ** slot = (void **)&thunk->u1.Function;
+            if (*slot != target) continue;
+
+            if (WriteSlot(slot, replacement)) {
+                TransportPatch patch = { slot, target };
+                m_Patches.push_back(patch);
+                patched++;
+            }
+        }
+    }
+
+    return patched;
+}
+
+bool TransportMonitor::WriteSlot(void ** slot, void * value) {
+
+    DWORD protection;
+
+    if (!VirtualProtect(slot, sizeof(void *), PAGE_READWRITE, &protection)) {
+        Log::debug("TransportMonitor::WriteSlot: VirtualProtect failed (%u)\n", GetLastError());
+        return false;
+    }
+
+    InterlockedExchangePointer(slot, value);
+    VirtualProtect(slot, sizeof(void *), protection, &protection);
+
+    return true;
+}
+
+void TransportMonitor::Record(string serial, string operation, double started, double elapsed) {
+
+    if (!m_Installed) return;
+
+    double wire = 0;
+    unsigned long long transmits = 0;
+
+    // Anything older belongs to calls between operations (session handling, key searches that weren't timed)
+    for (int i = 0; i < m_Log.count; i++) {
+        if (m_Log.start[i] < started) continue;
+        wire += m_Log.wire[i];
+        transmits += m_Log.transmits[i];
+    }
+
+    m_Log.count = 0;
+
+    EnterCriticalSection(&m_Lock);
+
+    TransportAttribution * entry = &m_Attribution[make_pair(operation, serial)];
+    entry->count++;
+    entry->elapsed += elapsed;
+    entry->wire += wire;
+    entry->transmits += transmits;
+    m_Attributed += transmits;
+
+    LeaveCriticalSection(&m_Lock);
+}
+
+void TransportMonitor::Report() {
+
+    if (!m_Installed) return;
+
+    EnterCriticalSection(&m_Lock);
+
+    Log::info("\nTRANSPORT ATTRIBUTION (%llu of %ld SCardTransmit calls fell within an operation):\n",
+              m_Attributed, m_Transmits);
+    Log::info("%-20s %-16s %8s %10s %10s %8s %8s %8s\n",
+              "OPERATION", "SERIAL", "COUNT", "MEAN", "WIRE", "WIRE %", "LIBRARY %", "APDUS");
+
+    for (map<pair<string, string>, TransportAttribution>::iterator entry = m_Attribution.begin();
+            entry != m_Attribution.end();
+            ++entry)
+    {
+        TransportAttribution * totals = &entry->second;
+        double share = (totals->elapsed > 0) ? totals->wire * 100.0 / totals->elapsed : 0;
+
+        Log::info("%-20s %-16s %8llu %7.1f ms %7.1f ms %7.1f%% %8.1f%% %8.1f\n",
+                  entry->first.first.c_str(), entry->first.second.c_str(), totals->count,
+                  totals->elapsed / totals->count / 1000.0, totals->wire / totals->count / 1000.0,
+                  share, 100.0 - share, (double)totals->transmits / totals->count);
+    }
+
+    LeaveCriticalSection(&m_Lock);
+}
@@ -0,0 +1,83 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+#include "stdafx.h"
+
+#include <windows.h>
+#include <string>
+#include <vector>
+#include <map>
+
+using namespace std;
+
+// The transmits remembered per thread between operations. Further transmits are folded into the last one.
+#define TRANSPORT_MAX_INTERVALS 64
+
+// The time on the wire for one operation, totalled over all of its executions
+typedef struct {
+    unsigned long long count;
+    double elapsed;
+    double wire;
+    unsigned long long transmits;
+} TransportAttribution;
+
+// An import table entry that has been redirected, so it can be put back
+typedef struct {
+    void ** slot;
+    void * original;
+} TransportPatch;
+
+
+// Times the SCardTransmit calls made by the PKCS#11 library, by redirecting its imports from
+// winscard.dll, and attributes them to the operations running on the same thread.
+class TransportMonitor
+{
+public:
+    TransportMonitor(void);
+    ~TransportMonitor(void);
+
+    // Redirects SCardTransmit in every loaded module other than this executable and winscard.dll.
+    // Call once the library has been initialised, so that the modules it depends on are loaded.
+    static bool Install();
+
+    // Restores the original import table entries
+    static void Remove();
+
+    // Returns true if the hook is in place
+    static bool isInstalled();
+
+    // Attributes the transmits made on this thread since [started] to an operation that took [elapsed]
+    static void Record(string serial, string operation, double started, double elapsed);
+
+    // Logs the share of each operation spent on the wire and in the library
+    static void Report();
+
+private:
+    // Redirects every import of [target] by [module] to [replacement]. Returns the number of entries changed.
+    static int PatchModule(HMODULE module, void * target, void * replacement);
+
+    // Writes an import table entry
+    static bool WriteSlot(void ** slot, void * value);
+};
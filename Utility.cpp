@@ -35,8 +35,15 @@ THE SOFTWARE.
 #include <cctype>
 #include <locale>
 
+#include <windows.h>
+
 #include "Log.h"
 #include "Utility.h"
+
+// The CK_RV last thrown on each thread, so that a failure can be counted against it (and, separately,
+// against the token's circuit breaker)
+static __declspec(thread) CK_RV m_LastError = CKR_OK;
+static __declspec(thread) CK_RV m_LastFailure = CKR_OK;
 //
 //char *rtrim(char *s)
 //{
@@ -101,7 +108,7 @@ string Utility::CK_VERSIONtoString(CK_VERSION value) {
     return buffer.str();
 };
 
-char* ErrorToString(CK_RV result) {
+char* Utility::ErrorToString(CK_RV result) {
 
     switch (result)
     {
@@ -302,9 +309,25 @@ void Utility::ThrowOnError(CK_RV result, char * source, char * call) {
                result,
                ErrorToString(result));
 
+    m_LastError = result;
+    m_LastFailure = result;
     throw ErrorToString(result);
 }
 
+CK_RV Utility::TakeLastError() {
+
+    CK_RV result = m_LastError;
+    m_LastError = CKR_OK;
+    return result;
+}
+
+CK_RV Utility::TakeLastFailure() {
+
+    CK_RV result = m_LastFailure;
+    m_LastFailure = CKR_OK;
+    return result;
+}
+
 void Utility::HexStringToArray(char *data, const char *hexstring, unsigned int len)
 {
     const char *pos = hexstring;
@@ -344,4 +367,19 @@ string Utility::CurrentDateTime() {
 
     return buf;
 
+}
+
+// High resolution timestamp, based on the performance counter
+double Utility::QueryMicroseconds() {
+
+    static LARGE_INTEGER frequency = { 0 };
+    LARGE_INTEGER counter;
+
+    if (0 == frequency.QuadPart) {
+        QueryPerformanceFrequency(&frequency);
+    }
+
+    QueryPerformanceCounter(&counter);
+
+    return (double)counter.QuadPart * 1000000.0 / (double)frequency.QuadPart;
 }
\ No newline at end of file
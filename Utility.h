@@ -21,6 +21,15 @@ public:
     // Takes a PKCS#11 CK_RV result and throws an error if it is considered a failure.
     static void ThrowOnError(CK_RV result, char * source, char * call);
 
+    // Returns the CK_RV last thrown by ThrowOnError on this thread (CKR_OK if none), and clears it
+    static CK_RV TakeLastError();
+
+    // As TakeLastError, but kept separately - returns the CK_RV of the last failure on this thread since the previous call
+    static CK_RV TakeLastFailure();
+
+    // Returns the name of a PKCS#11 CK_RV result code
+    static char * ErrorToString(CK_RV result);
+
     // Parses a hexadecimal numeric string to produce a byte array.
     static void HexStringToArray(char * data, const char *hexstring, unsigned int len);
 
@@ -29,5 +38,8 @@ public:
 
     // Returns a formatted string with the current local date and time.
     static string CurrentDateTime();
+
+    // Returns a high resolution, monotonic timestamp in microseconds (for measuring elapsed time only).
+    static double QueryMicroseconds();
 };
 
@@ -0,0 +1,347 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "StdAfx.h"
+#include "Warmup.h"
+
+#include <limits.h>
+
+#include "Statistics.h"
+#include "Log.h"
+
+
+Warmup::Warmup(void)
+{
+    m_Transactions = 0;
+    m_Results = NULL;
+    m_Trend = NULL;
+
+    InitializeCriticalSection(&m_Lock);
+}
+
+
+Warmup::~Warmup(void)
+{
+    DeleteCriticalSection(&m_Lock);
+}
+
+void Warmup::Configure(int transactions, Results * results, LatencyTrend * trend) {
+    m_Transactions = transactions;
+    m_Results = results;
+    m_Trend = trend;
+}
+
+bool Warmup::isEnabled() {
+    return m_Transactions != 0;
+}
+
+bool Warmup::Record(string serial, int iteration, string operation, string mechanism, double microseconds) {
+
+    if (!this->isEnabled()) return false;
+
+    EnterCriticalSection(&m_Lock);
+
+    WarmupToken * token = &m_Tokens[serial];
+
+    if (token->warm) {
+        this->Count(operation, microseconds);
+        LeaveCriticalSection(&m_Lock);
+        return false;
+    }
+
+    WarmupRecord record;
+    record.operation = operation;
+    record.mechanism = mechanism;
+    record.microseconds = microseconds;
+    token->running[iteration].push_back(record);
+
+    LeaveCriticalSection(&m_Lock);
+    return true;
+}
+
+void Warmup::Complete(string serial, int iteration, bool succeeded) {
+
+    if (!this->isEnabled()) return;
+
+    EnterCriticalSection(&m_Lock);
+
+    WarmupToken * token = &m_Tokens[serial];
+
+    if (token->warm) {
+        LeaveCriticalSection(&m_Lock);
+        return;
+    }
+
+    map<int, vector<WarmupRecord> >::iterator transaction = token->running.find(iteration);
+
+    if (succeeded) {
+
+        // A transaction with no operations held has nothing to test
+        if (transaction == token->running.end()) {
+            LeaveCriticalSection(&m_Lock);
+            return;
+        }
+
+        token->held[iteration].swap(transaction->second);
+        token->running.erase(transaction);
+    }
+    else {
+
+        // The operations that did succeed were made while cold, but say nothing about the transaction's latency
+        if (transaction != token->running.end()) {
+            for (size_t i = 0; i < transaction->second.size(); i++) {
+                m_Cold[transaction->second[i].operation].Record(transaction->second[i].microseconds);
+            }
+            token->running.erase(transaction);
+        }
+
+        token->failed.insert(iteration);
+
+        // Only a fixed warm-up has moved on
+        if (m_Transactions == WARMUP_AUTO) {
+            LeaveCriticalSection(&m_Lock);
+            return;
+        }
+    }
+
+    string reason;
+    int length = this->Test(token, &reason);
+
+    if (length >= 0) this->End(serial, token, length, reason);
+
+    LeaveCriticalSection(&m_Lock);
+}
+
+int Warmup::Test(WarmupToken * token, string * reason) {
+
+    int completed = (int)token->held.size();
+
+    // The failed transactions are among the first [m_Transactions], so every successful one held is discarded
+    if (m_Transactions != WARMUP_AUTO) {
+        *reason = "count";
+        return (completed + (int)token->failed.size() >= m_Transactions) ? completed : -1;
+    }
+
+    // Only re-tested as each batch fills
+    if (completed < WARMUP_MIN_TRANSACTIONS || completed % WARMUP_BATCH != 0) return -1;
+
+    vector<double> latencies;
+    Latencies(token, &latencies);
+
+    int length = Statistics::TruncationPoint(&latencies, WARMUP_BATCH);
+    if (length < 0) return -1;
+
+    // A truncation point late in the range searched means the latency is still settling
+    if (completed >= WARMUP_MAX_TRANSACTIONS) {
+        *reason = "limit";
+        return length;
+    }
+
+    if (length <= completed / 4) {
+        *reason = "MSER-5";
+        return length;
+    }
+
+    return -1;
+}
+
+void Warmup::Latencies(WarmupToken * token, vector<double> * latencies) {
+
+    for (map<int, vector<WarmupRecord> >::iterator transaction = token->held.begin();
+            transaction != token->held.end();
+            ++transaction)
+    {
+        double sum = 0;
+        for (size_t i = 0; i < transaction->second.size(); i++) sum += transaction->second[i].microseconds;
+        latencies->push_back(sum);
+    }
+}
+
+void Warmup::End(string serial, WarmupToken * token, int length, string reason) {
+
+    int index = 0;
+    int first = INT_MAX;
+
+    for (map<int, vector<WarmupRecord> >::iterator transaction = token->held.begin();
+            transaction != token->held.end();
+            ++transaction, ++index)
+    {
+        for (size_t i = 0; i < transaction->second.size(); i++) {
+
+            WarmupRecord * record = &transaction->second[i];
+
+            if (index < length) {
+                m_Cold[record->operation].Record(record->microseconds);
+                continue;
+            }
+
+            if (transaction->first < first) first = transaction->first;
+
+            // Settled - recorded as though it had never been held
+            this->Count(record->operation, record->microseconds);
+
+            if (NULL != m_Trend) m_Trend->Record(serial, transaction->first, record->operation, record->microseconds);
+            if (NULL != m_Results) m_Results->Record(serial, record->operation, record->mechanism, record->microseconds);
+        }
+    }
+
+    // Transactions still running finish after the truncation point, so what they have done so far is warm
+    for (map<int, vector<WarmupRecord> >::iterator transaction = token->running.begin();
+            transaction != token->running.end();
+            ++transaction)
+    {
+        for (size_t i = 0; i < transaction->second.size(); i++) {
+
+            WarmupRecord * record = &transaction->second[i];
+
+            this->Count(record->operation, record->microseconds);
+
+            if (NULL != m_Trend) m_Trend->Record(serial, transaction->first, record->operation, record->microseconds);
+            if (NULL != m_Results) m_Results->Record(serial, record->operation, record->mechanism, record->microseconds);
+        }
+    }
+
+    // The failed transactions before the first one recorded were part of the warm-up too
+    for (set<int>::iterator failed = token->failed.begin(); failed != token->failed.end() && *failed < first; ++failed) {
+        length++;
+    }
+
+    token->held.clear();
+    token->running.clear();
+    token->failed.clear();
+    token->warm = true;
+    token->length = length;
+    token->reason = reason;
+
+    Log::info("Token %s warmed up after %d transactions (%s)\n", serial.c_str(), length, reason.c_str());
+}
+
+void Warmup::Count(string operation, double microseconds) {
+    m_Warm[operation].Record(microseconds);
+}
+
+void Warmup::Finish() {
+
+    if (!this->isEnabled()) return;
+
+    EnterCriticalSection(&m_Lock);
+
+    for (map<string, WarmupToken>::iterator entry = m_Tokens.begin();
+            entry != m_Tokens.end();
+            ++entry)
+    {
+        WarmupToken * token = &entry->second;
+        if (token->warm) continue;
+
+        // The run is over, so any transaction still open has ended
+        for (map<int, vector<WarmupRecord> >::iterator transaction = token->running.begin();
+                transaction != token->running.end();
+                ++transaction)
+        {
+            token->held[transaction->first].swap(transaction->second);
+        }
+        token->running.clear();
+
+        int completed = (int)token->held.size();
+        int length;
+
+        if (m_Transactions == WARMUP_AUTO) {
+            vector<double> latencies;
+            Latencies(token, &latencies);
+
+            // Too few transactions to tell, so they are all treated as warm-up
+            length = Statistics::TruncationPoint(&latencies, WARMUP_BATCH);
+            if (length < 0) length = completed;
+        } else {
+            int remaining = m_Transactions - (int)token->failed.size();
+            length = (completed < remaining) ? completed : remaining;
+            if (length < 0) length = 0;
+        }
+
+        Log::warn("Token %s was still warming up at the end of the run\n", entry->first.c_str());
+        this->End(entry->first, token, length, "end of run");
+    }
+
+    LeaveCriticalSection(&m_Lock);
+}
+
+void Warmup::Report() {
+
+    if (!this->isEnabled()) return;
+
+    EnterCriticalSection(&m_Lock);
+
+    if (m_Transactions == WARMUP_AUTO) {
+        Log::info("\nWARM-UP (detected by MSER-%d):\n", WARMUP_BATCH);
+    } else {
+        Log::info("\nWARM-UP (first %d transactions):\n", m_Transactions);
+    }
+
+    Log::info("%-20s %13s %s\n", "SERIAL", "TRANSACTIONS", "ENDED BY");
+
+    for (map<string, WarmupToken>::iterator token = m_Tokens.begin();
+            token != m_Tokens.end();
+            ++token)
+    {
+        if (token->second.warm) {
+            Log::info("%-20s %13d %s\n", token->first.c_str(), token->second.length, token->second.reason.c_str());
+        } else {
+            Log::info("%-20s %13u %s\n", token->first.c_str(), (unsigned)token->second.held.size(), "(warming up)");
+        }
+    }
+
+    // The cost of a cold token, operation by operation
+    Log::info("\n%-20s %10s %12s %10s %12s %8s\n", "OPERATION", "COLD", "COLD MEAN", "WARM", "WARM MEAN", "RATIO");
+
+    for (map<string, Histogram>::iterator warm = m_Warm.begin();
+            warm != m_Warm.end();
+            ++warm)
+    {
+        Histogram * cold = (m_Cold.find(warm->first) != m_Cold.end()) ? &m_Cold[warm->first] : NULL;
+
+        if (NULL == cold) {
+            Log::info("%-20s %10s %12s %10llu %9.2f ms %8s\n", warm->first.c_str(), "-", "-",
+                      warm->second.getCount(), warm->second.getMean() / 1000.0, "-");
+            continue;
+        }
+
+        Log::info("%-20s %10llu %9.2f ms %10llu %9.2f ms %7.2fx\n", warm->first.c_str(),
+                  cold->getCount(), cold->getMean() / 1000.0,
+                  warm->second.getCount(), warm->second.getMean() / 1000.0,
+                  (warm->second.getMean() > 0) ? cold->getMean() / warm->second.getMean() : 0);
+    }
+
+    // Operations only made while cold (such as loading a key once)
+    for (map<string, Histogram>::iterator cold = m_Cold.begin();
+            cold != m_Cold.end();
+            ++cold)
+    {
+        if (m_Warm.find(cold->first) != m_Warm.end()) continue;
+
+        Log::info("%-20s %10llu %9.2f ms %10s %12s %8s\n", cold->first.c_str(),
+                  cold->second.getCount(), cold->second.getMean() / 1000.0, "-", "-", "-");
+    }
+
+    LeaveCriticalSection(&m_Lock);
+}
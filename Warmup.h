@@ -0,0 +1,134 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+#include "stdafx.h"
+
+#include <windows.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+
+#include "Histogram.h"
+#include "LatencyTrend.h"
+#include "Results.h"
+
+using namespace std;
+
+// The warm-up setting that detects the end of the warm-up instead of using a fixed count
+#define WARMUP_AUTO                 -1
+
+// The transactions averaged into each batch by the MSER rule (MSER-5)
+#define WARMUP_BATCH                5
+
+// The transactions seen before the steady state is first tested for, and after which the warm-up is ended regardless
+#define WARMUP_MIN_TRANSACTIONS     50
+#define WARMUP_MAX_TRANSACTIONS     1000
+
+// A successful operation held back while its token warms up
+typedef struct {
+    string operation;
+    string mechanism;
+    double microseconds;
+} WarmupRecord;
+
+// The warm-up of a single token
+typedef struct {
+    bool warm;
+
+    // The transactions discarded as warm-up, and what ended it
+    int length;
+    string reason;
+
+    // The operations held back so far, by iteration - of the transactions still running, and of those completed
+    map<int, vector<WarmupRecord> > running;
+    map<int, vector<WarmupRecord> > held;
+
+    // The transactions that failed while warming up, which count towards a fixed warm-up but aren't tested
+    set<int> failed;
+} WarmupToken;
+
+
+// Keeps the first transactions on each token - while the middleware fills its caches, the applet is
+// selected and the reader powers up - out of the results. The warm-up ends after a fixed number of
+// transactions, or with WARMUP_AUTO once the MSER-5 rule finds the transaction latency has settled.
+// Operations are held back until then, and those after the truncation point are recorded as usual.
+class Warmup
+{
+public:
+    Warmup(void);
+    ~Warmup(void);
+
+    // Sets the warm-up to [transactions] per token (WARMUP_AUTO to detect it, 0 disables), and where the
+    // operations after it are recorded
+    void Configure(int transactions, Results * results, LatencyTrend * trend);
+
+    // Returns true unless the warm-up has been disabled
+    bool isEnabled();
+
+    // Offers a successful operation of transaction [iteration] on token [serial]. Returns true if the
+    // warm-up has taken it, or false if the token is warm and the caller should record it.
+    bool Record(string serial, int iteration, string operation, string mechanism, double microseconds);
+
+    // Marks transaction [iteration] on token [serial] as complete, and whether it [succeeded]. Only completed
+    // transactions are tested for the end of the warm-up, as concurrent workers interleave their operations,
+    // and only successful ones by MSER-5, as a transaction that failed part way through looks fast.
+    void Complete(string serial, int iteration, bool succeeded);
+
+    // Ends the warm-up of any token still warming up at the end of the run, at the best truncation point so far
+    void Finish();
+
+    // Logs the warm-up length of each token, and the cold and warm latency of each operation
+    void Report();
+
+private:
+    // Returns the number of held transactions to discard if the warm-up of [token] is over (setting [reason]), or -1.
+    // Must be called with m_Lock held.
+    int Test(WarmupToken * token, string * reason);
+
+    // Copies the total latency of each transaction held for [token] into [latencies], in order
+    static void Latencies(WarmupToken * token, vector<double> * latencies);
+
+    // Discards the first [length] held transactions of a token and records the rest, along with the operations of
+    // the transactions still running. Must be called with m_Lock held.
+    void End(string serial, WarmupToken * token, int length, string reason);
+
+    // Counts a warm operation for the report. Must be called with m_Lock held.
+    void Count(string operation, double microseconds);
+
+private:
+    CRITICAL_SECTION m_Lock;
+
+    int m_Transactions;
+    Results * m_Results;
+    LatencyTrend * m_Trend;
+
+    // By token serial
+    map<string, WarmupToken> m_Tokens;
+
+    // The latencies of the discarded and the recorded operations, by operation
+    map<string, Histogram> m_Cold;
+    map<string, Histogram> m_Warm;
+};
@@ -0,0 +1,351 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "StdAfx.h"
+#include "Watchdog.h"
+
+#include <sstream>
+
+#include "Utility.h"
+#include "Log.h"
+
+
+Watchdog::Watchdog(void)
+{
+    m_Thread = NULL;
+    m_StopEvent = NULL;
+    m_Affinity = NULL;
+    m_Isolate = NULL;
+    m_Results = NULL;
+    m_Running = false;
+    m_Started = 0;
+    m_Deadline = 0;
+
+    InitializeCriticalSection(&m_Lock);
+}
+
+
+Watchdog::~Watchdog(void)
+{
+    this->Stop();
+    DeleteCriticalSection(&m_Lock);
+}
+
+bool Watchdog::Configure(string spec) {
+
+    stringstream stream(spec);
+    string item;
+    int deadline = 0;
+    map<string, int> deadlines;
+
+    while (getline(stream, item, ',')) {
+
+        size_t equals = item.find('=');
+        string operation = (equals == string::npos) ? "" : item.substr(0, equals);
+        string value = (equals == string::npos) ? item : item.substr(equals + 1);
+
+        if (value.empty() || value.find_first_not_of("0123456789") != string::npos) {
+            Log::error("Invalid deadline '%s'\n", item.c_str());
+            return false;
+        }
+
+        if (operation.empty()) {
+            deadline = atoi(value.c_str());
+        } else {
+            deadlines[operation] = atoi(value.c_str());
+        }
+    }
+
+    if (deadline <= 0 && deadlines.empty()) return false;
+
+    m_Deadline = deadline;
+    m_Deadlines = deadlines;
+
+    return true;
+}
+
+void Watchdog::Start(WatchdogIsolate isolate, Results * results) {
+
+    Log::debug("Watchdog::Start: Called\n");
+
+    if (NULL != m_Thread) {
+        Log::warn("Watchdog::Start: Watchdog is already running, ignoring\n");
+        return;
+    }
+
+    m_Isolate = isolate;
+    m_Results = results;
+    m_Started = Utility::QueryMicroseconds();
+
+    EnterCriticalSection(&m_Lock);
+    m_Calls.clear();
+    m_Stalls.clear();
+    LeaveCriticalSection(&m_Lock);
+
+    m_StopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    m_Thread = CreateThread(NULL, 0, ThreadProc, this, CREATE_SUSPENDED, NULL);
+
+    if (NULL == m_Thread) {
+        Log::error("Watchdog::Start: Unable to create the watchdog thread\n");
+        CloseHandle(m_StopEvent);
+        m_StopEvent = NULL;
+        return;
+    }
+
+    if (NULL != m_Affinity) m_Affinity->PinService(m_Thread, "watchdog");
+
+    m_Running = true;
+    ResumeThread(m_Thread);
+
+    Log::info("Watching for PKCS#11 calls running longer than %d ms%s\n", m_Deadline,
+              m_Deadlines.empty() ? "" : " (or their operation's own deadline)");
+}
+
+void Watchdog::Stop() {
+
+    if (NULL == m_Thread) return;
+
+    Log::debug("Watchdog::Stop: Called\n");
+
+    m_Running = false;
+
+    SetEvent(m_StopEvent);
+    WaitForSingleObject(m_Thread, INFINITE);
+
+    CloseHandle(m_Thread);
+    CloseHandle(m_StopEvent);
+    m_Thread = NULL;
+    m_StopEvent = NULL;
+}
+
+void Watchdog::SetAffinity(ThreadAffinity * affinity) {
+    m_Affinity = affinity;
+}
+
+void Watchdog::Enter(CK_SLOT_ID slot, CK_SESSION_HANDLE session, string serial, string operation) {
+
+    if (!m_Running) return;
+
+    WatchdogCall call;
+    call.slot = slot;
+    call.session = session;
+    call.serial = serial;
+    call.operation = operation;
+    call.started = Utility::QueryMicroseconds();
+    call.stall = -1;
+    call.closed = false;
+
+    EnterCriticalSection(&m_Lock);
+    m_Calls[GetCurrentThreadId()] = call;
+    LeaveCriticalSection(&m_Lock);
+}
+
+bool Watchdog::Leave() {
+
+    if (!m_Running) return false;
+
+    double now = Utility::QueryMicroseconds();
+
+    EnterCriticalSection(&m_Lock);
+
+    map<DWORD, WatchdogCall>::iterator entry = m_Calls.find(GetCurrentThreadId());
+
+    if (entry == m_Calls.end()) {
+        LeaveCriticalSection(&m_Lock);
+        return false;
+    }
+
+    WatchdogCall call = entry->second;
+    m_Calls.erase(entry);
+
+    if (call.stall >= 0) {
+        m_Stalls[call.stall].duration = now - call.started;
+        m_Stalls[call.stall].returned = true;
+    }
+
+    LeaveCriticalSection(&m_Lock);
+
+    if (call.stall < 0) return false;
+
+    Log::warn("STALL - %s %s returned after %.1f s\n", call.serial.c_str(), call.operation.c_str(), (now - call.started) / 1000000.0);
+
+    if (NULL != m_Results) m_Results->Record(call.serial, "STALL", "-", now - call.started);
+
+    return call.closed;
+}
+
+double Watchdog::getDeadline(string operation) {
+
+    map<string, int>::iterator deadline = m_Deadlines.find(operation);
+    int milliseconds = (deadline != m_Deadlines.end()) ? deadline->second : m_Deadline;
+
+    return milliseconds * 1000.0;
+}
+
+DWORD WINAPI Watchdog::ThreadProc(LPVOID param) {
+
+    Watchdog * watchdog = (Watchdog *)param;
+
+    while (WAIT_TIMEOUT == WaitForSingleObject(watchdog->m_StopEvent, WATCHDOG_POLL_INTERVAL)) {
+        watchdog->Check();
+    }
+
+    return 0;
+}
+
+void Watchdog::Check() {
+
+    double now = Utility::QueryMicroseconds();
+    vector<int> flagged;
+
+    EnterCriticalSection(&m_Lock);
+
+    for (map<DWORD, WatchdogCall>::iterator entry = m_Calls.begin();
+            entry != m_Calls.end();
+            ++entry)
+    {
+        WatchdogCall * call = &entry->second;
+        double elapsed = now - call->started;
+
+        // Already flagged - just keep its running time up to date
+        if (call->stall >= 0) {
+            m_Stalls[call->stall].duration = elapsed;
+            continue;
+        }
+
+        double deadline = this->getDeadline(call->operation);
+        if (deadline <= 0 || elapsed < deadline) continue;
+
+        StallEvent stall;
+        stall.slot = call->slot;
+        stall.serial = call->serial;
+        stall.operation = call->operation;
+        stall.started = call->started - m_Started;
+        stall.duration = elapsed;
+        stall.returned = false;
+        stall.isolated = false;
+        stall.cancel = CKR_OK;
+        stall.close = CKR_OK;
+
+        call->stall = (int)m_Stalls.size();
+        m_Stalls.push_back(stall);
+        flagged.push_back(call->stall);
+    }
+
+    LeaveCriticalSection(&m_Lock);
+
+    // The isolation and the library calls take locks of their own, so they are made outside this one
+    for (size_t i = 0; i < flagged.size(); i++) {
+
+        EnterCriticalSection(&m_Lock);
+        StallEvent stall = m_Stalls[flagged[i]];
+        LeaveCriticalSection(&m_Lock);
+
+        Log::warn("STALL - %s (slot %u) has been in %s for %.1f s, past its %.0f ms deadline\n",
+                  stall.serial.c_str(), stall.slot, stall.operation.c_str(),
+                  stall.duration / 1000000.0, this->getDeadline(stall.operation) / 1000.0);
+
+        if (NULL == m_Isolate) continue;
+
+        m_Isolate(stall.slot, stall.serial);
+
+        // C_CancelFunction is a legacy call most libraries refuse. Closing the session from another
+        // thread is only safe if the library does its own locking.
+        CK_FUNCTION_LIST * functions = PKCS11Manager::getFunctionList();
+        CK_SESSION_HANDLE session = NULL_PTR;
+
+        EnterCriticalSection(&m_Lock);
+        for (map<DWORD, WatchdogCall>::iterator entry = m_Calls.begin();
+                entry != m_Calls.end();
+                ++entry)
+        {
+            if (entry->second.stall == flagged[i]) session = entry->second.session;
+        }
+        LeaveCriticalSection(&m_Lock);
+
+        CK_RV cancel = CKR_FUNCTION_NOT_SUPPORTED;
+        CK_RV close = CKR_FUNCTION_NOT_SUPPORTED;
+
+        if (NULL_PTR != session && NULL != functions) {
+
+            if (NULL != functions->C_CancelFunction) cancel = functions->C_CancelFunction(session);
+
+            if (CKR_OK != cancel && PKCS11Manager::isThreadSafe() && NULL != functions->C_CloseSession) {
+
+                // Marked before the close, so a worker returning from the call now either sees the mark or
+                // has already left, in which case the session is its own to close again
+                bool closing = false;
+
+                EnterCriticalSection(&m_Lock);
+                for (map<DWORD, WatchdogCall>::iterator entry = m_Calls.begin();
+                        entry != m_Calls.end();
+                        ++entry)
+                {
+                    if (entry->second.stall == flagged[i]) {
+                        entry->second.closed = true;
+                        closing = true;
+                    }
+                }
+                LeaveCriticalSection(&m_Lock);
+
+                if (closing) close = functions->C_CloseSession(session);
+            }
+        }
+
+        Log::warn("Isolated token %s - cancel returned 0x%08X, close returned 0x%08X\n", stall.serial.c_str(), cancel, close);
+
+        EnterCriticalSection(&m_Lock);
+        m_Stalls[flagged[i]].isolated = true;
+        m_Stalls[flagged[i]].cancel = cancel;
+        m_Stalls[flagged[i]].close = close;
+        LeaveCriticalSection(&m_Lock);
+    }
+}
+
+void Watchdog::Report() {
+
+    EnterCriticalSection(&m_Lock);
+
+    if (m_Stalls.empty()) {
+        LeaveCriticalSection(&m_Lock);
+        return;
+    }
+
+    Log::info("\nSTALLED CALLS (%u):\n", (unsigned)m_Stalls.size());
+    Log::info("%-20s %6s %-18s %10s %12s %-10s %-10s %10s %10s\n",
+              "SERIAL", "SLOT", "OPERATION", "AT", "DURATION", "RETURNED", "ISOLATED", "CANCEL", "CLOSE");
+
+    for (size_t i = 0; i < m_Stalls.size(); i++) {
+
+        StallEvent * stall = &m_Stalls[i];
+
+        Log::info("%-20s %6u %-18s %8.1f s %10.1f s %-10s %-10s 0x%08X 0x%08X\n",
+                  stall->serial.c_str(), stall->slot, stall->operation.c_str(),
+                  stall->started / 1000000.0, stall->duration / 1000000.0,
+                  stall->returned ? "yes" : "NO", stall->isolated ? "yes" : "no",
+                  stall->cancel, stall->close);
+    }
+
+    LeaveCriticalSection(&m_Lock);
+}
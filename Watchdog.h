@@ -0,0 +1,142 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 - Commonwealth of Australia (Represented by the Department of Defence)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+#include "stdafx.h"
+
+#include <windows.h>
+#include <string>
+#include <vector>
+#include <map>
+
+#include "PKCS11Manager.h"
+#include "Results.h"
+#include "ThreadAffinity.h"
+
+using namespace std;
+
+// The period between checks of the calls in progress (milliseconds)
+#define WATCHDOG_POLL_INTERVAL      100
+
+// Takes a stalled token out of the run, so the run can finish without it
+typedef void (*WatchdogIsolate)(CK_SLOT_ID slot, string serial);
+
+// A PKCS#11 call in progress on a worker thread
+typedef struct {
+    CK_SLOT_ID slot;
+    CK_SESSION_HANDLE session;
+    string serial;
+    string operation;
+
+    // When the call started (microseconds), and the stall it has been flagged as (-1 until then)
+    double started;
+    int stall;
+
+    // Set when the watchdog closes the call's session, so the worker drops the handle instead of closing
+    // it again (by then the library may have handed the same handle to another session)
+    bool closed;
+} WatchdogCall;
+
+// A call that ran past its deadline
+typedef struct {
+    CK_SLOT_ID slot;
+    string serial;
+    string operation;
+
+    // When the call started, relative to the start of the watchdog, and how long it ran for
+    // (so far, if it hasn't returned) in microseconds
+    double started;
+    double duration;
+
+    // Whether the call has returned, and what was done about it
+    bool returned;
+    bool isolated;
+    CK_RV cancel;
+    CK_RV close;
+} StallEvent;
+
+
+// Watches the PKCS#11 calls made by the workers and flags any that run past their deadline. A
+// stalled token can optionally be isolated, so the others carry on and the run can still finish,
+// and its session cancelled or closed from the watchdog.
+class Watchdog
+{
+public:
+    Watchdog(void);
+    ~Watchdog(void);
+
+    // Sets the deadlines from [spec] - a default in milliseconds, optionally followed by per-operation
+    // deadlines (e.g. "5000,SIGN=20000,DECRYPT=20000"). Returns false if it can't be parsed.
+    bool Configure(string spec);
+
+    // Starts watching. When [isolate] isn't NULL a stalled token is passed to it, and its session is
+    // cancelled or closed. Stalls are also recorded into [results] when it isn't NULL.
+    void Start(WatchdogIsolate isolate, Results * results);
+
+    // Stops watching
+    void Stop();
+
+    // Pins the watchdog thread with [affinity] (call before Start)
+    void SetAffinity(ThreadAffinity * affinity);
+
+    // Marks the start of [operation] on the calling thread (does nothing unless started)
+    void Enter(CK_SLOT_ID slot, CK_SESSION_HANDLE session, string serial, string operation);
+
+    // Marks the end of the calling thread's operation. Returns true if the watchdog closed the operation's
+    // session, in which case the caller must drop the handle without closing it.
+    bool Leave();
+
+    // Logs every stall, and whether the call ever returned
+    void Report();
+
+private:
+    // Thread entry point
+    static DWORD WINAPI ThreadProc(LPVOID param);
+
+    // Flags the calls that have passed their deadline
+    void Check();
+
+    // Returns the deadline of [operation] (microseconds)
+    double getDeadline(string operation);
+
+private:
+    HANDLE m_Thread;
+    HANDLE m_StopEvent;
+    CRITICAL_SECTION m_Lock;
+    ThreadAffinity * m_Affinity;
+    WatchdogIsolate m_Isolate;
+    Results * m_Results;
+
+    // Checked without the lock, so calls are only tracked while the watchdog runs
+    volatile bool m_Running;
+    double m_Started;
+
+    // The deadlines (milliseconds)
+    int m_Deadline;
+    map<string, int> m_Deadlines;
+
+    // The calls in progress, by thread id
+    map<DWORD, WatchdogCall> m_Calls;
+    vector<StallEvent> m_Stalls;
+};
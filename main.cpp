@@ -33,10 +33,36 @@ THE SOFTWARE.
 #include <iomanip>
 #include <map>
 
+#include "Agent.h"
+#include "BatchJob.h"
+#include "Comparison.h"
+#include "Coordinator.h"
+#include "DigestBenchmark.h"
+#include "HostCrypto.h"
+#include "Integrity.h"
+#include "IdentityCache.h"
+#include "ApduBenchmark.h"
+#include "TransportMonitor.h"
+#include "ThreadAffinity.h"
+#include "CalibrationLibrary.h"
+#include "CircuitBreaker.h"
+#include "Checkpoint.h"
+#include "Warmup.h"
+#include "ProcessLauncher.h"
+#include "JournalAnalyzer.h"
+#include "Lifecycle.h"
 #include "PCSC.h"
 #include "PKCS11Manager.h"
 #include "PKCS11Object.h"
+#include "LatencyTrend.h"
 #include "Options.h"
+#include "ProcessSampler.h"
+#include "Snapshot.h"
+#include "Results.h"
+#include "SigningPipeline.h"
+#include "Sha1.h"
+#include "SlotManager.h"
+#include "Watchdog.h"
 #include "Utility.h"
 #include "Log.h"
 
@@ -51,8 +77,8 @@ PKCS11Manager * m_PKCS11 = NULL;
 // Holds a list of GlobalPlatform CPLC ICC Serial Numbers associated with the token in each slot
 map<CK_ULONG, string> m_SlotSerials;
 
-// Global - The number of iterations performed so far
-int _iterations = 0;
+// Global - The number of transactions started so far, across all tokens
+volatile LONG _iterations = 0;
 
 // Global - A flag set by the Control Handler to indicate the application should cancel after the next processing cycle.
 bool _shutdown = false;
@@ -60,6 +86,71 @@ bool _shutdown = false;
 // Options instance
 Options _options;
 
+// Background sampler for process memory / handle growth
+ProcessSampler _sampler;
+
+// Per-token, per-operation latency windows used to detect wear over long runs
+LatencyTrend _trend;
+
+// Latency histograms per operation, mechanism and token, saved for run-to-run comparison
+Results _results;
+
+// Appends interval snapshots of the results while the load test runs
+Snapshot _snapshots;
+
+// Runs the per-token workers and follows tokens being removed and reinserted
+SlotManager _slotManager;
+
+// Shares a fixed number of operations between every token (--batch)
+BatchJob _batch;
+
+// Signs the files in a directory with the tokens (the sign command)
+SigningPipeline _pipeline;
+
+// Compares digesting on the tokens against digesting on the host (the digest command)
+DigestBenchmark _digests;
+
+// The serials resolved for each token on earlier runs
+IdentityCache _identities;
+
+// The processors the worker and service threads are pinned to
+ThreadAffinity _affinity;
+
+// Set while transactions are being run against the no-op library
+bool _calibrating = false;
+
+// The latencies of the calibration transactions, and the resulting harness overhead of each operation (microseconds)
+Results _calibration;
+map<string, double> _overhead;
+
+// The connection to the coordinator when running as an agent
+Agent _agent;
+
+// The host copies of the tokens' public keys (--offload)
+HostCrypto _hostCrypto;
+
+// Cross-checks of each transaction's digest, signature and decrypted data
+Integrity _integrity;
+
+// Flags PKCS#11 calls that run past their deadline (--deadline)
+Watchdog _watchdog;
+
+// The slot of the operation each worker thread has in progress, so a session closed by the watchdog can be dropped
+__declspec(thread) PKCS11Slot * _operationSlot = NULL;
+
+// Holds back tokens that keep failing (--breaker)
+CircuitBreaker _breaker;
+
+// Saves the state of a long run so it can be resumed (--checkpoint)
+Checkpoint _checkpoint;
+
+// Keeps each token's first transactions out of the results (--warmup)
+Warmup _warmup;
+
+// Serialises the appends to each token's journal, which --workers shares between threads
+CRITICAL_SECTION _journalLock;
+map<string, CRITICAL_SECTION *> _journalLocks;
+
 /*
  * Function Prototypes
  */
@@ -67,8 +158,26 @@ Options _options;
 // Initialises the PKCS11 library and enumerates the available slots/tokens
 void Startup(vector<PKCS11Slot> * slots);
 
-// Process a single iteration of the transaction simulation against all available tokens
-void Process(vector<PKCS11Slot> * slots);
+// Process a single iteration of the transaction simulation against one token (runs on the token's worker thread)
+bool Process(PKCS11Slot * slot, string serial, int iteration);
+
+// Runs Process for the slot manager, and then tells the warm-up the transaction is complete
+bool Transact(PKCS11Slot * slot, string serial, int iteration);
+
+// Signs the digest of a single batch item
+bool BatchSign(PKCS11Slot * slot, string serial, CK_OBJECT_HANDLE key, int item);
+
+// Signs the DigestInfo of a file for the signing pipeline
+bool FileSign(PKCS11Slot * slot, string serial, CK_OBJECT_HANDLE key, const char * in, int inLength, char * out, int * outLength, int item);
+
+// Resolves the serial used to journal the token in a slot (the CPLC CSN, or failing that the certificate serial)
+string ResolveSerial(PKCS11Slot * slot);
+
+// As above, using the CPLC already read from the slot's reader when it is in [cplc]
+string ResolveSerial(PKCS11Slot * slot, map<string, string> * cplc);
+
+// Returns the identity cache key for the token in a slot
+string IdentityKey(PKCS11Slot * slot, PKCS11Token * token);
 
 // Reads the GlobalPlatform CPLC information via the PC/SC interface
 string Process_FindSerial(PKCS11Slot * slot);
@@ -79,6 +188,15 @@ CK_OBJECT_HANDLE Process_FindPublicKey(PKCS11Slot * slot);
 // Gets the Key object handle identifier for the PRIVATE key
 CK_OBJECT_HANDLE Process_FindPrivateKey(PKCS11Slot * slot);
 
+// Returns the mechanism used by an operation (for the results file)
+string OperationMechanism(char * operation);
+
+// Runs transactions against the no-op library to measure the latency the harness adds to each operation
+void Calibrate();
+
+// Returns the harness overhead measured for an operation (microseconds)
+double HarnessOverhead(char * operation);
+
 // Release all application resources
 void Shutdown();
 
@@ -92,7 +210,16 @@ void DisplayVersion();
 void DisplayUsage();
 
 // Writes to the token log file
-void AppendJournal( string serial, char * operation, bool outcome, char * data, int len);
+void AppendJournal( string serial, int iteration, char * operation, bool outcome, char * data, int len);
+
+// Registers an operation about to be called on a token with the watchdog, and returns its start time
+double BeginOperation(PKCS11Slot * slot, string serial, char * operation);
+
+// Takes a token whose call has stalled out of the run (the watchdog's isolation callback)
+void IsolateToken(CK_SLOT_ID slot, string serial);
+
+// Journals a completed operation and records its latency (measured from [started]) for trend analysis
+void RecordOperation( string serial, int iteration, char * operation, bool outcome, char * data, int len, double started);
 
 static BOOL WINAPI ConsoleCtrlHandler(DWORD dwCtrlType);
 
@@ -117,6 +244,8 @@ int _tmain(int argc, _TCHAR* argv[])
     // Set the locale for string conversion
     setlocale(LC_CTYPE, "");
 
+    InitializeCriticalSection(&_journalLock);
+
     // Set the logging level
     Log::setLevel(LOG_INFO);
 
@@ -130,6 +259,40 @@ int _tmain(int argc, _TCHAR* argv[])
         return (EXIT_FAILURE);
     }
 
+    // Subcommands that work on existing results rather than a token
+    if (_options.Command == "analyze") {
+        return JournalAnalyzer::Run(&_options.Inputs) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (_options.Command == "compare") {
+        return Comparison::Run(&_options.Inputs, _options.Threshold, _options.Resamples);
+    }
+
+    if (_options.Command == "snapshot") {
+        return Snapshot::Run(&_options.Inputs, _options.ResultsFile, _options.Percentile);
+    }
+
+    // Measures the cards directly over PC/SC, without the PKCS#11 library
+    if (_options.Command == "apdu") {
+        return ApduBenchmark::Run(&_options.Inputs, _options.MaxIterations, _options.ResultsFile, &_shutdown);
+    }
+
+    // Drives agents on other hosts (or other processes on this one) and merges their results
+    if (_options.Command == "coordinator") {
+        return Coordinator::Run(&_options.Inputs, _options.Port, _options.MaxIterations, _options.Interval,
+                                _options.Rate, _options.ResultsFile, &_shutdown);
+    }
+
+    // An agent is a normal load test that takes its scenario from the coordinator, while sign and
+    // digest run the tokens through the signing pipeline and the digest comparison instead of the load test.
+    // Lifecycle loads and unloads the library itself, so it only needs the library and PIN.
+    if (!_options.Command.empty() && _options.Command != "agent" && _options.Command != "sign" && _options.Command != "digest" &&
+        _options.Command != "lifecycle") {
+        Log::error("Unknown command '%s'.\n", _options.Command.c_str());
+        DisplayUsage();
+        return (EXIT_FAILURE);
+    }
+
     // Validate Arguments
 
     // MANDATORY - PKCS11 Libary
@@ -144,12 +307,86 @@ int _tmain(int argc, _TCHAR* argv[])
         exit(EXIT_FAILURE);
     }
 
+    // Times the library's load, first session and unload rather than the token's operations
+    if (_options.Command == "lifecycle") {
+        string pin(_options.PIN.begin(), _options.PIN.end());
+        return Lifecycle::Run(_options.PKCS11Library, pin, _options.MaxIterations, _options.Interval, _options.ResultsFile, &_shutdown);
+    }
+
     // MANDATORY - KEY ID
     if (0 == _options.KeyIdLength) {
         Log::error("A valid, hexidecimal key identifier must supplied using the -K argument.\n");
         exit(EXIT_FAILURE);
     }
 
+    // Connect to the coordinator before loading the library, so a bad address fails fast
+    if (_options.Command == "agent") {
+
+        if (_options.Inputs.size() != 1) {
+            Log::error("The agent command needs the coordinator's address.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        // The coordinator decides the iterations of each token
+        if (_options.BatchItems > 0) {
+            Log::error("An agent can't run a batch, run the batch on its own.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        // Every child would connect as an agent of its own
+        if (_options.Processes > 1) {
+            Log::error("An agent can't share its tokens between processes, run one agent per process instead.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        string address(_options.Inputs[0].begin(), _options.Inputs[0].end());
+
+        // Calibrated before joining, as the coordinator starts every agent together once they have joined
+        Calibrate();
+
+        if (!_agent.Connect(address, _options.Port, &_shutdown)) {
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Work can't be stolen across processes
+    if (_options.BatchItems > 0 && _options.Processes > 1) {
+        Log::error("A batch runs in a single process, use --workers instead of --processes.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (_options.Command == "sign") {
+
+        if (_options.Inputs.size() != 1) {
+            Log::error("The sign command needs the directory of files to sign.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        if (_options.Processes > 1) {
+            Log::error("The signing pipeline runs in a single process, use --workers instead of --processes.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (_options.Command == "digest" && (_options.Processes > 1 || _options.BatchItems > 0)) {
+        Log::error("The digest command runs on its own, without --processes or --batch.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Share the tokens between child processes, each with its own instance of the library
+    if (_options.Processes > 1 && _options.ChildCount == 0) {
+
+        Results merged;
+        bool success = ProcessLauncher::Run(_options.Processes, &merged);
+
+        ProcessLauncher::Report(&merged);
+
+        if (merged.Save(_options.ResultsFile)) {
+            Log::info("Latency results written to %s\n", _options.ResultsFile.c_str());
+        }
+
+        return success ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
     
     // Holds the list of detected PKCS11 Slots
     vector<PKCS11Slot> slots;
@@ -157,39 +394,246 @@ int _tmain(int argc, _TCHAR* argv[])
     // Call Startup
     Startup(&slots);
 
-    // Loop
+    // The coordinator sets the iterations and interval once it knows every agent's tokens and workers
+    bool paced = false;
+
+    if (_agent.isConnected() &&
+        !_agent.ReceiveScenario((int)slots.size(), (_options.Workers > 1) ? _options.Workers : 1,
+                                &_options.MaxIterations, &_options.Interval, &paced)) {
+        Log::error("No scenario from the coordinator, aborting ...\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Measure the harness before the tokens, so its overhead is known for the whole run (an agent already has)
+    if (_options.Command != "agent") Calibrate();
+
+    // Aggregate latency into windows of this many iterations
+    _trend.SetWindowSize(_options.TrendWindow);
+
+    _warmup.Configure(_options.Warmup, &_results, &_trend);
+
+    // Watch for calls that never return
+    if (!_options.Deadline.empty() && !_watchdog.Configure(_options.Deadline)) {
+        Log::error("Invalid call deadline, aborting ...\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (_options.Isolate && _options.Deadline.empty()) {
+        Log::warn("--isolate has no effect without --deadline\n");
+    }
+
+    // Pin the threads started from here on
+    if (!_options.WorkerAffinity.empty() || !_options.ServiceAffinity.empty()) {
+
+        string workers = _options.WorkerAffinity.empty() ? AFFINITY_AUTO : _options.WorkerAffinity;
+
+        if (!_affinity.Configure(workers, _options.ServiceAffinity)) {
+            Log::error("Invalid processor affinity, aborting ...\n");
+            exit(EXIT_FAILURE);
+        }
+
+        _sampler.SetAffinity(&_affinity);
+        _snapshots.SetAffinity(&_affinity);
+        _slotManager.SetAffinity(&_affinity);
+        _batch.SetAffinity(&_affinity);
+        _pipeline.SetAffinity(&_affinity);
+        _digests.SetAffinity(&_affinity);
+        _watchdog.SetAffinity(&_affinity);
+        _checkpoint.SetAffinity(&_affinity);
+    }
+
+    // Start watching for middleware leaks
+    if (_options.SampleInterval > 0) {
+        _sampler.Start(_options.SampleInterval, &_iterations);
+    }
+
+    // Hooked after the tokens have been identified, so only the load test transmits are timed
+    if (_options.Transport) {
+        TransportMonitor::Install();
+    }
+
+    // Start with the other agents
+    if (_agent.isConnected()) {
+        _agent.WaitForStart();
+    }
+
+    // The other modes share their workers between the tokens rather than running each token's iterations
+    bool loadTest = _options.Command != "sign" && _options.Command != "digest" && _options.BatchItems == 0;
+
+    if (!loadTest && (_options.Duration > 0 || _options.CheckpointInterval > 0 || _options.Resume)) {
+        Log::warn("--duration, --checkpoint and --resume only apply to the load test, ignoring\n");
+    }
+
+    // Each child of the launcher checkpoints its own tokens
+    stringstream checkpointPath;
+    if (_options.ChildCount > 0) checkpointPath << _options.ChildIndex + 1 << ".";
+    checkpointPath << CHECKPOINT_FILE;
+
+    // What the earlier legs of a resumed run reached
+    CheckpointState resumed;
+    resumed.elapsed = 0;
+    resumed.iterations = 0;
+
+    // Run every token on its own worker until each has completed its iterations
     _iterations = 0;
 
-    while (_iterations < _options.MaxIterations) {
+    if (loadTest && _options.Resume) {
+
+        if (!Checkpoint::Load(checkpointPath.str(), &resumed, &_results)) {
+            Log::error("Unable to resume the run, aborting ...\n");
+            exit(EXIT_FAILURE);
+        }
+
+        _iterations = resumed.iterations;
+        _slotManager.RestoreIterations(&resumed.tokens);
+        _trend.RestoreWindows(&resumed.windows);
+        _integrity.RestoreCounts(&resumed.integrity);
+        _breaker.RestoreBreakers(&resumed.breakers);
+        _results.Resume();
+
+        Log::info("Resuming the run from %s after %.0f seconds and %d transactions\n",
+                  checkpointPath.str().c_str(), resumed.elapsed, resumed.iterations);
+    } else {
+        _results.Start();
+    }
+
+    if (_options.SnapshotInterval > 0) {
+
+        // Each child of the launcher has a file of its own - 'snapshot merge' combines them
+        stringstream path;
+        if (_options.ChildCount > 0) path << _options.ChildIndex + 1 << ".";
+        path << SNAPSHOT_FILE;
+
+        _snapshots.Start(path.str(), _options.SnapshotInterval, &_results);
+    }
 
-        // Increment the iteration count
-        _iterations++;
+    if (!_options.Deadline.empty()) {
 
-        // Call Process
-        Log::info ("ITERATION %d of %d:\n", _iterations, _options.MaxIterations);
+        // Only the slot manager's workers can be stopped token by token
+        bool isolate = _options.Isolate && loadTest;
 
-        try
-        {
-            Process(&slots);
+        if (_options.Isolate && !isolate) {
+            Log::warn("Stalled tokens can't be isolated in this mode, they will only be reported\n");
         }
-        catch (...) {
-            Log::error("Unhandled exception during processing ...\n");
+
+        _watchdog.Start(isolate ? IsolateToken : NULL, &_results);
+    }
+
+    string pin(_options.PIN.begin(), _options.PIN.end());
+
+    if (_options.Command == "sign") {
+
+        string directory(_options.Inputs[0].begin(), _options.Inputs[0].end());
+
+        _pipeline.Run(directory, _options.OutputDirectory, &slots, &m_SlotSerials, _options.Workers, _options.Hashers,
+                      _options.QueueDepth, pin, Process_FindPrivateKey, FileSign, &_shutdown);
+    }
+    else if (_options.Command == "digest") {
+
+        _digests.Run(&slots, &m_SlotSerials, &_options.DigestSizes, _options.MaxIterations, pin,
+                     Process_FindPrivateKey, &_results, &_shutdown);
+    }
+    else if (_options.BatchItems > 0) {
+
+        // A fixed amount of work, shared between the tokens as they become free
+        _batch.Run(&slots, &m_SlotSerials, _options.BatchItems, _options.Workers, pin,
+                   Process_FindPrivateKey, BatchSign, &_shutdown);
+    }
+    else {
+
+        if (_options.Duration > 0) {
+            Log::info("Running against each of %u tokens for %d seconds (at most %d iterations each)\n",
+                      (unsigned)slots.size(), _options.Duration, _options.MaxIterations);
+        } else {
+            Log::info("Running %d iterations against each of %u tokens\n", _options.MaxIterations, (unsigned)slots.size());
         }
 
-        // Wait for the next round
+        // The login state is shared by every session with a token, so concurrent workers can't each log in
+        // and out - they share a pool of sessions that stay logged in instead
+        if (_options.Workers > 1 && _options.Sessions == 0) {
+            _options.Sessions = _options.Workers;
+            Log::info("Pooling %d sessions per token for the workers\n", _options.Sessions);
+        }
+
+        _slotManager.SetSessions(_options.Workers, _options.Sessions, pin);
+
+        _breaker.Configure(_options.Breaker, _options.Backoff);
+        _breaker.SetResults(&_results);
+        _slotManager.SetBreaker(&_breaker);
+        _slotManager.SetPacing(paced);
 
-        if (_shutdown) {
-            Log::info("Skipping further load test iterations\n");
-            break;
+        _slotManager.Start(m_PKCS11, &slots, &m_SlotSerials, _options.MaxIterations, _options.Interval,
+                           ResolveSerial, Transact, &_results);
+
+        if (_options.CheckpointInterval > 0) {
+            _checkpoint.SetSources(&_trend, &_integrity, &_breaker);
+            _checkpoint.Start(checkpointPath.str(), _options.CheckpointInterval, &resumed, &_results, &_slotManager, &_iterations);
         }
 
-        if (_iterations < _options.MaxIterations) {
-            Log::info ("Iteration complete, waiting for %dms.\n", _options.Interval);
-            Sleep(_options.Interval);
+        // The duration counts the earlier legs of a resumed run
+        double leg = Utility::QueryMicroseconds();
+
+        while (!_slotManager.Wait(1000)) {
+
+            if (_options.Duration > 0 && resumed.elapsed + (Utility::QueryMicroseconds() - leg) / 1000000.0 >= _options.Duration) {
+                Log::info("The run has reached its duration of %d seconds\n", _options.Duration);
+                break;
+            }
+
+            // An agent streams its progress, and stops when the coordinator says so
+            if (_agent.isConnected() && !_agent.Poll(_iterations, &_results)) {
+                _shutdown = true;
+            }
+
+            if (_shutdown) {
+                Log::info("Skipping further load test iterations\n");
+                break;
+            }
         }
+
+        _slotManager.Stop();
+        _checkpoint.Stop();
+
+        Log::info("LOAD TEST COMPLETE\n");
     }
 
-    Log::info("LOAD TEST COMPLETE\n");
+    _watchdog.Stop();
+    _warmup.Finish();
+    _results.Stop();
+    _snapshots.Stop();
+
+    // A child's results are merged by the launcher, which writes the results file
+    if (_options.ChildCount > 0) {
+        ProcessLauncher::SendResults(_options.ChildPipe, &_results);
+    }
+    else if (_agent.isConnected()) {
+        _agent.SendResults(&_results);
+    }
+    else if (_results.Save(_options.ResultsFile)) {
+        Log::info("Latency results written to %s\n", _options.ResultsFile.c_str());
+    }
+
+    if (_options.SampleInterval > 0) {
+        _sampler.Stop();
+        _sampler.Report();
+    }
+
+    if (_options.Command == "sign") {
+        _pipeline.Report();
+    } else if (_options.Command == "digest") {
+        _digests.Report();
+    } else if (_options.BatchItems > 0) {
+        _batch.Report();
+    } else {
+        _slotManager.Report();
+        _breaker.Report();
+    }
+
+    _warmup.Report();
+    _trend.Report();
+    _integrity.Report();
+    _watchdog.Report();
+    TransportMonitor::Report();
 
     // Call Shutdown
     Shutdown();
@@ -227,6 +671,62 @@ void Startup(vector<PKCS11Slot> * slots)
         exit(EXIT_FAILURE);
     }
 
+    // A child of the launcher drives every ChildCount'th token, starting from its own index
+    if (_options.ChildCount > 0) {
+
+        vector<PKCS11Slot> owned;
+
+        for (size_t i = 0; i < slots->size(); i++) {
+            if ((int)(i % _options.ChildCount) == _options.ChildIndex) owned.push_back((*slots)[i]);
+        }
+
+        if (owned.empty()) {
+            Log::info("Process %d of %d has no tokens to drive\n", _options.ChildIndex + 1, _options.ChildCount);
+            exit(EXIT_SUCCESS);
+        }
+
+        *slots = owned;
+    }
+
+    double started = Utility::QueryMicroseconds();
+
+    PCSC::Initialise();
+
+    if (!_options.IdentityFile.empty()) {
+        _identities.Load(_options.IdentityFile);
+
+        // The children share the file, so a token they identify is only cached in memory
+        if (_options.ChildCount > 0) _identities.Detach();
+    }
+
+    // Tokens already in the identity cache only need C_GetTokenInfo - read the CPLC from every
+    // other reader at once, so that startup is bounded by the slowest card rather than the sum
+    vector<string> readers;
+    map<string, string> cplc;
+
+    for (size_t i = 0; i < slots->size(); i++) {
+
+        PKCS11Token token;
+        string serial;
+
+        try {
+            (*slots)[i].QueryToken(&token);
+            if (_identities.Find(IdentityKey(&(*slots)[i], &token), &serial)) continue;
+        }
+        catch (...) {
+            // Handled when the slot is resolved below
+        }
+
+        readers.push_back((*slots)[i].description);
+    }
+
+    if (!readers.empty()) {
+        PCSC::QueryCPLC(&readers, &cplc);
+
+        Log::info("Read the CPLC from %u of %u readers in %.0f ms\n", (unsigned)cplc.size(), (unsigned)readers.size(),
+                  (Utility::QueryMicroseconds() - started) / 1000.0);
+    }
+
     // Print slot info
     for(vector<PKCS11Slot>::iterator slot = slots->begin();
             slot != slots->end();
@@ -240,31 +740,77 @@ void Startup(vector<PKCS11Slot> * slots)
 
 
         try {
-            slot->OpenSession(false);
-            string serial = Process_FindSerial(&(*slot));
+            m_SlotSerials[slot->id] = ResolveSerial(&(*slot), &cplc);
+        } catch ( ... ) {
+            Log::error("Unable to retrieve serial number for slot %u\n", slot->id);
+            exit(EXIT_FAILURE);
+        }
+    }
 
-            try {
-                string csn = PCSC::QueryCPLC(slot->description);
-                m_SlotSerials[slot->id] = csn;
-                Log::info("Matched serial %s to CPLC ICC CSN %u. Using CSN\n", serial.c_str(), csn);
-            }
-            catch (...) {
-                Log::error("Unable to retrieve CPLC, using certificate serial number %s\n", serial.c_str());
-                m_SlotSerials[slot->id] = serial;
+    Log::info("Discovered %u tokens in %.0f ms\n", (unsigned)slots->size(), (Utility::QueryMicroseconds() - started) / 1000.0);
+}
+
+string ResolveSerial(PKCS11Slot * slot) {
+    return ResolveSerial(slot, NULL);
+}
+
+string ResolveSerial(PKCS11Slot * slot, map<string, string> * cplc) {
+
+    // A single C_GetTokenInfo is enough to recognise a token seen on an earlier run
+    PKCS11Token token;
+    slot->QueryToken(&token);
+
+    string key = IdentityKey(slot, &token);
+    string cached;
+
+    if (_identities.Find(key, &cached)) {
+        Log::info("Using cached serial %s for slot %u (from %s)\n", cached.c_str(), slot->id, _options.IdentityFile.c_str());
+        return cached;
+    }
+
+    slot->OpenSession(false);
+
+    try {
+        string serial = Process_FindSerial(slot);
+        string result;
+
+        try {
+            if (NULL != cplc) {
+                // Already read in parallel with the other readers (or failed)
+                map<string, string>::iterator found = cplc->find(slot->description);
+                if (found == cplc->end()) throw "No CPLC";
+                result = found->second;
+            } else {
+                result = PCSC::QueryCPLC(slot->description);
             }
+            Log::info("Matched serial %s to CPLC ICC CSN %s. Using CSN\n", serial.c_str(), result.c_str());
+        }
+        catch (...) {
+            Log::error("Unable to retrieve CPLC, using certificate serial number %s\n", serial.c_str());
+            result = serial;
+        }
 
+        slot->CloseSession();
 
-        } catch ( ... ) {
-            Log::error("Unable to retrieve serial number for slot %u\n", slot->id);
-            slot->CloseSession();
-            exit(EXIT_FAILURE);
+        if (!_options.IdentityFile.empty()) {
+            _identities.Add(key, result);
         }
 
+        return result;
+
+    } catch ( ... ) {
         slot->CloseSession();
+        throw "Unable to resolve the token serial number";
     }
 }
 
 
+string IdentityKey(PKCS11Slot * slot, PKCS11Token * token) {
+
+    // The key identifier is part of the key, since the certificate serial fallback depends on it
+    return IdentityCache::MakeKey(slot->description, token, Utility::ArraytoHexString(_options.KeyId, _options.KeyIdLength));
+}
+
 string Process_FindSerial(PKCS11Slot * slot) {
 
     try {
@@ -369,170 +915,292 @@ CK_OBJECT_HANDLE Process_FindPublicKey(PKCS11Slot * slot) {
     }
 }
 
-void Process(vector<PKCS11Slot> * slots) {
+bool Process(PKCS11Slot * slot, string serial, int iteration) {
 
-    // Loop through each slot with a token
-    for(vector<PKCS11Slot>::iterator slot = slots->begin();
-            slot != slots->end();
-            ++slot)
-    {
-        // Retrieve the serial number associated with this slot
-        string serial = m_SlotSerials[slot->id];
+    InterlockedIncrement(&_iterations);
+
+    Log::info("SERIAL %s: ITERATION %d of %d\n", serial.c_str(), iteration, _options.MaxIterations);
+
+    // Open Session (unless the slot manager has attached a pooled session, which is already logged in)
+    bool pooled = slot->isSessionOpen();
+    if (!pooled) slot->OpenSession(false);
 
-        Log::info("SERIAL: %s\n", serial.c_str());
+    CK_OBJECT_HANDLE privateKey, publicKey = 0;
 
-        // Open Session
-        slot->OpenSession(false);
+    // Public key operations move to the host once it has a copy of the key (except while calibrating,
+    // as the no-op library has no key to copy)
+    bool offload = _options.Offload && !_calibrating;
+    bool loaded = offload && _hostCrypto.isLoaded(serial);
 
-        CK_OBJECT_HANDLE privateKey, publicKey;
+    // Recorded apart from the token's operations, so runs with and without --offload compare like for like
+    char * encryptOperation = offload ? (char *)"HOST_ENCRYPT" : (char *)"ENCRYPT";
+    char * verifyOperation = offload ? (char *)"HOST_VERIFY" : (char *)"VERIFY";
 
-        int dataLength = 128;
-        char * data = new char[dataLength];
+    // The no-op library returns whatever was in the buffers, so there is nothing to check while calibrating
+    bool checking = !_calibrating;
+    bool intact = true;
 
-        int cipherTextLength = 256;
-        char * cipherText = new char[cipherTextLength];
+    // The start time of the current operation
+    double started = 0;
 
-        int digestLength = 20;
-        char * digest = new char[digestLength];
+    // NOTE: These are stack buffers - heap allocations here were never released, and
+    // would be reported by the process sampler as a leak in the middleware.
+    char data[128];
+    int dataLength = sizeof(data);
 
-        int signatureLength = 512;
-        char * signature = new char[signatureLength];
+    // The random data as generated, to compare the decrypted data with
+    char original[128];
+    int originalLength = 0;
 
-        // Login
+    char cipherText[256];
+    int cipherTextLength = sizeof(cipherText);
+
+    char digest[20];
+    int digestLength = sizeof(digest);
+
+    char signature[512];
+    int signatureLength = sizeof(signature);
+
+    // Login
+    if (!pooled) {
         try {
-            Log::info(" - Login ...");
             string pin(_options.PIN.begin(), _options.PIN.end());
+            started = BeginOperation(slot, serial, "LOGIN");
             slot->Login(&pin);
-            AppendJournal(serial, "LOGIN", true, NULL, 0);
-            Log::info("Success\n");
+            RecordOperation(serial, iteration, "LOGIN", true, NULL, 0, started);
         } catch (...) {
-            Log::info("Failed\n");
-            AppendJournal(serial, "LOGIN", false, NULL, 0);
+            RecordOperation(serial, iteration, "LOGIN", false, NULL, 0, started);
             slot->CloseSession();
-            continue;
+            return false;
         }
+    }
 
-        // Find Private Key [x]
-        try {
-            Log::info(" - Find Private key ...");
-            privateKey = Process_FindPrivateKey((&(*slot)));
-            AppendJournal(serial, "FIND_KEY_PRIVATE", true, NULL, 0);
-            Log::info("Success\n");
-        } catch (...) {
-            Log::info("Failed\n");
-            AppendJournal(serial, "FIND_KEY_PRIVATE", false, NULL, 0);
-            slot->CloseSession();
-            continue;
-        }
+    // Find Private Key [x]
+    try {
+        started = BeginOperation(slot, serial, "FIND_KEY_PRIVATE");
+        privateKey = Process_FindPrivateKey(slot);
+        RecordOperation(serial, iteration, "FIND_KEY_PRIVATE", true, NULL, 0, started);
+    } catch (...) {
+        RecordOperation(serial, iteration, "FIND_KEY_PRIVATE", false, NULL, 0, started);
+        if (!pooled) slot->CloseSession();
+        return false;
+    }
 
-        // Find Public Key [x]
+    // Find Public Key [x] (not needed once the host has a copy)
+    if (!loaded) {
         try {
-            Log::info(" - Find Public key ...");
-            publicKey = Process_FindPublicKey((&(*slot)));
-            AppendJournal(serial, "FIND_KEY_PUBLIC", true, NULL, 0);
-            Log::info("Success\n");
+            started = BeginOperation(slot, serial, "FIND_KEY_PUBLIC");
+            publicKey = Process_FindPublicKey(slot);
+            RecordOperation(serial, iteration, "FIND_KEY_PUBLIC", true, NULL, 0, started);
         } catch (...) {
-            Log::info("Failed\n");
-            AppendJournal(serial, "FIND_KEY_PUBLIC", false, NULL, 0);
-            slot->CloseSession();
-            continue;
+            RecordOperation(serial, iteration, "FIND_KEY_PUBLIC", false, NULL, 0, started);
+            if (!pooled) slot->CloseSession();
+            return false;
         }
+    }
 
-        // Generate Random Data
+    // Copy the Public Key to the host (once per token)
+    if (offload && !loaded) {
         try {
-            Log::info(" - Generate Random Data (%d bytes) ...", dataLength);
-            slot->GenerateRandom(data, dataLength);
-            AppendJournal(serial, "RANDOM", true, data, dataLength);
-            Log::info("Success\n");
+            started = BeginOperation(slot, serial, "LOAD_KEY_PUBLIC");
+            _hostCrypto.Load(serial, slot, publicKey);
+            RecordOperation(serial, iteration, "LOAD_KEY_PUBLIC", true, NULL, 0, started);
         } catch (...) {
-            Log::info("Failed\n");
-            AppendJournal(serial, "RANDOM", false, NULL, 0);
-            slot->CloseSession();
-            continue;
+            RecordOperation(serial, iteration, "LOAD_KEY_PUBLIC", false, NULL, 0, started);
+            if (!pooled) slot->CloseSession();
+            return false;
         }
+    }
 
-        // Encrypt (with Public Key)
-        try {
-            Log::info(" - Encrypt (%d bytes) ...", dataLength);
+    // Generate Random Data
+    try {
+        started = BeginOperation(slot, serial, "RANDOM");
+        slot->GenerateRandom(data, dataLength);
+        RecordOperation(serial, iteration, "RANDOM", true, data, dataLength, started);
+        memcpy(original, data, dataLength);
+        originalLength = dataLength;
+    } catch (...) {
+        RecordOperation(serial, iteration, "RANDOM", false, NULL, 0, started);
+        if (!pooled) slot->CloseSession();
+        return false;
+    }
+
+    // Encrypt (with Public Key)
+    try {
+        started = BeginOperation(slot, serial, encryptOperation);
+        if (offload) {
+            _hostCrypto.EncryptData(serial, data, dataLength, cipherText, &cipherTextLength);
+        } else {
             slot->EncryptData(publicKey, data, dataLength, cipherText, &cipherTextLength);
-            AppendJournal(serial, "ENCRYPT", true, cipherText, cipherTextLength);
-            Log::info("Success\n");
-        } catch (...) {
-            Log::info("Failed\n");
-            AppendJournal(serial, "ENCRYPT", false, NULL, 0);
-            slot->CloseSession();
-            continue;
         }
+        RecordOperation(serial, iteration, encryptOperation, true, cipherText, cipherTextLength, started);
+    } catch (...) {
+        RecordOperation(serial, iteration, encryptOperation, false, NULL, 0, started);
+        if (!pooled) slot->CloseSession();
+        return false;
+    }
 
-        // Digest
-        try {
-            Log::info(" - Digest (%d bytes) ...", dataLength);
-            slot->GenerateDigest(cipherText, cipherTextLength, digest, &digestLength);
-            AppendJournal(serial, "DIGEST", true, NULL, 0);
-            Log::info("Success\n");
-        } catch (...) {
-            Log::info("Failed\n");
-            AppendJournal(serial, "DIGEST", false, NULL, 0);
-            slot->CloseSession();
-            continue;
-        }
+    // Digest
+    try {
+        started = BeginOperation(slot, serial, "DIGEST");
+        slot->GenerateDigest(cipherText, cipherTextLength, digest, &digestLength);
+        RecordOperation(serial, iteration, "DIGEST", true, NULL, 0, started);
+    } catch (...) {
+        RecordOperation(serial, iteration, "DIGEST", false, NULL, 0, started);
+        if (!pooled) slot->CloseSession();
+        return false;
+    }
 
-        // Sign
-        try {
-            Log::info(" - Sign (%d bytes) ...", digestLength);
-            slot->GenerateSignature(privateKey, digest, digestLength, signature, &signatureLength);
-            AppendJournal(serial, "SIGN", true, signature, signatureLength);
-            Log::info("Success\n");
-        } catch (...) {
-            Log::info("Failed\n");
-            AppendJournal(serial, "SIGN", false, NULL, 0);
-            slot->CloseSession();
-            continue;
+    // Check the token's digest against the host's
+    if (checking) {
+        BYTE expected[SHA1_DIGEST_LENGTH];
+        Sha1::Hash(cipherText, cipherTextLength, expected);
+
+        bool match = (digestLength == SHA1_DIGEST_LENGTH) && Integrity::Equal(expected, digest, SHA1_DIGEST_LENGTH);
+        if (!_integrity.Record(serial, INTEGRITY_DIGEST, match)) {
+            RecordOperation(serial, iteration, "INTEGRITY_" INTEGRITY_DIGEST, false, digest, digestLength, Utility::QueryMicroseconds());
+            intact = false;
         }
+    }
 
-        // Verify
-        try {
-            Log::info(" - Verify Signature (%d bytes) ...", signatureLength);
-            slot->VerifySignature(publicKey, digest, digestLength, signature, signatureLength);
-            AppendJournal(serial, "VERIFY", true, NULL, NULL);
-            Log::info("Success\n");
-        } catch (...) {
-            Log::info("Failed\n");
-            AppendJournal(serial, "VERIFY", false, NULL, 0);
-            slot->CloseSession();
-            continue;
+    // Sign
+    try {
+        started = BeginOperation(slot, serial, "SIGN");
+        slot->GenerateSignature(privateKey, digest, digestLength, signature, &signatureLength);
+        RecordOperation(serial, iteration, "SIGN", true, signature, signatureLength, started);
+    } catch (...) {
+        RecordOperation(serial, iteration, "SIGN", false, NULL, 0, started);
+        if (!pooled) slot->CloseSession();
+        return false;
+    }
+
+    // Verify
+    bool valid = false;
+    try {
+        started = BeginOperation(slot, serial, verifyOperation);
+        if (offload) {
+            valid = _hostCrypto.VerifySignature(serial, digest, digestLength, signature, signatureLength);
+        } else {
+            valid = slot->VerifySignature(publicKey, digest, digestLength, signature, signatureLength);
         }
+        RecordOperation(serial, iteration, verifyOperation, true, NULL, 0, started);
+    } catch (...) {
+        RecordOperation(serial, iteration, verifyOperation, false, NULL, 0, started);
+        if (!pooled) slot->CloseSession();
+        return false;
+    }
 
-        // Decrypt (with Private Key)
-        try {
-            Log::info(" - Decrypt (%d bytes) ...", cipherTextLength);
-            slot->DecryptData(privateKey, cipherText, cipherTextLength, data, &dataLength);
-            AppendJournal(serial, "DECRYPT", true, data, dataLength);
-            Log::info("Success\n");
-        } catch (...) {
-            Log::info("Failed\n");
-            AppendJournal(serial, "DECRYPT", false, NULL, 0);
-            slot->CloseSession();
-            continue;
+    // The verification ran, but the token's own signature didn't pass it
+    if (checking && !_integrity.Record(serial, INTEGRITY_SIGNATURE, valid)) {
+        RecordOperation(serial, iteration, "INTEGRITY_" INTEGRITY_SIGNATURE, false, signature, signatureLength, Utility::QueryMicroseconds());
+        intact = false;
+    }
+
+    // Decrypt (with Private Key)
+    try {
+        started = BeginOperation(slot, serial, "DECRYPT");
+        slot->DecryptData(privateKey, cipherText, cipherTextLength, data, &dataLength);
+        RecordOperation(serial, iteration, "DECRYPT", true, data, dataLength, started);
+    } catch (...) {
+        RecordOperation(serial, iteration, "DECRYPT", false, NULL, 0, started);
+        if (!pooled) slot->CloseSession();
+        return false;
+    }
+
+    // The round trip must give back the random data exactly
+    if (checking) {
+        bool match = (dataLength == originalLength) && Integrity::Equal(original, data, originalLength);
+        if (!_integrity.Record(serial, INTEGRITY_DECRYPT, match)) {
+            RecordOperation(serial, iteration, "INTEGRITY_" INTEGRITY_DECRYPT, false, data, dataLength, Utility::QueryMicroseconds());
+            intact = false;
         }
+    }
 
-        // Logout
+    // Logout (a pooled session stays logged in for the next transaction)
+    if (!pooled) {
         try {
-            Log::info(" - Logout ...", cipherTextLength);
+            started = BeginOperation(slot, serial, "LOGOUT");
             slot->Logout();
-            AppendJournal(serial, "LOGOUT", true, NULL, 0);
-            Log::info("Success\n");
+            RecordOperation(serial, iteration, "LOGOUT", true, NULL, 0, started);
         } catch (...) {
-            Log::info("Failed\n");
-            AppendJournal(serial, "LOGOUT", false, NULL, 0);
+            RecordOperation(serial, iteration, "LOGOUT", false, NULL, 0, started);
         }
+    }
 
-        // Close Session
-        slot->CloseSession();
+    // Close Session
+    if (!pooled) slot->CloseSession();
+
+    // A transaction that completed with corrupt results still failed
+    return intact;
+}
+
+bool Transact(PKCS11Slot * slot, string serial, int iteration) {
+
+    bool success;
+
+    // With concurrent workers the operations of different transactions interleave, so the warm-up
+    // can't tell when a transaction has ended from the operations alone
+    try {
+        success = Process(slot, serial, iteration);
+    }
+    catch (...) {
+        _warmup.Complete(serial, iteration, false);
+        throw;
+    }
+
+    _warmup.Complete(serial, iteration, success);
+    return success;
+}
+
+bool BatchSign(PKCS11Slot * slot, string serial, CK_OBJECT_HANDLE key, int item) {
+
+    InterlockedIncrement(&_iterations);
+
+    // A distinct digest for each item
+    char digest[20];
+    memset(digest, 0, sizeof(digest));
+    memcpy(digest, &item, sizeof(item));
+
+    char signature[512];
+    int signatureLength = sizeof(signature);
+
+    double started = BeginOperation(slot, serial, "SIGN");
+
+    try {
+        slot->GenerateSignature((int)key, digest, sizeof(digest), signature, &signatureLength);
+        RecordOperation(serial, item, "SIGN", true, signature, signatureLength, started);
+        _warmup.Complete(serial, item, true);
+    } catch (...) {
+        RecordOperation(serial, item, "SIGN", false, NULL, 0, started);
+        _warmup.Complete(serial, item, false);
+        return false;
     }
+
+    return true;
+}
+
+bool FileSign(PKCS11Slot * slot, string serial, CK_OBJECT_HANDLE key, const char * in, int inLength, char * out, int * outLength, int item) {
+
+    InterlockedIncrement(&_iterations);
+
+    double started = BeginOperation(slot, serial, "SIGN");
+
+    try {
+        slot->GenerateSignature((int)key, in, inLength, out, outLength);
+        RecordOperation(serial, item, "SIGN", true, out, *outLength, started);
+        _warmup.Complete(serial, item, true);
+    } catch (...) {
+        RecordOperation(serial, item, "SIGN", false, NULL, 0, started);
+        _warmup.Complete(serial, item, false);
+        return false;
+    }
+
+    return true;
 }
 
 void Shutdown() {
+    TransportMonitor::Remove();
+    PCSC::Release();
     Log::debug("Shutdown: Complete\n");
 }
 
@@ -556,30 +1224,205 @@ void DisplayUsage()
 {
     DisplayVersion();
 
-    cout << "Usage: " << _options.EXEName << " <-L library_path> <-P pin> [-C count] [-I interval] [-HD]" << endl << endl;
+    cout << "Usage: " << _options.EXEName << " <-L library_path> <-P pin> [-C count] [-I interval] [-HD] [--sample seconds] [--window iterations] [--warmup count|auto] [--results file] [--snapshot seconds] [--duration time] [--checkpoint seconds] [--resume] [--cache file|none] [--transport] [--offload] [--fingerprint] [--deadline ms[,OPERATION=ms...]] [--isolate] [--affinity auto|cpus] [--service-affinity cpus] [--calibrate count] [--processes count] [--workers count] [--sessions count] [--breaker count] [--backoff ms] [--batch count]" << endl;
+    cout << "       " << _options.EXEName << " coordinator <agents> [-C count] [-I interval] [--rate tps] [--port port] [--results file]" << endl;
+    cout << "       " << _options.EXEName << " agent <host[:port]> <-L library_path> <-P pin> [--port port] [options]" << endl;
+    cout << "       " << _options.EXEName << " sign <directory> <-L library_path> <-P pin> [--output directory] [--workers count] [--hashers count] [--queue depth]" << endl;
+    cout << "       " << _options.EXEName << " digest <-L library_path> <-P pin> [-C count] [--sizes bytes,bytes,...]" << endl;
+    cout << "       " << _options.EXEName << " analyze <journal> [journal ...]" << endl;
+    cout << "       " << _options.EXEName << " compare <baseline> <candidate> [--threshold percent] [--resamples count]" << endl;
+    cout << "       " << _options.EXEName << " snapshot merge|diff|query <file> [file ...] [--results file] [--percentile p]" << endl;
+    cout << "       " << _options.EXEName << " apdu [script] [-C count] [--results file]" << endl;
+    cout << "       " << _options.EXEName << " lifecycle <-L library_path> <-P pin> [-C count] [-I interval] [--results file]" << endl << endl;
     cout << "   L : Sets the library path" << endl;
     cout << "   P : Sets the USER pin used for the PKCS#11 Login" << endl;
-    cout << "   C : Sets the maximum iteration count (defaults to 9999999)" << endl;
-    cout << "   I : Set the load testing interval in milliseconds (defaults to 1000)" << endl;
+    cout << "   C : Sets the maximum iteration count for each token (defaults to 9999999)" << endl;
+    cout << "   I : Set the load testing interval between each token's transactions in milliseconds (defaults to 1000)" << endl;
     cout << "   H : Show this usage description and exits" << endl;
-    cout << "   D : Enabled debugging output" << endl << endl;
+    cout << "   D : Enabled debugging output" << endl;
+    cout << "   --sample : Samples process memory, handle and thread counts every [seconds] to flag leaks (defaults to 0, off)" << endl;
+    cout << "   --window : Sets the number of iterations per latency trend window in <serial>.trend (defaults to 100)" << endl;
+    cout << "   --warmup : Keeps each token's first [count] transactions out of the results, or detects the end of its warm-up with 'auto' (defaults to 0, off)" << endl;
+    cout << "   --results : Sets the file the latency histograms are written to at the end of the run (defaults to results.txt)" << endl;
+    cout << "   --snapshot : Appends the histograms and failure counts of each interval of [seconds] to snapshots.txt (defaults to 0, off)" << endl;
+    cout << "   --duration : Runs the load test for this long (e.g. 3600, 90m, 72h or 3d) instead of until -C iterations" << endl;
+    cout << "   --checkpoint : Saves the run's counts and histograms to checkpoint.txt every [seconds] (defaults to 0, off)" << endl;
+    cout << "   --resume : Carries on an interrupted run from checkpoint.txt, with its counts, histograms, trends and locked tokens intact (the warm-up and backoffs start afresh)" << endl;
+    cout << "   --affinity : Pins each token worker to one of the listed processors (e.g. 2-5,8), or 'auto' for a NUMA-aware layout" << endl;
+    cout << "   --service-affinity : Pins the slot watcher and process sampler threads to the listed processors" << endl;
+    cout << "   --processes : Shares the tokens between this many processes, each loading the library itself (defaults to 1)" << endl;
+    cout << "   --workers : Sets the number of threads transacting against each token at once (defaults to 1)" << endl;
+    cout << "   --sessions : Sets the number of logged in sessions each token's workers share (defaults to 0, a session per transaction, or --workers when that is above 1)" << endl;
+    cout << "   --breaker : Sets the consecutive failures after which a token backs off before it is retried (defaults to 5, 0 disables)" << endl;
+    cout << "   --backoff : Sets the milliseconds a failing token first backs off for, doubling with each failed retry (defaults to 1000)" << endl;
+    cout << "   --batch : Signs this many digests as fast as possible, shared between every token by work stealing, instead of -C transactions each" << endl;
+    cout << "   --output : Sets the directory the sign command writes the .sig files to (defaults to the input directory)" << endl;
+    cout << "   --hashers : Sets the number of threads hashing files for the sign command (defaults to 1)" << endl;
+    cout << "   --queue : Sets the capacity of the queues between the sign command's stages (defaults to 16)" << endl;
+    cout << "   --sizes : Sets the payload sizes in bytes the digest command compares at (defaults to 64,1024,16384,131072)" << endl;
+    cout << "   --port : Sets the TCP port the coordinator listens on and agents connect to (defaults to 7011)" << endl;
+    cout << "   --rate : Sets the total transactions per second the coordinator shares between the agents' workers, pacing each to a fixed period (defaults to 0, each token runs at -I)" << endl;
+    cout << "   --calibrate : Sets the number of transactions run against a no-op library to measure the harness overhead (defaults to 100, 0 disables)" << endl;
+    cout << "   --transport : Times the library's SCardTransmit calls and reports the share of each operation spent on the wire" << endl;
+    cout << "   --offload : Verifies and encrypts on the host with a copy of each token's public key, so the token only does the private key operations" << endl;
+    cout << "   --fingerprint : Writes the length and CRC-32C of each operation's data to the journals instead of the data in hex" << endl;
+    cout << "   --deadline : Reports PKCS#11 calls that take longer than this many milliseconds, with optional per-operation deadlines (e.g. 5000,SIGN=20000)" << endl;
+    cout << "   --isolate : Stops a token's workers and cancels its call when the call stalls past its deadline, so the other tokens can finish" << endl;
+    cout << "   --cache : Caches the token serials in this file between runs, so a known token is identified with C_GetTokenInfo, or 'none' to turn it off (defaults to off)" << endl;
+    cout << "   --threshold : Sets the percentage slow-down that compare treats as a regression (defaults to 10)" << endl;
+    cout << "   --percentile : Sets the percentile shown by snapshot query (defaults to 99)" << endl;
+    cout << "   --resamples : Sets the number of bootstrap resamples for the compare confidence intervals (defaults to 1000)" << endl << endl;
+    cout << "   analyze : Reports failure rates, MTBF, failure-free streaks and hourly throughput from journal files" << endl;
+    cout << "   compare : Compares two results files, exiting with 2 on a significant latency or throughput regression" << endl;
+    cout << "   snapshot : Merges, subtracts or queries snapshot and results files without going back to the journals" << endl;
+    cout << "   lifecycle : Loads, logs in to and unloads the library -C times, timing each step and the process growth left behind by each cycle" << endl;
+    cout << "   apdu : Replays an APDU script directly over PC/SC against every card and adds the round trips to the results file" << endl;
+    cout << "   coordinator : Waits for the given number of agents, starts them together and merges the histograms they stream back" << endl;
+    cout << "   agent : Runs the load test on behalf of the coordinator at host[:port]" << endl;
+    cout << "   sign : Signs every file in a directory with SHA-256 and the token key, writing a detached <file>.sig for each" << endl << endl;
 }
 
 
 
-void AppendJournal( string serial, char * operation, bool outcome, char * data, int len ) {
+double BeginOperation(PKCS11Slot * slot, string serial, char * operation) {
+
+    _operationSlot = slot;
+    _watchdog.Enter(slot->id, slot->getSession(), serial, operation);
+
+    return Utility::QueryMicroseconds();
+}
+
+void IsolateToken(CK_SLOT_ID slot, string serial) {
+    _slotManager.Isolate(serial);
+}
+
+void RecordOperation( string serial, int iteration, char * operation, bool outcome, char * data, int len, double started ) {
+
+    double elapsed = Utility::QueryMicroseconds() - started;
+
+    // The watchdog closed the session under a stalled call - the handle may already belong to another session
+    if (_watchdog.Leave() && NULL != _operationSlot) {
+        _operationSlot->DetachSession();
+    }
+    _operationSlot = NULL;
+
+    Log::info(" - %s %s %s (%.1f ms)\n", serial.c_str(), operation, outcome ? "Success" : "Failed", elapsed / 1000.0);
+
+    AppendJournal(serial, iteration, operation, outcome, data, len);
+
+    // Taken whatever the outcome, so an error swallowed along the way isn't blamed on a later failure
+    CK_RV code = Utility::TakeLastError();
+
+    // Failed operations are only counted - their latency says nothing about the health of the card
+    if (!outcome) {
+        if (!_calibrating) _results.RecordError(serial, operation, OperationMechanism(operation), code);
+        return;
+    }
+
+    if (_calibrating) {
+        _calibration.Record(serial, operation, OperationMechanism(operation), elapsed);
+        return;
+    }
+
+    TransportMonitor::Record(serial, operation, started, elapsed);
+
+    // The trend and results show the time spent in the library, without the harness's share
+    double corrected = elapsed - HarnessOverhead(operation);
+    if (corrected < 0) corrected = 0;
+
+    // Held back until the token has warmed up
+    if (_warmup.Record(serial, iteration, operation, OperationMechanism(operation), corrected)) return;
+
+    _trend.Record(serial, iteration, operation, corrected);
+    _results.Record(serial, operation, OperationMechanism(operation), corrected);
+}
+
+void Calibrate() {
+
+    if (_options.CalibrationIterations <= 0) return;
+
+    Log::info("Calibrating the harness with %d transactions against a no-op library\n", _options.CalibrationIterations);
+
+    PKCS11Slot slot(CalibrationLibrary::getFunctionList());
+    slot.description = CALIBRATION_SERIAL;
+    slot.isTokenPresent = true;
+
+    _calibrating = true;
+
+    int completed = 0;
+    double started = Utility::QueryMicroseconds();
+
+    for (int i = 1; i <= _options.CalibrationIterations && !_shutdown; i++) {
+        if (Process(&slot, CALIBRATION_SERIAL, i)) completed++;
+    }
+
+    double elapsed = Utility::QueryMicroseconds() - started;
+
+    _calibrating = false;
+    _iterations = 0;
+
+    // The journal was written only to include its cost
+    DeleteFileA(CALIBRATION_SERIAL ".log");
+
+    if (completed == 0) {
+        Log::warn("The calibration did not complete, the harness overhead will not be subtracted\n");
+        return;
+    }
+
+    double timed = 0;
+    map<string, Histogram> * histograms = _calibration.getHistograms();
+
+    for (map<string, Histogram>::iterator entry = histograms->begin();
+            entry != histograms->end();
+            ++entry)
+    {
+        string operation, mechanism, serial;
+        Results::SplitKey(entry->first, &operation, &mechanism, &serial);
+
+        _overhead[operation] = entry->second.getMean();
+        timed += entry->second.getMean();
+    }
+
+    double transaction = elapsed / completed;
+
+    Log::info("HARNESS OVERHEAD (%d calibration transactions):\n", completed);
+    Log::info(" - %.2f us per operation within the timed interval (subtracted from the results and trends)\n",
+              timed / _overhead.size());
+    Log::info(" - %.3f ms per transaction including journaling and logging, at most %.0f transactions/s per token\n",
+              transaction / 1000.0, 1000000.0 / transaction);
+}
+
+double HarnessOverhead(char * operation) {
+
+    map<string, double>::iterator entry = _overhead.find(string(operation));
+    return (entry == _overhead.end()) ? 0 : entry->second;
+}
+
+string OperationMechanism(char * operation) {
+
+    string name(operation);
+
+    if (name == "ENCRYPT" || name == "DECRYPT" || name == "SIGN" || name == "VERIFY") return "CKM_RSA_PKCS";
+    if (name == "DIGEST") return "CKM_SHA_1";
+    if (name == "HOST_ENCRYPT" || name == "HOST_VERIFY") return "HOST_RSA_PKCS";
+
+    // Operations that don't take a mechanism
+    return "-";
+}
+
+void AppendJournal( string serial, int iteration, char * operation, bool outcome, char * data, int len ) {
 
     // Generate the file path
     string path = serial + ".log";
 
-    // Check if the file exists
-    ofstream o(path, ios_base::app | ios_base::out);
+    // The line is built first, so the lock is only held for the write
+    ostringstream o;
 
     // Get the date/time
 
     o << Utility::CurrentDateTime() << ",";
 
-    o << serial << "," << _iterations << "," << string(operation) << ",";
+    o << serial << "," << iteration << "," << string(operation) << ",";
 
     if (outcome) {
         o << "SUCCESS";
@@ -587,13 +1430,32 @@ void AppendJournal( string serial, char * operation, bool outcome, char * data,
         o << "FAIL";
     }
 
-    if (len != 0) {
+    // The length and CRC-32C of the data are enough to spot a change, and far cheaper to write than the data
+    if (len != 0 && _options.Fingerprint) {
+        char fingerprint[32];
+        sprintf_s(fingerprint, sizeof(fingerprint), "%d:%08X", len, Integrity::Fingerprint(data, len));
+        o << "," << fingerprint;
+    }
+    else if (len != 0) {
         o << "," << Utility::ArraytoHexString(data, len);
     }
 
     o << endl;
 
-    o.close();
+    EnterCriticalSection(&_journalLock);
+    CRITICAL_SECTION * lock = _journalLocks[serial];
+    if (NULL == lock) {
+        lock = new CRITICAL_SECTION;
+        InitializeCriticalSection(lock);
+        _journalLocks[serial] = lock;
+    }
+    LeaveCriticalSection(&_journalLock);
+
+    EnterCriticalSection(lock);
+    ofstream journal(path, ios_base::app | ios_base::out);
+    journal << o.str();
+    journal.close();
+    LeaveCriticalSection(lock);
 }
 
 static BOOL WINAPI ConsoleCtrlHandler(DWORD dwCtrlType)